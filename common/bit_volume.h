@@ -0,0 +1,357 @@
+#ifndef BIT_VOLUME_H_
+#define BIT_VOLUME_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define BIT_VOLUME_AVX2
+#include <immintrin.h>
+#endif
+
+/*
+ * Packed binary volumes, one bit per voxel.
+ *
+ * The layout is the one of the voxel table (vtable) of gpu-vox: the bits of consecutive voxels
+ * along the fastest axis fill 32-bit words from the most significant bit down, i.e. voxel i of a
+ * row is bit 31 - i % 32 of word i / 32. Every row of the fastest axis starts a new word, so a
+ * H x W x D volume packs into H x W x ceil(D/32) words that can be cropped like the dense volume;
+ * if D is a multiple of 32 this is exactly a gpu-vox voxel table. Reading the words as big endian
+ * bytes gives the bits in voxel order (numpy.unpackbits).
+ *
+ * Packing and unpacking use AVX2 where the CPU supports it, chosen at runtime so that the
+ * binaries stay portable.
+ */
+
+/** \brief Number of words of a packed row.
+ * \param[in] length voxels along the fastest axis
+ * \return words
+ */
+inline size_t bit_words(size_t length) {
+  return (length + 31)/32;
+}
+
+/** \brief Reverse the bits of a word.
+ * \param[in] word word
+ * \return reversed word
+ */
+inline uint32_t reverse_bits(uint32_t word) {
+  word = ((word >> 1) & 0x55555555u) | ((word & 0x55555555u) << 1);
+  word = ((word >> 2) & 0x33333333u) | ((word & 0x33333333u) << 2);
+  word = ((word >> 4) & 0x0f0f0f0fu) | ((word & 0x0f0f0f0fu) << 4);
+  word = ((word >> 8) & 0x00ff00ffu) | ((word & 0x00ff00ffu) << 8);
+  return (word >> 16) | (word << 16);
+}
+
+#ifdef BIT_VOLUME_AVX2
+/** \brief Check once whether the CPU supports AVX2.
+ * \return support
+ */
+inline bool bit_volume_avx2() {
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+
+/** \brief Pack whole words of values using AVX2.
+ * \param[in] values values, non-zero is set
+ * \param[in] words_count number of words, i.e. 32 values each
+ * \param[out] words packed words
+ */
+__attribute__((target("avx2")))
+inline void pack_bits_avx2(const int32_t* values, size_t words_count, uint32_t* words) {
+  const __m256i zero = _mm256_setzero_si256();
+  for (size_t w = 0; w < words_count; w++) {
+    uint32_t mask = 0;
+    for (int g = 0; g < 4; g++) {
+      __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + 32*w + 8*g));
+      uint32_t empty = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, zero))));
+      mask |= (~empty & 0xffu) << (8*g);
+    }
+    // movemask puts the first value into the least significant bit.
+    words[w] = reverse_bits(mask);
+  }
+}
+
+/** \brief Unpack whole words into 0/1 values using AVX2.
+ * \param[in] words packed words
+ * \param[in] words_count number of words
+ * \param[out] values 32 values per word
+ */
+__attribute__((target("avx2")))
+inline void unpack_bits_avx2(const uint32_t* words, size_t words_count, int32_t* values) {
+  const __m256i bits = _mm256_setr_epi32(static_cast<int32_t>(0x80000000u), 1 << 30, 1 << 29, 1 << 28, 1 << 27, 1 << 26, 1 << 25, 1 << 24);
+  for (size_t w = 0; w < words_count; w++) {
+    for (int g = 0; g < 4; g++) {
+      __m256i x = _mm256_and_si256(_mm256_set1_epi32(static_cast<int32_t>(words[w] << (8*g))), bits);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + 32*w + 8*g), _mm256_srli_epi32(_mm256_cmpeq_epi32(x, bits), 31));
+    }
+  }
+}
+
+/** \brief Unpack whole words into 0/1 floats using AVX2.
+ * \param[in] words packed words
+ * \param[in] words_count number of words
+ * \param[out] values 32 values per word
+ */
+__attribute__((target("avx2")))
+inline void unpack_bits_avx2(const uint32_t* words, size_t words_count, float* values) {
+  const __m256i bits = _mm256_setr_epi32(static_cast<int32_t>(0x80000000u), 1 << 30, 1 << 29, 1 << 28, 1 << 27, 1 << 26, 1 << 25, 1 << 24);
+  const __m256 one = _mm256_set1_ps(1.f);
+  for (size_t w = 0; w < words_count; w++) {
+    for (int g = 0; g < 4; g++) {
+      __m256i x = _mm256_and_si256(_mm256_set1_epi32(static_cast<int32_t>(words[w] << (8*g))), bits);
+      _mm256_storeu_ps(values + 32*w + 8*g, _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, bits)), one));
+    }
+  }
+}
+#endif
+
+/** \brief Pack a row of values into bits.
+ * \param[in] values values, non-zero is set
+ * \param[in] n number of values
+ * \param[out] words bit_words(n) words, trailing bits are zero
+ */
+inline void pack_bits(const int32_t* values, size_t n, uint32_t* words) {
+  size_t w = 0;
+#ifdef BIT_VOLUME_AVX2
+  if (bit_volume_avx2()) {
+    pack_bits_avx2(values, n/32, words);
+    w = n/32;
+  }
+#endif
+  for (; w < bit_words(n); w++) {
+    uint32_t word = 0;
+    for (size_t i = 32*w; i < n && i < 32*w + 32; i++) {
+      word |= (values[i] != 0 ? 1u : 0u) << (31 - i % 32);
+    }
+    words[w] = word;
+  }
+}
+
+/** \brief Unpack values [first, n) of a row of bits without SIMD.
+ * \param[in] words bit_words(n) words
+ * \param[in] first first value
+ * \param[in] n number of values
+ * \param[out] values values
+ */
+template<typename Scalar>
+inline void unpack_bits_scalar(const uint32_t* words, size_t first, size_t n, Scalar* values) {
+  for (size_t i = first; i < n; i++) {
+    values[i] = static_cast<Scalar>((words[i/32] >> (31 - i % 32)) & 1u);
+  }
+}
+
+/** \brief Unpack a row of bits into 0/1 values.
+ * \param[in] words bit_words(n) words
+ * \param[in] n number of values
+ * \param[out] values values
+ */
+template<typename Scalar>
+inline void unpack_bits(const uint32_t* words, size_t n, Scalar* values) {
+  unpack_bits_scalar(words, 0, n, values);
+}
+
+/** \brief Unpack a row of bits into 0/1 integers, using AVX2 if available. */
+inline void unpack_bits(const uint32_t* words, size_t n, int32_t* values) {
+  size_t first = 0;
+#ifdef BIT_VOLUME_AVX2
+  if (bit_volume_avx2()) {
+    unpack_bits_avx2(words, n/32, values);
+    first = 32*(n/32);
+  }
+#endif
+  unpack_bits_scalar(words, first, n, values);
+}
+
+/** \brief Unpack a row of bits into 0/1 floats, using AVX2 if available. */
+inline void unpack_bits(const uint32_t* words, size_t n, float* values) {
+  size_t first = 0;
+#ifdef BIT_VOLUME_AVX2
+  if (bit_volume_avx2()) {
+    unpack_bits_avx2(words, n/32, values);
+    first = 32*(n/32);
+  }
+#endif
+  unpack_bits_scalar(words, first, n, values);
+}
+
+/** \brief Pack a volume row by row.
+ * \param[in] values rows x length values in row-major order
+ * \param[in] rows number of rows, e.g. height*width
+ * \param[in] length voxels along the fastest axis
+ * \param[out] words rows x bit_words(length) words
+ */
+inline void pack_bit_rows(const int32_t* values, size_t rows, size_t length, uint32_t* words) {
+  const size_t row_words = bit_words(length);
+  for (size_t r = 0; r < rows; r++) {
+    pack_bits(values + r*length, length, words + r*row_words);
+  }
+}
+
+/** \brief Unpack a volume row by row.
+ * \param[in] words rows x bit_words(length) words
+ * \param[in] rows number of rows
+ * \param[in] length voxels along the fastest axis
+ * \param[out] values rows x length 0/1 values in row-major order
+ */
+template<typename Scalar>
+inline void unpack_bit_rows(const uint32_t* words, size_t rows, size_t length, Scalar* values) {
+  const size_t row_words = bit_words(length);
+  for (size_t r = 0; r < rows; r++) {
+    unpack_bits(words + r*row_words, length, values + r*length);
+  }
+}
+
+/** \brief Split a flat bit stream, e.g. a gpu-vox voxel table, into word aligned rows.
+ * \param[in] bits rows*length bits without padding between rows
+ * \param[in] rows number of rows
+ * \param[in] length voxels along the fastest axis
+ * \param[out] words rows x bit_words(length) words
+ */
+inline void bits_to_rows(const uint32_t* bits, size_t rows, size_t length, uint32_t* words) {
+  const size_t row_words = bit_words(length);
+  if (length % 32 == 0) {
+    memcpy(words, bits, rows*row_words*sizeof(uint32_t));
+    return;
+  }
+
+  const size_t total = rows*length;
+  for (size_t r = 0; r < rows; r++) {
+    for (size_t k = 0; k < row_words; k++) {
+      const size_t position = r*length + 32*k;
+      const size_t shift = position % 32;
+      uint32_t word = bits[position/32] << shift;
+      if (shift > 0 && position + 32 - shift < total) {
+        word |= bits[position/32 + 1] >> (32 - shift);
+      }
+      const size_t remaining = length - 32*k;
+      if (remaining < 32) {
+        word &= ~0u << (32 - remaining);
+      }
+      words[r*row_words + k] = word;
+    }
+  }
+}
+
+/** \brief Number of set bits of a word.
+ * \param[in] word word
+ * \return set bits
+ */
+inline unsigned int count_bits(uint32_t word) {
+  word = word - ((word >> 1) & 0x55555555u);
+  word = (word & 0x33333333u) + ((word >> 2) & 0x33333333u);
+  word = (word + (word >> 4)) & 0x0f0f0f0fu;
+  return (word*0x01010101u) >> 24;
+}
+
+/** \brief Words of a chunk of a flat bit stream in bit_offsets and for_each_set_bit. */
+const size_t BIT_CHUNK_WORDS = 4096;
+
+/** \brief Exclusive prefix sum of the set bits of a flat bit stream, e.g. a gpu-vox voxel table,
+ * per chunk of BIT_CHUNK_WORDS words: the set bits of chunk c have the ranks offsets[c] to
+ * offsets[c + 1] - 1 in voxel order. The chunks are counted in parallel.
+ * \param[in] bits bit_words(n) words, bits past n are ignored
+ * \param[in] n number of bits
+ * \param[out] offsets chunks + 1 offsets
+ * \return number of set bits
+ */
+inline size_t bit_offsets(const uint32_t* bits, size_t n, std::vector<size_t>& offsets) {
+  const size_t words = bit_words(n);
+  const int64_t chunks = static_cast<int64_t>((words + BIT_CHUNK_WORDS - 1)/BIT_CHUNK_WORDS);
+  offsets.assign(chunks + 1, 0);
+  #pragma omp parallel for
+  for (int64_t c = 0; c < chunks; c++) {
+    size_t count = 0;
+    for (size_t w = c*BIT_CHUNK_WORDS; w < std::min(words, (c + 1)*BIT_CHUNK_WORDS); w++) {
+      uint32_t word = bits[w];
+      if (w == words - 1 && n % 32 != 0) {
+        word &= ~0u << (32 - n % 32);
+      }
+      count += count_bits(word);
+    }
+    offsets[c + 1] = count;
+  }
+  for (int64_t c = 0; c < chunks; c++) {
+    offsets[c + 1] += offsets[c];
+  }
+  return offsets.back();
+}
+
+/** \brief Visit the set bits of a flat bit stream with their rank, the chunks in parallel, so
+ * that the set bits can be compacted into arrays of bit_offsets(...) entries without a dense pass.
+ * \param[in] bits bit_words(n) words, bits past n are ignored
+ * \param[in] n number of bits
+ * \param[in] offsets offsets of bit_offsets(bits, n, offsets)
+ * \param[in] visit called as visit(index, rank) for every set bit
+ */
+template<typename Visit>
+inline void for_each_set_bit(const uint32_t* bits, size_t n, const std::vector<size_t>& offsets, Visit visit) {
+  const size_t words = bit_words(n);
+  const int64_t chunks = static_cast<int64_t>(offsets.size()) - 1;
+  #pragma omp parallel for schedule(dynamic)
+  for (int64_t c = 0; c < chunks; c++) {
+    size_t rank = offsets[c];
+    for (size_t w = c*BIT_CHUNK_WORDS; w < std::min(words, (c + 1)*BIT_CHUNK_WORDS); w++) {
+      size_t index = 32*w;
+      for (uint32_t word = bits[w]; word != 0 && index < n; word <<= 1, index++) {
+        if (word & 0x80000000u) {
+          visit(index, rank++);
+        }
+      }
+    }
+  }
+}
+
+/** \brief Number of leading zero bits of a non-zero word, i.e. the position of its first set bit.
+ * \param[in] word non-zero word
+ * \return leading zeros
+ */
+inline unsigned int leading_zeros(uint32_t word) {
+  unsigned int zeros = 0;
+  if ((word & 0xffff0000u) == 0) { zeros += 16; word <<= 16; }
+  if ((word & 0xff000000u) == 0) { zeros += 8; word <<= 8; }
+  if ((word & 0xf0000000u) == 0) { zeros += 4; word <<= 4; }
+  if ((word & 0xc0000000u) == 0) { zeros += 2; word <<= 2; }
+  if ((word & 0x80000000u) == 0) { zeros += 1; }
+  return zeros;
+}
+
+/** \brief First bit at or after index of a flat bit stream that is set (or clear), a word at a time.
+ * \param[in] bits bit stream
+ * \param[in] index first bit to look at
+ * \param[in] end bit to stop at
+ * \param[in] set look for a set bit, otherwise for a clear one
+ * \return index of the bit, end if there is none before end
+ */
+inline size_t next_bit(const uint32_t* bits, size_t index, size_t end, bool set) {
+  while (index < end) {
+    uint32_t word = set ? bits[index/32] : ~bits[index/32];
+    word &= 0xffffffffu >> (index % 32);
+    if (word != 0) {
+      return std::min(end, 32*(index/32) + leading_zeros(word));
+    }
+    index = 32*(index/32 + 1);
+  }
+  return end;
+}
+
+/** \brief Visit the runs of consecutive set bits of a range of a flat bit stream, e.g. a row of a
+ * gpu-vox voxel table, skipping empty words as a whole.
+ * \param[in] bits bit stream
+ * \param[in] first first bit of the range
+ * \param[in] end bit after the range
+ * \param[in] visit called as visit(begin, end) for every maximal run, relative to first
+ */
+template<typename Visit>
+inline void for_each_bit_run(const uint32_t* bits, size_t first, size_t end, Visit visit) {
+  for (size_t index = next_bit(bits, first, end, true); index < end; index = next_bit(bits, index, end, true)) {
+    const size_t run_end = next_bit(bits, index, end, false);
+    visit(index - first, run_end - first);
+    index = run_end;
+  }
+}
+
+#endif
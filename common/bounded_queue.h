@@ -0,0 +1,78 @@
+#ifndef BOUNDED_QUEUE_H_
+#define BOUNDED_QUEUE_H_
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/** \brief Blocking FIFO queue of limited capacity connecting pipeline stages.
+ *
+ * Producers block while the queue is full, consumers while it is empty. Once closed, pushes fail
+ * and pops drain the remaining items before failing, which lets consumers run until their
+ * producers are done.
+ */
+template<typename T>
+class BoundedQueue {
+public:
+  /** \brief Constructor.
+   * \param[in] capacity maximum number of queued items, at least 1
+   */
+  explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1), closed(false) {
+
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  /** \brief Append an item, waiting for space.
+   * \param[in] item item, moved from
+   * \return false if the queue was closed
+   */
+  bool push(T&& item) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->not_full.wait(lock, [this]() { return this->closed || this->items.size() < this->capacity; });
+    if (this->closed) {
+      return false;
+    }
+
+    this->items.push_back(std::move(item));
+    this->not_empty.notify_one();
+    return true;
+  }
+
+  /** \brief Take the oldest item, waiting for one.
+   * \param[out] item item
+   * \return false if the queue is closed and empty
+   */
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->not_empty.wait(lock, [this]() { return this->closed || !this->items.empty(); });
+    if (this->items.empty()) {
+      return false;
+    }
+
+    item = std::move(this->items.front());
+    this->items.pop_front();
+    this->not_full.notify_one();
+    return true;
+  }
+
+  /** \brief Close the queue, waking up all waiting producers and consumers. */
+  void close() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->closed = true;
+    this->not_full.notify_all();
+    this->not_empty.notify_all();
+  }
+
+private:
+  const size_t capacity;
+  bool closed;
+  std::deque<T> items;
+  /** \brief Guards everything above. */
+  std::mutex mutex;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+};
+
+#endif
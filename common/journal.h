@@ -0,0 +1,205 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cinttypes>
+
+#ifdef __unix__
+#include <unistd.h>
+#endif
+
+/** \brief Status of an item in the journal. */
+enum JournalStatus {
+  JOURNAL_NONE = 0,
+  JOURNAL_STARTED = 1,
+  JOURNAL_DONE = 2,
+  JOURNAL_FAILED = 3,
+  JOURNAL_QUARANTINED = 4
+};
+
+/** \brief Names of the statuses, as written to the journal. */
+static const char* const JOURNAL_STATUS_NAMES[] = { "none", "started", "done", "failed", "quarantined" };
+
+/** \brief Latest journal record of an item. */
+struct JournalEntry {
+  JournalStatus status = JOURNAL_NONE;
+  /** \brief Content hash of the input (including everything else that determines the output). */
+  uint64_t hash = 0;
+  /** \brief Failed attempts with this hash. */
+  int attempts = 0;
+  /** \brief Where the output went, e.g. file or file:index. */
+  std::string output;
+};
+
+/** \brief Append-only journal of a batch run, used to resume it after a failure.
+ *
+ * Every event is one tab-separated line "status hash attempts output item message", appended and
+ * synced immediately so the journal survives crashes; on load the last line of every item wins,
+ * and a torn last line is ignored. Items are only considered done if their hash still matches,
+ * so changed inputs or parameters are redone.
+ */
+class Journal {
+public:
+  /** \brief Constructor.
+   * \param[in] filepath journal file
+   * \param[in] resume whether to load existing records; otherwise the journal is truncated
+   */
+  Journal(const std::string& filepath, bool resume) : filepath(filepath), file(nullptr) {
+    bool torn = false;
+    if (resume) {
+      torn = this->load();
+    }
+    this->file = fopen(filepath.c_str(), resume ? "a" : "w");
+    if (this->file == nullptr) {
+      fprintf(stdout, "[Journal] Could not open %s \n", filepath.c_str());
+    }
+    else if (torn) {
+      // End the torn line, so that it does not swallow the next record.
+      fputc('\n', this->file);
+    }
+  }
+
+  ~Journal() {
+    if (this->file != nullptr) {
+      fclose(this->file);
+    }
+  }
+
+  Journal(const Journal&) = delete;
+  Journal& operator=(const Journal&) = delete;
+
+  /** \brief Check whether records can be appended.
+   * \return open
+   */
+  bool is_open() const {
+    return this->file != nullptr;
+  }
+
+  /** \brief Get the latest record of an item; records with a different hash count as none.
+   * \param[in] item item, e.g. input file
+   * \param[in] hash current content hash of the item
+   * \return entry
+   */
+  JournalEntry get(const std::string& item, uint64_t hash) const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::map<std::string, JournalEntry>::const_iterator it = this->entries.find(item);
+    if (it == this->entries.end() || it->second.hash != hash) {
+      return JournalEntry();
+    }
+    return it->second;
+  }
+
+  /** \brief Append a record, counting failed attempts; a failure becomes quarantined once max_attempts is reached.
+   * \param[in] item item
+   * \param[in] hash content hash of the item
+   * \param[in] status new status
+   * \param[in] output output location
+   * \param[in] message reason of a failure
+   * \param[in] max_attempts attempts before quarantining
+   * \return status recorded
+   */
+  JournalStatus record(const std::string& item, uint64_t hash, JournalStatus status, const std::string& output,
+      const std::string& message = "", int max_attempts = 1) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    JournalEntry& entry = this->entries[item];
+    if (entry.hash != hash) {
+      entry.attempts = 0;
+    }
+    entry.hash = hash;
+    entry.output = output;
+    entry.status = status;
+    if (status == JOURNAL_FAILED) {
+      entry.attempts++;
+      if (entry.attempts >= max_attempts) {
+        entry.status = JOURNAL_QUARANTINED;
+      }
+    }
+
+    if (this->file != nullptr) {
+      fprintf(this->file, "%s\t%016" PRIx64 "\t%d\t%s\t%s\t%s\n", JOURNAL_STATUS_NAMES[entry.status], hash, entry.attempts,
+        clean(output).c_str(), clean(item).c_str(), clean(message).c_str());
+      fflush(this->file);
+#ifdef __unix__
+      fsync(fileno(this->file));
+#endif
+    }
+    return entry.status;
+  }
+
+private:
+  /** \brief Load all complete lines of the journal.
+   * \return whether the journal ends with a torn line
+   */
+  bool load() {
+    FILE* in = fopen(this->filepath.c_str(), "r");
+    if (in == nullptr) {
+      return false;
+    }
+
+    std::string line;
+    int c;
+    while ((c = fgetc(in)) != EOF) {
+      if (c != '\n') {
+        line += static_cast<char>(c);
+        continue;
+      }
+
+      std::string fields[6];
+      size_t n = 0;
+      for (size_t i = 0; i < line.size() && n < 6; i++) {
+        if (line[i] == '\t' && n < 5) {
+          n++;
+        }
+        else {
+          fields[n] += line[i];
+        }
+      }
+      line.clear();
+      if (n < 4) {
+        continue;
+      }
+
+      JournalEntry entry;
+      for (int s = 0; s < 5; s++) {
+        if (fields[0] == JOURNAL_STATUS_NAMES[s]) {
+          entry.status = static_cast<JournalStatus>(s);
+        }
+      }
+      entry.hash = strtoull(fields[1].c_str(), nullptr, 16);
+      entry.attempts = atoi(fields[2].c_str());
+      entry.output = fields[3];
+      this->entries[fields[4]] = entry;
+    }
+    fclose(in);
+    return !line.empty();
+  }
+
+  /** \brief Replace tabs and line breaks so a value fits into one field.
+   * \param[in] value value
+   * \return cleaned value
+   */
+  static std::string clean(const std::string& value) {
+    std::string cleaned(value);
+    for (size_t i = 0; i < cleaned.size(); i++) {
+      if (cleaned[i] == '\t' || cleaned[i] == '\n' || cleaned[i] == '\r') {
+        cleaned[i] = ' ';
+      }
+    }
+    return cleaned;
+  }
+
+  const std::string filepath;
+  FILE* file;
+  /** \brief Guards the entries and appending. */
+  mutable std::mutex mutex;
+  /** \brief Latest entry per item. */
+  std::map<std::string, JournalEntry> entries;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <string>
+#include <cstddef>
+
+// POSIX memory mapping
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** \brief Read-only memory mapping of a whole file; the mapping is released on destruction. */
+class MappedFile {
+public:
+  /** \brief Empty constructor. */
+  MappedFile() : mapped(nullptr), length(0) {
+
+  }
+
+  /** \brief Destructor, unmaps the file. */
+  ~MappedFile() {
+    this->close();
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  /** \brief Map the given file into memory.
+   * \param[in] filepath path to the file
+   * \param[in] sequential whether the file will mostly be read front to back
+   * \return success
+   */
+  bool open(const std::string& filepath, bool sequential = true) {
+    this->close();
+
+    int fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      ::close(fd);
+      return false;
+    }
+
+    this->length = static_cast<size_t>(info.st_size);
+    if (this->length == 0) {
+      // mmap refuses zero-length mappings; an empty file is still a valid (empty) view.
+      ::close(fd);
+      return true;
+    }
+
+    void* address = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (address == MAP_FAILED) {
+      this->length = 0;
+      return false;
+    }
+
+    this->mapped = address;
+    madvise(this->mapped, this->length, sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+    return true;
+  }
+
+  /** \brief Advise the kernel that the mapping is read at random positions (e.g. samples of a dataset), which disables read-ahead. */
+  void random_access() {
+    if (this->mapped != nullptr) {
+      madvise(this->mapped, this->length, MADV_RANDOM);
+    }
+  }
+
+  /** \brief Unmap the file if mapped. */
+  void close() {
+    if (this->mapped != nullptr) {
+      munmap(this->mapped, this->length);
+    }
+
+    this->mapped = nullptr;
+    this->length = 0;
+  }
+
+  /** \brief Get the first byte of the mapping.
+   * \return pointer to the data, nullptr for empty files
+   */
+  const char* data() const {
+    return static_cast<const char*>(this->mapped);
+  }
+
+  /** \brief Get the size of the mapping.
+   * \return size in bytes
+   */
+  size_t size() const {
+    return this->length;
+  }
+
+private:
+
+  /** \brief Start of the mapping. */
+  void* mapped;
+
+  /** \brief Length of the mapping in bytes. */
+  size_t length;
+};
+
+#endif
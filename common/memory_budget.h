@@ -0,0 +1,152 @@
+#ifndef MEMORY_BUDGET_H_
+#define MEMORY_BUDGET_H_
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+/** \brief Predicted memory use of a run, checked against an optional limit before allocating.
+ *
+ * Callers add the large allocations they are about to make (volumes, voxel tables, parsed meshes);
+ * the resident size of the process at construction time is included as baseline, so anything
+ * already loaded (libraries, a parsed mesh) is accounted for.
+ */
+class MemoryBudget {
+public:
+  /** \brief Constructor.
+   * \param[in] limit budget in bytes, 0 for no limit
+   */
+  explicit MemoryBudget(uint64_t limit = 0) : limit(limit) {
+    this->add("process", current_rss());
+  }
+
+  /** \brief Add a predicted allocation.
+   * \param[in] name what is allocated
+   * \param[in] bytes size in bytes
+   */
+  void add(const std::string& name, uint64_t bytes) {
+    this->items.push_back(Item());
+    this->items.back().name = name;
+    this->items.back().bytes = bytes;
+  }
+
+  /** \brief Replace the size of a previously added allocation, e.g. when switching to a streaming strategy.
+   * \param[in] name what is allocated
+   * \param[in] bytes size in bytes
+   */
+  void set(const std::string& name, uint64_t bytes) {
+    for (size_t i = 0; i < this->items.size(); i++) {
+      if (this->items[i].name == name) {
+        this->items[i].bytes = bytes;
+        return;
+      }
+    }
+    this->add(name, bytes);
+  }
+
+  /** \brief Predicted peak memory.
+   * \return bytes
+   */
+  uint64_t total() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < this->items.size(); i++) {
+      total += this->items[i].bytes;
+    }
+    return total;
+  }
+
+  /** \brief Check the prediction against the limit.
+   * \return whether the run fits
+   */
+  bool fits() const {
+    return this->limit == 0 || this->total() <= this->limit;
+  }
+
+  /** \brief Print every allocation and the predicted total. */
+  void print() const {
+    for (size_t i = 0; i < this->items.size(); i++) {
+      fprintf(stdout, "[Memory] %s: %s \n", this->items[i].name.c_str(), readable(this->items[i].bytes).c_str());
+    }
+    if (this->limit > 0) {
+      fprintf(stdout, "[Memory] Predicted peak: %s of %s budget \n", readable(this->total()).c_str(), readable(this->limit).c_str());
+    }
+    else {
+      fprintf(stdout, "[Memory] Predicted peak: %s \n", readable(this->total()).c_str());
+    }
+  }
+
+  /** \brief Print the actual peak resident size next to the prediction. */
+  void report() const {
+    fprintf(stdout, "[Memory] Peak RSS: %s (predicted %s) \n", readable(peak_rss()).c_str(), readable(this->total()).c_str());
+  }
+
+  /** \brief Resident size of the process.
+   * \return bytes, 0 if unknown
+   */
+  static uint64_t current_rss() {
+#ifdef __linux__
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file == nullptr) {
+      return 0;
+    }
+    unsigned long long pages = 0, resident = 0;
+    int read = fscanf(file, "%llu %llu", &pages, &resident);
+    fclose(file);
+    return read == 2 ? static_cast<uint64_t>(resident) * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) : 0;
+#else
+    return 0;
+#endif
+  }
+
+  /** \brief Peak resident size of the process so far.
+   * \return bytes, 0 if unknown
+   */
+  static uint64_t peak_rss() {
+#ifdef __linux__
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+      return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+    }
+#endif
+    return 0;
+  }
+
+  /** \brief Format a size for humans.
+   * \param[in] bytes size
+   * \return e.g. "1.5 GB"
+   */
+  static std::string readable(uint64_t bytes) {
+    const char* units[] = { "bytes", "kB", "MB", "GB", "TB" };
+    double value = static_cast<double>(bytes);
+    int unit = 0;
+    while (value >= 1024 && unit < 4) {
+      value /= 1024;
+      unit++;
+    }
+
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+    return std::string(buffer);
+  }
+
+  /** \brief Budget in bytes, 0 for no limit. */
+  const uint64_t limit;
+
+private:
+  /** \brief A predicted allocation. */
+  struct Item {
+    std::string name;
+    uint64_t bytes;
+  };
+
+  /** \brief Allocations in the order they were added. */
+  std::vector<Item> items;
+};
+
+#endif
@@ -0,0 +1,374 @@
+#ifndef MESH_CACHE_H_
+#define MESH_CACHE_H_
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <stdint.h>
+
+// POSIX directory handling
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include "mapped_file.h"
+
+/** \brief Version of the on-disk layout; part of every key so old entries simply miss. */
+const uint32_t MESH_CACHE_VERSION = 2;
+
+/** \brief Alignment of every section in a cache entry, in bytes. */
+const uint64_t MESH_CACHE_ALIGNMENT = 64;
+
+/** \brief Header of a cache entry.
+ *
+ * An entry is a single file laid out as header | vertices | faces, every section starting at a
+ * multiple of MESH_CACHE_ALIGNMENT, so it can be used straight from a memory mapping:
+ *  - vertices: n_vertices x vertex_stride floats, x, y, z first;
+ *  - faces: n_faces x 3 int32 vertex indices.
+ */
+struct MeshCacheHeader {
+  /** \brief Always "VXMC". */
+  char magic[4];
+  /** \brief Layout version, MESH_CACHE_VERSION. */
+  uint32_t version;
+  /** \brief Key the entry was stored under. */
+  uint64_t key;
+  /** \brief Number of vertices. */
+  uint64_t n_vertices;
+  /** \brief Number of faces. */
+  uint64_t n_faces;
+  /** \brief Number of floats per vertex. */
+  uint32_t vertex_stride;
+  /** \brief Unused, zero. */
+  uint32_t reserved;
+  /** \brief Mesh bounding box minimum. */
+  float bbox_min[3];
+  /** \brief Mesh bounding box maximum. */
+  float bbox_max[3];
+  /** \brief Byte offset of the vertices. */
+  uint64_t vertices_offset;
+  /** \brief Byte offset of the faces. */
+  uint64_t faces_offset;
+  /** \brief Total size of the entry in bytes. */
+  uint64_t file_size;
+};
+
+/** \brief A loaded cache entry; all pointers point into the memory mapping and stay valid as long as the entry lives. */
+struct MeshCacheEntry {
+  /** \brief Mapping of the entry file. */
+  MappedFile file;
+  /** \brief Header. */
+  const MeshCacheHeader* header;
+  /** \brief Vertices, header->vertex_stride floats each. */
+  const float* vertices;
+  /** \brief Faces, three indices each. */
+  const int32_t* faces;
+
+  /** \brief Empty constructor. */
+  MeshCacheEntry() : header(nullptr), vertices(nullptr), faces(nullptr) {
+
+  }
+};
+
+/** \brief Finalizer of MurmurHash3, spreads the bits of a 64-bit word.
+ * \param[in] h word
+ * \return mixed word
+ */
+inline uint64_t mesh_cache_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/** \brief Fast 64-bit, non-cryptographic hash of a byte range, consuming eight bytes per step.
+ * \param[in] data bytes to hash
+ * \param[in] size number of bytes
+ * \param[in] seed seed, e.g. a previous hash
+ * \return hash
+ */
+inline uint64_t mesh_cache_hash(const char* data, size_t size, uint64_t seed = 0) {
+  const uint64_t prime = 0x9e3779b185ebca87ULL;
+  uint64_t h = seed ^ (static_cast<uint64_t>(size)*prime);
+
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    h = (h ^ mesh_cache_mix(word))*prime;
+    h = (h << 31) | (h >> 33);
+  }
+
+  if (i < size) {
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, size - i);
+    h = (h ^ mesh_cache_mix(tail))*prime;
+  }
+
+  return mesh_cache_mix(h);
+}
+
+/** \brief On-disk cache of parsed meshes together with their bounding box.
+ *
+ * Entries are keyed by the hash of the input file's content together with a parameter string
+ * describing everything else that went into the parsed data (vertex layout, label remapping, ...).
+ * Recency is tracked through the entries' modification times, which are refreshed on every hit;
+ * once the directory exceeds its size limit, the least recently used entries are removed.
+ */
+class MeshCache {
+public:
+  /** \brief Constructor.
+   * \param[in] directory cache directory, created if necessary; an empty path disables the cache
+   * \param[in] max_bytes size limit of the directory in bytes
+   */
+  MeshCache(const std::string& directory = "", uint64_t max_bytes = 0) : directory(directory), max_bytes(max_bytes) {
+    if (!this->directory.empty()) {
+      mkdir(this->directory.c_str(), 0755);
+
+      struct stat info;
+      if (stat(this->directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+        fprintf(stdout, "[Cache] Cannot use %s as cache directory, caching disabled \n", this->directory.c_str());
+        this->directory.clear();
+      }
+    }
+
+    this->evict();
+  }
+
+  /** \brief Check whether the cache is in use.
+   * \return enabled
+   */
+  bool enabled() const {
+    return !this->directory.empty();
+  }
+
+  /** \brief Compute the key for an input file.
+   * \param[in] filepath input file whose content is hashed
+   * \param[in] params description of all parameters influencing the cached data
+   * \return key, 0 if the file cannot be read
+   */
+  static uint64_t key(const std::string& filepath, const std::string& params) {
+    MappedFile file;
+    if (!file.open(filepath)) {
+      return 0;
+    }
+
+    uint64_t h = mesh_cache_hash(params.c_str(), params.size(), MESH_CACHE_VERSION);
+    h = mesh_cache_hash(file.data(), file.size(), h);
+    return h == 0 ? 1 : h;
+  }
+
+  /** \brief Load an entry.
+   * \param[in] key key of the entry
+   * \param[out] entry loaded entry
+   * \return hit
+   */
+  bool load(uint64_t key, MeshCacheEntry& entry) {
+    if (!this->enabled() || key == 0) {
+      return false;
+    }
+
+    std::string path = this->entry_path(key);
+    if (!entry.file.open(path, false)) {
+      return false;
+    }
+
+    const char* data = entry.file.data();
+    const uint64_t size = entry.file.size();
+    const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(data);
+
+    bool valid = size >= sizeof(MeshCacheHeader)
+      && memcmp(header->magic, "VXMC", 4) == 0
+      && header->version == MESH_CACHE_VERSION
+      && header->key == key
+      && header->file_size == size
+      && header->vertex_stride >= 3
+      && header->vertices_offset + header->n_vertices*header->vertex_stride*sizeof(float) <= size
+      && header->faces_offset + header->n_faces*3*sizeof(int32_t) <= size;
+
+    if (!valid) {
+      fprintf(stdout, "[Cache] Removing invalid entry %s \n", path.c_str());
+      entry.file.close();
+      unlink(path.c_str());
+      return false;
+    }
+
+    entry.header = header;
+    entry.vertices = reinterpret_cast<const float*>(data + header->vertices_offset);
+    entry.faces = reinterpret_cast<const int32_t*>(data + header->faces_offset);
+
+    // Refresh the modification time, it doubles as LRU timestamp.
+    utime(path.c_str(), nullptr);
+    return true;
+  }
+
+  /** \brief Store an entry, computing the mesh bounding box, and evict old entries if needed.
+   * \param[in] key key of the entry
+   * \param[in] vertices n_vertices x vertex_stride floats
+   * \param[in] n_vertices number of vertices
+   * \param[in] vertex_stride floats per vertex, at least 3
+   * \param[in] faces n_faces x 3 vertex indices
+   * \param[in] n_faces number of faces
+   * \return success
+   */
+  bool store(uint64_t key, const float* vertices, uint64_t n_vertices, uint32_t vertex_stride,
+      const int32_t* faces, uint64_t n_faces) {
+
+    if (!this->enabled() || key == 0 || vertex_stride < 3) {
+      return false;
+    }
+
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "VXMC", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.key = key;
+    header.n_vertices = n_vertices;
+    header.n_faces = n_faces;
+    header.vertex_stride = vertex_stride;
+    header.vertices_offset = align(sizeof(MeshCacheHeader));
+    header.faces_offset = align(header.vertices_offset + n_vertices*vertex_stride*sizeof(float));
+    header.file_size = header.faces_offset + n_faces*3*sizeof(int32_t);
+
+    if (header.file_size > this->max_bytes) {
+      return false;
+    }
+
+    for (int d = 0; d < 3; d++) {
+      header.bbox_min[d] = FLT_MAX;
+      header.bbox_max[d] = -FLT_MAX;
+    }
+
+    for (uint64_t v = 0; v < n_vertices; v++) {
+      for (int d = 0; d < 3; d++) {
+        header.bbox_min[d] = std::min(header.bbox_min[d], vertices[v*vertex_stride + d]);
+        header.bbox_max[d] = std::max(header.bbox_max[d], vertices[v*vertex_stride + d]);
+      }
+    }
+
+    // Write to a temporary file first; the rename makes the entry appear atomically to concurrent runs.
+    std::string path = this->entry_path(key);
+    std::string temporary = path + ".tmp" + std::to_string(static_cast<long>(getpid()));
+
+    FILE* out = fopen(temporary.c_str(), "wb");
+    if (out == nullptr) {
+      return false;
+    }
+
+    bool success = write_at(out, 0, &header, sizeof(header))
+      && write_at(out, header.vertices_offset, vertices, n_vertices*vertex_stride*sizeof(float))
+      && write_at(out, header.faces_offset, faces, n_faces*3*sizeof(int32_t))
+      && fflush(out) == 0 && ftruncate(fileno(out), static_cast<off_t>(header.file_size)) == 0;
+    success = (fclose(out) == 0) && success;
+
+    if (!success || rename(temporary.c_str(), path.c_str()) != 0) {
+      unlink(temporary.c_str());
+      return false;
+    }
+
+    this->evict();
+    return true;
+  }
+
+  /** \brief Remove least recently used entries until the directory fits into the size limit. */
+  void evict() {
+    if (!this->enabled()) {
+      return;
+    }
+
+    DIR* dir = opendir(this->directory.c_str());
+    if (dir == nullptr) {
+      return;
+    }
+
+    struct Item {
+      std::string path;
+      uint64_t size;
+      time_t time;
+    };
+
+    std::vector<Item> items;
+    uint64_t total = 0;
+
+    struct dirent* it;
+    while ((it = readdir(dir)) != nullptr) {
+      std::string name(it->d_name);
+      if (name.size() < 5 || name.compare(name.size() - 5, 5, ".vxmc") != 0) {
+        continue;
+      }
+
+      Item item;
+      item.path = this->directory + "/" + name;
+
+      struct stat info;
+      if (stat(item.path.c_str(), &info) != 0) {
+        continue;
+      }
+
+      item.size = static_cast<uint64_t>(info.st_size);
+      item.time = info.st_mtime;
+      items.push_back(item);
+      total += item.size;
+    }
+    closedir(dir);
+
+    std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+      return a.time < b.time;
+    });
+
+    for (size_t i = 0; i < items.size() && total > this->max_bytes; i++) {
+      if (unlink(items[i].path.c_str()) == 0) {
+        fprintf(stdout, "[Cache] Evicted %s \n", items[i].path.c_str());
+        total -= items[i].size;
+      }
+    }
+  }
+
+private:
+
+  /** \brief Round up to the section alignment.
+   * \param[in] offset offset
+   * \return aligned offset
+   */
+  static uint64_t align(uint64_t offset) {
+    return (offset + MESH_CACHE_ALIGNMENT - 1)/MESH_CACHE_ALIGNMENT*MESH_CACHE_ALIGNMENT;
+  }
+
+  /** \brief Write a section at the given offset.
+   * \param[in] out file
+   * \param[in] offset byte offset
+   * \param[in] data data
+   * \param[in] bytes number of bytes
+   * \return success
+   */
+  static bool write_at(FILE* out, uint64_t offset, const void* data, uint64_t bytes) {
+    if (fseeko(out, static_cast<off_t>(offset), SEEK_SET) != 0) {
+      return false;
+    }
+    return bytes == 0 || fwrite(data, 1, bytes, out) == bytes;
+  }
+
+  /** \brief Path of the entry for a key.
+   * \param[in] key key
+   * \return path
+   */
+  std::string entry_path(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.vxmc", static_cast<unsigned long long>(key));
+    return this->directory + "/" + name;
+  }
+
+  /** \brief Cache directory, empty if disabled. */
+  std::string directory;
+
+  /** \brief Size limit in bytes. */
+  uint64_t max_bytes;
+};
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef MESH_CLEANING_H_
+#define MESH_CLEANING_H_
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+#include "voxel_stats.h"
+#include "mesh_faces.h"
+
+/** \brief What a cleaning pass changed. */
+struct MeshCleaningReport {
+  /** \brief Vertices replaced by another vertex within the weld tolerance. */
+  uint64_t welded_vertices;
+  /** \brief Triangles removed because two of their (welded) vertices coincide or their area is zero. */
+  uint64_t degenerate_triangles;
+  /** \brief Triangles removed because another triangle has the same (welded) vertices, in any order. */
+  uint64_t duplicate_triangles;
+
+  MeshCleaningReport() : welded_vertices(0), degenerate_triangles(0), duplicate_triangles(0) {
+
+  }
+
+  /** \brief Triangles removed.
+   * \return triangles
+   */
+  uint64_t removed_triangles() const {
+    return this->degenerate_triangles + this->duplicate_triangles;
+  }
+
+  MeshCleaningReport& operator+=(const MeshCleaningReport& other) {
+    this->welded_vertices += other.welded_vertices;
+    this->degenerate_triangles += other.degenerate_triangles;
+    this->duplicate_triangles += other.duplicate_triangles;
+    return *this;
+  }
+
+  /** \brief The report as voxelizer counters, e.g. for VoxelStats.
+   * \return counters
+   */
+  StatValues stats() const {
+    StatValues values;
+    values[STAT_WELDED_VERTICES] = this->welded_vertices;
+    values[STAT_DEGENERATE_TRIANGLES] = this->degenerate_triangles;
+    values[STAT_DUPLICATE_TRIANGLES] = this->duplicate_triangles;
+    return values;
+  }
+};
+
+/** \brief Hash of a cell of the welding grid.
+ * \param[in] x cell coordinate
+ * \param[in] y cell coordinate
+ * \param[in] z cell coordinate
+ * \return key
+ */
+inline uint64_t weld_cell_key(int64_t x, int64_t y, int64_t z) {
+  uint64_t key = static_cast<uint64_t>(x)*0x9e3779b97f4a7c15ull;
+  key ^= static_cast<uint64_t>(y)*0xc2b2ae3d27d4eb4full;
+  key ^= static_cast<uint64_t>(z)*0x165667b19e3779f9ull;
+  return key ^ (key >> 29);
+}
+
+/** \brief Weld vertices using a spatial hash.
+ *
+ * Every vertex is mapped to the vertex of smallest index within the tolerance (Euclidean
+ * distance), following chains so that representatives map to themselves. With a tolerance of 0
+ * only vertices at exactly the same position are welded. Vertices are hashed by their cell of
+ * size tolerance, and only the 27 neighbouring cells are searched, so the pass is O(n log n).
+ * \param[in] positions n x 3 floats
+ * \param[in] n number of vertices
+ * \param[in] tolerance weld distance, no welding if negative
+ * \param[out] representative vertex each vertex is welded to
+ * \return number of welded vertices, i.e. vertices that are not their own representative
+ */
+inline uint64_t weld_vertices(const float* positions, size_t n, float tolerance, std::vector<uint32_t>& representative) {
+  representative.resize(n);
+  for (size_t v = 0; v < n; v++) {
+    representative[v] = static_cast<uint32_t>(v);
+  }
+  if (tolerance < 0 || n == 0) {
+    return 0;
+  }
+
+  const bool exact = !(tolerance > 0);
+  const float squared_tolerance = tolerance*tolerance;
+
+  // Cells of the vertices; exact welding hashes the coordinates themselves (with -0 as 0).
+  auto cell = [&](size_t v, int64_t c[3]) {
+    for (int i = 0; i < 3; i++) {
+      if (exact) {
+        uint32_t bits;
+        float value = positions[3*v + i] + 0.0f;
+        memcpy(&bits, &value, sizeof(bits));
+        c[i] = bits;
+      }
+      else {
+        c[i] = static_cast<int64_t>(std::floor(positions[3*v + i]/tolerance));
+      }
+    }
+  };
+
+  std::vector<std::pair<uint64_t, uint32_t>> cells(n);
+  #pragma omp parallel for
+  for (int64_t v = 0; v < static_cast<int64_t>(n); v++) {
+    int64_t c[3];
+    cell(v, c);
+    cells[v] = std::make_pair(weld_cell_key(c[0], c[1], c[2]), static_cast<uint32_t>(v));
+  }
+  std::sort(cells.begin(), cells.end());
+
+  #pragma omp parallel for schedule(dynamic, 1024)
+  for (int64_t v = 0; v < static_cast<int64_t>(n); v++) {
+    int64_t c[3];
+    cell(v, c);
+    const float* p = positions + 3*v;
+    uint32_t best = static_cast<uint32_t>(v);
+
+    const int reach = exact ? 0 : 1;
+    for (int dx = -reach; dx <= reach; dx++) {
+      for (int dy = -reach; dy <= reach; dy++) {
+        for (int dz = -reach; dz <= reach; dz++) {
+          const uint64_t key = weld_cell_key(c[0] + dx, c[1] + dy, c[2] + dz);
+          // Entries of a cell are sorted by index, so the first match is the smallest.
+          for (auto it = std::lower_bound(cells.begin(), cells.end(), std::make_pair(key, static_cast<uint32_t>(0)));
+               it != cells.end() && it->first == key && it->second < best; ++it) {
+            const float* q = positions + 3*it->second;
+            const float d[3] = { p[0] - q[0], p[1] - q[1], p[2] - q[2] };
+            const bool close = exact ? (d[0] == 0 && d[1] == 0 && d[2] == 0)
+              : (d[0]*d[0] + d[1]*d[1] + d[2]*d[2] <= squared_tolerance);
+            if (close) {
+              best = it->second;
+              break;
+            }
+          }
+        }
+      }
+    }
+    representative[v] = best;
+  }
+
+  // Representatives have smaller indices, so one pass in index order resolves all chains.
+  uint64_t welded = 0;
+  for (size_t v = 0; v < n; v++) {
+    representative[v] = representative[representative[v]];
+    welded += representative[v] != v;
+  }
+  return welded;
+}
+
+/** \brief Clean a triangle mesh: weld vertices, then drop degenerate and duplicate triangles.
+ *
+ * Faces are rewritten to the welded vertices and filtered in place, keeping their order and
+ * orientation; of duplicate triangles the first one is kept. Triangles are degenerate if two
+ * welded vertices coincide or the cross product of their edges is zero, i.e. their normal is
+ * undefined. The vertices themselves are left untouched, so per-vertex attributes stay valid;
+ * welded vertices are simply no longer referenced.
+ * \param[in] positions n_vertices x 3 floats
+ * \param[in] n_vertices number of vertices
+ * \param[in,out] faces faces, anything indexable by 0, 1 and 2
+ * \param[in] tolerance weld distance, 0 to weld only identical positions, negative to not weld
+ * \return what was changed
+ */
+template<typename Face>
+MeshCleaningReport clean_mesh(const float* positions, size_t n_vertices, std::vector<Face>& faces, float tolerance) {
+  MeshCleaningReport report;
+  std::vector<uint32_t> representative;
+  report.welded_vertices = weld_vertices(positions, n_vertices, tolerance, representative);
+
+  // Sorted vertices and index of every face; degenerate faces get the largest key and are skipped.
+  const uint32_t none = MeshFaceKey::none;
+  const int64_t n_faces = static_cast<int64_t>(faces.size());
+  std::vector<MeshFaceKey> keys(faces.size());
+  std::vector<uint8_t> keep(faces.size(), 1);
+  uint64_t degenerate = 0;
+
+  #pragma omp parallel for reduction(+:degenerate)
+  for (int64_t f = 0; f < n_faces; f++) {
+    uint32_t v[3];
+    for (int i = 0; i < 3; i++) {
+      v[i] = representative[faces[f][i]];
+      faces[f][i] = v[i];
+    }
+
+    if (mesh_face_degenerate(positions, v)) {
+      keep[f] = 0;
+      keys[f] = MeshFaceKey{ none, none, none, static_cast<uint32_t>(f) };
+      degenerate++;
+      continue;
+    }
+
+    std::sort(v, v + 3);
+    keys[f] = MeshFaceKey{ v[0], v[1], v[2], static_cast<uint32_t>(f) };
+  }
+  report.degenerate_triangles = degenerate;
+
+  std::sort(keys.begin(), keys.end());
+  uint64_t duplicate = 0;
+  #pragma omp parallel for reduction(+:duplicate)
+  for (int64_t k = 1; k < n_faces; k++) {
+    if (keys[k].same_vertices(keys[k - 1])) {
+      keep[keys[k].f] = 0;
+      duplicate++;
+    }
+  }
+  report.duplicate_triangles = duplicate;
+
+  compact_faces(faces, keep);
+  return report;
+}
+
+#endif
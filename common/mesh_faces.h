@@ -0,0 +1,75 @@
+#ifndef MESH_FACES_H_
+#define MESH_FACES_H_
+
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+
+/** \brief Sorted vertices and index of a face, to find faces with the same vertices by sorting.
+ *
+ * Degenerate faces get MeshFaceKey::none as vertices, so they sort last and are never the same
+ * as another face.
+ */
+struct MeshFaceKey {
+  /** \brief Vertex of degenerate faces. */
+  static const uint32_t none = ~0u;
+
+  /** \brief Sorted vertices. */
+  uint32_t a, b, c;
+  /** \brief Face index. */
+  uint32_t f;
+
+  bool operator<(const MeshFaceKey& other) const {
+    return a != other.a ? a < other.a : (b != other.b ? b < other.b : (c != other.c ? c < other.c : f < other.f));
+  }
+
+  /** \brief Check whether two faces have the same vertices, in any order; degenerate faces never do.
+   * \param[in] other other key
+   * \return same vertices
+   */
+  bool same_vertices(const MeshFaceKey& other) const {
+    return a != none && a == other.a && b == other.b && c == other.c;
+  }
+};
+
+/** \brief Check whether a triangle is degenerate, i.e. two of its vertices coincide or the cross product of its edges is zero or not finite, so its normal is undefined.
+ * \param[in] positions vertices, 3 floats each
+ * \param[in] v vertex indices
+ * \return degenerate
+ */
+inline bool mesh_face_degenerate(const float* positions, const uint32_t v[3]) {
+  if (v[0] == v[1] || v[1] == v[2] || v[0] == v[2]) {
+    return true;
+  }
+
+  const float* p0 = positions + 3*static_cast<uint64_t>(v[0]);
+  const float* p1 = positions + 3*static_cast<uint64_t>(v[1]);
+  const float* p2 = positions + 3*static_cast<uint64_t>(v[2]);
+  const float e0[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+  const float e1[3] = { p2[0] - p1[0], p2[1] - p1[1], p2[2] - p1[2] };
+  const float n[3] = { e0[1]*e1[2] - e0[2]*e1[1], e0[2]*e1[0] - e0[0]*e1[2], e0[0]*e1[1] - e0[1]*e1[0] };
+  const float length = n[0]*n[0] + n[1]*n[1] + n[2]*n[2];
+  return !(length > 0) || !std::isfinite(length);
+}
+
+/** \brief Remove faces in place, keeping the order of the others.
+ * \param[in,out] faces faces
+ * \param[in] keep non-zero for every face to keep
+ * \return number of faces kept
+ */
+template<typename Face>
+size_t compact_faces(std::vector<Face>& faces, const std::vector<uint8_t>& keep) {
+  size_t kept = 0;
+  for (size_t f = 0; f < faces.size(); f++) {
+    if (keep[f]) {
+      if (kept != f) {
+        faces[kept] = faces[f];
+      }
+      kept++;
+    }
+  }
+  faces.resize(kept);
+  return kept;
+}
+
+#endif
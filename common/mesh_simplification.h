@@ -0,0 +1,228 @@
+#ifndef MESH_SIMPLIFICATION_H_
+#define MESH_SIMPLIFICATION_H_
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+#include "mesh_faces.h"
+
+/** \brief Largest cluster cell, as a fraction of the voxel size, for which the error stays below half a voxel. */
+const float SIMPLIFICATION_MAX_CELL = 0.5f/1.7320508f;
+
+/** \brief What a simplification pass changed. */
+struct MeshSimplificationReport {
+  /** \brief Triangles before and after. */
+  uint64_t triangles_before;
+  uint64_t triangles_after;
+  /** \brief Vertex clusters, i.e. distinct vertices of the simplified mesh. */
+  uint64_t clusters;
+  /** \brief Triangles that collapsed onto a point or edge no other triangle covers, and were kept unchanged instead. */
+  uint64_t kept_triangles;
+  /** \brief Largest distance a vertex moved; bounds the Hausdorff distance between the meshes. */
+  float max_displacement;
+
+  MeshSimplificationReport() : triangles_before(0), triangles_after(0), clusters(0), kept_triangles(0), max_displacement(0) {
+
+  }
+
+  /** \brief Fraction of the triangles left.
+   * \return ratio
+   */
+  double ratio() const {
+    return this->triangles_before > 0 ? static_cast<double>(this->triangles_after)/this->triangles_before : 1.0;
+  }
+
+  MeshSimplificationReport& operator+=(const MeshSimplificationReport& other) {
+    this->triangles_before += other.triangles_before;
+    this->triangles_after += other.triangles_after;
+    this->clusters += other.clusters;
+    this->kept_triangles += other.kept_triangles;
+    this->max_displacement = std::max(this->max_displacement, other.max_displacement);
+    return *this;
+  }
+};
+
+/** \brief Simplify a triangle mesh by vertex clustering.
+ *
+ * Vertices are clustered in the cells of a grid of the given cell size anchored at origin, and
+ * every vertex is replaced by the vertex of its cluster closest to the cluster mean, so no
+ * vertex moves further than a cell diagonal and per-vertex attributes stay valid. Triangles
+ * are rewritten to the representatives and duplicates are removed. A triangle that collapses
+ * onto a point or an edge is dropped only if that point or edge belongs to a remaining
+ * triangle, otherwise it is kept unchanged; so every point of either mesh is within
+ * max_displacement of the other, i.e. the Hausdorff distance is at most max_displacement.
+ * With a cell of SIMPLIFICATION_MAX_CELL voxels or less it stays below half a voxel.
+ *
+ * Faces keep their order and orientation; vertices are not touched, clustered vertices are
+ * simply no longer referenced.
+ * \param[in] positions n_vertices x 3 floats
+ * \param[in] n_vertices number of vertices
+ * \param[in,out] faces faces, anything indexable by 0, 1 and 2
+ * \param[in] cell cell size, positive
+ * \param[in] origin corner of the grid, e.g. the voxel grid origin
+ * \return what was changed
+ */
+template<typename Face>
+MeshSimplificationReport simplify_mesh(const float* positions, size_t n_vertices, std::vector<Face>& faces, float cell, const float origin[3]) {
+  MeshSimplificationReport report;
+  report.triangles_before = faces.size();
+  report.triangles_after = faces.size();
+  if (n_vertices == 0 || !(cell > 0)) {
+    return report;
+  }
+
+  // Sort the vertices by cell; the cells are compared exactly, so distinct cells never merge.
+  struct CellVertex {
+    int64_t x, y, z;
+    uint32_t v;
+    bool operator<(const CellVertex& other) const {
+      return x != other.x ? x < other.x : (y != other.y ? y < other.y : (z != other.z ? z < other.z : v < other.v));
+    }
+    bool same_cell(const CellVertex& other) const {
+      return x == other.x && y == other.y && z == other.z;
+    }
+  };
+
+  const int64_t n = static_cast<int64_t>(n_vertices);
+  std::vector<CellVertex> cells(n_vertices);
+  #pragma omp parallel for
+  for (int64_t v = 0; v < n; v++) {
+    const float* p = positions + 3*v;
+    cells[v].x = static_cast<int64_t>(std::floor((p[0] - origin[0])/cell));
+    cells[v].y = static_cast<int64_t>(std::floor((p[1] - origin[1])/cell));
+    cells[v].z = static_cast<int64_t>(std::floor((p[2] - origin[2])/cell));
+    cells[v].v = static_cast<uint32_t>(v);
+  }
+  std::sort(cells.begin(), cells.end());
+
+  std::vector<size_t> starts;
+  for (size_t i = 0; i < n_vertices; i++) {
+    if (i == 0 || !cells[i].same_cell(cells[i - 1])) {
+      starts.push_back(i);
+    }
+  }
+  starts.push_back(n_vertices);
+  report.clusters = starts.size() - 1;
+
+  // Representative of every cluster: the vertex closest to the mean.
+  std::vector<uint32_t> representative(n_vertices);
+  float max_displacement = 0;
+  const int64_t n_clusters = static_cast<int64_t>(report.clusters);
+  #pragma omp parallel for schedule(dynamic, 256) reduction(max:max_displacement)
+  for (int64_t c = 0; c < n_clusters; c++) {
+    double mean[3] = { 0, 0, 0 };
+    for (size_t i = starts[c]; i < starts[c + 1]; i++) {
+      for (int k = 0; k < 3; k++) {
+        mean[k] += positions[3*cells[i].v + k];
+      }
+    }
+    const double count = static_cast<double>(starts[c + 1] - starts[c]);
+
+    uint32_t best = cells[starts[c]].v;
+    double best_distance = -1;
+    for (size_t i = starts[c]; i < starts[c + 1]; i++) {
+      double distance = 0;
+      for (int k = 0; k < 3; k++) {
+        const double d = positions[3*cells[i].v + k] - mean[k]/count;
+        distance += d*d;
+      }
+      if (best_distance < 0 || distance < best_distance) {
+        best = cells[i].v;
+        best_distance = distance;
+      }
+    }
+
+    const float* q = positions + 3*best;
+    for (size_t i = starts[c]; i < starts[c + 1]; i++) {
+      const float* p = positions + 3*cells[i].v;
+      const float d[3] = { p[0] - q[0], p[1] - q[1], p[2] - q[2] };
+      representative[cells[i].v] = best;
+      max_displacement = std::max(max_displacement, std::sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]));
+    }
+  }
+  report.max_displacement = max_displacement;
+
+  // Images of the faces, as sorted vertices; degenerate images, with fewer than three distinct
+  // vertices or zero area, are collapsed.
+  const uint32_t none = MeshFaceKey::none;
+  const int64_t n_faces = static_cast<int64_t>(faces.size());
+  std::vector<MeshFaceKey> keys(faces.size());
+  std::vector<uint8_t> collapsed(faces.size(), 0);
+
+  #pragma omp parallel for
+  for (int64_t f = 0; f < n_faces; f++) {
+    uint32_t v[3];
+    for (int i = 0; i < 3; i++) {
+      v[i] = representative[faces[f][i]];
+    }
+    collapsed[f] = mesh_face_degenerate(positions, v);
+
+    std::sort(v, v + 3);
+    keys[f] = collapsed[f] ? MeshFaceKey{ none, none, none, static_cast<uint32_t>(f) } : MeshFaceKey{ v[0], v[1], v[2], static_cast<uint32_t>(f) };
+  }
+
+  // Remaining triangles: the first of every set of duplicates, and their vertices and edges.
+  std::sort(keys.begin(), keys.end());
+  std::vector<uint8_t> keep(faces.size(), 0);
+  std::vector<uint8_t> used(n_vertices, 0);
+  std::vector<std::pair<uint32_t, uint32_t>> edges;
+  for (size_t k = 0; k < keys.size() && keys[k].a != none; k++) {
+    if (k > 0 && keys[k].same_vertices(keys[k - 1])) {
+      continue;
+    }
+    keep[keys[k].f] = 1;
+    used[keys[k].a] = used[keys[k].b] = used[keys[k].c] = 1;
+    edges.push_back(std::make_pair(keys[k].a, keys[k].b));
+    edges.push_back(std::make_pair(keys[k].b, keys[k].c));
+    edges.push_back(std::make_pair(keys[k].a, keys[k].c));
+  }
+  std::sort(edges.begin(), edges.end());
+
+  // Collapsed triangles whose point or edge is covered are dropped, the others kept unchanged.
+  uint64_t kept_triangles = 0;
+  #pragma omp parallel for reduction(+:kept_triangles)
+  for (int64_t f = 0; f < n_faces; f++) {
+    if (!collapsed[f]) {
+      continue;
+    }
+    uint32_t v[3];
+    for (int i = 0; i < 3; i++) {
+      v[i] = representative[faces[f][i]];
+    }
+    std::sort(v, v + 3);
+
+    bool covered;
+    if (v[0] == v[2]) {
+      covered = used[v[0]] != 0;
+    }
+    else if (v[0] == v[1] || v[1] == v[2]) {
+      covered = std::binary_search(edges.begin(), edges.end(), std::make_pair(v[0], v[2]));
+    }
+    else {
+      // Three distinct but collinear vertices.
+      covered = false;
+    }
+
+    if (!covered) {
+      keep[f] = 2;
+      kept_triangles++;
+    }
+  }
+  report.kept_triangles = kept_triangles;
+
+  // Remaining triangles are rewritten to the representatives, kept collapsed ones stay unchanged.
+  #pragma omp parallel for
+  for (int64_t f = 0; f < n_faces; f++) {
+    if (keep[f] == 1) {
+      for (int i = 0; i < 3; i++) {
+        faces[f][i] = representative[faces[f][i]];
+      }
+    }
+  }
+  report.triangles_after = compact_faces(faces, keep);
+  return report;
+}
+
+#endif
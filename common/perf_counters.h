@@ -0,0 +1,382 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/** \brief Hardware events counted per stage and thread. */
+enum PerfEvent {
+  PERF_CYCLES = 0,
+  PERF_INSTRUCTIONS = 1,
+  PERF_LLC_MISSES = 2,
+  PERF_BRANCH_MISSES = 3,
+  PERF_N_EVENTS = 4
+};
+
+/** \brief Names of the events, as used in the JSON output. */
+static const char* const PERF_EVENT_NAMES[PERF_N_EVENTS] = { "cycles", "instructions", "llc_misses", "branch_misses" };
+
+/** \brief Counter values; events the CPU or kernel does not provide are marked invalid. */
+struct PerfValues {
+  uint64_t values[PERF_N_EVENTS];
+  bool valid[PERF_N_EVENTS];
+
+  PerfValues() {
+    for (int e = 0; e < PERF_N_EVENTS; e++) {
+      this->values[e] = 0;
+      this->valid[e] = false;
+    }
+  }
+};
+
+/** \brief Group of perf_event_open counters of the calling thread (user space only), read in one syscall. */
+class PerfGroup {
+public:
+  /** \brief Constructor, opens the counters; check available() afterwards. */
+  PerfGroup() : leader(-1), n_open(0) {
+    for (int e = 0; e < PERF_N_EVENTS; e++) {
+      this->fds[e] = -1;
+      this->slots[e] = -1;
+    }
+
+#ifdef __linux__
+    const uint64_t configs[PERF_N_EVENTS] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    for (int e = 0; e < PERF_N_EVENTS; e++) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[e];
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+
+      int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, this->leader, 0));
+      if (fd < 0) {
+        if (e == 0) {
+          this->error = strerror(errno);
+          return;
+        }
+        continue;
+      }
+
+      if (this->leader < 0) {
+        this->leader = fd;
+      }
+      this->fds[e] = fd;
+      this->slots[e] = this->n_open++;
+    }
+#else
+    this->error = "perf_event_open is only available on Linux";
+#endif
+  }
+
+  /** \brief Destructor, closes the counters. */
+  ~PerfGroup() {
+#ifdef __linux__
+    for (int e = 0; e < PERF_N_EVENTS; e++) {
+      if (this->fds[e] >= 0) {
+        close(this->fds[e]);
+      }
+    }
+#endif
+  }
+
+  PerfGroup(const PerfGroup&) = delete;
+  PerfGroup& operator=(const PerfGroup&) = delete;
+
+  /** \brief Check whether at least the cycle counter could be opened.
+   * \return available
+   */
+  bool available() const {
+    return this->leader >= 0;
+  }
+
+  /** \brief Reason why the counters are unavailable.
+   * \return error message
+   */
+  const std::string& why() const {
+    return this->error;
+  }
+
+  /** \brief Read the running totals of all counters.
+   * \param[out] values counter values
+   * \return success
+   */
+  bool read(PerfValues& values) const {
+#ifdef __linux__
+    if (this->leader < 0) {
+      return false;
+    }
+
+    uint64_t buffer[1 + PERF_N_EVENTS];
+    if (::read(this->leader, buffer, sizeof(buffer)) < static_cast<ssize_t>(sizeof(uint64_t))) {
+      return false;
+    }
+
+    for (int e = 0; e < PERF_N_EVENTS; e++) {
+      values.valid[e] = this->slots[e] >= 0 && static_cast<uint64_t>(this->slots[e]) < buffer[0];
+      values.values[e] = values.valid[e] ? buffer[1 + this->slots[e]] : 0;
+    }
+    return true;
+#else
+    (void) values;
+    return false;
+#endif
+  }
+
+private:
+  int fds[PERF_N_EVENTS];
+  /** \brief Position of every event in the group read, -1 if it could not be opened. */
+  int slots[PERF_N_EVENTS];
+  int leader;
+  int n_open;
+  std::string error;
+};
+
+/** \brief Process-wide collection of hardware counter totals per stage and thread.
+ *
+ * Disabled by default; once enabled, every thread lazily opens its own PerfGroup the first time it
+ * enters a PerfScope. Results are printed next to the [Perf] timings and can be written as JSON.
+ */
+class PerfCounters {
+public:
+  /** \brief Get the collection.
+   * \return counters
+   */
+  static PerfCounters& instance() {
+    static PerfCounters counters;
+    return counters;
+  }
+
+  /** \brief Start counting. */
+  void enable() {
+    this->active.store(true, std::memory_order_release);
+  }
+
+  /** \brief Check whether counting is enabled.
+   * \return enabled
+   */
+  bool enabled() const {
+    return this->active.load(std::memory_order_relaxed);
+  }
+
+  /** \brief Get the counters of the calling thread, opening them on first use.
+   * \param[out] tid id of the calling thread
+   * \return counters, nullptr if unavailable
+   */
+  const PerfGroup* group(int& tid) {
+    static thread_local PerfGroup* local = nullptr;
+    static thread_local int local_tid = -1;
+
+    if (local == nullptr) {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->groups.emplace_back(new PerfGroup());
+      local = this->groups.back().get();
+      local_tid = static_cast<int>(this->groups.size()) - 1;
+
+      if (!local->available() && !this->warned) {
+        fprintf(stdout, "[Perf] Hardware counters unavailable (%s), check /proc/sys/kernel/perf_event_paranoid \n", local->why().c_str());
+        this->warned = true;
+      }
+    }
+
+    tid = local_tid;
+    return local->available() ? local : nullptr;
+  }
+
+  /** \brief Add the counts of one stage execution on one thread.
+   * \param[in] stage stage name
+   * \param[in] tid thread id
+   * \param[in] delta counter increments
+   */
+  void add(const std::string& stage, int tid, const PerfValues& delta) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    std::map<std::string, size_t>::iterator it = this->index.find(stage);
+    if (it == this->index.end()) {
+      it = this->index.insert(std::make_pair(stage, this->stages.size())).first;
+      this->stages.push_back(Stage());
+      this->stages.back().name = stage;
+    }
+
+    Stage& s = this->stages[it->second];
+    s.calls++;
+    PerfValues& thread = s.threads[tid];
+    for (int e = 0; e < PERF_N_EVENTS; e++) {
+      thread.values[e] += delta.values[e];
+      thread.valid[e] = thread.valid[e] || delta.valid[e];
+    }
+  }
+
+  /** \brief Print one line per stage with the totals over all threads. */
+  void print() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    for (size_t i = 0; i < this->stages.size(); i++) {
+      PerfValues total = this->total(this->stages[i]);
+      fprintf(stdout, "[Perf] %s counters (%zu threads):", this->stages[i].name.c_str(), this->stages[i].threads.size());
+      for (int e = 0; e < PERF_N_EVENTS; e++) {
+        if (total.valid[e]) {
+          fprintf(stdout, " %s %llu", PERF_EVENT_NAMES[e], static_cast<unsigned long long>(total.values[e]));
+        }
+        else {
+          fprintf(stdout, " %s n/a", PERF_EVENT_NAMES[e]);
+        }
+      }
+      if (total.valid[PERF_CYCLES] && total.valid[PERF_INSTRUCTIONS] && total.values[PERF_CYCLES] > 0) {
+        fprintf(stdout, " IPC %.2f", static_cast<double>(total.values[PERF_INSTRUCTIONS])/total.values[PERF_CYCLES]);
+      }
+      fprintf(stdout, " \n");
+    }
+  }
+
+  /** \brief Write totals and per-thread counts of all stages as JSON; unavailable events are null.
+   * \param[in] filepath JSON file to write
+   * \return success
+   */
+  bool write(const std::string& filepath) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    FILE* file = fopen(filepath.c_str(), "w");
+    if (file == nullptr) {
+      fprintf(stdout, "[Perf] Could not write %s \n", filepath.c_str());
+      return false;
+    }
+
+    fprintf(file, "{\"stages\": [");
+    for (size_t i = 0; i < this->stages.size(); i++) {
+      const Stage& stage = this->stages[i];
+      fprintf(file, "%s\n{\"name\": \"%s\", \"calls\": %llu, \"total\": ", i == 0 ? "" : ",", stage.name.c_str(),
+        static_cast<unsigned long long>(stage.calls));
+      write_values(file, this->total(stage));
+
+      fprintf(file, ", \"threads\": [");
+      for (std::map<int, PerfValues>::const_iterator it = stage.threads.begin(); it != stage.threads.end(); ++it) {
+        fprintf(file, "%s{\"thread\": %d, \"counters\": ", it == stage.threads.begin() ? "" : ", ", it->first);
+        write_values(file, it->second);
+        fprintf(file, "}");
+      }
+      fprintf(file, "]}");
+    }
+    fprintf(file, "\n]}\n");
+
+    bool success = !ferror(file);
+    return fclose(file) == 0 && success;
+  }
+
+private:
+  /** \brief Counts of one stage. */
+  struct Stage {
+    std::string name;
+    uint64_t calls = 0;
+    /** \brief Counts per thread id. */
+    std::map<int, PerfValues> threads;
+  };
+
+  PerfCounters() : active(false), warned(false) {
+
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  /** \brief Sum the counts of a stage over all threads.
+   * \param[in] stage stage
+   * \return totals
+   */
+  static PerfValues total(const Stage& stage) {
+    PerfValues total;
+    for (std::map<int, PerfValues>::const_iterator it = stage.threads.begin(); it != stage.threads.end(); ++it) {
+      for (int e = 0; e < PERF_N_EVENTS; e++) {
+        total.values[e] += it->second.values[e];
+        total.valid[e] = total.valid[e] || it->second.valid[e];
+      }
+    }
+    return total;
+  }
+
+  /** \brief Write counter values as JSON object.
+   * \param[in] file file
+   * \param[in] values values
+   */
+  static void write_values(FILE* file, const PerfValues& values) {
+    fprintf(file, "{");
+    for (int e = 0; e < PERF_N_EVENTS; e++) {
+      if (values.valid[e]) {
+        fprintf(file, "%s\"%s\": %llu", e == 0 ? "" : ", ", PERF_EVENT_NAMES[e], static_cast<unsigned long long>(values.values[e]));
+      }
+      else {
+        fprintf(file, "%s\"%s\": null", e == 0 ? "" : ", ", PERF_EVENT_NAMES[e]);
+      }
+    }
+    fprintf(file, "}");
+  }
+
+  std::atomic<bool> active;
+  bool warned;
+  /** \brief Guards everything below. */
+  std::mutex mutex;
+  /** \brief Counter groups of all threads, owned here so they outlive their threads. */
+  std::vector<std::unique_ptr<PerfGroup>> groups;
+  /** \brief Stages in order of first appearance, and their index by name. */
+  std::vector<Stage> stages;
+  std::map<std::string, size_t> index;
+};
+
+/** \brief Counts hardware events of the calling thread from construction to destruction,
+ * e.g. PerfScope perf("voxelize") inside a parallel region to get per-thread counts.
+ */
+class PerfScope {
+public:
+  /** \brief Constructor, reads the counters if counting is enabled.
+   * \param[in] stage stage name
+   */
+  PerfScope(const char* stage) : stage(stage), group(nullptr), tid(-1) {
+    if (PerfCounters::instance().enabled()) {
+      this->group = PerfCounters::instance().group(this->tid);
+      if (this->group != nullptr && !this->group->read(this->begin)) {
+        this->group = nullptr;
+      }
+    }
+  }
+
+  /** \brief Destructor, adds the counts since construction to the stage. */
+  ~PerfScope() {
+    PerfValues end;
+    if (this->group != nullptr && this->group->read(end)) {
+      for (int e = 0; e < PERF_N_EVENTS; e++) {
+        end.values[e] -= this->begin.values[e];
+      }
+      PerfCounters::instance().add(this->stage, this->tid, end);
+    }
+  }
+
+  PerfScope(const PerfScope&) = delete;
+  PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+  const char* stage;
+  const PerfGroup* group;
+  int tid;
+  PerfValues begin;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef RADIX_SORT_H_
+#define RADIX_SORT_H_
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <stdint.h>
+
+/** \brief Sort (key, value) pairs by key with a parallel LSD radix sort.
+ *
+ * Keys are sorted 8 bits per pass, from the lowest bit up to key_bits; higher bits are ignored.
+ * Every pass splits the pairs into fixed blocks, counts the digits of every block in parallel,
+ * turns the counts into offsets (digit major, then block) and scatters the blocks in parallel.
+ * The sort is stable, so pairs with equal keys keep their order, and passes whose digit is the
+ * same for all keys are skipped.
+ * \param[in,out] keys keys
+ * \param[in,out] values values, as many as keys
+ * \param[in] key_bits number of low bits of the keys to sort on
+ */
+template<typename Value>
+void radix_sort_pairs(std::vector<uint64_t>& keys, std::vector<Value>& values, int key_bits) {
+  const size_t n = keys.size();
+  const size_t block = static_cast<size_t>(1) << 16;
+  const int64_t n_blocks = static_cast<int64_t>((n + block - 1)/block);
+  if (n < 2) {
+    return;
+  }
+
+  std::vector<uint64_t> sorted_keys(n);
+  std::vector<Value> sorted_values(n);
+  std::vector<size_t> offsets(256*n_blocks);
+
+  for (int shift = 0; shift < key_bits; shift += 8) {
+    #pragma omp parallel for
+    for (int64_t b = 0; b < n_blocks; b++) {
+      size_t* count = &offsets[256*b];
+      std::fill(count, count + 256, 0);
+      for (size_t i = b*block; i < std::min(n, (b + 1)*block); i++) {
+        count[(keys[i] >> shift) & 0xff]++;
+      }
+    }
+
+    size_t sum = 0;
+    bool trivial = false;
+    for (int d = 0; d < 256; d++) {
+      const size_t start = sum;
+      for (int64_t b = 0; b < n_blocks; b++) {
+        const size_t count = offsets[256*b + d];
+        offsets[256*b + d] = sum;
+        sum += count;
+      }
+      trivial = trivial || sum - start == n;
+    }
+    if (trivial) {
+      continue;
+    }
+
+    #pragma omp parallel for
+    for (int64_t b = 0; b < n_blocks; b++) {
+      size_t* offset = &offsets[256*b];
+      for (size_t i = b*block; i < std::min(n, (b + 1)*block); i++) {
+        const size_t j = offset[(keys[i] >> shift) & 0xff]++;
+        sorted_keys[j] = keys[i];
+        sorted_values[j] = values[i];
+      }
+    }
+    keys.swap(sorted_keys);
+    values.swap(sorted_values);
+  }
+}
+
+#endif
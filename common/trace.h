@@ -0,0 +1,283 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+
+/** \brief Default number of events kept per thread before the oldest ones are overwritten. */
+const size_t TRACE_BUFFER_CAPACITY = 1 << 16;
+
+/** \brief A completed span; name and category must be string literals (or otherwise outlive the tracer). */
+struct TraceEvent {
+  const char* name;
+  const char* category;
+  /** \brief Begin and end in nanoseconds of the monotonic clock. */
+  uint64_t begin;
+  uint64_t end;
+};
+
+/** \brief Ring buffer of the events of one thread, only ever written by its owning thread. */
+class TraceBuffer {
+public:
+  /** \brief Constructor.
+   * \param[in] tid thread id used in the trace
+   * \param[in] capacity maximum number of events kept
+   */
+  TraceBuffer(int tid, size_t capacity) : tid(tid), count(0), events(capacity) {
+
+  }
+
+  /** \brief Add an event, overwriting the oldest one if the buffer is full.
+   * \param[in] event event to add
+   */
+  void push(const TraceEvent& event) {
+    this->events[this->count % this->events.size()] = event;
+    this->count++;
+  }
+
+  /** \brief Number of events kept.
+   * \return size
+   */
+  size_t size() const {
+    return this->count < this->events.size() ? static_cast<size_t>(this->count) : this->events.size();
+  }
+
+  /** \brief Number of events lost because the buffer was full.
+   * \return dropped events
+   */
+  uint64_t dropped() const {
+    return this->count - this->size();
+  }
+
+  /** \brief Get the i-th kept event, oldest first.
+   * \param[in] i index in [0, size())
+   * \return event
+   */
+  const TraceEvent& at(size_t i) const {
+    return this->events[(this->count - this->size() + i) % this->events.size()];
+  }
+
+  /** \brief Thread id used in the trace. */
+  const int tid;
+
+private:
+  /** \brief Total number of events pushed. */
+  uint64_t count;
+  /** \brief Storage, indexed modulo its size. */
+  std::vector<TraceEvent> events;
+};
+
+/** \brief Process-wide tracer collecting spans into per-thread ring buffers and writing them as Chrome trace JSON.
+ *
+ * Disabled by default, so instrumented code only pays for one branch per span. Recording never locks
+ * except the first time a thread records; writing must happen after all parallel work has finished.
+ * The JSON can be opened in chrome://tracing or ui.perfetto.dev.
+ */
+class Tracer {
+public:
+  /** \brief Get the tracer.
+   * \return tracer
+   */
+  static Tracer& instance() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  /** \brief Start recording.
+   * \param[in] detail whether to also record fine-grained spans (bricks, triangle batches)
+   * \param[in] capacity events kept per thread
+   */
+  void enable(bool detail = false, size_t capacity = TRACE_BUFFER_CAPACITY) {
+    this->capacity = capacity;
+    this->detail.store(detail, std::memory_order_relaxed);
+    this->active.store(true, std::memory_order_release);
+  }
+
+  /** \brief Check whether spans are recorded.
+   * \param[in] detail whether the span in question is fine-grained
+   * \return enabled
+   */
+  bool enabled(bool detail = false) const {
+    return this->active.load(std::memory_order_relaxed) && (!detail || this->detail.load(std::memory_order_relaxed));
+  }
+
+  /** \brief Current time of the monotonic clock.
+   * \return nanoseconds
+   */
+  static uint64_t now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
+
+  /** \brief Record a span of the calling thread.
+   * \param[in] name span name, string literal
+   * \param[in] category span category, string literal
+   * \param[in] begin begin as given by now()
+   * \param[in] end end as given by now()
+   */
+  void record(const char* name, const char* category, uint64_t begin, uint64_t end) {
+    TraceEvent event = { name, category, begin, end };
+    this->buffer().push(event);
+  }
+
+  /** \brief Write all recorded spans as Chrome trace JSON (complete "X" events, timestamps in microseconds).
+   * \param[in] filepath JSON file to write
+   * \return success
+   */
+  bool write(const std::string& filepath) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    FILE* file = fopen(filepath.c_str(), "w");
+    if (file == nullptr) {
+      fprintf(stdout, "[Trace] Could not write %s \n", filepath.c_str());
+      return false;
+    }
+
+    uint64_t dropped = 0;
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (size_t b = 0; b < this->buffers.size(); b++) {
+      const TraceBuffer& buffer = *this->buffers[b];
+      dropped += buffer.dropped();
+
+      fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+        b == 0 ? "" : ",\n", buffer.tid, buffer.tid);
+
+      for (size_t i = 0; i < buffer.size(); i++) {
+        const TraceEvent& event = buffer.at(i);
+        uint64_t begin = event.begin > this->origin ? event.begin - this->origin : 0;
+        fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+          event.name, event.category, buffer.tid, begin/1000.0, (event.end - event.begin)/1000.0);
+      }
+    }
+    fprintf(file, "\n], \"otherData\": {\"dropped_events\": %llu}}\n", static_cast<unsigned long long>(dropped));
+
+    bool success = !ferror(file);
+    success = fclose(file) == 0 && success;
+
+    if (dropped > 0) {
+      fprintf(stdout, "[Trace] %llu events were dropped, the per-thread buffers were full \n", static_cast<unsigned long long>(dropped));
+    }
+    return success;
+  }
+
+private:
+  Tracer() : origin(now()), capacity(TRACE_BUFFER_CAPACITY), active(false), detail(false) {
+
+  }
+
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+
+  /** \brief Get the buffer of the calling thread, registering it on first use.
+   * \return buffer
+   */
+  TraceBuffer& buffer() {
+    static thread_local TraceBuffer* local = nullptr;
+    if (local == nullptr) {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->buffers.emplace_back(new TraceBuffer(static_cast<int>(this->buffers.size()), this->capacity));
+      local = this->buffers.back().get();
+    }
+    return *local;
+  }
+
+  /** \brief Time all timestamps in the trace are relative to. */
+  const uint64_t origin;
+  /** \brief Events kept per thread. */
+  size_t capacity;
+  /** \brief Whether spans, and fine-grained spans, are recorded. */
+  std::atomic<bool> active;
+  std::atomic<bool> detail;
+  /** \brief Guards the registration of buffers. */
+  std::mutex mutex;
+  /** \brief Buffers of all threads that recorded, owned here so they outlive their threads. */
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+
+/** \brief Records a span from construction to destruction, e.g. TraceScope scope("voxelize"). */
+class TraceScope {
+public:
+  /** \brief Constructor, starts the span if tracing is enabled.
+   * \param[in] name span name, string literal
+   * \param[in] category span category, string literal
+   * \param[in] detail whether this is a fine-grained span, only recorded in detail mode
+   */
+  TraceScope(const char* name, const char* category = "stage", bool detail = false)
+    : name(name), category(category), begin(Tracer::instance().enabled(detail) ? Tracer::now() : 0) {
+
+  }
+
+  /** \brief Destructor, records the span. */
+  ~TraceScope() {
+    if (this->begin != 0) {
+      Tracer::instance().record(this->name, this->category, this->begin, Tracer::now());
+    }
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  const char* name;
+  const char* category;
+  const uint64_t begin;
+};
+
+/** \brief Records one fine-grained span per batch of consecutive loop iterations.
+ *
+ * Declared per thread before a (statically scheduled) loop, step(i) is called at the top of every
+ * iteration and starts a new span whenever i crosses a multiple of the batch size; this keeps loop
+ * bodies unchanged and costs one branch per iteration when detail tracing is disabled.
+ */
+class TraceBatch {
+public:
+  /** \brief Constructor.
+   * \param[in] name span name, string literal
+   * \param[in] batch_size number of iterations per span
+   */
+  TraceBatch(const char* name, long batch_size)
+    : name(name), batch_size(batch_size), active(Tracer::instance().enabled(true)), batch(-1), begin(0) {
+
+  }
+
+  /** \brief Destructor, records the last open span. */
+  ~TraceBatch() {
+    this->close();
+  }
+
+  TraceBatch(const TraceBatch&) = delete;
+  TraceBatch& operator=(const TraceBatch&) = delete;
+
+  /** \brief Advance to iteration i.
+   * \param[in] i loop index
+   */
+  void step(long i) {
+    if (this->active && i/this->batch_size != this->batch) {
+      this->close();
+      this->batch = i/this->batch_size;
+      this->begin = Tracer::now();
+    }
+  }
+
+private:
+  /** \brief Record the open span, if any. */
+  void close() {
+    if (this->active && this->batch >= 0) {
+      Tracer::instance().record(this->name, "batch", this->begin, Tracer::now());
+    }
+  }
+
+  const char* name;
+  const long batch_size;
+  const bool active;
+  long batch;
+  uint64_t begin;
+};
+
+#endif
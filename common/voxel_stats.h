@@ -0,0 +1,283 @@
+#ifndef VOXEL_STATS_H_
+#define VOXEL_STATS_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+
+/** \brief Algorithmic counters of the voxelizers. */
+enum VoxelStat {
+  /** \brief Triangles of the mesh. */
+  STAT_TRIANGLES = 0,
+  /** \brief Grid voxels visited. */
+  STAT_VOXELS = 1,
+  /** \brief Triangle-voxel pairs tested, i.e. voxels visited inside triangle bounding boxes. */
+  STAT_BOX_TESTS = 2,
+  /** \brief Pairs rejected by the triangle plane test and by the edge tests of the three projections. */
+  STAT_PLANE_CULLS = 3,
+  STAT_XY_CULLS = 4,
+  STAT_YZ_CULLS = 5,
+  STAT_ZX_CULLS = 6,
+  /** \brief Pairs rejected by a combined triangle-box overlap test. */
+  STAT_OVERLAP_CULLS = 7,
+  /** \brief Voxels marked, and marks of voxels that were already set. */
+  STAT_MARKS = 8,
+  STAT_DUPLICATE_MARKS = 9,
+  /** \brief Point-triangle distances and ray-triangle intersections computed for SDFs, and rays that hit. */
+  STAT_DISTANCE_TESTS = 10,
+  STAT_RAY_TESTS = 11,
+  STAT_RAY_HITS = 12,
+  /** \brief Vertices welded and degenerate and duplicate triangles removed by mesh cleaning. */
+  STAT_WELDED_VERTICES = 13,
+  STAT_DEGENERATE_TRIANGLES = 14,
+  STAT_DUPLICATE_TRIANGLES = 15,
+  STAT_N_COUNTERS = 16
+};
+
+/** \brief Names of the counters, as used in the JSON output. */
+static const char* const VOXEL_STAT_NAMES[STAT_N_COUNTERS] = {
+  "triangles", "voxels", "box_tests", "plane_culls", "xy_culls", "yz_culls", "zx_culls", "overlap_culls",
+  "marks", "duplicate_marks", "distance_tests", "ray_tests", "ray_hits", "welded_vertices", "degenerate_triangles",
+  "duplicate_triangles"
+};
+
+/** \brief Culling tests in the order a triangle-voxel pair goes through them, used to derive cull rates. */
+static const VoxelStat VOXEL_STAT_CULLS[] = { STAT_PLANE_CULLS, STAT_XY_CULLS, STAT_YZ_CULLS, STAT_ZX_CULLS, STAT_OVERLAP_CULLS };
+
+/** \brief Counter values; meant to live on the stack of one thread and be summed once per parallel region. */
+struct StatValues {
+  uint64_t values[STAT_N_COUNTERS];
+
+  StatValues() {
+    this->clear();
+  }
+
+  /** \brief Reset all counters. */
+  void clear() {
+    for (int c = 0; c < STAT_N_COUNTERS; c++) {
+      this->values[c] = 0;
+    }
+  }
+
+  uint64_t& operator[](VoxelStat c) {
+    return this->values[c];
+  }
+
+  uint64_t operator[](VoxelStat c) const {
+    return this->values[c];
+  }
+
+  StatValues& operator+=(const StatValues& other) {
+    for (int c = 0; c < STAT_N_COUNTERS; c++) {
+      this->values[c] += other.values[c];
+    }
+    return *this;
+  }
+};
+
+/** \brief Process-wide collection of the counters of every voxelized item (mesh file) and stage.
+ *
+ * Counting is always compiled in: kernels increment a StatValues on their own stack and hand the
+ * sum to the caller, which records it here; collecting is disabled by default. The JSON lists every
+ * item so pathological meshes (huge bounding boxes, low cull rates) stand out in batch runs.
+ */
+class VoxelStats {
+public:
+  /** \brief Get the collection.
+   * \return collection
+   */
+  static VoxelStats& instance() {
+    static VoxelStats stats;
+    return stats;
+  }
+
+  /** \brief Start collecting. */
+  void enable() {
+    this->active.store(true, std::memory_order_release);
+  }
+
+  /** \brief Check whether counters are collected.
+   * \return enabled
+   */
+  bool enabled() const {
+    return this->active.load(std::memory_order_relaxed);
+  }
+
+  /** \brief Record the counters of one stage of one item; does nothing if disabled.
+   * \param[in] item item name, e.g. the mesh file
+   * \param[in] stage stage name
+   * \param[in] values counters
+   */
+  void add(const std::string& item, const std::string& stage, const StatValues& values) {
+    if (!this->enabled()) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Record record;
+    record.item = item;
+    record.stage = stage;
+    record.values = values;
+    this->records.push_back(record);
+  }
+
+  /** \brief Print one line per stage with the totals over all items. */
+  void print() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    std::vector<Record> totals = this->totals();
+    for (size_t i = 0; i < totals.size(); i++) {
+      fprintf(stdout, "[Stats] %s (%llu items):", totals[i].stage.c_str(), static_cast<unsigned long long>(totals[i].items));
+      for (int c = 0; c < STAT_N_COUNTERS; c++) {
+        if (totals[i].values.values[c] > 0) {
+          fprintf(stdout, " %s %llu", VOXEL_STAT_NAMES[c], static_cast<unsigned long long>(totals[i].values.values[c]));
+        }
+      }
+
+      double rates[N_CULLS];
+      cull_rates(totals[i].values, rates);
+      for (int t = 0; t < N_CULLS; t++) {
+        if (rates[t] >= 0) {
+          fprintf(stdout, " %s %.1f%%", VOXEL_STAT_NAMES[VOXEL_STAT_CULLS[t]], 100*rates[t]);
+        }
+      }
+      fprintf(stdout, " \n");
+    }
+  }
+
+  /** \brief Write the counters of every item and the totals per stage as JSON.
+   * \param[in] filepath JSON file to write
+   * \return success
+   */
+  bool write(const std::string& filepath) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    FILE* file = fopen(filepath.c_str(), "w");
+    if (file == nullptr) {
+      fprintf(stdout, "[Stats] Could not write %s \n", filepath.c_str());
+      return false;
+    }
+
+    fprintf(file, "{\"items\": [");
+    for (size_t i = 0; i < this->records.size(); i++) {
+      fprintf(file, "%s\n{\"name\": \"%s\", ", i == 0 ? "" : ",", escape(this->records[i].item).c_str());
+      write_record(file, this->records[i]);
+      fprintf(file, "}");
+    }
+
+    fprintf(file, "\n], \"totals\": [");
+    std::vector<Record> totals = this->totals();
+    for (size_t i = 0; i < totals.size(); i++) {
+      fprintf(file, "%s\n{\"items\": %llu, ", i == 0 ? "" : ",", static_cast<unsigned long long>(totals[i].items));
+      write_record(file, totals[i]);
+      fprintf(file, "}");
+    }
+    fprintf(file, "\n]}\n");
+
+    bool success = !ferror(file);
+    return fclose(file) == 0 && success;
+  }
+
+private:
+  /** \brief Number of culling tests. */
+  static const int N_CULLS = sizeof(VOXEL_STAT_CULLS)/sizeof(VOXEL_STAT_CULLS[0]);
+
+  /** \brief Counters of one stage of one item, or totals of a stage over items. */
+  struct Record {
+    std::string item;
+    std::string stage;
+    uint64_t items = 1;
+    StatValues values;
+  };
+
+  VoxelStats() : active(false) {
+
+  }
+
+  VoxelStats(const VoxelStats&) = delete;
+  VoxelStats& operator=(const VoxelStats&) = delete;
+
+  /** \brief Sum the records per stage, stages in order of first appearance.
+   * \return totals
+   */
+  std::vector<Record> totals() const {
+    std::vector<Record> totals;
+    std::map<std::string, size_t> index;
+    for (size_t i = 0; i < this->records.size(); i++) {
+      std::map<std::string, size_t>::iterator it = index.find(this->records[i].stage);
+      if (it == index.end()) {
+        index[this->records[i].stage] = totals.size();
+        totals.push_back(this->records[i]);
+        totals.back().item.clear();
+      }
+      else {
+        totals[it->second].items++;
+        totals[it->second].values += this->records[i].values;
+      }
+    }
+    return totals;
+  }
+
+  /** \brief Write stage, counters and the rate of every culling test relative to the pairs reaching it.
+   * \param[in] file file
+   * \param[in] record record
+   */
+  static void write_record(FILE* file, const Record& record) {
+    fprintf(file, "\"stage\": \"%s\", \"counters\": {", record.stage.c_str());
+    for (int c = 0; c < STAT_N_COUNTERS; c++) {
+      fprintf(file, "%s\"%s\": %llu", c == 0 ? "" : ", ", VOXEL_STAT_NAMES[c], static_cast<unsigned long long>(record.values.values[c]));
+    }
+
+    fprintf(file, "}, \"cull_rates\": {");
+    double rates[N_CULLS];
+    cull_rates(record.values, rates);
+    bool first = true;
+    for (int t = 0; t < N_CULLS; t++) {
+      if (rates[t] >= 0) {
+        fprintf(file, "%s\"%s\": %.6f", first ? "" : ", ", VOXEL_STAT_NAMES[VOXEL_STAT_CULLS[t]], rates[t]);
+        first = false;
+      }
+    }
+    fprintf(file, "}");
+  }
+
+  /** \brief Fraction of the triangle-voxel pairs reaching each culling test that it rejects.
+   * \param[in] values counters
+   * \param[out] rates rate per test in VOXEL_STAT_CULLS, -1 for tests that rejected nothing (usually not used by the engine)
+   */
+  static void cull_rates(const StatValues& values, double* rates) {
+    uint64_t reaching = values[STAT_BOX_TESTS];
+    for (int t = 0; t < N_CULLS; t++) {
+      uint64_t culls = values[VOXEL_STAT_CULLS[t]];
+      rates[t] = culls > 0 && reaching > 0 ? static_cast<double>(culls)/reaching : -1;
+      reaching -= culls < reaching ? culls : reaching;
+    }
+  }
+
+  /** \brief Escape a string for JSON.
+   * \param[in] value string
+   * \return escaped string
+   */
+  static std::string escape(const std::string& value) {
+    std::string escaped;
+    for (size_t i = 0; i < value.size(); i++) {
+      if (value[i] == '"' || value[i] == '\\') {
+        escaped += '\\';
+      }
+      escaped += value[i];
+    }
+    return escaped;
+  }
+
+  std::atomic<bool> active;
+  /** \brief Guards the records. */
+  std::mutex mutex;
+  /** \brief Records in the order they were added. */
+  std::vector<Record> records;
+};
+
+#endif
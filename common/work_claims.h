@@ -0,0 +1,200 @@
+#ifndef WORK_CLAIMS_H_
+#define WORK_CLAIMS_H_
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#endif
+
+/** \brief Parse a static shard of the form "i/n".
+ * \param[in] value shard, e.g. "2/8"
+ * \param[out] index shard index i, 0 <= i < n
+ * \param[out] count number of shards n
+ * \return whether the value is valid
+ */
+inline bool parse_shard(const std::string& value, int& index, int& count) {
+  char rest = 0;
+  if (sscanf(value.c_str(), "%d/%d%c", &index, &count, &rest) != 2) {
+    return false;
+  }
+  return count > 0 && index >= 0 && index < count;
+}
+
+/** \brief Static shard of an item, stable across processes and machines.
+ * \param[in] key e.g. position or content hash of the item
+ * \param[in] count number of shards
+ * \return shard index
+ */
+inline int shard_of(uint64_t key, int count) {
+  // Finalizer of splitmix64, so consecutive keys spread evenly.
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+  return static_cast<int>(key % static_cast<uint64_t>(count));
+}
+
+/** \brief Dynamic distribution of items over processes sharing a directory, e.g. on a shared filesystem.
+ *
+ * Every item has a claim file "<name>.claim" in the directory. A process claims an item by
+ * taking an exclusive flock on its claim file, which it holds while working on the item; the
+ * lock is released by the kernel if the process dies, so items of crashed processes are simply
+ * claimed again. A completed item is marked "done" in its claim file and skipped by everyone,
+ * a failed one is released for other processes to retry.
+ */
+class WorkClaims {
+public:
+  /** \brief Constructor, creates the directory if needed; check is_open() afterwards.
+   * \param[in] directory shared claim directory
+   */
+  explicit WorkClaims(const std::string& directory) : directory(directory), ready(false) {
+#ifdef __unix__
+    if (mkdir(directory.c_str(), 0775) != 0 && errno != EEXIST) {
+      fprintf(stdout, "[Claims] Could not create %s: %s \n", directory.c_str(), strerror(errno));
+      return;
+    }
+    this->ready = true;
+#else
+    fprintf(stdout, "[Claims] Claiming work needs flock, which is not available on this platform \n");
+#endif
+  }
+
+  ~WorkClaims() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (std::map<std::string, int>::iterator it = this->held.begin(); it != this->held.end(); ++it) {
+#ifdef __unix__
+      close(it->second);
+#endif
+    }
+  }
+
+  WorkClaims(const WorkClaims&) = delete;
+  WorkClaims& operator=(const WorkClaims&) = delete;
+
+  /** \brief Check whether the directory can be used.
+   * \return open
+   */
+  bool is_open() const {
+    return this->ready;
+  }
+
+  /** \brief Try to claim an item.
+   * \param[in] name name of the item, unique within the directory
+   * \return whether this process now owns the item; false if another process works on it or it is done
+   */
+  bool claim(const std::string& name) {
+#ifdef __unix__
+    if (!this->ready) {
+      return false;
+    }
+
+    int fd = ::open(this->path(name).c_str(), O_RDWR | O_CREAT, 0664);
+    if (fd < 0) {
+      fprintf(stdout, "[Claims] Could not open %s: %s \n", this->path(name).c_str(), strerror(errno));
+      return false;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+      close(fd);
+      return false;
+    }
+
+    char status[5] = { 0 };
+    if (pread(fd, status, 4, 0) == 4 && strncmp(status, "done", 4) == 0) {
+      close(fd);
+      return false;
+    }
+
+    char owner[320];
+    char host[256] = { 0 };
+    gethostname(host, sizeof(host) - 1);
+    int length = snprintf(owner, sizeof(owner), "claimed by %s:%ld\n", host, static_cast<long>(getpid()));
+    if (ftruncate(fd, 0) != 0 || pwrite(fd, owner, length, 0) != length) {
+      close(fd);
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->held[name] = fd;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /** \brief Mark a claimed item as done and release it.
+   * \param[in] name name of the item
+   * \return success
+   */
+  bool complete(const std::string& name) {
+    int fd = this->take(name);
+    if (fd < 0) {
+      return false;
+    }
+
+#ifdef __unix__
+    bool success = ftruncate(fd, 0) == 0 && pwrite(fd, "done\n", 5, 0) == 5 && fsync(fd) == 0;
+    close(fd);
+    return success;
+#else
+    return false;
+#endif
+  }
+
+  /** \brief Release a claimed item without completing it, e.g. after a failure, so other processes may retry it.
+   * \param[in] name name of the item
+   */
+  void release(const std::string& name) {
+    int fd = this->take(name);
+#ifdef __unix__
+    if (fd >= 0) {
+      close(fd);
+    }
+#endif
+  }
+
+private:
+  /** \brief Remove a held claim from the list.
+   * \param[in] name name of the item
+   * \return descriptor of the locked claim file, -1 if not held
+   */
+  int take(const std::string& name) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::map<std::string, int>::iterator it = this->held.find(name);
+    if (it == this->held.end()) {
+      return -1;
+    }
+    int fd = it->second;
+    this->held.erase(it);
+    return fd;
+  }
+
+  /** \brief Path of the claim file of an item.
+   * \param[in] name name of the item
+   * \return path
+   */
+  std::string path(const std::string& name) const {
+    return this->directory + "/" + name + ".claim";
+  }
+
+  const std::string directory;
+  /** \brief Whether the directory exists. */
+  bool ready;
+  /** \brief Guards held. */
+  std::mutex mutex;
+  /** \brief Locked claim files by item. */
+  std::map<std::string, int> held;
+};
+
+#endif
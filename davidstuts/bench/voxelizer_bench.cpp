@@ -0,0 +1,561 @@
+#include <cstdio>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <chrono>
+#include <algorithm>
+
+// Boost
+#include <boost/program_options.hpp>
+
+// Eigen
+#include <Eigen/Dense>
+#include <unsupported/Eigen/CXX11/Tensor>
+
+// OpenMP
+#include <omp.h>
+
+// Mesh and voxelization.
+#include "mesh.h"
+
+#ifdef VOXELIZER_BENCH_CPU_VOXELIZER
+// CPU fallback of the CUDA voxelizer.
+#include "gpu-vox/src/cpu_voxelizer.h"
+#endif
+
+/** \brief Procedural mesh in the unit cube. */
+struct BenchMesh {
+  std::string name;
+  std::vector<Eigen::Vector3f> vertices;
+  std::vector<Eigen::Vector3i> faces;
+};
+
+/** \brief One measured configuration. */
+struct BenchResult {
+  std::string mesh;
+  std::string engine;
+  int size;
+  int threads;
+  int triangles;
+  double seconds;
+  double voxels_per_second;
+  double triangles_per_second;
+  long peak_rss_kb;
+  long occupied;
+};
+
+/** \brief Add an icosphere to the mesh.
+ * \param[in] center center
+ * \param[in] radius radius
+ * \param[in] subdivisions number of times every triangle is split into four
+ * \param[in] inward whether the faces point inward (for the inner side of shells)
+ * \param[in,out] mesh mesh to add to
+ */
+void add_sphere(const Eigen::Vector3f& center, float radius, int subdivisions, bool inward, BenchMesh& mesh) {
+  const float t = (1.f + std::sqrt(5.f))/2.f;
+  std::vector<Eigen::Vector3f> vertices = {
+    {-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+    {0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+    {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}
+  };
+  std::vector<Eigen::Vector3i> faces = {
+    {0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+    {1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+    {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+    {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1}
+  };
+
+  for (int s = 0; s < subdivisions; s++) {
+    std::map<std::pair<int, int>, int> midpoints;
+    auto midpoint = [&vertices, &midpoints](int a, int b) {
+      std::pair<int, int> edge(std::min(a, b), std::max(a, b));
+      std::map<std::pair<int, int>, int>::iterator it = midpoints.find(edge);
+      if (it != midpoints.end()) {
+        return it->second;
+      }
+      vertices.push_back((vertices[a] + vertices[b])/2.f);
+      midpoints[edge] = static_cast<int>(vertices.size()) - 1;
+      return static_cast<int>(vertices.size()) - 1;
+    };
+
+    std::vector<Eigen::Vector3i> split;
+    split.reserve(4*faces.size());
+    for (const Eigen::Vector3i& f : faces) {
+      int ab = midpoint(f(0), f(1));
+      int bc = midpoint(f(1), f(2));
+      int ca = midpoint(f(2), f(0));
+      split.push_back(Eigen::Vector3i(f(0), ab, ca));
+      split.push_back(Eigen::Vector3i(f(1), bc, ab));
+      split.push_back(Eigen::Vector3i(f(2), ca, bc));
+      split.push_back(Eigen::Vector3i(ab, bc, ca));
+    }
+    faces.swap(split);
+  }
+
+  const int offset = static_cast<int>(mesh.vertices.size());
+  for (const Eigen::Vector3f& v : vertices) {
+    mesh.vertices.push_back(center + radius*v.normalized());
+  }
+  for (const Eigen::Vector3i& f : faces) {
+    mesh.faces.push_back(inward ? Eigen::Vector3i(f(0), f(2), f(1)) + Eigen::Vector3i::Constant(offset)
+      : f + Eigen::Vector3i::Constant(offset));
+  }
+}
+
+/** \brief Add an axis-aligned box whose sides are split into n x n quads.
+ * \param[in] min minimum corner
+ * \param[in] max maximum corner
+ * \param[in] n quads per side and direction
+ * \param[in,out] mesh mesh to add to
+ */
+void add_box(const Eigen::Vector3f& min, const Eigen::Vector3f& max, int n, BenchMesh& mesh) {
+  for (int axis = 0; axis < 3; axis++) {
+    const int u = (axis + 1)%3;
+    const int v = (axis + 2)%3;
+
+    for (int side = 0; side < 2; side++) {
+      const int offset = static_cast<int>(mesh.vertices.size());
+      for (int j = 0; j <= n; j++) {
+        for (int i = 0; i <= n; i++) {
+          Eigen::Vector3f p;
+          p(axis) = side == 0 ? min(axis) : max(axis);
+          p(u) = min(u) + (max(u) - min(u))*i/n;
+          p(v) = min(v) + (max(v) - min(v))*j/n;
+          mesh.vertices.push_back(p);
+        }
+      }
+
+      for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+          int a = offset + j*(n + 1) + i;
+          int b = a + 1;
+          int c = a + (n + 1);
+          int d = c + 1;
+          if (side == 0) {
+            mesh.faces.push_back(Eigen::Vector3i(a, c, b));
+            mesh.faces.push_back(Eigen::Vector3i(b, c, d));
+          }
+          else {
+            mesh.faces.push_back(Eigen::Vector3i(a, b, c));
+            mesh.faces.push_back(Eigen::Vector3i(b, d, c));
+          }
+        }
+      }
+    }
+  }
+}
+
+/** \brief Generate a procedural mesh with roughly the given number of triangles.
+ * \param[in] name sphere (subdivided icosphere), shell (two spheres closer than a voxel) or room (finely tessellated walls with furniture)
+ * \param[in] triangles target number of triangles
+ * \param[out] mesh generated mesh in the unit cube
+ * \return success
+ */
+bool generate_mesh(const std::string& name, int triangles, BenchMesh& mesh) {
+  mesh = BenchMesh();
+  mesh.name = name;
+
+  if (name == "sphere" || name == "shell") {
+    const int per_sphere = name == "sphere" ? triangles : triangles/2;
+    int subdivisions = 0;
+    while (20*(1 << (2*subdivisions)) < per_sphere) {
+      subdivisions++;
+    }
+
+    const Eigen::Vector3f center(0.5f, 0.5f, 0.5f);
+    add_sphere(center, 0.4f, subdivisions, false, mesh);
+    if (name == "shell") {
+      add_sphere(center, 0.395f, subdivisions, true, mesh);
+    }
+    return true;
+  }
+
+  if (name == "room") {
+    // Walls plus four pieces of furniture tessellated at half the resolution: 12 n^2 + 4*12 (n/2)^2 = 24 n^2.
+    const int n = std::max(1, static_cast<int>(std::ceil(std::sqrt(triangles/24.))));
+    const int m = std::max(1, n/2);
+    add_box(Eigen::Vector3f(0.05f, 0.05f, 0.05f), Eigen::Vector3f(0.95f, 0.95f, 0.95f), n, mesh);
+    add_box(Eigen::Vector3f(0.30f, 0.05f, 0.30f), Eigen::Vector3f(0.70f, 0.35f, 0.60f), m, mesh);
+    add_box(Eigen::Vector3f(0.05f, 0.05f, 0.70f), Eigen::Vector3f(0.25f, 0.80f, 0.95f), m, mesh);
+    add_box(Eigen::Vector3f(0.75f, 0.05f, 0.05f), Eigen::Vector3f(0.95f, 0.45f, 0.40f), m, mesh);
+    add_box(Eigen::Vector3f(0.40f, 0.70f, 0.40f), Eigen::Vector3f(0.60f, 0.72f, 0.60f), m, mesh);
+    return true;
+  }
+
+  std::cout << "[Error] Unknown mesh " << name << ", choose from sphere, shell or room." << std::endl;
+  return false;
+}
+
+/** \brief Scale a procedural mesh to the voxel grid and add colors and labels.
+ * \param[in] bench_mesh mesh in the unit cube
+ * \param[in] size grid size
+ * \param[out] mesh mesh in grid coordinates
+ */
+void to_mesh(const BenchMesh& bench_mesh, int size, Mesh& mesh) {
+  for (size_t v = 0; v < bench_mesh.vertices.size(); v++) {
+    Eigen::Matrix<float, 7, 1> vertex;
+    vertex.head<3>() = size*bench_mesh.vertices[v];
+    vertex(3) = 255.f*bench_mesh.vertices[v](0);
+    vertex(4) = 255.f*bench_mesh.vertices[v](1);
+    vertex(5) = 255.f*bench_mesh.vertices[v](2);
+    vertex(6) = static_cast<float>(v%20);
+    mesh.add_vertex_color(vertex);
+  }
+
+  for (Eigen::Vector3i face : bench_mesh.faces) {
+    mesh.add_face(face);
+  }
+}
+
+/** \brief Reset the peak resident set size of the process (Linux >= 4.0), so every run reports its own peak. */
+void reset_peak_rss() {
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  if (clear_refs) {
+    clear_refs << "5";
+  }
+}
+
+/** \brief Get the peak resident set size of the process.
+ * \return peak RSS in kB, -1 if unavailable
+ */
+long peak_rss_kb() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::stol(line.substr(6));
+    }
+  }
+  return -1;
+}
+
+/** \brief Run one engine once.
+ * \param[in] engine occ, occ_color, sdf or cpu
+ * \param[in] bench_mesh mesh in the unit cube
+ * \param[in] size grid size
+ * \param[out] seconds time spent voxelizing, excluding setup
+ * \param[out] occupied number of occupied (or, for SDFs, inside) voxels
+ * \return success
+ */
+bool run_engine(const std::string& engine, const BenchMesh& bench_mesh, int size, double& seconds, long& occupied) {
+  Mesh mesh;
+  to_mesh(bench_mesh, size, mesh);
+  occupied = 0;
+
+  std::chrono::steady_clock::time_point begin;
+  if (engine == "occ") {
+    Eigen::Tensor<int, 3, Eigen::RowMajor> occ(size, size, size);
+    occ.setZero();
+    begin = std::chrono::steady_clock::now();
+    mesh.voxelize_occ(occ, VoxelizationMode::CORNER);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    for (long i = 0; i < occ.size(); i++) {
+      occupied += occ.data()[i] != 0;
+    }
+    return true;
+  }
+
+  if (engine == "occ_color") {
+    Eigen::Tensor<int, 4, Eigen::RowMajor> occ(size, size, size, 4);
+    occ.setConstant(-1);
+    begin = std::chrono::steady_clock::now();
+    mesh.voxelize_occ_color(occ, VoxelizationMode::CORNER);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    for (long i = 0; i < occ.size(); i += 4) {
+      occupied += occ.data()[i + 3] != -1;
+    }
+    return true;
+  }
+
+  if (engine == "sdf") {
+    Eigen::Tensor<float, 3, Eigen::RowMajor> sdf(size, size, size);
+    begin = std::chrono::steady_clock::now();
+    mesh.voxelize_sdf(sdf, VoxelizationMode::CENTER);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    for (long i = 0; i < sdf.size(); i++) {
+      occupied += sdf.data()[i] < 0;
+    }
+    return true;
+  }
+
+#ifdef VOXELIZER_BENCH_CPU_VOXELIZER
+  if (engine == "cpu") {
+    trimesh::TriMesh trimesh;
+    for (const Eigen::Vector3f& v : bench_mesh.vertices) {
+      trimesh.vertices.push_back(trimesh::point(v(0), v(1), v(2)));
+    }
+    for (const Eigen::Vector3i& f : bench_mesh.faces) {
+      trimesh.faces.push_back(trimesh::TriMesh::Face(f(0), f(1), f(2)));
+    }
+
+    voxinfo info(AABox<glm::vec3>(glm::vec3(0.f), glm::vec3(1.f)), glm::uvec3(size, size, size), bench_mesh.faces.size());
+    const size_t n_voxels = static_cast<size_t>(size)*size*size;
+    std::vector<unsigned int> vtable((n_voxels + 31)/32, 0);
+
+    begin = std::chrono::steady_clock::now();
+    StatValues stats;
+    cpu_voxelizer::cpu_voxelize_mesh(info, &trimesh, vtable.data(), false, stats);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    for (size_t i = 0; i < vtable.size(); i++) {
+      occupied += __builtin_popcount(vtable[i]);
+    }
+    return true;
+  }
+#endif
+
+  std::cout << "[Error] Unknown engine " << engine << ", choose from occ, occ_color, sdf"
+#ifdef VOXELIZER_BENCH_CPU_VOXELIZER
+    << ", cpu"
+#endif
+    << "." << std::endl;
+  return false;
+}
+
+/** \brief Split a comma separated list.
+ * \param[in] list list
+ * \return elements
+ */
+std::vector<std::string> split_list(const std::string& list) {
+  std::vector<std::string> elements;
+  std::stringstream stream(list);
+  std::string element;
+  while (std::getline(stream, element, ',')) {
+    if (!element.empty()) {
+      elements.push_back(element);
+    }
+  }
+  return elements;
+}
+
+/** \brief Get the raw value of a field in a single-line JSON object as written by write_results.
+ * \param[in] line line holding one result object
+ * \param[in] key field name
+ * \return value without quotes, empty if missing
+ */
+std::string json_field(const std::string& line, const std::string& key) {
+  size_t p = line.find("\"" + key + "\":");
+  if (p == std::string::npos) {
+    return "";
+  }
+
+  p = line.find_first_not_of(" \"", p + key.size() + 3);
+  size_t end = line.find_first_of(",}\"", p);
+  return line.substr(p, end - p);
+}
+
+/** \brief Identify a configuration, to match results against a baseline.
+ * \param[in] result result
+ * \return key
+ */
+std::string result_key(const BenchResult& result) {
+  std::stringstream key;
+  key << result.mesh << " " << result.engine << " " << result.size << "^3 " << result.triangles << " triangles x" << result.threads;
+  return key.str();
+}
+
+/** \brief Write results as JSON, one result object per line.
+ * \param[in] filepath JSON file
+ * \param[in] results results
+ * \return success
+ */
+bool write_results(const std::string& filepath, const std::vector<BenchResult>& results) {
+  std::ofstream out(filepath);
+  if (!out) {
+    return false;
+  }
+
+  out << "{\"benchmark\": \"voxelizer_bench\", \"max_threads\": " << omp_get_max_threads() << ", \"results\": [" << std::endl;
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult& r = results[i];
+    out << "{\"mesh\": \"" << r.mesh << "\", \"engine\": \"" << r.engine << "\", \"size\": " << r.size
+      << ", \"threads\": " << r.threads << ", \"triangles\": " << r.triangles << ", \"seconds\": " << r.seconds
+      << ", \"voxels_per_second\": " << r.voxels_per_second << ", \"triangles_per_second\": " << r.triangles_per_second
+      << ", \"peak_rss_kb\": " << r.peak_rss_kb << ", \"occupied\": " << r.occupied << "}"
+      << (i + 1 < results.size() ? "," : "") << std::endl;
+  }
+  out << "]}" << std::endl;
+
+  return static_cast<bool>(out);
+}
+
+/** \brief Read results written by write_results.
+ * \param[in] filepath JSON file
+ * \param[out] results results by key
+ * \return success
+ */
+bool read_results(const std::string& filepath, std::map<std::string, BenchResult>& results) {
+  std::ifstream in(filepath);
+  if (!in) {
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(in, line)) {
+    if (json_field(line, "engine").empty()) {
+      continue;
+    }
+
+    BenchResult r;
+    r.mesh = json_field(line, "mesh");
+    r.engine = json_field(line, "engine");
+    r.size = std::stoi(json_field(line, "size"));
+    r.threads = std::stoi(json_field(line, "threads"));
+    r.triangles = std::stoi(json_field(line, "triangles"));
+    r.seconds = std::stod(json_field(line, "seconds"));
+    r.voxels_per_second = std::stod(json_field(line, "voxels_per_second"));
+    r.triangles_per_second = std::stod(json_field(line, "triangles_per_second"));
+    r.peak_rss_kb = std::stol(json_field(line, "peak_rss_kb"));
+    r.occupied = std::stol(json_field(line, "occupied"));
+    results[result_key(r)] = r;
+  }
+
+  return true;
+}
+
+/** \brief Benchmark all engines on procedural meshes across grid sizes and thread counts. */
+int main(int argc, char** argv) {
+  boost::program_options::options_description desc("Allowed options");
+  desc.add_options()
+      ("help", "produce help message")
+      ("meshes", boost::program_options::value<std::string>()->default_value("sphere,shell,room"), "comma separated procedural meshes: sphere, shell, room")
+      ("triangles", boost::program_options::value<std::string>()->default_value("2000"), "comma separated (approximate) triangle counts of the meshes")
+      ("engines", boost::program_options::value<std::string>()->default_value(
+#ifdef VOXELIZER_BENCH_CPU_VOXELIZER
+        "occ,occ_color,sdf,cpu"
+#else
+        "occ,occ_color,sdf"
+#endif
+        ), "comma separated engines: occ (voxelize_occ), occ_color (voxelize_occ_color), sdf (voxelize_sdf)"
+#ifdef VOXELIZER_BENCH_CPU_VOXELIZER
+        ", cpu (cpu_voxelize_mesh)"
+#endif
+        )
+      ("sizes", boost::program_options::value<std::string>()->default_value("16,32"), "comma separated grid sizes")
+      ("threads", boost::program_options::value<std::string>()->default_value(""), "comma separated thread counts, defaults to 1 and the maximum")
+      ("repeat", boost::program_options::value<int>()->default_value(3), "runs per configuration, the fastest counts")
+      ("output", boost::program_options::value<std::string>()->default_value("bench.json"), "JSON file to write the results to")
+      ("baseline", boost::program_options::value<std::string>()->default_value(""), "JSON file of an earlier run to compare against")
+      ("tolerance", boost::program_options::value<double>()->default_value(0.1), "relative slowdown against the baseline reported as regression");
+
+  boost::program_options::variables_map parameters;
+  boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), parameters);
+  boost::program_options::notify(parameters);
+
+  if (parameters.find("help") != parameters.end()) {
+    std::cout << desc << std::endl;
+    return 0;
+  }
+
+  std::vector<std::string> meshes = split_list(parameters["meshes"].as<std::string>());
+  std::vector<std::string> engines = split_list(parameters["engines"].as<std::string>());
+  std::vector<int> triangles;
+  for (const std::string& t : split_list(parameters["triangles"].as<std::string>())) {
+    triangles.push_back(std::stoi(t));
+  }
+  std::vector<int> sizes;
+  for (const std::string& s : split_list(parameters["sizes"].as<std::string>())) {
+    sizes.push_back(std::stoi(s));
+  }
+  std::vector<int> threads;
+  for (const std::string& t : split_list(parameters["threads"].as<std::string>())) {
+    threads.push_back(std::stoi(t));
+  }
+  if (threads.empty()) {
+    threads.push_back(1);
+    if (omp_get_max_threads() > 1) {
+      threads.push_back(omp_get_max_threads());
+    }
+  }
+  const int repeat = std::max(1, parameters["repeat"].as<int>());
+
+  std::vector<BenchResult> results;
+  for (const std::string& name : meshes) {
+    for (int target : triangles) {
+      BenchMesh bench_mesh;
+      if (!generate_mesh(name, target, bench_mesh)) {
+        return 1;
+      }
+
+      for (const std::string& engine : engines) {
+        for (int size : sizes) {
+          for (int n_threads : threads) {
+            omp_set_num_threads(n_threads);
+            reset_peak_rss();
+
+            BenchResult r;
+            r.mesh = name;
+            r.engine = engine;
+            r.size = size;
+            r.threads = n_threads;
+            r.triangles = static_cast<int>(bench_mesh.faces.size());
+            r.seconds = 0;
+
+            for (int i = 0; i < repeat; i++) {
+              double seconds = 0;
+              if (!run_engine(engine, bench_mesh, size, seconds, r.occupied)) {
+                return 1;
+              }
+              r.seconds = i == 0 ? seconds : std::min(r.seconds, seconds);
+            }
+
+            r.voxels_per_second = static_cast<double>(size)*size*size/r.seconds;
+            r.triangles_per_second = r.triangles/r.seconds;
+            r.peak_rss_kb = peak_rss_kb();
+            results.push_back(r);
+
+            printf("[Bench] %-48s %10.4f s %14.0f voxels/s %14.0f triangles/s %8ld kB\n", result_key(r).c_str(),
+              r.seconds, r.voxels_per_second, r.triangles_per_second, r.peak_rss_kb);
+            fflush(stdout);
+          }
+        }
+      }
+    }
+  }
+
+  std::string output = parameters["output"].as<std::string>();
+  if (!write_results(output, results)) {
+    std::cout << "Could not write " << output << "." << std::endl;
+    return 1;
+  }
+  std::cout << "Wrote " << output << "." << std::endl;
+
+  std::string baseline = parameters["baseline"].as<std::string>();
+  if (baseline.empty()) {
+    return 0;
+  }
+
+  std::map<std::string, BenchResult> baseline_results;
+  if (!read_results(baseline, baseline_results)) {
+    std::cout << "Could not read " << baseline << "." << std::endl;
+    return 1;
+  }
+
+  const double tolerance = parameters["tolerance"].as<double>();
+  int regressions = 0;
+  for (const BenchResult& r : results) {
+    std::map<std::string, BenchResult>::const_iterator it = baseline_results.find(result_key(r));
+    if (it == baseline_results.end()) {
+      printf("[Compare] %-48s not in baseline\n", result_key(r).c_str());
+      continue;
+    }
+
+    const BenchResult& b = it->second;
+    const bool slower = r.seconds > b.seconds*(1 + tolerance);
+    const bool differs = r.occupied != b.occupied;
+    regressions += slower || differs;
+    printf("[Compare] %-48s %6.2fx speedup (%.4f s, baseline %.4f s)%s%s\n", result_key(r).c_str(), b.seconds/r.seconds,
+      r.seconds, b.seconds, slower ? " REGRESSION" : "", differs ? " OUTPUT DIFFERS" : "");
+  }
+
+  std::cout << regressions << " regressions against " << baseline << "." << std::endl;
+  return regressions > 0 ? 2 : 0;
+}
@@ -32,7 +32,7 @@ def write_hdf5(file, tensor, key = 'tensor'):
 
 def read_hdf5(file, key = 'tensor'):
     """
-    Read a tensor, i.e. numpy array, from HDF5.
+    Read a tensor, i.e. numpy array, from HDF5; packed occupancy (see --occ_format) is unpacked.
     :param file: path to file to read
     :type file: str
     :param key: key to read
@@ -46,7 +46,16 @@ def read_hdf5(file, key = 'tensor'):
     h5f = h5py.File(file, 'r')
 
     assert key in h5f.keys(), 'key %s not found in file %s' % (key, file)
-    tensor = h5f[key][()]
+    dataset = h5f[key]
+    tensor = dataset[()]
+    if 'shape' in dataset.attrs and dataset.attrs.get('format', b'') in (b'bits', 'bits'):
+        # 32 voxels per word along the last axis, the first voxel in the most significant bit.
+        shape = tuple(dataset.attrs['shape'])
+        bits = np.unpackbits(tensor.astype('>u4').view(np.uint8), axis=-1)
+        tensor = bits[..., :shape[-1]].astype(np.int32)
+        # Move the packed dimensions to the dense ones they run along, e.g. gpu-vox packs x x y x z as z x y x x.
+        axes = [int(axis) for axis in dataset.attrs.get('axes', range(len(shape)))]
+        tensor = np.moveaxis(tensor, range(-len(shape), 0), [axis - len(shape) for axis in axes])
     h5f.close()
 
     return tensor
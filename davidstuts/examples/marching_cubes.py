@@ -8,7 +8,7 @@ mcubes = None
 
 def read_hdf5(file, key = 'tensor'):
     """
-    Read a tensor, i.e. numpy array, from HDF5.
+    Read a tensor, i.e. numpy array, from HDF5; quantized SDFs (see --sdf_format) are converted back to float32.
 
     :param file: path to file to read
     :type file: str
@@ -21,7 +21,12 @@ def read_hdf5(file, key = 'tensor'):
     assert os.path.exists(file), 'file %s not found' % file
 
     h5f = h5py.File(file, 'r')
-    tensor = h5f[key][()]
+    dataset = h5f[key]
+    tensor = dataset[()]
+    if 'scale' in dataset.attrs:
+        tensor = tensor.astype(np.float32)*dataset.attrs['scale']
+    elif tensor.dtype == np.float16:
+        tensor = tensor.astype(np.float32)
     h5f.close()
 
     return tensor
@@ -1,5 +1,6 @@
 #include <cstdio>
 #include <iostream>
+#include <vector>
 
 // Boost
 #include <boost/filesystem.hpp>
@@ -12,123 +13,41 @@
 // HDF5
 #include <H5Cpp.h>
 
-/** \brief Read a Hdf5 file into an Eigen tensor.
- * \param[in] filepath path to file
- * \param[out] dense Eigen tensor
- * \return success
- */
-bool read_hdf5_rank4(const std::string filepath, Eigen::Tensor<float, 4, Eigen::RowMajor>& dense) {
-
-  try {
-    H5::H5File file(filepath, H5F_ACC_RDONLY);
-    H5::DataSet dataset = file.openDataSet("tensor");
-
-    /*
-     * Get filespace for rank and dimension
-     */
-    H5::DataSpace filespace = dataset.getSpace();
-
-    /*
-     * Get number of dimensions in the file dataspace
-     */
-    const size_t rank = 4;
-
-    /*
-     * Get and print the dimension sizes of the file dataspace
-     */
-    hsize_t dimsf[rank];
-    filespace.getSimpleExtentDims(dimsf);
-
-    /*
-     * Setup tensor.
-     */
-    dense = Eigen::Tensor<float, rank, Eigen::RowMajor>(dimsf[0], dimsf[1], dimsf[2], dimsf[3]);
-    float* buffer = static_cast<float*>(dense.data());
-
-    /*
-     * Define the memory space to read dataset.
-     */
-    H5::DataSpace mspace(rank, dimsf);
-    dataset.read(buffer, H5::PredType::NATIVE_FLOAT, mspace, filespace);
-  }
-
-  // catch failure caused by the H5File operations
-  catch(H5::FileIException error) {
-    error.printError();
-    return false;
-  }
-
-  // catch failure caused by the DataSet operations
-  catch(H5::DataSetIException error) {
-    error.printError();
-    return false;
-  }
+// Reader of samples, crops and whole tensors.
+#include "io/hdf5_reader.h"
 
-  // catch failure caused by the DataSpace operations
-  catch(H5::DataSpaceIException error) {
-    error.printError();
-    return false;
-  }
-
-  return true;
-}
-
-/** \brief Read a Hdf5 file into an Eigen tensor.
+/** \brief Read a rank-N tensor, or one of its samples, from a Hdf5 file.
  * \param[in] filepath path to file
- * \param[out] dense Eigen tensor
+ * \param[in] sample sample to read, -1 for the whole tensor
+ * \param[out] dimensions dimensions of what was read
  * \return success
  */
-bool read_hdf5_rank5(const std::string filepath, Eigen::Tensor<float, 5, Eigen::RowMajor>& dense) {
-
-  try {
-    H5::H5File file(filepath, H5F_ACC_RDONLY);
-    H5::DataSet dataset = file.openDataSet("tensor");
-
-    /*
-     * Get filespace for rank and dimension
-     */
-    H5::DataSpace filespace = dataset.getSpace();
-
-    /*
-     * Get number of dimensions in the file dataspace
-     */
-    const size_t rank = 5;
-
-    /*
-     * Get and print the dimension sizes of the file dataspace
-     */
-    hsize_t dimsf[rank];
-    filespace.getSimpleExtentDims(dimsf);
-
-    /*
-     * Setup tensor.
-     */
-    dense = Eigen::Tensor<float, rank, Eigen::RowMajor>(dimsf[0], dimsf[1], dimsf[2], dimsf[3], dimsf[4]);
-    float* buffer = static_cast<float*>(dense.data());
-
-    /*
-     * Define the memory space to read dataset.
-     */
-    H5::DataSpace mspace(rank, dimsf);
-    dataset.read(buffer, H5::PredType::NATIVE_FLOAT, mspace, filespace);
-  }
-
-  // catch failure caused by the H5File operations
-  catch(H5::FileIException error) {
-    error.printError();
+template<int Rank>
+bool read_hdf5(const std::string& filepath, int sample, std::vector<int>& dimensions) {
+  Hdf5Reader<float, Rank> reader(filepath);
+  if (!reader.is_open()) {
     return false;
   }
+  std::cout << "The dataset is " << (reader.is_mapped() ? "memory mapped." : "read through HDF5.") << std::endl;
 
-  // catch failure caused by the DataSet operations
-  catch(H5::DataSetIException error) {
-    error.printError();
-    return false;
+  dimensions.clear();
+  if (sample >= 0) {
+    typename Hdf5Reader<float, Rank>::Sample tensor;
+    if (!reader.read_sample(sample, tensor)) {
+      return false;
+    }
+    for (int i = 0; i < Rank - 1; i++) {
+      dimensions.push_back(tensor.dimension(i));
+    }
   }
-
-  // catch failure caused by the DataSpace operations
-  catch(H5::DataSpaceIException error) {
-    error.printError();
-    return false;
+  else {
+    typename Hdf5Reader<float, Rank>::Tensor tensor;
+    if (!reader.read(tensor)) {
+      return false;
+    }
+    for (int i = 0; i < Rank; i++) {
+      dimensions.push_back(tensor.dimension(i));
+    }
   }
 
   return true;
@@ -139,7 +58,8 @@ int main(int argc, char** argv) {
   desc.add_options()
       ("help", "produce help message")
       ("input",  boost::program_options::value<std::string>(), "path to input HDF5 file")
-      ("rank", boost::program_options::value<int>()->default_value(5), "rank of tensor saved in HDF5 file, '4' or '5' supported");
+      ("rank", boost::program_options::value<int>()->default_value(5), "rank of tensor saved in HDF5 file, '3' (a single volume), '4' or '5' supported")
+      ("sample", boost::program_options::value<int>()->default_value(-1), "only read this sample, i.e. slice along the first dimension, -1 to read the whole tensor");
 
   boost::program_options::positional_options_description positionals;
   positionals.add("input", 1);
@@ -164,30 +84,19 @@ int main(int argc, char** argv) {
 
   bool success = false;
   std::vector<int> dimensions;
+  int sample = parameters["sample"].as<int>();
 
-  // The case distinction here is necessary as Eigen does currently not easily allow
-  // (let me know if you find out how) to construct a tensor of certain rank by a list
-  // of dimensions - the constructor always expects, see
-  // https://stackoverflow.com/questions/47475487/eigen-tensor-construction-with-vector-of-dimensions
-
-  if (rank == 4) {
-    Eigen::Tensor<float, 4, Eigen::RowMajor> tensor;
-    success = read_hdf5_rank4(input.string(), tensor);
-
-    for (int i = 0; i < rank; i++) {
-      dimensions.push_back(tensor.dimension(i));
-    }
+  if (rank == 3) {
+    success = read_hdf5<3>(input.string(), sample, dimensions);
+  }
+  else if (rank == 4) {
+    success = read_hdf5<4>(input.string(), sample, dimensions);
   }
   else if(rank == 5) {
-    Eigen::Tensor<float, 5, Eigen::RowMajor> tensor;
-    success = read_hdf5_rank5(input.string(), tensor);
-
-    for (int i = 0; i < rank; i++) {
-      dimensions.push_back(tensor.dimension(i));
-    }
+    success = read_hdf5<5>(input.string(), sample, dimensions);
   }
   else {
-    std::cout << "Only --rank=4 or --rank=5 supported." << std::endl;
+    std::cout << "Only --rank=3, --rank=4 or --rank=5 supported." << std::endl;
     return 1;
   }
 
@@ -0,0 +1,103 @@
+#ifndef BIT_OCCUPANCY_H_
+#define BIT_OCCUPANCY_H_
+
+#include <string>
+#include <vector>
+
+// HDF5
+#include <H5Cpp.h>
+
+#include "common/bit_volume.h"
+
+/** \brief Storage formats of occupancy grids. */
+enum class OccupancyFormat {
+  DENSE,
+  BITS
+};
+
+/** \brief Parse an occupancy format.
+ * \param[in] name dense or bits
+ * \param[out] format format
+ * \return whether the format is known
+ */
+inline bool parse_occupancy_format(const std::string& name, OccupancyFormat& format) {
+  if (name == "dense") {
+    format = OccupancyFormat::DENSE;
+  }
+  else if (name == "bits") {
+    format = OccupancyFormat::BITS;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+/** \brief Mark a dataset of 32-bit words as packed occupancy (see common/bit_volume.h).
+ *
+ * The dataset gets the attributes "format" ("bits"), "shape", the unpacked dimensions of a single
+ * volume, i.e. of the last shape.size() dimensions of the dataset (leading dimensions like the
+ * volume index N are not packed), and "axes", for every dimension of shape the dimension of the
+ * dense volumes of the writing tool it runs along. The last dimension of the dataset holds
+ * bit_words(shape[last]) words. voxelize packs height x width x depth volumes as they are (axes
+ * [0, 1, 2]), gpu-vox packs its x x y x z volumes as z x y x x (axes [2, 1, 0]).
+ * \param[in] dataset dataset
+ * \param[in] shape unpacked dimensions of a volume
+ * \param[in] axes dense dimension of every dimension of shape
+ */
+inline void write_bit_attributes(H5::DataSet& dataset, const std::vector<hsize_t>& shape, const std::vector<hsize_t>& axes) {
+  H5::DataSpace scalar(H5S_SCALAR);
+  H5::StrType string_type(H5::PredType::C_S1, 4);
+  dataset.createAttribute("format", string_type, scalar).write(string_type, "bits");
+  hsize_t rank[1] = { shape.size() };
+  H5::DataSpace vector(1, rank);
+  dataset.createAttribute("shape", H5::PredType::NATIVE_HSIZE, vector).write(H5::PredType::NATIVE_HSIZE, shape.data());
+  dataset.createAttribute("axes", H5::PredType::NATIVE_HSIZE, vector).write(H5::PredType::NATIVE_HSIZE, axes.data());
+}
+
+/** \brief Read the axes of packed occupancy, see write_bit_attributes().
+ *
+ * Files written before the attribute existed are packed as their dense volumes.
+ * \param[in] dataset dataset holding packed occupancy
+ * \param[in] rank number of unpacked dimensions
+ * \param[out] axes dense dimension of every unpacked dimension
+ */
+inline void read_bit_axes(const H5::DataSet& dataset, size_t rank, std::vector<hsize_t>& axes) {
+  axes.resize(rank);
+  for (size_t i = 0; i < rank; i++) {
+    axes[i] = i;
+  }
+
+  if (dataset.attrExists("axes")) {
+    H5::Attribute attribute = dataset.openAttribute("axes");
+    if (static_cast<size_t>(attribute.getSpace().getSimpleExtentNpoints()) == rank) {
+      attribute.read(H5::PredType::NATIVE_HSIZE, axes.data());
+    }
+  }
+}
+
+/** \brief Read the unpacked dimensions of a volume of packed occupancy.
+ * \param[in] dataset dataset
+ * \param[out] shape unpacked dimensions of a volume
+ * \return whether the dataset holds packed occupancy
+ */
+inline bool read_bit_shape(const H5::DataSet& dataset, std::vector<hsize_t>& shape) {
+  if (!dataset.attrExists("format") || !dataset.attrExists("shape")) {
+    return false;
+  }
+
+  H5::Attribute format = dataset.openAttribute("format");
+  std::string name;
+  format.read(format.getStrType(), name);
+  if (name.compare(0, 4, "bits") != 0) {
+    return false;
+  }
+
+  H5::Attribute attribute = dataset.openAttribute("shape");
+  H5::DataSpace space = attribute.getSpace();
+  shape.assign(space.getSimpleExtentNpoints(), 0);
+  attribute.read(H5::PredType::NATIVE_HSIZE, shape.data());
+  return !shape.empty();
+}
+
+#endif
@@ -0,0 +1,478 @@
+#ifndef HDF5_READER_H_
+#define HDF5_READER_H_
+
+#include <string>
+#include <vector>
+#include <array>
+#include <memory>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <iostream>
+
+// Eigen
+#include <unsupported/Eigen/CXX11/Tensor>
+
+// HDF5
+#include <H5Cpp.h>
+
+#include "io/hdf5_types.h"
+#include "io/sdf_quantization.h"
+#include "io/bit_occupancy.h"
+#include "common/mapped_file.h"
+#include "common/bounded_queue.h"
+
+/** \brief Reads samples, crops or all of a N x ... dataset, e.g. for training loaders.
+ *
+ * Samples (slices along the first dimension) and sub-boxes are read as hyperslabs, so only the
+ * requested data is read and converted. If the dataset is stored contiguously without filters
+ * in the requested type (e.g. written by write_float_hdf5, or by Hdf5VolumeWriter for a known
+ * number of volumes), the file is memory mapped instead: samples can then be used in place and
+ * reads are plain copies that need no HDF5 call at all. Other datasets (e.g. chunked shards or
+ * the virtual dataset of merged shards) always go through HDF5, which is serialized by
+ * hdf5_mutex() so that a reader can be used from several threads. Quantized SDFs
+ * (see SdfQuantization) are dequantized when read as floating point values, and packed
+ * occupancy (see OccupancyFormat) is unpacked: its dimensions are those of the unpacked volumes,
+ * in the order they are packed (see read_bit_axes()).
+ */
+template<typename Scalar, int Rank>
+class Hdf5Reader {
+  static_assert(Rank >= 2, "Hdf5Reader reads datasets of samples, i.e. of rank 2 or more");
+
+public:
+  typedef Eigen::Tensor<Scalar, Rank, Eigen::RowMajor> Tensor;
+  typedef Eigen::Tensor<Scalar, Rank - 1, Eigen::RowMajor> Sample;
+  typedef std::array<hsize_t, Rank> Index;
+
+  /** \brief Constructor, opens the dataset; check is_open() afterwards.
+   * \param[in] filepath h5 file
+   * \param[in] dataset_name dataset to read
+   * \param[in] map memory map the dataset if its layout allows
+   */
+  Hdf5Reader(const std::string& filepath, const std::string& dataset_name = "tensor", bool map = true) : scale(1), packed_words(0), data(nullptr) {
+    std::lock_guard<std::mutex> lock(hdf5_mutex());
+    try {
+      this->file.reset(new H5::H5File(filepath, H5F_ACC_RDONLY));
+      this->dataset = this->file->openDataSet(dataset_name);
+
+      H5::DataSpace space = this->dataset.getSpace();
+      if (space.getSimpleExtentNdims() != Rank) {
+        std::cout << "Expected a rank-" << Rank << " dataset " << dataset_name << " in " << filepath << "." << std::endl;
+        this->close();
+        return;
+      }
+      space.getSimpleExtentDims(this->dims.data());
+      if (std::is_floating_point<Scalar>::value) {
+        this->scale = read_sdf_scale(this->dataset);
+      }
+      std::vector<hsize_t> shape;
+      if (read_bit_shape(this->dataset, shape)) {
+        this->packed_words = this->dims[Rank - 1];
+        this->dims[Rank - 1] = shape.back();
+      }
+
+      if (map && !this->is_packed()) {
+        H5::DSetCreatPropList properties = this->dataset.getCreatePlist();
+        if (properties.getLayout() == H5D_CONTIGUOUS && properties.getNfilters() == 0 && this->dataset.getDataType() == hdf5_type<Scalar>()) {
+          this->map_contiguous(filepath);
+        }
+      }
+    }
+    catch (H5::Exception& error) {
+      error.printError();
+      this->close();
+    }
+  }
+
+  ~Hdf5Reader() {
+    std::lock_guard<std::mutex> lock(hdf5_mutex());
+    this->close();
+  }
+
+  Hdf5Reader(const Hdf5Reader&) = delete;
+  Hdf5Reader& operator=(const Hdf5Reader&) = delete;
+
+  /** \brief Check whether the dataset was opened.
+   * \return open
+   */
+  bool is_open() const {
+    return this->file != nullptr;
+  }
+
+  /** \brief Check whether the dataset is memory mapped.
+   * \return mapped
+   */
+  bool is_mapped() const {
+    return this->data != nullptr;
+  }
+
+  /** \brief Check whether the dataset holds packed occupancy, which is unpacked on reading.
+   * \return packed
+   */
+  bool is_packed() const {
+    return this->packed_words > 0;
+  }
+
+  /** \brief Get the dimensions of the dataset.
+   * \return dimensions
+   */
+  const Index& dimensions() const {
+    return this->dims;
+  }
+
+  /** \brief Number of samples, i.e. the first dimension.
+   * \return N
+   */
+  size_t size() const {
+    return this->is_open() ? static_cast<size_t>(this->dims[0]) : 0;
+  }
+
+  /** \brief Get a sample without copying.
+   * \param[in] n sample
+   * \return row-major values of the sample, valid as long as the reader; nullptr if the dataset is not mapped
+   */
+  const Scalar* sample_data(size_t n) const {
+    if (!this->is_mapped() || n >= this->size()) {
+      return nullptr;
+    }
+    return this->data + n*this->sample_elements();
+  }
+
+  /** \brief Read the whole dataset.
+   * \param[out] tensor tensor
+   * \return success
+   */
+  bool read(Tensor& tensor) {
+    Index offset;
+    offset.fill(0);
+    return this->read_box(offset, this->dims, tensor);
+  }
+
+  /** \brief Read one sample.
+   * \param[in] n sample
+   * \param[out] sample sample
+   * \return success
+   */
+  bool read_sample(size_t n, Sample& sample) {
+    Eigen::DSizes<Eigen::Index, Rank - 1> sample_dims;
+    for (int d = 1; d < Rank; d++) {
+      sample_dims[d - 1] = static_cast<Eigen::Index>(this->dims[d]);
+    }
+    sample.resize(sample_dims);
+
+    Index offset, extent;
+    offset.fill(0);
+    offset[0] = n;
+    extent = this->dims;
+    extent[0] = 1;
+    return this->read_into(offset, extent, sample.data());
+  }
+
+  /** \brief Read a sub-box, e.g. a crop of several samples.
+   * \param[in] offset first element of the box
+   * \param[in] extent size of the box
+   * \param[out] box tensor of the given extent
+   * \return success
+   */
+  bool read_box(const Index& offset, const Index& extent, Tensor& box) {
+    Eigen::DSizes<Eigen::Index, Rank> box_dims;
+    for (int d = 0; d < Rank; d++) {
+      box_dims[d] = static_cast<Eigen::Index>(extent[d]);
+    }
+    box.resize(box_dims);
+    return this->read_into(offset, extent, box.data());
+  }
+
+  /** \brief Read a batch of samples in the given order.
+   * \param[in] indices samples
+   * \param[out] batch tensor with one sample per index
+   * \return success
+   */
+  bool read_batch(const std::vector<size_t>& indices, Tensor& batch) {
+    Eigen::DSizes<Eigen::Index, Rank> batch_dims;
+    batch_dims[0] = static_cast<Eigen::Index>(indices.size());
+    for (int d = 1; d < Rank; d++) {
+      batch_dims[d] = static_cast<Eigen::Index>(this->dims[d]);
+    }
+    batch.resize(batch_dims);
+
+    Index offset, extent;
+    offset.fill(0);
+    extent = this->dims;
+    extent[0] = 1;
+    for (size_t i = 0; i < indices.size(); i++) {
+      offset[0] = indices[i];
+      if (!this->read_into(offset, extent, batch.data() + i*this->sample_elements())) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  /** \brief Read a sub-box into a buffer, from the mapping if possible.
+   * \param[in] offset first element of the box
+   * \param[in] extent size of the box
+   * \param[out] buffer row-major values of the box
+   * \return success
+   */
+  bool read_into(const Index& offset, const Index& extent, Scalar* buffer) {
+    if (!this->is_open()) {
+      return false;
+    }
+    for (int d = 0; d < Rank; d++) {
+      if (offset[d] + extent[d] > this->dims[d]) {
+        std::cout << "Box exceeds the dataset in dimension " << d << "." << std::endl;
+        return false;
+      }
+    }
+
+    if (this->is_mapped()) {
+      this->copy_mapped(offset, extent, buffer);
+      return true;
+    }
+    if (this->is_packed()) {
+      return this->read_packed(offset, extent, buffer);
+    }
+
+    std::lock_guard<std::mutex> lock(hdf5_mutex());
+    try {
+      H5::DataSpace filespace = this->dataset.getSpace();
+      filespace.selectHyperslab(H5S_SELECT_SET, extent.data(), offset.data());
+      H5::DataSpace memspace(Rank, extent.data());
+      this->dataset.read(buffer, hdf5_type<Scalar>(), memspace, filespace);
+    }
+    catch (H5::Exception& error) {
+      error.printError();
+      return false;
+    }
+
+    if (this->scale != 1) {
+      size_t elements = 1;
+      for (int d = 0; d < Rank; d++) {
+        elements *= extent[d];
+      }
+      const Scalar scale = static_cast<Scalar>(this->scale);
+      #pragma omp simd
+      for (size_t i = 0; i < elements; i++) {
+        buffer[i] *= scale;
+      }
+    }
+    return true;
+  }
+
+  /** \brief Read the words covering a sub-box of packed occupancy and unpack them.
+   * \param[in] offset first element of the box
+   * \param[in] extent size of the box
+   * \param[out] buffer row-major values of the box
+   * \return success
+   */
+  bool read_packed(const Index& offset, const Index& extent, Scalar* buffer) {
+    Index word_offset = offset;
+    Index word_extent = extent;
+    word_offset[Rank - 1] = offset[Rank - 1]/32;
+    word_extent[Rank - 1] = bit_words(offset[Rank - 1] + extent[Rank - 1]) - word_offset[Rank - 1];
+
+    size_t rows = 1;
+    for (int d = 0; d < Rank - 1; d++) {
+      rows *= extent[d];
+    }
+    const size_t row_words = word_extent[Rank - 1];
+    const size_t length = extent[Rank - 1];
+    if (rows == 0 || length == 0) {
+      return true;
+    }
+
+    std::vector<uint32_t> words(rows*row_words);
+    {
+      std::lock_guard<std::mutex> lock(hdf5_mutex());
+      try {
+        H5::DataSpace filespace = this->dataset.getSpace();
+        filespace.selectHyperslab(H5S_SELECT_SET, word_extent.data(), word_offset.data());
+        H5::DataSpace memspace(Rank, word_extent.data());
+        this->dataset.read(words.data(), H5::PredType::NATIVE_UINT32, memspace, filespace);
+      }
+      catch (H5::Exception& error) {
+        error.printError();
+        return false;
+      }
+    }
+
+    // Boxes starting within a word are unpacked from the word boundary and shifted.
+    const size_t shift = offset[Rank - 1] % 32;
+    if (shift == 0) {
+      unpack_bit_rows(words.data(), rows, length, buffer);
+      return true;
+    }
+    std::vector<Scalar> row(shift + length);
+    for (size_t r = 0; r < rows; r++) {
+      unpack_bits(words.data() + r*row_words, shift + length, row.data());
+      std::copy(row.begin() + shift, row.end(), buffer + r*length);
+    }
+    return true;
+  }
+
+  /** \brief Copy a sub-box from the mapping, one contiguous row of the last dimension at a time.
+   * \param[in] offset first element of the box
+   * \param[in] extent size of the box
+   * \param[out] buffer row-major values of the box
+   */
+  void copy_mapped(const Index& offset, const Index& extent, Scalar* buffer) const {
+    hsize_t strides[Rank];
+    strides[Rank - 1] = 1;
+    for (int d = Rank - 2; d >= 0; d--) {
+      strides[d] = strides[d + 1]*this->dims[d + 1];
+    }
+
+    hsize_t rows = 1;
+    for (int d = 0; d < Rank - 1; d++) {
+      rows *= extent[d];
+    }
+    const hsize_t row_length = extent[Rank - 1];
+
+    for (hsize_t r = 0; r < rows; r++) {
+      hsize_t remaining = r;
+      hsize_t source = offset[Rank - 1];
+      for (int d = Rank - 2; d >= 0; d--) {
+        source += (offset[d] + remaining % extent[d])*strides[d];
+        remaining /= extent[d];
+      }
+      memcpy(buffer + r*row_length, this->data + source, row_length*sizeof(Scalar));
+    }
+  }
+
+  /** \brief Map the file and locate the data of a contiguous dataset in it; the data of an empty dataset may not be allocated yet.
+   * \param[in] filepath h5 file
+   */
+  void map_contiguous(const std::string& filepath) {
+    haddr_t offset = HADDR_UNDEF;
+    try {
+      offset = this->dataset.getOffset();
+    }
+    catch (H5::Exception&) {
+      return;
+    }
+
+    if (offset % sizeof(Scalar) == 0 && this->mapping.open(filepath, false) && offset + this->elements()*sizeof(Scalar) <= this->mapping.size()) {
+      this->mapping.random_access();
+      this->data = reinterpret_cast<const Scalar*>(this->mapping.data() + offset);
+    }
+    else {
+      this->mapping.close();
+    }
+  }
+
+  /** \brief Number of elements of one sample.
+   * \return elements
+   */
+  size_t sample_elements() const {
+    size_t elements = 1;
+    for (int d = 1; d < Rank; d++) {
+      elements *= static_cast<size_t>(this->dims[d]);
+    }
+    return elements;
+  }
+
+  /** \brief Number of elements of the dataset.
+   * \return elements
+   */
+  size_t elements() const {
+    return static_cast<size_t>(this->dims[0])*this->sample_elements();
+  }
+
+  /** \brief Release the dataset, the file and the mapping; expects hdf5_mutex() to be held. */
+  void close() {
+    this->data = nullptr;
+    this->mapping.close();
+    this->dataset = H5::DataSet();
+    this->file.reset();
+  }
+
+  std::unique_ptr<H5::H5File> file;
+  H5::DataSet dataset;
+  Index dims;
+  /** \brief Value of one step of quantized SDFs, 1 otherwise. */
+  float scale;
+  /** \brief Words per row of packed occupancy, 0 if not packed. */
+  hsize_t packed_words;
+  /** \brief Mapping of the whole file if the dataset is mapped. */
+  MappedFile mapping;
+  /** \brief First element of the dataset within the mapping, nullptr if not mapped. */
+  const Scalar* data;
+};
+
+/** \brief Reads batches of samples ahead on a pool of background threads.
+ *
+ * A training loop requests the next few batches up front and waits on the futures only when it
+ * needs them; requests beyond the capacity block, bounding the memory of batches in flight.
+ * Mapped datasets are read by all threads in parallel, chunked ones one hyperslab at a time.
+ */
+template<typename Scalar, int Rank>
+class Hdf5Prefetcher {
+public:
+  typedef typename Hdf5Reader<Scalar, Rank>::Tensor Tensor;
+
+  /** \brief Constructor, starts the threads.
+   * \param[in] reader reader, has to outlive the prefetcher
+   * \param[in] threads number of threads
+   * \param[in] capacity number of requests waiting to be read at most
+   */
+  Hdf5Prefetcher(Hdf5Reader<Scalar, Rank>& reader, int threads = 2, size_t capacity = 8) : reader(reader), requests(capacity) {
+    for (int t = 0; t < std::max(1, threads); t++) {
+      this->threads.emplace_back([this]() {
+        Request request;
+        while (this->requests.pop(request)) {
+          Tensor batch;
+          if (!this->reader.read_batch(request.indices, batch)) {
+            batch = Tensor();
+          }
+          request.promise.set_value(std::move(batch));
+        }
+      });
+    }
+  }
+
+  /** \brief Destructor, reads the remaining requests and stops the threads. */
+  ~Hdf5Prefetcher() {
+    this->requests.close();
+    for (size_t t = 0; t < this->threads.size(); t++) {
+      this->threads[t].join();
+    }
+  }
+
+  Hdf5Prefetcher(const Hdf5Prefetcher&) = delete;
+  Hdf5Prefetcher& operator=(const Hdf5Prefetcher&) = delete;
+
+  /** \brief Request a batch.
+   * \param[in] indices samples of the batch
+   * \return batch once read, an empty tensor if reading failed
+   */
+  std::future<Tensor> prefetch(const std::vector<size_t>& indices) {
+    Request request;
+    request.indices = indices;
+    std::future<Tensor> batch = request.promise.get_future();
+    if (!this->requests.push(std::move(request))) {
+      std::promise<Tensor> closed;
+      closed.set_value(Tensor());
+      return closed.get_future();
+    }
+    return batch;
+  }
+
+private:
+  /** \brief A requested batch. */
+  struct Request {
+    std::vector<size_t> indices;
+    std::promise<Tensor> promise;
+  };
+
+  Hdf5Reader<Scalar, Rank>& reader;
+  BoundedQueue<Request> requests;
+  std::vector<std::thread> threads;
+};
+
+#endif
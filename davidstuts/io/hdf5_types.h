@@ -0,0 +1,57 @@
+#ifndef HDF5_TYPES_H_
+#define HDF5_TYPES_H_
+
+#include <cstdint>
+#include <mutex>
+
+// HDF5
+#include <H5Cpp.h>
+
+/** \brief HDF5 type of the supported scalars. */
+template<typename Scalar>
+const H5::PredType& hdf5_type();
+
+template<>
+inline const H5::PredType& hdf5_type<float>() {
+  return H5::PredType::NATIVE_FLOAT;
+}
+
+template<>
+inline const H5::PredType& hdf5_type<double>() {
+  return H5::PredType::NATIVE_DOUBLE;
+}
+
+template<>
+inline const H5::PredType& hdf5_type<int>() {
+  return H5::PredType::NATIVE_INT;
+}
+
+template<>
+inline const H5::PredType& hdf5_type<int16_t>() {
+  return H5::PredType::NATIVE_INT16;
+}
+
+template<>
+inline const H5::PredType& hdf5_type<int8_t>() {
+  return H5::PredType::NATIVE_INT8;
+}
+
+template<>
+inline const H5::PredType& hdf5_type<uint8_t>() {
+  return H5::PredType::NATIVE_UINT8;
+}
+
+template<>
+inline const H5::PredType& hdf5_type<uint32_t>() {
+  return H5::PredType::NATIVE_UINT32;
+}
+
+/** \brief Serializes HDF5 calls from several threads; the library is usually built without thread safety.
+ * \return mutex
+ */
+inline std::mutex& hdf5_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+#endif
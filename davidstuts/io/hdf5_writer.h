@@ -0,0 +1,371 @@
+#ifndef HDF5_WRITER_H_
+#define HDF5_WRITER_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+
+// HDF5
+#include <H5Cpp.h>
+
+#include "io/hdf5_types.h"
+#include "io/sdf_quantization.h"
+#include "io/bit_occupancy.h"
+
+/** \brief Largest HDF5 chunk used for a volume, well below the 4 GB chunk limit. */
+const uint64_t HDF5_MAX_CHUNK_BYTES = 1 << 30;
+
+/** \brief Writes a N x height x width x depth tensor one volume at a time.
+ *
+ * If the number of volumes is known up front, the dataset "tensor" is created contiguous with
+ * all of them (zero until written), which Hdf5Reader maps into memory instead of reading it
+ * through HDF5. Otherwise it is created empty and extendable along N, chunked per volume, and
+ * every write extends it as needed. Every write stores one volume as hyperslab and flushes the
+ * file, so only the volume being written has to be in memory and everything written so far
+ * survives a crash.
+ * Volumes may arrive in any order; the dataset "written" (one byte per volume) marks the
+ * volumes that are complete, gaps read as zero until they are filled. A resumed writer reopens
+ * such a file and keeps its complete volumes and its layout. Float volumes (SDFs) can be stored quantized and
+ * int volumes (occupancy) packed into bits, see SdfQuantization and OccupancyFormat.
+ */
+template<typename Scalar>
+class Hdf5VolumeWriter {
+public:
+  /** \brief Constructor, creates (or truncates) the file; check is_open() afterwards.
+   * \param[in] filepath h5 file to write
+   * \param[in] height height of volumes
+   * \param[in] width width of volumes
+   * \param[in] depth depth of volumes
+   * \param[in] resume keep the volumes of an existing file of the same type and dimensions instead of truncating it
+   * \param[in] quantization storage format of float volumes, ignored for other scalars
+   * \param[in] count number of volumes if known, to create a contiguous tensor; 0 for an extendable one
+   */
+  Hdf5VolumeWriter(const std::string& filepath, int height, int width, int depth, bool resume = false,
+      const SdfQuantization& quantization = SdfQuantization(), size_t count = 0)
+    : Hdf5VolumeWriter(filepath, height, width, depth, resume, quantization, OccupancyFormat::DENSE, count) {
+
+  }
+
+  /** \brief Constructor for occupancy, creates (or truncates) the file; check is_open() afterwards.
+   * \param[in] filepath h5 file to write
+   * \param[in] height height of volumes
+   * \param[in] width width of volumes
+   * \param[in] depth depth of volumes
+   * \param[in] resume keep the volumes of an existing file of the same type and dimensions instead of truncating it
+   * \param[in] format storage format of int volumes, ignored for other scalars; packed volumes are stored as height x width x bit_words(depth) words
+   * \param[in] count number of volumes if known, to create a contiguous tensor; 0 for an extendable one
+   */
+  Hdf5VolumeWriter(const std::string& filepath, int height, int width, int depth, bool resume, OccupancyFormat format, size_t count = 0)
+    : Hdf5VolumeWriter(filepath, height, width, depth, resume, SdfQuantization(), format, count) {
+
+  }
+
+  /** \brief Check whether the file and datasets were created.
+   * \return open
+   */
+  bool is_open() const {
+    return this->file != nullptr;
+  }
+
+  /** \brief Check whether an existing file was opened for resuming.
+   * \return resumed
+   */
+  bool is_resumed() const {
+    return this->resumed;
+  }
+
+  /** \brief Check whether a volume is complete, including volumes written by a previous run.
+   * \param[in] index position along N
+   * \return written
+   */
+  bool is_written(size_t index) const {
+    return index < this->complete.size() && this->complete[index] != 0;
+  }
+
+  /** \brief Write one volume.
+   * \param[in] index position along N
+   * \param[in] data height x width x depth values in row-major order
+   * \return success
+   */
+  bool write(size_t index, const Scalar* data) {
+    if (!this->is_open()) {
+      return false;
+    }
+
+    try {
+      this->extend(index + 1);
+
+      hsize_t start[4] = { index, 0, 0, 0 };
+      hsize_t count[4] = { 1, this->dims[1], this->dims[2], this->dims[3] };
+      H5::DataSpace filespace = this->tensor.getSpace();
+      filespace.selectHyperslab(H5S_SELECT_SET, count, start);
+      H5::DataSpace memspace(4, count);
+      if (this->quantization.is_identity() && !this->packed) {
+        this->tensor.write(data, hdf5_type<Scalar>(), memspace, filespace);
+      }
+      else {
+        this->tensor.write(this->encode(data), this->storage_type(), memspace, filespace);
+      }
+
+      hsize_t written_start[1] = { index };
+      hsize_t written_count[1] = { 1 };
+      H5::DataSpace written_filespace = this->written.getSpace();
+      written_filespace.selectHyperslab(H5S_SELECT_SET, written_count, written_start);
+      H5::DataSpace written_memspace(1, written_count);
+      uint8_t yes = 1;
+      this->written.write(&yes, H5::PredType::NATIVE_UINT8, written_memspace, written_filespace);
+
+      this->file->flush(H5F_SCOPE_LOCAL);
+      if (index >= this->complete.size()) {
+        this->complete.resize(index + 1, 0);
+      }
+      this->complete[index] = 1;
+    }
+    catch (H5::Exception& error) {
+      error.printError();
+      return false;
+    }
+
+    return true;
+  }
+
+  /** \brief Make the dataset hold at least n volumes, e.g. so that it keeps its size when the last volumes could not be produced; the missing volumes stay zero and unwritten.
+   * \param[in] n number of volumes
+   * \return success
+   */
+  bool reserve(size_t n) {
+    if (!this->is_open()) {
+      return false;
+    }
+
+    try {
+      this->extend(n);
+    }
+    catch (H5::Exception& error) {
+      error.printError();
+      return false;
+    }
+
+    return true;
+  }
+
+  /** \brief Number of volumes the dataset holds so far.
+   * \return N
+   */
+  size_t size() const {
+    return this->n;
+  }
+
+private:
+  /** \brief Constructor shared by the public ones. */
+  Hdf5VolumeWriter(const std::string& filepath, int height, int width, int depth, bool resume,
+      const SdfQuantization& quantization, OccupancyFormat format, size_t count) : n(0), resumed(false),
+      quantization(std::is_same<Scalar, float>::value ? quantization : SdfQuantization()),
+      packed(std::is_same<Scalar, int>::value && format == OccupancyFormat::BITS), length(depth) {
+    this->dims[0] = 0;
+    this->dims[1] = height;
+    this->dims[2] = width;
+    this->dims[3] = this->packed ? bit_words(depth) : depth;
+
+    H5::Exception::dontPrint();
+    if (resume && this->open(filepath, count)) {
+      this->resumed = true;
+      return;
+    }
+
+    try {
+      this->file.reset(new H5::H5File(filepath, H5F_ACC_TRUNC));
+
+      // A contiguous tensor is allocated up front, so that it has its place in the file even before the last write.
+      const bool contiguous = count > 0;
+      this->n = count;
+      this->dims[0] = count;
+      hsize_t max_dims[4] = { contiguous ? count : H5S_UNLIMITED, this->dims[1], this->dims[2], this->dims[3] };
+      H5::DataSpace dataspace(4, this->dims, max_dims);
+
+      const H5::DataType storage = this->storage_type();
+      H5::DSetCreatPropList properties;
+      if (contiguous) {
+        properties.setLayout(H5D_CONTIGUOUS);
+        properties.setAllocTime(H5D_ALLOC_TIME_EARLY);
+      }
+      else {
+        // One chunk per volume, split along the height for very large volumes.
+        const uint64_t slice_bytes = static_cast<uint64_t>(width)*this->dims[3]*storage.getSize();
+        hsize_t chunk[4] = { 1, std::max<hsize_t>(1, std::min<hsize_t>(height, HDF5_MAX_CHUNK_BYTES/std::max<uint64_t>(1, slice_bytes))), this->dims[2], this->dims[3] };
+        properties.setChunk(4, chunk);
+      }
+      uint64_t fill = 0;
+      properties.setFillValue(storage, &fill);
+      this->tensor = this->file->createDataSet("tensor", storage, dataspace, properties);
+      if (!this->quantization.is_identity()) {
+        this->quantization.write_attributes(this->tensor);
+      }
+      if (this->packed) {
+        write_bit_attributes(this->tensor, { this->dims[1], this->dims[2], static_cast<hsize_t>(this->length) }, { 0, 1, 2 });
+      }
+
+      hsize_t written_dims[1] = { count };
+      hsize_t written_max_dims[1] = { contiguous ? count : H5S_UNLIMITED };
+      hsize_t written_chunk[1] = { 1024 };
+      H5::DataSpace written_space(1, written_dims, written_max_dims);
+      H5::DSetCreatPropList written_properties;
+      if (!contiguous) {
+        written_properties.setChunk(1, written_chunk);
+      }
+      uint8_t no = 0;
+      written_properties.setFillValue(H5::PredType::NATIVE_UINT8, &no);
+      this->written = this->file->createDataSet("written", H5::PredType::NATIVE_UINT8, written_space, written_properties);
+      this->file->flush(H5F_SCOPE_LOCAL);
+    }
+    catch (H5::Exception& error) {
+      error.printError();
+      this->close();
+    }
+  }
+
+  /** \brief Open an existing file written by this class with the same scalar type and volume dimensions.
+   * \param[in] filepath h5 file
+   * \param[in] count number of volumes if known, a contiguous tensor has to hold them
+   * \return success
+   */
+  bool open(const std::string& filepath, size_t count) {
+    try {
+      this->file.reset(new H5::H5File(filepath, H5F_ACC_RDWR));
+      this->tensor = this->file->openDataSet("tensor");
+      this->written = this->file->openDataSet("written");
+
+      H5::DataSpace dataspace = this->tensor.getSpace();
+      hsize_t existing[4];
+      hsize_t max_existing[4];
+      if (dataspace.getSimpleExtentNdims() != 4 || !(this->tensor.getDataType() == this->storage_type())
+          || (std::is_same<Scalar, float>::value && !this->quantization.matches(this->tensor))
+          || (this->packed && !this->matches_bits())) {
+        this->close();
+        return false;
+      }
+      dataspace.getSimpleExtentDims(existing, max_existing);
+      if (existing[1] != this->dims[1] || existing[2] != this->dims[2] || existing[3] != this->dims[3]
+          || (max_existing[0] != H5S_UNLIMITED && max_existing[0] < count)) {
+        this->close();
+        return false;
+      }
+
+      hsize_t written_dims[1];
+      H5::DataSpace written_space = this->written.getSpace();
+      written_space.getSimpleExtentDims(written_dims);
+
+      this->n = static_cast<size_t>(existing[0]);
+      this->dims[0] = existing[0];
+      this->complete.assign(static_cast<size_t>(std::min<hsize_t>(written_dims[0], existing[0])), 0);
+      if (!this->complete.empty()) {
+        hsize_t start[1] = { 0 };
+        hsize_t count[1] = { this->complete.size() };
+        H5::DataSpace memspace(1, count);
+        written_space.selectHyperslab(H5S_SELECT_SET, count, start);
+        this->written.read(this->complete.data(), H5::PredType::NATIVE_UINT8, memspace, written_space);
+      }
+    }
+    catch (H5::Exception&) {
+      this->close();
+      return false;
+    }
+
+    return true;
+  }
+
+  /** \brief Type of the values in the file.
+   * \return type
+   */
+  H5::DataType storage_type() const {
+    if (this->packed) {
+      return H5::PredType::NATIVE_UINT32;
+    }
+    return this->quantization.is_identity() ? H5::DataType(hdf5_type<Scalar>()) : this->quantization.type();
+  }
+
+  /** \brief Check whether the packed tensor of an existing file has the same unpacked depth.
+   * \return match
+   */
+  bool matches_bits() const {
+    std::vector<hsize_t> shape;
+    return read_bit_shape(this->tensor, shape) && shape.back() == static_cast<hsize_t>(this->length);
+  }
+
+  /** \brief Quantize a float volume into the buffer.
+   * \param[in] data height x width x depth values
+   * \return buffer
+   */
+  const void* encode(const float* data) {
+    const size_t count = static_cast<size_t>(this->dims[1]*this->dims[2]*this->dims[3]);
+    this->buffer.resize(count*this->quantization.bytes());
+    this->quantization.quantize(data, count, this->buffer.data());
+    return this->buffer.data();
+  }
+
+  /** \brief Pack an occupancy volume into the words.
+   * \param[in] data height x width x depth values
+   * \return words
+   */
+  const void* encode(const int* data) {
+    const size_t rows = static_cast<size_t>(this->dims[1]*this->dims[2]);
+    this->words.resize(rows*this->dims[3]);
+    pack_bit_rows(data, rows, this->length, this->words.data());
+    return this->words.data();
+  }
+
+  /** \brief Other volumes are stored as they are.
+   * \param[in] data height x width x depth values
+   * \return data
+   */
+  template<typename Other>
+  const void* encode(const Other* data) {
+    return data;
+  }
+
+  /** \brief Release the datasets and the file, which stays open as long as any of them is referenced. */
+  void close() {
+    this->tensor = H5::DataSet();
+    this->written = H5::DataSet();
+    this->file.reset();
+  }
+
+  /** \brief Extend both datasets to at least n volumes, throws on failure.
+   * \param[in] n number of volumes
+   */
+  void extend(size_t n) {
+    if (n > this->n) {
+      this->n = n;
+      this->dims[0] = this->n;
+      this->tensor.extend(this->dims);
+      hsize_t written_dims[1] = { this->n };
+      this->written.extend(written_dims);
+    }
+  }
+
+  std::unique_ptr<H5::H5File> file;
+  H5::DataSet tensor;
+  H5::DataSet written;
+  /** \brief Current dimensions of the tensor. */
+  hsize_t dims[4];
+  size_t n;
+  /** \brief Whether an existing file was opened. */
+  bool resumed;
+  /** \brief Written flag of every volume. */
+  std::vector<uint8_t> complete;
+  /** \brief Storage format of float volumes. */
+  const SdfQuantization quantization;
+  /** \brief Whether int volumes are packed into bits. */
+  const bool packed;
+  /** \brief Depth of the volumes before packing. */
+  const size_t length;
+  /** \brief Quantized volume being written. */
+  std::vector<uint8_t> buffer;
+  /** \brief Packed volume being written. */
+  std::vector<uint32_t> words;
+};
+
+#endif
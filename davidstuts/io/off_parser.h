@@ -0,0 +1,262 @@
+#ifndef OFF_PARSER_H_
+#define OFF_PARSER_H_
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <charconv>
+
+#ifndef __cpp_lib_to_chars
+#error "Parsing floats needs std::from_chars for floating point, e.g. GCC 11 or newer."
+#endif
+
+// OpenMP
+#include <omp.h>
+
+#include "common/mapped_file.h"
+
+/** \brief Maximum number of values read per vertex line (x, y, z, r, g, b, label). */
+const int OFF_MAX_VERTEX_COLUMNS = 7;
+
+/** \brief Minimum number of bytes per parse chunk, smaller files are parsed by a single thread. */
+const size_t OFF_MIN_CHUNK_BYTES = 1 << 16;
+
+/** \brief Skip spaces and tabs (but not line breaks).
+ * \param[in] p current position
+ * \param[in] end end of the line
+ * \return first non-blank position
+ */
+inline const char* off_skip_blank(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+    ++p;
+  }
+  return p;
+}
+
+/** \brief Get the end of the line starting at p, i.e. the position of the next '\n' or end.
+ * \param[in] p current position
+ * \param[in] end end of the buffer
+ * \return end of line
+ */
+inline const char* off_line_end(const char* p, const char* end) {
+  const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+  return newline == nullptr ? end : newline;
+}
+
+/** \brief Check whether the line [p, end) carries data, i.e. is neither blank nor a comment.
+ * \param[in] p start of line
+ * \param[in] end end of line
+ * \return is data line
+ */
+inline bool off_is_data_line(const char* p, const char* end) {
+  p = off_skip_blank(p, end);
+  return p < end && *p != '#';
+}
+
+/** \brief Parse the next number of the line; std::from_chars neither skips whitespace nor accepts '+'.
+ * \param[in,out] p current position, advanced past the number
+ * \param[in] end end of line
+ * \param[out] value parsed value
+ * \return success
+ */
+template<typename T>
+inline bool off_parse_next(const char*& p, const char* end, T& value) {
+  p = off_skip_blank(p, end);
+  if (p < end && *p == '+') {
+    ++p;
+  }
+
+  std::from_chars_result result = std::from_chars(p, end, value);
+  if (result.ec != std::errc()) {
+    return false;
+  }
+
+  p = result.ptr;
+  return true;
+}
+
+/** \brief Parse an (C)OFF file in parallel from a memory mapping.
+ *
+ * The body after the header is split into line-aligned chunks; the data lines of every chunk
+ * are counted in a first parallel pass, a prefix sum then gives each chunk the index of its
+ * first line, so the second pass can parse vertices and faces directly into their final slots.
+ *
+ * \param[in] filepath path to the OFF file
+ * \param[in] magic accepted header lines, e.g. "OFF" and "off"
+ * \param[in] columns number of values to read per vertex, between 3 and OFF_MAX_VERTEX_COLUMNS; missing trailing values are zero
+ * \param[in] allocate called once as allocate(n_vertices, n_faces) before any vertex or face is stored
+ * \param[in] store_vertex called concurrently as store_vertex(index, const float* values)
+ * \param[in] store_face called concurrently as store_face(index, const int* indices)
+ * \return success
+ */
+template<typename Allocate, typename StoreVertex, typename StoreFace>
+bool parse_off(const std::string& filepath, const std::vector<std::string>& magic, int columns,
+    Allocate allocate, StoreVertex store_vertex, StoreFace store_face) {
+
+  MappedFile file;
+  if (!file.open(filepath)) {
+    std::cout << "[Error] Could not open " << filepath << std::endl;
+    return false;
+  }
+
+  const char* p = file.data();
+  const char* end = p + file.size();
+
+  // Header, without trailing blanks or carriage return.
+  const char* line_end = off_line_end(p, end);
+  const char* header_end = line_end;
+  while (header_end > p && (header_end[-1] == ' ' || header_end[-1] == '\t' || header_end[-1] == '\r')) {
+    --header_end;
+  }
+
+  std::string header(p, header_end);
+  if (std::find(magic.begin(), magic.end(), header) == magic.end()) {
+    std::cout << "[Error] Invalid header: \"" << header << "\", " << filepath << std::endl;
+    return false;
+  }
+
+  // Counts, the first data line after the header.
+  p = std::min(line_end + 1, end);
+  line_end = off_line_end(p, end);
+  while (p < end && !off_is_data_line(p, line_end)) {
+    p = std::min(line_end + 1, end);
+    line_end = off_line_end(p, end);
+  }
+
+  int n_vertices = 0;
+  int n_faces = 0;
+  const char* q = p;
+  if (!off_parse_next(q, line_end, n_vertices) || !off_parse_next(q, line_end, n_faces) || n_vertices < 0 || n_faces < 0) {
+    std::cout << "[Error] Invalid vertex and face counts, " << filepath << std::endl;
+    return false;
+  }
+
+  const char* body = std::min(line_end + 1, end);
+  const size_t body_size = end - body;
+
+  // Line-aligned chunks; chunk c covers [chunk_begin[c], chunk_begin[c + 1]).
+  int n_chunks = std::max(1, std::min(4*omp_get_max_threads(), static_cast<int>(body_size/OFF_MIN_CHUNK_BYTES)));
+  std::vector<const char*> chunk_begin(n_chunks + 1, end);
+  chunk_begin[0] = body;
+  for (int c = 1; c < n_chunks; c++) {
+    const char* split = std::max(chunk_begin[c - 1], body + (body_size*c)/n_chunks);
+    if (split > body && split[-1] != '\n') {
+      split = std::min(off_line_end(split, end) + 1, end);
+    }
+    chunk_begin[c] = split;
+  }
+
+  // First pass: count data lines per chunk, then prefix sum to get the first line index per chunk.
+  std::vector<long> chunk_lines(n_chunks + 1, 0);
+
+  #pragma omp parallel for schedule(static)
+  for (int c = 0; c < n_chunks; c++) {
+    long count = 0;
+    for (const char* s = chunk_begin[c]; s < chunk_begin[c + 1];) {
+      const char* e = off_line_end(s, chunk_begin[c + 1]);
+      if (off_is_data_line(s, e)) {
+        count++;
+      }
+      s = e + 1;
+    }
+    chunk_lines[c + 1] = count;
+  }
+
+  for (int c = 0; c < n_chunks; c++) {
+    chunk_lines[c + 1] += chunk_lines[c];
+  }
+
+  const long n_lines = static_cast<long>(n_vertices) + static_cast<long>(n_faces);
+  if (chunk_lines[n_chunks] < n_lines) {
+    std::cout << "[Error] Number of vertices and faces in header (" << n_vertices << ", " << n_faces
+      << ") exceeds the number of lines in " << filepath << std::endl;
+    return false;
+  }
+
+  allocate(n_vertices, n_faces);
+
+  // Second pass: parse every data line into its slot; the first error (by line index) is reported.
+  long error_line = n_lines;
+  int error_points = 0;
+
+  #pragma omp parallel for schedule(dynamic, 1)
+  for (int c = 0; c < n_chunks; c++) {
+    long index = chunk_lines[c];
+    if (index >= n_lines) {
+      continue;
+    }
+
+    float values[OFF_MAX_VERTEX_COLUMNS];
+    int indices[3];
+
+    for (const char* s = chunk_begin[c]; s < chunk_begin[c + 1] && index < n_lines;) {
+      const char* e = off_line_end(s, chunk_begin[c + 1]);
+      if (!off_is_data_line(s, e)) {
+        s = e + 1;
+        continue;
+      }
+
+      bool valid = true;
+      int n = 0;
+      const char* r = s;
+
+      if (index < n_vertices) {
+        int read = 0;
+        while (read < columns && off_parse_next(r, e, values[read])) {
+          read++;
+        }
+        valid = read >= 3;
+        std::fill(values + read, values + columns, 0.f);
+
+        if (valid) {
+          store_vertex(static_cast<int>(index), values);
+        }
+      }
+      else {
+        valid = off_parse_next(r, e, n) && n == 3
+          && off_parse_next(r, e, indices[0]) && off_parse_next(r, e, indices[1]) && off_parse_next(r, e, indices[2]);
+
+        for (int k = 0; valid && k < 3; k++) {
+          valid = indices[k] >= 0 && indices[k] < n_vertices;
+        }
+
+        if (valid) {
+          store_face(static_cast<int>(index - n_vertices), indices);
+        }
+      }
+
+      if (!valid) {
+        #pragma omp critical(off_parse_error)
+        {
+          if (index < error_line) {
+            error_line = index;
+            error_points = n;
+          }
+        }
+        break;
+      }
+
+      index++;
+      s = e + 1;
+    }
+  }
+
+  if (error_line < n_lines) {
+    if (error_line < n_vertices) {
+      std::cout << "[Error] Invalid vertex " << error_line << " in " << filepath << std::endl;
+    }
+    else if (error_points != 3) {
+      std::cout << "[Error] Not a triangle (" << error_points << " points) at face " << (error_line - n_vertices) << " in " << filepath << std::endl;
+    }
+    else {
+      std::cout << "[Error] Invalid face " << (error_line - n_vertices) << " in " << filepath << std::endl;
+    }
+    return false;
+  }
+
+  return true;
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef PLY_WRITER_H_
+#define PLY_WRITER_H_
+
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+
+/** \brief Write a triangle mesh as binary little endian PLY.
+ *
+ * The vertices are written as float x, y, z and the faces as a uchar count followed by int
+ * indices, the layout MeshLab, Open3D and trimesh read. The data is written as it is in
+ * memory, so this expects a little endian host, as all x86 and ARM machines we run on are.
+ * \param[in] filepath PLY file
+ * \param[in] vertices vertices, x, y and z each
+ * \param[in] faces triangles, three vertex indices each
+ * \return success
+ */
+inline bool write_ply(const std::string& filepath, const std::vector<float>& vertices, const std::vector<int32_t>& faces) {
+  std::ofstream file(filepath.c_str(), std::ios::out | std::ios::binary);
+  if (!file) {
+    return false;
+  }
+
+  const size_t num_vertices = vertices.size()/3;
+  const size_t num_faces = faces.size()/3;
+  file << "ply\n"
+       << "format binary_little_endian 1.0\n"
+       << "element vertex " << num_vertices << "\n"
+       << "property float x\n"
+       << "property float y\n"
+       << "property float z\n"
+       << "element face " << num_faces << "\n"
+       << "property list uchar int vertex_indices\n"
+       << "end_header\n";
+  file.write(reinterpret_cast<const char*>(vertices.data()), num_vertices*3*sizeof(float));
+
+  // Faces are 13 bytes each, packed into a buffer of a few thousand at a time
+  const size_t face_bytes = 1 + 3*sizeof(int32_t);
+  const size_t batch = 4096;
+  std::vector<char> buffer(batch*face_bytes);
+  for (size_t first = 0; first < num_faces; first += batch) {
+    const size_t count = std::min(batch, num_faces - first);
+    for (size_t f = 0; f < count; f++) {
+      char* p = buffer.data() + f*face_bytes;
+      p[0] = 3;
+      memcpy(p + 1, &faces[3*(first + f)], 3*sizeof(int32_t));
+    }
+    file.write(buffer.data(), count*face_bytes);
+  }
+  return static_cast<bool>(file);
+}
+
+#endif
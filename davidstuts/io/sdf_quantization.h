@@ -0,0 +1,286 @@
+#ifndef SDF_QUANTIZATION_H_
+#define SDF_QUANTIZATION_H_
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SDF_QUANTIZATION_F16C
+#include <immintrin.h>
+#endif
+
+// HDF5
+#include <H5Cpp.h>
+
+/** \brief Storage formats of SDFs. */
+enum class SdfFormat {
+  FLOAT32,
+  FLOAT16,
+  INT16,
+  INT8
+};
+
+/** \brief Convert a float to IEEE half precision, rounding to nearest even; out of range values become infinity.
+ * \param[in] value value
+ * \return half precision bits
+ */
+inline uint16_t float_to_half(float value) {
+  const uint32_t infinity = 255u << 23;
+  const uint32_t half_max = (127u + 16u) << 23;
+  const uint32_t denormal_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const uint32_t sign = bits & 0x80000000u;
+  bits ^= sign;
+
+  uint16_t half;
+  if (bits >= half_max) {
+    half = bits > infinity ? 0x7e00 : 0x7c00;
+  }
+  else if (bits < (113u << 23)) {
+    // Subnormal half: let the float adder do the rounding.
+    float f, magic;
+    memcpy(&f, &bits, sizeof(f));
+    memcpy(&magic, &denormal_magic, sizeof(magic));
+    f += magic;
+    memcpy(&bits, &f, sizeof(bits));
+    half = static_cast<uint16_t>(bits - denormal_magic);
+  }
+  else {
+    const uint32_t odd = (bits >> 13) & 1u;
+    bits += (static_cast<uint32_t>(15 - 127) << 23) + 0xfffu + odd;
+    half = static_cast<uint16_t>(bits >> 13);
+  }
+  return static_cast<uint16_t>(half | (sign >> 16));
+}
+
+#ifdef SDF_QUANTIZATION_F16C
+/** \brief Check once whether the CPU supports F16C (and the AVX it comes with).
+ * \return support
+ */
+inline bool sdf_quantization_f16c() {
+  static const bool supported = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+  return supported;
+}
+
+/** \brief Clamp and convert whole groups of 8 values to half precision using F16C.
+ * \param[in] values values
+ * \param[in] groups number of groups, i.e. 8 values each
+ * \param[in] t truncation
+ * \param[out] out half precision bits
+ */
+__attribute__((target("avx,f16c")))
+inline void float_to_half_f16c(const float* values, size_t groups, float t, uint16_t* out) {
+  const __m256 lower = _mm256_set1_ps(-t);
+  const __m256 upper = _mm256_set1_ps(t);
+  for (size_t g = 0; g < groups; g++) {
+    __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(values + 8*g), lower), upper);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8*g), _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT));
+  }
+}
+#endif
+
+/** \brief How SDFs are stored: as float32, float16 or linearly quantized to int16/int8.
+ *
+ * Values are clamped to [-truncation, truncation] first (if truncation is positive); the
+ * integer formats then map this range linearly onto [-max, max] of the integer type, and the
+ * dataset gets the attributes "scale" (value of one step) and "truncation", so readers
+ * dequantize by multiplying with the scale. HDF5 converts float16 to float on reading by itself.
+ */
+struct SdfQuantization {
+  SdfFormat format;
+  /** \brief Truncation distance in SDF units, 0 for none; required by the integer formats. */
+  float truncation;
+
+  /** \brief Constructor, float32 without truncation. */
+  SdfQuantization() : format(SdfFormat::FLOAT32), truncation(0) {
+
+  }
+
+  /** \brief Parse a format.
+   * \param[in] name float32, float16, int16 or int8
+   * \param[in] truncation truncation distance, 0 for none
+   * \param[out] quantization quantization
+   * \return whether the format is known and has the truncation it needs
+   */
+  static bool parse(const std::string& name, float truncation, SdfQuantization& quantization) {
+    if (name == "float32") {
+      quantization.format = SdfFormat::FLOAT32;
+    }
+    else if (name == "float16") {
+      quantization.format = SdfFormat::FLOAT16;
+    }
+    else if (name == "int16") {
+      quantization.format = SdfFormat::INT16;
+    }
+    else if (name == "int8") {
+      quantization.format = SdfFormat::INT8;
+    }
+    else {
+      return false;
+    }
+
+    quantization.truncation = std::max(0.f, truncation);
+    return !quantization.is_integer() || quantization.truncation > 0;
+  }
+
+  /** \brief Name of the format.
+   * \return name
+   */
+  const char* name() const {
+    const char* names[] = { "float32", "float16", "int16", "int8" };
+    return names[static_cast<int>(this->format)];
+  }
+
+  /** \brief Check whether values are stored as they are.
+   * \return identity
+   */
+  bool is_identity() const {
+    return this->format == SdfFormat::FLOAT32 && this->truncation <= 0;
+  }
+
+  /** \brief Check whether the format is an integer format.
+   * \return integer
+   */
+  bool is_integer() const {
+    return this->format == SdfFormat::INT16 || this->format == SdfFormat::INT8;
+  }
+
+  /** \brief Largest stored integer.
+   * \return maximum
+   */
+  float maximum() const {
+    return this->format == SdfFormat::INT16 ? 32767.f : 127.f;
+  }
+
+  /** \brief Value of one integer step.
+   * \return scale, 1 for float formats
+   */
+  float scale() const {
+    return this->is_integer() ? this->truncation/this->maximum() : 1.f;
+  }
+
+  /** \brief Bytes per stored value.
+   * \return bytes
+   */
+  size_t bytes() const {
+    return this->format == SdfFormat::FLOAT32 ? 4 : (this->format == SdfFormat::INT8 ? 1 : 2);
+  }
+
+  /** \brief Type of the stored values, in the file and in the buffers passed to HDF5.
+   * \return type
+   */
+  H5::DataType type() const {
+    switch (this->format) {
+      case SdfFormat::FLOAT16: {
+        // IEEE half: 1 sign, 5 exponent and 10 mantissa bits.
+        H5::FloatType half(H5::PredType::NATIVE_FLOAT);
+        half.setFields(15, 10, 5, 0, 10);
+        half.setOffset(0);
+        half.setPrecision(16);
+        half.setSize(2);
+        half.setEbias(15);
+        return half;
+      }
+      case SdfFormat::INT16:
+        return H5::PredType::NATIVE_INT16;
+      case SdfFormat::INT8:
+        return H5::PredType::NATIVE_INT8;
+      default:
+        return H5::PredType::NATIVE_FLOAT;
+    }
+  }
+
+  /** \brief Convert values to the stored format in one vectorized pass.
+   * \param[in] values values
+   * \param[in] n number of values
+   * \param[out] buffer n*bytes() bytes
+   */
+  void quantize(const float* values, size_t n, void* buffer) const {
+    const float t = this->truncation > 0 ? this->truncation : 3.4e38f;
+
+    if (this->format == SdfFormat::FLOAT32) {
+      float* out = static_cast<float*>(buffer);
+      #pragma omp simd
+      for (size_t i = 0; i < n; i++) {
+        out[i] = std::min(std::max(values[i], -t), t);
+      }
+    }
+    else if (this->format == SdfFormat::FLOAT16) {
+      uint16_t* out = static_cast<uint16_t*>(buffer);
+      size_t i = 0;
+#ifdef SDF_QUANTIZATION_F16C
+      // Chosen at runtime so that the binaries stay portable.
+      if (sdf_quantization_f16c()) {
+        float_to_half_f16c(values, n/8, t, out);
+        i = n/8*8;
+      }
+#endif
+      for (; i < n; i++) {
+        out[i] = float_to_half(std::min(std::max(values[i], -t), t));
+      }
+    }
+    else {
+      // Round half away from zero by truncating value +- 0.5, which vectorizes unlike lrint.
+      const float inverse = this->maximum()/this->truncation;
+      if (this->format == SdfFormat::INT16) {
+        int16_t* out = static_cast<int16_t*>(buffer);
+        #pragma omp simd
+        for (size_t i = 0; i < n; i++) {
+          float x = std::min(std::max(values[i], -t), t)*inverse;
+          out[i] = static_cast<int16_t>(x + (x < 0 ? -0.5f : 0.5f));
+        }
+      }
+      else {
+        int8_t* out = static_cast<int8_t*>(buffer);
+        #pragma omp simd
+        for (size_t i = 0; i < n; i++) {
+          float x = std::min(std::max(values[i], -t), t)*inverse;
+          out[i] = static_cast<int8_t>(x + (x < 0 ? -0.5f : 0.5f));
+        }
+      }
+    }
+  }
+
+  /** \brief Check whether a dataset was written with this quantization, e.g. before appending to it.
+   * \param[in] dataset dataset
+   * \return match
+   */
+  bool matches(const H5::DataSet& dataset) const {
+    float truncation = 0;
+    if (dataset.attrExists("truncation")) {
+      dataset.openAttribute("truncation").read(H5::PredType::NATIVE_FLOAT, &truncation);
+    }
+    return dataset.getDataType() == this->type() && truncation == this->truncation;
+  }
+
+  /** \brief Attach the format, scale and truncation to a dataset.
+   * \param[in] dataset dataset
+   */
+  void write_attributes(H5::DataSet& dataset) const {
+    H5::DataSpace scalar(H5S_SCALAR);
+    float scale = this->scale();
+    dataset.createAttribute("scale", H5::PredType::NATIVE_FLOAT, scalar).write(H5::PredType::NATIVE_FLOAT, &scale);
+    dataset.createAttribute("truncation", H5::PredType::NATIVE_FLOAT, scalar).write(H5::PredType::NATIVE_FLOAT, &this->truncation);
+    H5::StrType string_type(H5::PredType::C_S1, strlen(this->name()));
+    dataset.createAttribute("format", string_type, scalar).write(string_type, this->name());
+  }
+};
+
+/** \brief Read the scale of a quantized dataset.
+ * \param[in] dataset dataset
+ * \return scale, 1 if the dataset is not quantized
+ */
+inline float read_sdf_scale(const H5::DataSet& dataset) {
+  float scale = 1;
+  if (dataset.attrExists("scale")) {
+    dataset.openAttribute("scale").read(H5::PredType::NATIVE_FLOAT, &scale);
+  }
+  return scale;
+}
+
+#endif
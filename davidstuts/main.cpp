@@ -5,6 +5,10 @@
 #include <sstream>
 #include <vector>
 #include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 #include <cfloat>
 
 // Boost
@@ -21,676 +25,35 @@
 // OpenMP
 #include <omp.h>
 
-// happly.h
-#include "happly.h"
-
-// Point-triangle distance and ray-triangle intersection.
-#include "triangle_point/poitri.h"
-#include "triangle_ray/raytri.h"
-#include "box_triangle/aabb_triangle_overlap.h"
-
-/** \brief Compute triangle point distance and corresponding closest point.
- * \param[in] point point
- * \param[in] v1 first vertex
- * \param[in] v2 second vertex
- * \param[in] v3 third vertex
- * \param[out] ray corresponding closest point
- * \return distance
- */
-float triangle_point_distance(const Eigen::Vector3f &point, const Eigen::Vector3f &v1, const Eigen::Vector3f &v2, const Eigen::Vector3f &v3,
-    Eigen::Vector3f &closest_point) {
-
-  Vec3f x0(point.data());
-  Vec3f x1(v1.data());
-  Vec3f x2(v2.data());
-  Vec3f x3(v3.data());
-
-  Vec3f r(0);
-  float distance = point_triangle_distance(x0, x1, x2, x3, r);
-
-  for (int d = 0; d < 3; d++) {
-    closest_point(d) = r[d];
-  }
-
-  return distance;
-}
-
-/** \brief Test triangle ray intersection.
- * \param[in] origin origin of ray
- * \param[in] dest destination of ray
- * \param[in] v1 first vertex
- * \param[in] v2 second vertex
- * \param[in] v3 third vertex
- * \return intersects
- */
-bool triangle_ray_intersection(const Eigen::Vector3f &origin, const Eigen::Vector3f &dest,
-    const Eigen::Vector3f &v1, const Eigen::Vector3f &v2, const Eigen::Vector3f &v3, float &t) {
-
-  double _origin[3] = {origin(0), origin(1), origin(2)};
-  double _dir[3] = {dest(0) - origin(0), dest(1) - origin(1), dest(2) - origin(2)};
-  double _v1[3] = {v1(0), v1(1), v1(2)};
-  double _v2[3] = {v2(0), v2(1), v2(2)};
-  double _v3[3] = {v3(0), v3(1), v3(2)};
-
-  // t is the distance, u and v are barycentric coordinates
-  // http://fileadmin.cs.lth.se/cs/personal/tomas_akenine-moller/code/raytri_tam.pdf
-  double _t, u, v;
-  int success = intersect_triangle(_origin, _dir, _v1, _v2, _v3, &_t, &u, &v);
-  t = _t;
-
-  if (success) {
-    return true;
-  }
-
-  return false;
-}
-
-/** \brief Compute triangle box intersection.
- * \param[in] min defining voxel
- * \param[in] max defining voxel
- * \param[in] v1 first vertex
- * \param[in] v2 second vertex
- * \param[in] v3 third vertex
- * \return intersects
- */
-bool triangle_box_intersection(const Eigen::Vector3f &min, Eigen::Vector3f &max, const Eigen::Vector3f &v1, const Eigen::Vector3f &v2, const Eigen::Vector3f &v3) {
-  float half_size[3] = {
-    (max(0) - min(0))/2.,
-    (max(1) - min(1))/2.,
-    (max(2) - min(2))/2.
-  };
-
-  float center[3] = {
-    max(0) - half_size[0],
-    max(1) - half_size[1],
-    max(2) - half_size[2]
-  };
-
-  float vertices[3][3] = {{v1(0), v1(1), v1(2)}, {v2(0), v2(1), v2(2)}, {v3(0), v3(1), v3(2)}};
-  return triBoxOverlap(center, half_size, vertices);
-}
-
-/** \brief Compute triangle box intersection.
- * \param[in] min defining voxel
- * \param[in] max defining voxel
- * \param[in] v1 first vertex
- * \param[in] v2 second vertex
- * \param[in] v3 third vertex
- * \return intersects
- */
-bool triangle_box_intersection_color(const Eigen::Vector3f &min, Eigen::Vector3f &max, const Eigen::Matrix<float, 7, 1> &v1, const Eigen::Matrix<float, 7, 1> &v2, const Eigen::Matrix<float, 7, 1> &v3) {
-  float half_size[3] = {
-    (max(0) - min(0))/2.,
-    (max(1) - min(1))/2.,
-    (max(2) - min(2))/2.
-  };
-
-  float center[3] = {
-    max(0) - half_size[0],
-    max(1) - half_size[1],
-    max(2) - half_size[2]
-  };
-
-  float vertices[3][3] = {{v1(0), v1(1), v1(2)}, {v2(0), v2(1), v2(2)}, {v3(0), v3(1), v3(2)}};
-  return triBoxOverlap(center, half_size, vertices);
-}
-
-
-/** \brief Specifies the voxelization mode, i.e. which point of a voxel to use for SDF computation. */
-enum VoxelizationMode {
-  CENTER = 0,
-  CORNER = 1
-};
-
-/** \brief Just encapsulating vertices and faces. */
-class Mesh {
-public:
-  /** \brief Empty constructor. */
-  Mesh() {
-
-  }
-
-  /** \brief Reading an off file and returning the vertices x, y, z coordinates and the
-   * face indices.
-   * \param[in] filepath path to the OFF file
-   * \param[out] mesh read mesh with vertices and faces
-   * \return success
-   */
-  static bool from_off(const std::string filepath, Mesh& mesh) {
-
-    std::ifstream* file = new std::ifstream(filepath.c_str());
-    std::string line;
-    std::stringstream ss;
-    int line_nb = 0;
-
-    std::getline(*file, line);
-    ++line_nb;
-
-    if (line != "off" && line != "OFF") {
-      std::cout << "[Error] Invalid header: \"" << line << "\", " << filepath << std::endl;
-      return false;
-    }
-
-    size_t n_edges;
-    std::getline(*file, line);
-    ++line_nb;
-
-    int n_vertices;
-    int n_faces;
-    ss << line;
-    ss >> n_vertices;
-    ss >> n_faces;
-    ss >> n_edges;
-
-    for (size_t v = 0; v < n_vertices; ++v) {
-      std::getline(*file, line);
-      ++line_nb;
-
-      ss.clear();
-      ss.str("");
-
-      Eigen::Vector3f vertex;
-      ss << line;
-      ss >> vertex(0);
-      ss >> vertex(1);
-      ss >> vertex(2);
-
-      mesh.add_vertex(vertex);
-    }
-
-    size_t n;
-    for (size_t f = 0; f < n_faces; ++f) {
-      std::getline(*file, line);
-      ++line_nb;
-
-      ss.clear();
-      ss.str("");
-
-      size_t n;
-      ss << line;
-      ss >> n;
-
-      if(n != 3) {
-        std::cout << "[Error] Not a triangle (" << n << " points) at " << (line_nb - 1) << std::endl;
-        return false;
-      }
-
-      Eigen::Vector3i face;
-      ss >> face(0);
-      ss >> face(1);
-      ss >> face(2);
-
-      mesh.add_face(face);
-    }
-
-    if (n_vertices != mesh.num_vertices()) {
-      std::cout << "[Error] Number of vertices in header differs from actual number of vertices." << std::endl;
-      return false;
-    }
-
-    if (n_faces != mesh.num_faces()) {
-      std::cout << "[Error] Number of faces in header differs from actual number of faces." << std::endl;
-      return false;
-    }
-
-    file->close();
-    delete file;
-
-    return true;
-  }
-
-
-  /** \brief Reading an off file and returning the vertices x, y, z coordinates and the
-   * face indices.
-   * \param[in] filepath path to the OFF file
-   * \param[out] mesh read mesh with vertices and faces
-   * \return success
-   */
-  static bool from_off_color(const std::string filepath, Mesh& mesh) {
-
-    std::ifstream* file = new std::ifstream(filepath.c_str());
-    std::string line;
-    std::stringstream ss;
-    int line_nb = 0;
-
-    std::getline(*file, line);
-    ++line_nb;
-
-    if (line != "coff" && line != "COFF") {
-      std::cout << "[Error] Invalid header: \"" << line << "\", " << filepath << std::endl;
-      return false;
-    }
-
-    size_t n_edges;
-    std::getline(*file, line);
-    ++line_nb;
-
-    int n_vertices;
-    int n_faces;
-    ss << line;
-    ss >> n_vertices;
-    ss >> n_faces;
-    ss >> n_edges;
-
-    for (size_t v = 0; v < n_vertices; ++v) {
-      std::getline(*file, line);
-      ++line_nb;
-
-      ss.clear();
-      ss.str("");
-
-      Eigen::Matrix<float, 7, 1> vertex;
-      ss << line;
-      ss >> vertex(0);
-      ss >> vertex(1);
-      ss >> vertex(2);
-      ss >> vertex(3);
-      ss >> vertex(4);
-      ss >> vertex(5);
-      ss >> vertex(6);
-      mesh.add_vertex_color(vertex);
-    }
-
-    size_t n;
-    for (size_t f = 0; f < n_faces; ++f) {
-      std::getline(*file, line);
-      ++line_nb;
-
-      ss.clear();
-      ss.str("");
-
-      size_t n;
-      ss << line;
-      ss >> n;
-
-      if(n != 3) {
-        std::cout << "[Error] Not a triangle (" << n << " points) at " << (line_nb - 1) << std::endl;
-        return false;
-      }
-
-      Eigen::Vector3i face;
-      ss >> face(0);
-      ss >> face(1);
-      ss >> face(2);
-
-      mesh.add_face(face);
-    }
-
-    if (n_vertices != mesh.num_vertices_color()) {
-      std::cout << "[Error] Number of vertices in header differs from actual number of vertices." << std::endl;
-      return false;
-    }
-
-    if (n_faces != mesh.num_faces()) {
-      std::cout << "[Error] Number of faces in header differs from actual number of faces." << std::endl;
-      return false;
-    }
-
-    file->close();
-    delete file;
-
-    return true;
-  }
-
-  /** \brief Reading an ply file and returning the vertices x, y, z coordinates and the
-   * face indices.
-   * \param[in] filepath path to the ply file
-   * \param[out] mesh read mesh with vertices and faces
-   * \return success
-   */
-  static bool from_ply(const std::string filepath, Mesh& mesh) {
-  // Construct the data object by reading from file
-    happly::PLYData plyIn(filepath);
-
-    // Get mesh-style data from the object
-    std::vector<std::array<double, 3>> vPos = plyIn.getVertexPositions();
-    std::vector<std::vector<size_t>> fInd = plyIn.getFaceIndices<size_t>();
-    std::vector<std::array<unsigned char, 3>> vcolor = plyIn.getVertexColors();
-
-     // Declaring iterator to a vector 
-
-    std::vector<std::array<double, 3>>::iterator vec = vPos.begin();
-    std::vector<std::array<unsigned char, 3>>::iterator vec_c= vcolor.begin();
-
-    while(vec != vPos.end() || vec_c != vcolor.end())
-    {
-      // TODO: Broken, find a way to get info for the label and append to vertex at the end
-        Eigen::Matrix<float, 7, 1> vertex;
-        vertex(0) = (float(vec[0][0]));
-        vertex(1) = (float(vec[0][1]));
-        vertex(2) = (float(vec[0][2]));
-        vertex(3) = (float(vec_c[0][0]));
-        vertex(4) = (float(vec_c[0][1]));
-        vertex(5) = (float(vec_c[0][2]));
-        // vertex(6) = (float(vec[0][3]));
-
-        ++vec;
-        ++vec_c;
-        mesh.add_vertex_color(vertex);
-    }
+// Mesh and voxelization.
+#include "mesh.h"
 
+// Parser, voxelizer and writer pipeline for directories.
+#include "pipeline.h"
 
-    // for(auto& vec: vPos){
-    //     Eigen::Vector3f vertex;
-    //     vertex(0) = (float(vec[0]));
-    //     vertex(1) = (float(vec[1]));
-    //     vertex(2) = (float(vec[2]));
-    //     mesh.add_vertex(vertex);
-    // }
-
-    for(auto& f: fInd){
-      Eigen::Vector3i face;
-      face(0) = (int(f[0]));
-      face(1) = (int(f[1]));
-      face(2) = (int(f[2]));
-      mesh.add_face(face);
-    }
-
-    if (vPos.size() != mesh.num_vertices_color()) {
-      std::cout << "[Error] Number of vertices in header differs from actual number of vertices." << std::endl;
-      return false;
-    }
-
-    if (fInd.size() != mesh.num_faces()) {
-      std::cout << "[Error] Number of faces in header differs from actual number of faces." << std::endl;
-      return false;
-    }
-
-    return true;
-  }
-
-
-
-  /** \brief Write mesh to OFF file.
-   * \param[in] filepath path to OFF file to write
-   * \return success
-   */
-  bool to_off(const std::string filepath) {
-    std::ofstream* out = new std::ofstream(filepath, std::ofstream::out);
-    if (!static_cast<bool>(out)) {
-      return false;
-    }
-
-    (*out) << "OFF" << std::endl;
-    (*out) << this->num_vertices() << " " << this->num_faces() << " 0" << std::endl;
-
-    for (unsigned int v = 0; v < this->num_vertices(); v++) {
-      (*out) << this->vertices[v](0) << " " << this->vertices[v](1) << " " << this->vertices[v](2) << std::endl;
-    }
-
-    for (unsigned int f = 0; f < this->num_faces(); f++) {
-      (*out) << "3 " << this->faces[f](0) << " " << this->faces[f](1) << " " << this->faces[f](2) << std::endl;
-    }
-
-    out->close();
-    delete out;
-
-    return true;
-  }
-
-  /** \brief Write mesh to OFF file.
-   * \param[in] filepath path to OFF file to write
-   * \return success
-   */
-  bool to_off_color(const std::string filepath) {
-    std::ofstream* out = new std::ofstream(filepath, std::ofstream::out);
-    if (!static_cast<bool>(out)) {
-      return false;
-    }
-
-    (*out) << "COFF" << std::endl;
-    (*out) << this->num_vertices_color() << " " << this->num_faces() << " 0" << std::endl;
-
-    for (unsigned int v = 0; v < this->num_vertices_color(); v++) {
-      (*out) << this->vertices_color[v](0) << " " << this->vertices_color[v](1) << " " << this->vertices_color[v](2)<< " "; // We do a line wrap for readability here
-      (*out) << this->vertices_color[v](3) << " " << this->vertices_color[v](4) << " " << this->vertices_color[v](5) << std::endl;
-    }
-
-    for (unsigned int f = 0; f < this->num_faces(); f++) {
-      (*out) << "3 " << this->faces[f](0) << " " << this->faces[f](1) << " " << this->faces[f](2) << std::endl;
-    }
-
-    out->close();
-    delete out;
-
-    return true;
-  }
-
-
-  /** \brief Add a vertex.
-   * \param[in] vertex vertex to add
-   */
-  void add_vertex(Eigen::Vector3f& vertex) {
-    this->vertices.push_back(vertex);
-  }
-
-  /** \brief Add a vertex with color.
-   * \param[in] vertex vertex to add
-   */
-  void add_vertex_color(Eigen::Matrix<float, 7, 1>& vertex) {
-    this->vertices_color.push_back(vertex);
-    // Remove this part. It is for debugging only
-    this->vertices.push_back(vertex.head(3));
-  }
-
-  /** \brief Get the number of vertices.
-   * \return number of vertices
-   */
-  int num_vertices() {
-    return static_cast<int>(this->vertices.size());
-  }
-
-  /** \brief Get the number of vertices.
-   * \return number of vertices
-   */
-  int num_vertices_color() {
-    return static_cast<int>(this->vertices_color.size());
-  }
-
-  /** \brief Add a face.
-   * \param[in] face face to add
-   */
-  void add_face(Eigen::Vector3i& face) {
-    this->faces.push_back(face);
-  }
-
-  /** \brief Get the number of faces.
-   * \return number of faces
-   */
-  int num_faces() {
-    return static_cast<int>(this->faces.size());
-  }
-
-  /** \brief Translate the mesh.
-   * \param[in] translation translation vector
-   */
-  void translate(const Eigen::Vector3f& translation) {
-    for (int v = 0; v < this->num_vertices(); ++v) {
-      for (int i = 0; i < 3; ++i) {
-        this->vertices[v](i) += translation(i);
-      }
-    }
-  }
-
-  /** \brief Scale the mesh.
-   * \param[in] scale scale vector
-   */
-  void scale(const Eigen::Vector3f& scale) {
-    for (int v = 0; v < this->num_vertices(); ++v) {
-      for (int i = 0; i < 3; ++i) {
-        this->vertices[v](i) *= scale(i);
-      }
-    }
-  }
-
-  /** \brief Voxelize the given mesh into a SDF.
-   * \param[out] sdf volume to fill with sdf values
-   */
-  void voxelize_sdf(Eigen::Tensor<float, 3, Eigen::RowMajor>& sdf, const VoxelizationMode &mode) {
-
-    int height = sdf.dimension(0);
-    int width = sdf.dimension(1);
-    int depth = sdf.dimension(2);
-
-    #pragma omp parallel
-    {
-      #pragma omp for
-      for (int i = 0; i < height*width*depth; i++) {
-        int d = i%depth;
-        int w = (i/depth)%width;
-        int h = (i/depth)/width;
-
-        sdf(h, w, d) = FLT_MAX;
-
-        // the box corresponding to this voxel
-        Eigen::Vector3f min(w, h, d);
-        Eigen::Vector3f max(w + 1, h + 1, d + 1);
-
-        Eigen::Vector3f center(w + 0.5f, h + 0.5f, d + 0.5f);
-        if (mode == VoxelizationMode::CORNER) {
-          center = Eigen::Vector3f(w, h, d);
-        }
+// Streaming HDF5 output, one volume at a time.
+#include "io/hdf5_writer.h"
+#include "io/sdf_quantization.h"
+#include "io/bit_occupancy.h"
 
-        // count number of intersections.
-        int num_intersect = 0;
-        for (unsigned int f = 0; f < this->num_faces(); ++f) {
-
-          Eigen::Vector3f v1 = this->vertices[this->faces[f](0)];
-          Eigen::Vector3f v2 = this->vertices[this->faces[f](1)];
-          Eigen::Vector3f v3 = this->vertices[this->faces[f](2)];
-
-          Eigen::Vector3f closest_point;
-          triangle_point_distance(center, v1, v2, v3, closest_point);
-          float distance = (center - closest_point).norm();
-
-          if (distance < sdf(h, w, d)) {
-            sdf(h, w, d) = distance;
-          }
-
-          bool intersect = triangle_ray_intersection(center, Eigen::Vector3f(0, 0, 0), v1, v2, v3, distance);
-
-          if (intersect && distance >= 0) {
-            num_intersect++;
-          }
-        }
-
-        if (num_intersect%2 == 1) {
-          sdf(h, w, d) *= -1;
-        }
-      }
-    }
-  }
-
-  /** \brief Voxelize the given mesh into an occupancy grid.
-   * \param[out] occ volume to fill
-   */
-  void voxelize_occ(Eigen::Tensor<int, 3, Eigen::RowMajor>& occ, const VoxelizationMode &mode) {
-
-    int height = occ.dimension(0);
-    int width = occ.dimension(1);
-    int depth = occ.dimension(2);
-
-    #pragma omp parallel
-    {
-      #pragma omp for
-      for (int i = 0; i < height*width*depth; i++) {
-        int d = i%depth;
-        int w = (i/depth)%width;
-        int h = (i/depth)/width;
-
-        Eigen::Vector3f min(w, h, d);
-        Eigen::Vector3f max(w + 1, h + 1, d + 1);
-
-        for (unsigned int f = 0; f < this->num_faces(); ++f) {
-
-          Eigen::Vector3f v1 = this->vertices[this->faces[f](0)];
-          Eigen::Vector3f v2 = this->vertices[this->faces[f](1)];
-          Eigen::Vector3f v3 = this->vertices[this->faces[f](2)];
-
-          bool overlap = triangle_box_intersection(min, max, v1, v2, v3);
-          if (overlap) {
-            occ(h, w, d) = 1;
-            std::cout<< "We found a match"<<std::endl;
-            break;
-          }
-        }
-      }
-    }
-  }
-
-  static float find_label(float & a, float& b, float &c){
-    //If any two match, return it
-    if (a == b || a == c) {
-        return a;
-    }
-    if (b == c){
-        return b;
-    }
-    // In worst case, just use the max value from the three
-    return std::max(std::max(a, b), c);
-  }
+// Binary cache of parsed meshes.
+#include "common/mesh_cache.h"
 
-  /** \brief Voxelize the given mesh into an occupancy grid.
-   * \param[out] occ volume to fill
-   */
-  void voxelize_occ_color(Eigen::Tensor<int, 4, Eigen::RowMajor>& occ, const VoxelizationMode &mode) {
-    
-    int height = occ.dimension(0);
-    int width = occ.dimension(1);
-    int depth = occ.dimension(2);
-
-
-    #pragma omp parallel
-    {
-      #pragma omp for
-      for (int i = 0; i < height*width*depth; i++) {
-        int d = i%depth;
-        int w = (i/depth)%width;
-        int h = (i/depth)/width;
-
-        Eigen::Vector3f min(w, h, d);
-        Eigen::Vector3f max(w + 1, h + 1, d + 1);
-
-        for (unsigned int f = 0; f < this->num_faces(); ++f) {
-          Eigen::Matrix<float, 7, 1> v1 = this->vertices_color[this->faces[f](0)];
-          Eigen::Matrix<float, 7, 1> v2 = this->vertices_color[this->faces[f](1)];
-          Eigen::Matrix<float, 7, 1> v3 = this->vertices_color[this->faces[f](2)];
-
-          // For checking the intersection we only need first three values ie coordinates
-          // Eigen::Vector3f vec1 = v1.head<3>();
-          // Eigen::Vector3f vec2 = v2.head<3>();
-          // Eigen::Vector3f vec3 = v3.head<3>();
-
-          // std::cout<< "Original value is "<< v1<<std::endl;
-          // std::cout<< "The head value is"<< vec1<<std::endl;
-
-          bool overlap = triangle_box_intersection_color(min, max, v1, v2, v3);
-          if (overlap) {
-            // Get the color from the three vertices and average them
-            occ(h, w, d, 0) = (int) (v1(3) + v2(3) + v3(3)) / 3;
-            occ(h, w, d, 1) = (int) (v1(4) + v2(4) + v3(4)) / 3;
-            occ(h, w, d, 2) = (int) (v1(5) + v2(5) + v3(5)) / 3;
-            // Take the three labels and find the most appropriate label
-            occ(h, w, d, 3) = (int) find_label(v1(6), v2(6), v3(6));
-            // std::cout<< "We found a match"<<std::endl;
-            break;
-          }
-        }
-      }
-    }
-  }
+// Chrome trace profiling and hardware counters.
+#include "common/trace.h"
+#include "common/perf_counters.h"
 
-private:
+// Always-on algorithmic counters.
+#include "common/voxel_stats.h"
 
-  /** \brief Vertices as (x,y,z)-vectors. */
-  std::vector<Eigen::Vector3f> vertices;
+// Memory prediction and budget.
+#include "common/memory_budget.h"
 
-  /** \brief Vertices as (x,y,z, r,g,b)-vectors. */
-  std::vector<Eigen::Matrix<float, 7, 1>> vertices_color;
+// Journal of directory runs for resuming.
+#include "common/journal.h"
 
-  /** \brief Faces as list of vertex indices. */
-  std::vector<Eigen::Vector3i> faces;
-};
+// Splitting directory runs over processes.
+#include "common/work_claims.h"
 
 /** \brief Write the given set of volumes to h5 file.
  * \param[in] filepath h5 file to write
@@ -699,9 +62,13 @@ private:
  * \param[in] width width of volumes
  * \param[in] depth depth of volumes
  * \param[in] dense volume data
+ * \param[in] quantization storage format of the values
  */
 template<int RANK>
-bool write_float_hdf5(const std::string filepath, Eigen::Tensor<float, RANK, Eigen::RowMajor>& tensor) {
+bool write_float_hdf5(const std::string filepath, Eigen::Tensor<float, RANK, Eigen::RowMajor>& tensor,
+    const SdfQuantization& quantization = SdfQuantization()) {
+  TraceScope scope("write");
+  PerfScope perf("write");
 
   try {
 
@@ -741,14 +108,23 @@ bool write_float_hdf5(const std::string filepath, Eigen::Tensor<float, RANK, Eig
      * Create a new dataset within the file using defined dataspace and
      * datatype and default dataset creation properties.
      */
-    H5::DataSet dataset = file.createDataSet("tensor", datatype, dataspace);
+    H5::DataSet dataset = quantization.is_identity() ? file.createDataSet("tensor", datatype, dataspace)
+      : file.createDataSet("tensor", quantization.type(), dataspace);
 
     /*
      * Write the data to the dataset using default memory space, file
      * space, and transfer properties.
      */
     float* data = static_cast<float*>(tensor.data());
-    dataset.write(data, H5::PredType::NATIVE_FLOAT);
+    if (quantization.is_identity()) {
+      dataset.write(data, H5::PredType::NATIVE_FLOAT);
+    }
+    else {
+      std::vector<uint8_t> buffer(tensor.size()*quantization.bytes());
+      quantization.quantize(data, tensor.size(), buffer.data());
+      dataset.write(buffer.data(), quantization.type());
+      quantization.write_attributes(dataset);
+    }
   }  // end of try block
 
   // catch failure caused by the H5File operations
@@ -775,6 +151,12 @@ bool write_float_hdf5(const std::string filepath, Eigen::Tensor<float, RANK, Eig
     return false;
   }
 
+  // catch failure caused by the Attribute operations
+  catch(H5::AttributeIException error) {
+    error.printError();
+    return false;
+  }
+
   return true;
 }
 
@@ -788,6 +170,8 @@ bool write_float_hdf5(const std::string filepath, Eigen::Tensor<float, RANK, Eig
  */
 template<int RANK>
 bool write_int_hdf5(const std::string filepath, Eigen::Tensor<int, RANK, Eigen::RowMajor>& tensor) {
+  TraceScope scope("write");
+  PerfScope perf("write");
 
   try {
 
@@ -865,6 +249,35 @@ bool write_int_hdf5(const std::string filepath, Eigen::Tensor<int, RANK, Eigen::
   return true;
 }
 
+/** \brief Read an OFF or COFF file, going through the mesh cache if it is enabled.
+ * \param[in] filepath path to the OFF file
+ * \param[in] color whether to read a COFF file with colors and labels
+ * \param[in] cache mesh cache
+ * \param[out] mesh read mesh
+ * \return success
+ */
+bool read_mesh(const std::string& filepath, bool color, MeshCache& cache, Mesh& mesh) {
+  TraceScope scope("parse");
+  PerfScope perf("parse");
+  uint64_t key = 0;
+
+  if (cache.enabled()) {
+    key = MeshCache::key(filepath, color ? "coff" : "off");
+
+    std::shared_ptr<MeshCacheEntry> entry = std::make_shared<MeshCacheEntry>();
+    if (cache.load(key, *entry) && Mesh::from_cache(entry, color, mesh)) {
+      return true;
+    }
+  }
+
+  bool success = color ? Mesh::from_off_color(filepath, mesh) : Mesh::from_off(filepath, mesh);
+  if (success && cache.enabled()) {
+    mesh.to_cache(cache, key);
+  }
+
+  return success;
+}
+
 /** \brief Read all files in a directory matching the given extension.
  * \param[in] directory path to directory
  * \param[out] files read file paths
@@ -883,6 +296,84 @@ void read_directory(const boost::filesystem::path directory, std::map<int, boost
   }
 }
 
+/** \brief Upper bound on the memory of a parsed mesh: the mapped file plus vertices and faces, which take less space than their text.
+ * \param[in] filepath mesh file
+ * \return bytes
+ */
+uint64_t predict_mesh_memory(const boost::filesystem::path& filepath) {
+  boost::system::error_code error;
+  uintmax_t size = boost::filesystem::file_size(filepath, error);
+  return error ? 0 : 2*static_cast<uint64_t>(size);
+}
+
+/** \brief Print the predicted memory and check it against the budget.
+ * \param[in] budget predicted allocations
+ * \return whether the run fits into the budget
+ */
+bool check_memory(const MemoryBudget& budget) {
+  budget.print();
+  if (!budget.fits()) {
+    std::cout << "The predicted memory exceeds --max_memory; voxelize fewer files at once or at a lower resolution." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/** \brief Print the triangle reduction of simplification and the voxelization time it saved.
+ *
+ * The saving is extrapolated from the voxelization time of the simplified meshes assuming time
+ * proportional to the number of triangles; large meshes voxelize faster per triangle once they
+ * fit in cache, so it is an upper estimate.
+ * \param[in] report simplification report
+ * \param[in] simplify_ms time spent simplifying
+ * \param[in] voxelize_ms time spent voxelizing the simplified meshes
+ */
+void report_simplification(const MeshSimplificationReport& report, double simplify_ms, double voxelize_ms) {
+  std::cout << "Simplified " << report.triangles_before << " to " << report.triangles_after << " triangles ("
+    << 100*report.ratio() << "%), moving vertices by at most " << report.max_displacement << " voxels";
+  if (report.kept_triangles > 0) {
+    std::cout << " and keeping " << report.kept_triangles << " collapsed triangles";
+  }
+  std::cout << "." << std::endl;
+
+  const double removed = static_cast<double>(report.triangles_before - report.triangles_after);
+  const double saved = report.triangles_after > 0 ? voxelize_ms*removed/report.triangles_after : 0;
+  std::cout << "Simplifying took " << simplify_ms << " ms and saved up to about " << saved << " ms of voxelization ("
+    << voxelize_ms << " ms), " << saved - simplify_ms << " ms net." << std::endl;
+}
+
+/** \brief Select the items a run still has to voxelize; a resumed run skips items that are written with an unchanged hash as well as quarantined items.
+ * \param[in] items all items with their hashes
+ * \param[in] journal journal of previous runs
+ * \param[in] writer output, tells which volumes are complete
+ * \param[out] done number of items skipped as already written
+ * \param[out] quarantined number of items skipped as quarantined
+ * \return items to voxelize
+ */
+template<typename Scalar>
+std::vector<PipelineItem> pending_items(const std::vector<PipelineItem>& items, const Journal& journal, const Hdf5VolumeWriter<Scalar>& writer,
+    size_t& done, size_t& quarantined) {
+  std::vector<PipelineItem> pending;
+  done = 0;
+  quarantined = 0;
+
+  for (size_t i = 0; i < items.size(); i++) {
+    JournalEntry entry = journal.get(items[i].path, items[i].hash);
+    if (entry.status == JOURNAL_DONE && writer.is_resumed() && writer.is_written(items[i].index)) {
+      done++;
+    }
+    else if (entry.status == JOURNAL_QUARANTINED) {
+      std::cout << "Skipping quarantined \"" << items[i].path << "\" after " << entry.attempts << " failed attempts." << std::endl;
+      quarantined++;
+    }
+    else {
+      pending.push_back(items[i]);
+    }
+  }
+
+  return pending;
+}
+
 /** \brief Main entrance point of the script.
  * Expects one parameter, the path to the corresponding config file in config/.
  */
@@ -896,6 +387,25 @@ int main(int argc, char** argv) {
       ("width", boost::program_options::value<int>()->default_value(32), "width of volume, corresponding to x-axis (=right")
       ("depth", boost::program_options::value<int>()->default_value(32), "depth of volume, corresponding to z-axis (=forward)")
       ("center", boost::program_options::bool_switch()->default_value(false), "by default, the top-left-front corner is used for SDF computation; if instead the voxel centers should be used, set this flag")
+      ("sdf_format", boost::program_options::value<std::string>()->default_value("float32"), "sdf mode: storage format of the SDFs, 'float32', 'float16', 'int16' or 'int8'; the integer formats map [-truncation, truncation] linearly onto the integer range and store the step as 'scale' attribute of the tensor")
+      ("truncation", boost::program_options::value<float>()->default_value(0), "sdf mode: clamp the stored SDFs to [-truncation, truncation] (in voxels), required by the integer formats; disabled if 0")
+      ("occ_format", boost::program_options::value<std::string>()->default_value("dense"), "occ mode on directories: storage format of the occupancy grids, 'dense' (32 bit integers) or 'bits' (packed 32 voxels per word along the depth, the layout of the gpu-vox voxel table)")
+      ("clean", boost::program_options::bool_switch()->default_value(false), "weld vertices and remove degenerate (zero area) and duplicate triangles before voxelizing, and report what was removed")
+      ("weld", boost::program_options::value<float>()->default_value(0), "with --clean: weld vertices closer than this distance in voxels; 0 welds only vertices at identical positions")
+      ("simplify", boost::program_options::value<float>()->default_value(0), "simplify meshes before voxelizing by clustering vertices in cells of this size in voxels; at most 0.288, so that the surface moves by less than half a voxel (Hausdorff distance), reports the triangle reduction and the time saved; disabled if 0")
+      ("cache_dir", boost::program_options::value<std::string>()->default_value(""), "directory of the binary mesh cache; parsed meshes are stored there keyed by their content and reused by later runs, disabled if empty")
+      ("cache_size", boost::program_options::value<int>()->default_value(4096), "size limit of the mesh cache in MB, least recently used meshes are evicted beyond it")
+      ("trace", boost::program_options::value<std::string>()->default_value(""), "write a Chrome trace (JSON, open in chrome://tracing or ui.perfetto.dev) of the parse, voxelize and write stages to this file, disabled if empty")
+      ("trace_detail", boost::program_options::bool_switch()->default_value(false), "also trace every brick of voxels per thread")
+      ("stats", boost::program_options::value<std::string>()->default_value(""), "write the algorithmic counters of every mesh (triangles, voxels and triangle-voxel pairs tested, cull rates, marks, SDF distance and ray tests) as JSON to this file and print their totals, disabled if empty")
+      ("perf_counters", boost::program_options::value<std::string>()->default_value(""), "count cycles, instructions, LLC misses and branch misses per stage and thread (Linux perf_event_open), print them and write them as JSON to this file, disabled if empty")
+      ("parsers", boost::program_options::value<int>()->default_value(0), "directory mode: number of threads parsing meshes ahead of the voxelizers, chosen automatically if 0")
+      ("workers", boost::program_options::value<int>()->default_value(0), "directory mode: number of meshes voxelized concurrently, each with an equal share of the OpenMP threads; chosen automatically from the grid size if 0, e.g. 8 workers of 8 threads at 32^3 on 64 threads")
+      ("max_memory", boost::program_options::value<int>()->default_value(0), "memory budget in MB; the memory needed for the volumes and meshes is predicted before voxelizing and the run is refused if it exceeds the budget, unlimited if 0")
+      ("resume", boost::program_options::bool_switch()->default_value(false), "directory mode: resume a previous run into the same output, skipping the files its journal (the output file name with .journal appended) records as written with unchanged content and parameters, and retrying failed ones")
+      ("max_attempts", boost::program_options::value<int>()->default_value(3), "directory mode: number of runs that may fail to read a file before it is quarantined, i.e. skipped by resumed runs")
+      ("shard", boost::program_options::value<std::string>()->default_value(""), "directory mode: only voxelize shard i of n, given as i/n, i.e. the i-th of n equal ranges of files; every shard writes its own output, merge them with merge_shards")
+      ("claim_dir", boost::program_options::value<std::string>()->default_value(""), "directory mode: share the files with other processes using this directory (e.g. on a shared filesystem), every process claims the files it voxelizes and writes its own output, merge them with merge_shards; disabled if empty")
       ("output", boost::program_options::value<std::string>(), "output file, will be a HDF5 file containing either a N x C x height x width x depth tensor or a C x height x width x depth tensor, where N is the number of files and C=2 the number of channels, N is discarded if only a single file is processed; should have the .h5 extension");
 
   boost::program_options::positional_options_description positionals;
@@ -924,6 +434,34 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  // The SDF storage options only apply to SDFs, occupancy grids keep float32.
+  SdfQuantization quantization;
+  if (mode == "sdf") {
+    if (!SdfQuantization::parse(parameters["sdf_format"].as<std::string>(), parameters["truncation"].as<float>(), quantization)) {
+      std::cout << "Invalid SDF format, choose from float32, float16, int16 or int8; the integer formats need a positive truncation." << std::endl;
+      return 1;
+    }
+  }
+  else if (!parameters["sdf_format"].defaulted() || !parameters["truncation"].defaulted()) {
+    std::cout << "Ignoring --sdf_format and --truncation, they only apply to sdf mode." << std::endl;
+  }
+  OccupancyFormat occupancy_format;
+  if (!parse_occupancy_format(parameters["occ_format"].as<std::string>(), occupancy_format)) {
+    std::cout << "Invalid occupancy format, choose from dense or bits." << std::endl;
+    return 1;
+  }
+
+  if (mode == "sdf" && !quantization.is_identity()) {
+    std::cout << "Storing SDFs as " << quantization.name();
+    if (quantization.truncation > 0) {
+      std::cout << " truncated to " << quantization.truncation;
+    }
+    if (quantization.is_integer()) {
+      std::cout << " with a step of " << quantization.scale();
+    }
+    std::cout << "." << std::endl;
+  }
+
   boost::filesystem::path input(parameters["input"].as<std::string>());
   if (!boost::filesystem::is_directory(input) && !boost::filesystem::is_regular_file(input)) {
     std::cout << "Input is neither directory nor file." << std::endl;
@@ -931,7 +469,7 @@ int main(int argc, char** argv) {
   }
 
   boost::filesystem::path output(parameters["output"].as<std::string>());
-  if (boost::filesystem::is_regular_file(output)) {
+  if (boost::filesystem::is_regular_file(output) && !parameters["resume"].as<bool>()) {
     std::cout << "Output file already exists; overwriting." << std::endl;
   }
 
@@ -951,25 +489,88 @@ int main(int argc, char** argv) {
 
   std::cout << "Voxelizing into " << height << " x " << width << " x " << depth << " (height x width x depth)." << std::endl;
 
+  const bool clean = parameters["clean"].as<bool>();
+  const float weld = std::max(0.f, parameters["weld"].as<float>());
+  if (clean) {
+    std::cout << "Cleaning meshes, welding vertices within " << weld << " voxels." << std::endl;
+  }
+
+  const float simplify = parameters["simplify"].as<float>();
+  if (simplify < 0 || simplify > SIMPLIFICATION_MAX_CELL) {
+    std::cout << "Invalid simplification cell size, choose from 0 to " << SIMPLIFICATION_MAX_CELL << " voxels." << std::endl;
+    return 1;
+  }
+  if (simplify > 0) {
+    std::cout << "Simplifying meshes by clustering vertices in cells of " << simplify << " voxels." << std::endl;
+  }
+
+  MeshCache cache(parameters["cache_dir"].as<std::string>(), static_cast<uint64_t>(parameters["cache_size"].as<int>()) << 20);
+
+  std::string trace = parameters["trace"].as<std::string>();
+  if (!trace.empty()) {
+    Tracer::instance().enable(parameters["trace_detail"].as<bool>());
+  }
+
+  std::string stats = parameters["stats"].as<std::string>();
+  if (!stats.empty()) {
+    VoxelStats::instance().enable();
+  }
+
+  std::string perf_counters = parameters["perf_counters"].as<std::string>();
+  if (!perf_counters.empty()) {
+    PerfCounters::instance().enable();
+  }
+
+  MemoryBudget budget(static_cast<uint64_t>(std::max(0, parameters["max_memory"].as<int>())) << 20);
+  int exit_code = 0;
+  const uint64_t voxels = static_cast<uint64_t>(height)*width*depth;
+
   if (boost::filesystem::is_regular_file(input)) {
 
     std::cout<<"Entering regular file section"<<std::endl;
+
+    budget.add("mesh (at most)", predict_mesh_memory(input));
+    budget.add("volume", voxels*(mode == "sdf" ? sizeof(float) : 4*sizeof(int)));
+    if (!check_memory(budget)) {
+      return 1;
+    }
+
     Mesh mesh;
 
     // bool success = Mesh::from_ply(input.string(), mesh);
-    bool success = Mesh::from_off_color(input.string(), mesh);
+    bool success = read_mesh(input.string(), true, cache, mesh);
     // bool success = Mesh::from_off(input.string(), mesh);
       if (!success) {
       std::cout << "Could not read " << input << "." << std::endl; //<< "trying off as backup";
     }
 
+    if (clean) {
+      MeshCleaningReport report = mesh.clean(weld);
+      VoxelStats::instance().add(input.string(), "clean", report.stats());
+      std::cout << "Cleaned " << input << ": welded " << report.welded_vertices << " vertices, removed "
+        << report.degenerate_triangles << " degenerate and " << report.duplicate_triangles << " duplicate triangles." << std::endl;
+    }
+
+    MeshSimplificationReport simplification;
+    double simplify_ms = 0;
+    if (simplify > 0) {
+      const uint64_t start = Tracer::now();
+      simplification = mesh.simplify(simplify);
+      simplify_ms = (Tracer::now() - start)/1e6;
+    }
+    const uint64_t voxelize_start = Tracer::now();
+
     if (mode == "sdf") {
       Eigen::Tensor<float, 3, Eigen::RowMajor> tensor(height, width, depth);
 
       mesh.voxelize_sdf(tensor, voxelization_mode);
+      VoxelStats::instance().add(input.string(), "voxelize_sdf", mesh.stats());
       std::cout << "Voxelized " << input << "." << std::endl;
+      if (simplify > 0) {
+        report_simplification(simplification, simplify_ms, (Tracer::now() - voxelize_start)/1e6);
+      }
 
-      bool success = write_float_hdf5<3>(output.string(), tensor);
+      bool success = write_float_hdf5<3>(output.string(), tensor, quantization);
 
       if (!success) {
         std::cout << "Could not write " << output << "." << std::endl;
@@ -977,12 +578,19 @@ int main(int argc, char** argv) {
       }
     }
     if (mode == "occ") {
-      
+      if (occupancy_format != OccupancyFormat::DENSE) {
+        std::cout << "Single files are voxelized with colors and labels, which are not binary; writing them dense." << std::endl;
+      }
+
       Eigen::Tensor<int, 4, Eigen::RowMajor> tensor(height, width, depth, 4);
       tensor.setZero();
 
       mesh.voxelize_occ_color(tensor, voxelization_mode);
+      VoxelStats::instance().add(input.string(), "voxelize_occ_color", mesh.stats());
       std::cout << "Voxelized " << input << "." << std::endl;
+      if (simplify > 0) {
+        report_simplification(simplification, simplify_ms, (Tracer::now() - voxelize_start)/1e6);
+      }
 
       bool success = write_int_hdf5<4>(output.string(), tensor);
       // bool success = mesh.to_off_color(output.string());
@@ -1008,69 +616,282 @@ int main(int argc, char** argv) {
 
     std::cout << "Read " << input_files.size() << " files." << std::endl;
 
-    if (mode == "sdf") {
-      Eigen::Tensor<float, 4, Eigen::RowMajor> tensor(input_files.size(), height, width, depth);
+    std::vector<PipelineItem> items = pipeline_items(input_files);
 
-      int i = 0;
-      for (std::map<int, boost::filesystem::path>::iterator it = input_files.begin(); it != input_files.end(); it++) {
-        Mesh mesh;
-        bool success = Mesh::from_off(it->second.string(), mesh);
+    // A static shard is a contiguous range of positions, so the merged output maps few ranges per shard.
+    const std::string shard = parameters["shard"].as<std::string>();
+    if (!shard.empty()) {
+      int shard_index = 0, shard_count = 1;
+      if (!parse_shard(shard, shard_index, shard_count)) {
+        std::cout << "Invalid shard " << shard << ", expected i/n with 0 <= i < n." << std::endl;
+        return 1;
+      }
 
-        if (!success) {
-          std::cout << "Could not read " << it->second << "." << std::endl;
-          return 1;
-        }
+      const int64_t n = static_cast<int64_t>(input_files.size());
+      items.erase(std::remove_if(items.begin(), items.end(), [&](const PipelineItem& item) {
+        return item.index < shard_index*n/shard_count || item.index >= (shard_index + 1)*n/shard_count;
+      }), items.end());
+      std::cout << "Voxelizing shard " << shard_index << " of " << shard_count << ": " << items.size() << " files." << std::endl;
+    }
+
+    std::unique_ptr<WorkClaims> claims;
+    const std::string claim_dir = parameters["claim_dir"].as<std::string>();
+    if (!claim_dir.empty()) {
+      claims.reset(new WorkClaims(claim_dir));
+      if (!claims->is_open()) {
+        return 1;
+      }
+      std::cout << "Claiming files from other processes in " << claim_dir << "." << std::endl;
+    }
 
-        Eigen::Tensor<float, 3, Eigen::RowMajor> slice(height, width, depth);
-        mesh.voxelize_sdf(slice, voxelization_mode);
-        tensor.chip(i, 0) = slice;
-        std::cout << "Voxelized " << it->second << " (" << (i + 1) << " of " << input_files.size() << ")." << std::endl;
+    PipelineConfig config = PipelineConfig::choose(items.size(), voxels, omp_get_max_threads(),
+      parameters["parsers"].as<int>(), parameters["workers"].as<int>());
+    std::cout << "Voxelizing with " << config.parsers << " parsers and " << config.workers << " workers of "
+      << config.threads_per_worker << " threads, largest meshes first." << std::endl;
 
-        i++;
+    // Meshes are held by the parsers, the queues and the workers, volumes by the workers, the queue and the writer;
+    // the output is written one volume at a time.
+    const uint64_t meshes_in_flight = config.parsers + config.queue_capacity + config.workers;
+    const uint64_t slices_in_flight = config.workers + config.queue_capacity + 1;
+    budget.add("meshes (at most)", meshes_in_flight*(items.empty() ? 0 : predict_mesh_memory(items[0].path)));
+    budget.add("slices", slices_in_flight*voxels*sizeof(float));
+    if (!check_memory(budget)) {
+      return 1;
+    }
+
+    // Hash every input together with the parameters and its position, so changed inputs, parameters or directories are redone.
+    const bool resume = parameters["resume"].as<bool>();
+    const int max_attempts = std::max(1, parameters["max_attempts"].as<int>());
+    const std::string params = mode + ";" + std::to_string(height) + "x" + std::to_string(width) + "x" + std::to_string(depth)
+      + ";" + (voxelization_mode == VoxelizationMode::CENTER ? "center" : "corner")
+      + (mode == "sdf" ? std::string(";") + quantization.name() + ";" + std::to_string(quantization.truncation) : std::string())
+      + (mode == "occ" && occupancy_format == OccupancyFormat::BITS ? ";bits" : "")
+      + (clean ? ";clean;" + std::to_string(weld) : "")
+      + (simplify > 0 ? ";simplify;" + std::to_string(simplify) : "");
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < static_cast<int64_t>(items.size()); i++) {
+      items[i].hash = MeshCache::key(items[i].path, params + ";" + std::to_string(items[i].index));
+    }
+
+    Journal journal(output.string() + ".journal", resume);
+    if (!journal.is_open()) {
+      return 1;
+    }
+
+    // Cleaning and simplification run on the parser threads, ahead of the voxelizers.
+    std::mutex cleaning_mutex;
+    MeshCleaningReport cleaning;
+    MeshSimplificationReport simplification;
+    std::atomic<uint64_t> simplify_ns(0), voxelize_ns(0);
+    auto parse = [&](const PipelineItem& item, Mesh& mesh) {
+      if (!read_mesh(item.path, false, cache, mesh)) {
+        return false;
+      }
+      if (clean) {
+        MeshCleaningReport report = mesh.clean(weld);
+        VoxelStats::instance().add(item.path, "clean", report.stats());
+        std::lock_guard<std::mutex> lock(cleaning_mutex);
+        cleaning += report;
+      }
+      if (simplify > 0) {
+        const uint64_t start = Tracer::now();
+        MeshSimplificationReport report = mesh.simplify(simplify);
+        simplify_ns += Tracer::now() - start;
+        std::lock_guard<std::mutex> lock(cleaning_mutex);
+        simplification += report;
+      }
+      return true;
+    };
+
+    // Claims are named by position and hash, so processes with other inputs or parameters never collide.
+    auto claim_name = [](const PipelineItem& item) {
+      char name[64];
+      snprintf(name, sizeof(name), "%d-%016llx", item.index, static_cast<unsigned long long>(item.hash));
+      return std::string(name);
+    };
+
+    auto claim = [&claims, &claim_name](const PipelineItem& item) {
+      return !claims || claims->claim(claim_name(item));
+    };
+
+    auto location = [&output](const PipelineItem& item) {
+      return output.string() + ":" + std::to_string(item.index);
+    };
+
+    // Parse failures are reported by the parser threads, everything else by the writer.
+    std::mutex report_mutex;
+    size_t written = 0, failed_items = 0, quarantined_items = 0;
+    size_t skipped_done = 0, skipped_quarantined = 0, n_pending = 0;
+
+    auto parse_failed = [&](const PipelineItem& item) {
+      if (claims) {
+        claims->release(claim_name(item));
+      }
+      JournalStatus status = journal.record(item.path, item.hash, JOURNAL_FAILED, location(item), "could not read", max_attempts);
+      std::lock_guard<std::mutex> lock(report_mutex);
+      if (status == JOURNAL_QUARANTINED) {
+        std::cout << "Could not read \"" << item.path << "\"; quarantined after " << max_attempts << " failed attempts." << std::endl;
+        quarantined_items++;
+      }
+      else {
+        std::cout << "Could not read \"" << item.path << "\"; will be retried by --resume." << std::endl;
+        failed_items++;
+      }
+    };
+
+    auto progress = [&](const PipelineItem& item) {
+      journal.record(item.path, item.hash, JOURNAL_DONE, location(item));
+      if (claims) {
+        claims->complete(claim_name(item));
+      }
+      std::lock_guard<std::mutex> lock(report_mutex);
+      written++;
+      std::cout << "Voxelized \"" << item.path << "\" (" << written << " of " << n_pending << ")." << std::endl;
+    };
+
+    auto resumed = [&](bool is_resumed, size_t n_items) {
+      if (resume && !is_resumed) {
+        std::cout << "Could not resume " << output << " (missing or different type, SDF format or dimensions); starting over." << std::endl;
+      }
+      if (skipped_done > 0 || skipped_quarantined > 0) {
+        std::cout << "Resuming: " << skipped_done << " files already written, " << skipped_quarantined << " quarantined, "
+          << n_items << " left." << std::endl;
+      }
+      n_pending = n_items;
+    };
+
+    // A single process writes every volume, into a contiguous tensor that readers can map; shards and claimed
+    // files fill only some of the volumes, so their tensor stays chunked and the others take no space.
+    const size_t volume_count = shard.empty() && !claims ? input_files.size() : 0;
+
+    std::string failed;
+    if (mode == "sdf") {
+      typedef Eigen::Tensor<float, 3, Eigen::RowMajor> Volume;
+      Hdf5VolumeWriter<float> writer(output.string(), height, width, depth, resume, quantization, volume_count);
+      if (!writer.is_open()) {
+        std::cout << "Could not write " << output << "." << std::endl;
+        return 1;
       }
 
-      bool success = write_float_hdf5<4>(output.string(), tensor);
+      std::vector<PipelineItem> pending = pending_items(items, journal, writer, skipped_done, skipped_quarantined);
+      resumed(writer.is_resumed(), pending.size());
+
+      bool success = run_pipeline<Volume>(pending, config, Volume::Dimensions(height, width, depth), claim, parse, parse_failed,
+        [&voxelization_mode, &voxelize_ns](const PipelineItem& item, Mesh& mesh, Volume& slice) {
+          const uint64_t start = Tracer::now();
+          mesh.voxelize_sdf(slice, voxelization_mode);
+          voxelize_ns += Tracer::now() - start;
+          VoxelStats::instance().add(item.path, "voxelize_sdf", mesh.stats());
+        },
+        [&writer, &progress](const PipelineItem& item, const Volume& slice) {
+          if (!writer.write(item.index, slice.data())) {
+            return false;
+          }
+          progress(item);
+          return true;
+        },
+        failed);
 
       if (!success) {
+        std::cout << "Could not write \"" << failed << "\" to " << output << "; rerun with --resume." << std::endl;
+        return 1;
+      }
+      if (!writer.reserve(input_files.size())) {
         std::cout << "Could not write " << output << "." << std::endl;
         return 1;
       }
     }
     if (mode == "occ") {
-      Eigen::Tensor<int, 4, Eigen::RowMajor> tensor(input_files.size(), height, width, depth);
-      tensor.setZero();
-
-      int i = 0;
-      for (std::map<int, boost::filesystem::path>::iterator it = input_files.begin(); it != input_files.end(); it++) {
-        Mesh mesh;
-        bool success = Mesh::from_off(it->second.string(), mesh);
-
-        if (!success) {
-          std::cout << "Could not read " << it->second << "." << std::endl;
-          return 1;
-        }
-
-        Eigen::Tensor<int, 3, Eigen::RowMajor> slice(height, width, depth);
-        slice.setZero();
-
-        mesh.voxelize_occ(slice, voxelization_mode);
-        tensor.chip(i, 0) = slice;
-        std::cout << "Voxelized " << it->second << " (" << (i + 1) << " of " << input_files.size() << ")." << std::endl;
-
-        i++;
+      typedef Eigen::Tensor<int, 3, Eigen::RowMajor> Volume;
+      Hdf5VolumeWriter<int> writer(output.string(), height, width, depth, resume, occupancy_format, volume_count);
+      if (!writer.is_open()) {
+        std::cout << "Could not write " << output << "." << std::endl;
+        return 1;
       }
 
-      bool success = write_int_hdf5<4>(output.string(), tensor);
+      std::vector<PipelineItem> pending = pending_items(items, journal, writer, skipped_done, skipped_quarantined);
+      resumed(writer.is_resumed(), pending.size());
+
+      bool success = run_pipeline<Volume>(pending, config, Volume::Dimensions(height, width, depth), claim, parse, parse_failed,
+        [&voxelization_mode, &voxelize_ns](const PipelineItem& item, Mesh& mesh, Volume& slice) {
+          const uint64_t start = Tracer::now();
+          slice.setZero();
+          mesh.voxelize_occ(slice, voxelization_mode);
+          voxelize_ns += Tracer::now() - start;
+          VoxelStats::instance().add(item.path, "voxelize_occ", mesh.stats());
+        },
+        [&writer, &progress](const PipelineItem& item, const Volume& slice) {
+          if (!writer.write(item.index, slice.data())) {
+            return false;
+          }
+          progress(item);
+          return true;
+        },
+        failed);
 
       if (!success) {
+        std::cout << "Could not write \"" << failed << "\" to " << output << "; rerun with --resume." << std::endl;
+        return 1;
+      }
+      if (!writer.reserve(input_files.size())) {
         std::cout << "Could not write " << output << "." << std::endl;
         return 1;
       }
     }
 
+    if (clean) {
+      std::cout << "Cleaning welded " << cleaning.welded_vertices << " vertices and removed " << cleaning.degenerate_triangles
+        << " degenerate and " << cleaning.duplicate_triangles << " duplicate triangles." << std::endl;
+    }
+    if (simplify > 0) {
+      report_simplification(simplification, simplify_ns/1e6, voxelize_ns/1e6);
+    }
+    if (failed_items > 0 || quarantined_items > 0) {
+      std::cout << "Could not read " << failed_items + quarantined_items << " files, " << quarantined_items << " of them quarantined." << std::endl;
+    }
+    if (failed_items > 0) {
+      std::cout << "Rerun with --resume to retry the failed files." << std::endl;
+      exit_code = 1;
+    }
+
     std::cout << "Wrote " << output << "." << std::endl;
-    std::cout << "The output is a " << input_files.size() << " x " << height << " x " << width << " x " << depth << " tensor." << std::endl;
+    std::cout << "The output is a " << input_files.size() << " x " << height << " x " << width << " x " << depth << " tensor";
+    if (mode == "occ" && occupancy_format == OccupancyFormat::BITS) {
+      std::cout << ", packed into " << input_files.size() << " x " << height << " x " << width << " x " << bit_words(depth) << " words";
+    }
+    std::cout << "." << std::endl;
+    if (!shard.empty() || claims) {
+      std::cout << "It holds only the volumes voxelized by this process; merge the outputs of all processes with merge_shards." << std::endl;
+    }
+  }
+
+  budget.report();
+
+  if (!stats.empty()) {
+    VoxelStats::instance().print();
+    if (!VoxelStats::instance().write(stats)) {
+      std::cout << "Could not write " << stats << "." << std::endl;
+      return 1;
+    }
+    std::cout << "Wrote stats " << stats << "." << std::endl;
+  }
+
+  if (!perf_counters.empty()) {
+    PerfCounters::instance().print();
+    if (!PerfCounters::instance().write(perf_counters)) {
+      std::cout << "Could not write " << perf_counters << "." << std::endl;
+      return 1;
+    }
+    std::cout << "Wrote counters " << perf_counters << "." << std::endl;
+  }
+
+  if (!trace.empty()) {
+    if (!Tracer::instance().write(trace)) {
+      std::cout << "Could not write " << trace << "." << std::endl;
+      return 1;
+    }
+    std::cout << "Wrote trace " << trace << "." << std::endl;
   }
 
-  return 0;
+  return exit_code;
 }
\ No newline at end of file
@@ -0,0 +1,303 @@
+#ifndef MARCHING_CUBES_H_
+#define MARCHING_CUBES_H_
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// OpenMP
+#include <omp.h>
+
+#include "mesh.h"
+
+/*
+ * Marching cubes over the SDF volumes of voxelize_sdf.
+ *
+ * Sample (h, w, d) of a height x width x depth volume lies at (w, h, d) for VoxelizationMode::CORNER
+ * and at (w + 0.5, h + 0.5, d + 0.5) for VoxelizationMode::CENTER, the points voxelize_sdf measures
+ * the distance at, so the surface comes out in the coordinates of the voxelized meshes. Samples below
+ * the iso value are inside; the triangles face outwards.
+ *
+ * The volume is split into slabs of planes along the height, processed in parallel. Every edge of
+ * the sample grid crossing the surface gets one vertex, owned by the plane of its lower sample, so
+ * vertices on edges shared by cubes, also across slabs, exist once: a first pass counts the vertices
+ * of every slab, their prefix sum gives the first vertex of every slab, and the second pass numbers
+ * the vertices of a plane in a fixed order wherever the plane is needed.
+ */
+
+/** \brief Edges of the cube as pairs of corners; corner c is at (c & 1, (c >> 1) & 1, (c >> 2) & 1)
+ * along (depth, width, height), edges 0-3 run along the depth, 4-7 along the width and 8-11 along the height.
+ */
+const int MARCHING_CUBES_EDGES[12][2] = {
+  {0, 1}, {2, 3}, {4, 5}, {6, 7},
+  {0, 2}, {1, 3}, {4, 6}, {5, 7},
+  {0, 4}, {1, 5}, {2, 6}, {3, 7}
+};
+
+/** \brief Faces of the cube as corners in counter-clockwise order seen from outside the cube. */
+const int MARCHING_CUBES_FACES[6][4] = {
+  {0, 4, 6, 2}, {1, 3, 7, 5},
+  {0, 1, 5, 4}, {2, 6, 7, 3},
+  {0, 2, 3, 1}, {4, 5, 7, 6}
+};
+
+/** \brief Sample planes per slab, the unit of work of a thread. */
+const int MARCHING_CUBES_SLAB = 4;
+
+/** \brief Edge of the cube between two corners, -1 if they do not share one.
+ * \param[in] a corner
+ * \param[in] b corner
+ * \return edge
+ */
+inline int marching_cubes_edge(int a, int b) {
+  for (int e = 0; e < 12; e++) {
+    if ((MARCHING_CUBES_EDGES[e][0] == a && MARCHING_CUBES_EDGES[e][1] == b) || (MARCHING_CUBES_EDGES[e][0] == b && MARCHING_CUBES_EDGES[e][1] == a)) {
+      return e;
+    }
+  }
+  return -1;
+}
+
+/** \brief Check whether two edges of the cube lie on a common face.
+ * \param[in] e edge
+ * \param[in] f edge
+ * \return on a common face
+ */
+inline bool marching_cubes_coplanar(int e, int f) {
+  for (int face = 0; face < 6; face++) {
+    int found = 0;
+    for (int i = 0; i < 4; i++) {
+      const int edge = marching_cubes_edge(MARCHING_CUBES_FACES[face][i], MARCHING_CUBES_FACES[face][(i + 1)%4]);
+      found += (edge == e) + (edge == f);
+    }
+    if (found == 2) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** \brief Triangles of every cube case as triples of edges.
+ *
+ * Instead of the classic hand-written table, the table is derived once from the faces: walking the
+ * corners of a face counter-clockwise, the surface leaves the inside corners on every edge from an
+ * inside to an outside corner and comes back on the preceding edge from an outside to an inside corner.
+ * On a face with two diagonal inside corners this separates the inside corners, a choice that only
+ * depends on the face, so the two cubes sharing a face always agree and the surface has no cracks.
+ * The segments of the six faces form closed loops. A loop crossing a face twice has diagonals lying
+ * on that face, which the neighbouring cube may use as well, so loops are split along diagonals
+ * between edges on no common face until only triangles are left.
+ * \return table, indexed by the case (bit c set if corner c is inside)
+ */
+inline const std::vector<std::array<int, 3> >* marching_cubes_table() {
+  static const std::vector<std::vector<std::array<int, 3> > > table = [] {
+    std::vector<std::vector<std::array<int, 3> > > cases(256);
+    for (int c = 0; c < 256; c++) {
+      // next[e] is the edge the surface runs to from edge e
+      int next[12];
+      std::fill(next, next + 12, -1);
+      for (int f = 0; f < 6; f++) {
+        const int* corners = MARCHING_CUBES_FACES[f];
+        for (int i = 0; i < 4; i++) {
+          const int a = corners[i], b = corners[(i + 1)%4];
+          if (!((c >> a) & 1) || ((c >> b) & 1)) {
+            continue;
+          }
+          // Leaving at edge (a, b): back to the closest preceding edge entering the inside corners
+          for (int j = 1; j < 4; j++) {
+            const int p = corners[(i - j + 4)%4], q = corners[(i - j + 5)%4];
+            if (!((c >> p) & 1) && ((c >> q) & 1)) {
+              next[marching_cubes_edge(a, b)] = marching_cubes_edge(p, q);
+              break;
+            }
+          }
+        }
+      }
+
+      bool visited[12] = {false};
+      for (int e = 0; e < 12; e++) {
+        if (next[e] < 0 || visited[e]) {
+          continue;
+        }
+        std::vector<int> loop;
+        for (int k = e; !visited[k]; k = next[k]) {
+          visited[k] = true;
+          loop.push_back(k);
+        }
+        std::vector<std::vector<int> > polygons(1, loop);
+        while (!polygons.empty()) {
+          std::vector<int> polygon = polygons.back();
+          polygons.pop_back();
+          const size_t n = polygon.size();
+          if (n == 3) {
+            cases[c].push_back({polygon[0], polygon[2], polygon[1]});
+            continue;
+          }
+          size_t i = 0, j = 2;
+          for (size_t k = 0; k < n*n; k++) {
+            if (k%n >= k/n + 2 && !(k/n == 0 && k%n == n - 1) && !marching_cubes_coplanar(polygon[k/n], polygon[k%n])) {
+              i = k/n;
+              j = k%n;
+              break;
+            }
+          }
+          polygons.push_back(std::vector<int>(polygon.begin() + i, polygon.begin() + j + 1));
+          std::vector<int> rest(polygon.begin(), polygon.begin() + i + 1);
+          rest.insert(rest.end(), polygon.begin() + j, polygon.end());
+          polygons.push_back(rest);
+        }
+      }
+    }
+    return cases;
+  }();
+  return table.data();
+}
+
+/** \brief Triangle mesh extracted by marching cubes. */
+struct MarchingCubesMesh {
+  /** \brief Vertices, x, y and z each. */
+  std::vector<float> vertices;
+  /** \brief Triangles, three vertex indices each. */
+  std::vector<int32_t> faces;
+
+  /** \brief Number of vertices. */
+  size_t num_vertices() const {
+    return this->vertices.size()/3;
+  }
+
+  /** \brief Number of triangles. */
+  size_t num_faces() const {
+    return this->faces.size()/3;
+  }
+};
+
+/** \brief Extract the iso surface of a volume with marching cubes, slabs in parallel.
+ * \param[in] sdf height x width x depth values in row-major order
+ * \param[in] height height
+ * \param[in] width width
+ * \param[in] depth depth
+ * \param[in] mode sample positions used by voxelize_sdf
+ * \param[in] iso iso value
+ * \param[out] mesh mesh
+ */
+inline void marching_cubes(const float* sdf, int height, int width, int depth, const VoxelizationMode& mode, float iso, MarchingCubesMesh& mesh) {
+  const std::vector<std::array<int, 3> >* table = marching_cubes_table();
+  const float offset = mode == VoxelizationMode::CENTER ? 0.5f : 0.f;
+  const size_t plane_size = static_cast<size_t>(width)*depth;
+  const int slabs = (height + MARCHING_CUBES_SLAB - 1)/MARCHING_CUBES_SLAB;
+
+  auto value = [&](int h, int w, int d) {
+    return sdf[(static_cast<size_t>(h)*width + w)*depth + d];
+  };
+  // The edges owned by sample (h, w, d), along the depth, width and height, crossing the surface
+  auto crossings = [&](int h, int w, int d, bool* crossing) {
+    const bool inside = value(h, w, d) < iso;
+    crossing[0] = d + 1 < depth && (value(h, w, d + 1) < iso) != inside;
+    crossing[1] = w + 1 < width && (value(h, w + 1, d) < iso) != inside;
+    crossing[2] = h + 1 < height && (value(h + 1, w, d) < iso) != inside;
+  };
+
+  // Pass 1: vertices per slab
+  std::vector<size_t> vertex_offsets(slabs + 1, 0);
+  #pragma omp parallel for schedule(dynamic)
+  for (int s = 0; s < slabs; s++) {
+    size_t count = 0;
+    for (int h = s*MARCHING_CUBES_SLAB; h < std::min(height, (s + 1)*MARCHING_CUBES_SLAB); h++) {
+      for (int w = 0; w < width; w++) {
+        for (int d = 0; d < depth; d++) {
+          bool crossing[3];
+          crossings(h, w, d, crossing);
+          count += crossing[0] + crossing[1] + crossing[2];
+        }
+      }
+    }
+    vertex_offsets[s + 1] = count;
+  }
+  for (int s = 0; s < slabs; s++) {
+    vertex_offsets[s + 1] += vertex_offsets[s];
+  }
+
+  // Pass 2: vertices and triangles; the vertex numbers of the plane above a slab are those the next slab gives them
+  mesh.vertices.assign(3*vertex_offsets[slabs], 0.f);
+  std::vector<std::vector<int32_t> > slab_faces(slabs);
+  #pragma omp parallel
+  {
+    // Vertex numbers of the edges owned by the samples of two planes, -1 if not crossing
+    std::vector<int32_t> lower(3*plane_size), upper(3*plane_size);
+
+    auto number_plane = [&](int h, size_t first, bool emit, std::vector<int32_t>& numbers) {
+      size_t n = first;
+      for (int w = 0; w < width; w++) {
+        for (int d = 0; d < depth; d++) {
+          bool crossing[3];
+          crossings(h, w, d, crossing);
+          const size_t i = static_cast<size_t>(w)*depth + d;
+          for (int a = 0; a < 3; a++) {
+            numbers[3*i + a] = crossing[a] ? static_cast<int32_t>(n) : -1;
+            if (!crossing[a]) {
+              continue;
+            }
+            if (emit) {
+              const int h2 = h + (a == 2), w2 = w + (a == 1), d2 = d + (a == 0);
+              const float v1 = value(h, w, d), v2 = value(h2, w2, d2);
+              const float t = (iso - v1)/(v2 - v1);
+              mesh.vertices[3*n] = w + t*(w2 - w) + offset;
+              mesh.vertices[3*n + 1] = h + t*(h2 - h) + offset;
+              mesh.vertices[3*n + 2] = d + t*(d2 - d) + offset;
+            }
+            n++;
+          }
+        }
+      }
+      return n;
+    };
+
+    #pragma omp for schedule(dynamic)
+    for (int s = 0; s < slabs; s++) {
+      const int h0 = s*MARCHING_CUBES_SLAB;
+      const int h1 = std::min(height, (s + 1)*MARCHING_CUBES_SLAB);
+      size_t n = number_plane(h0, vertex_offsets[s], true, lower);
+      std::vector<int32_t>& faces = slab_faces[s];
+      for (int h = h0; h < h1 && h + 1 < height; h++) {
+        n = number_plane(h + 1, n, h + 1 < h1, upper);
+
+        for (int w = 0; w + 1 < width; w++) {
+          for (int d = 0; d + 1 < depth; d++) {
+            int c = 0;
+            for (int k = 0; k < 8; k++) {
+              c |= (value(h + ((k >> 2) & 1), w + ((k >> 1) & 1), d + (k & 1)) < iso) << k;
+            }
+            if (c == 0 || c == 255) {
+              continue;
+            }
+            for (const std::array<int, 3>& triangle : table[c]) {
+              for (int j = 0; j < 3; j++) {
+                // The owner of an edge is its first corner, the axis is the bit it flips
+                const int a = MARCHING_CUBES_EDGES[triangle[j]][0];
+                const int axis = triangle[j]/4;
+                const std::vector<int32_t>& numbers = (a >> 2) & 1 ? upper : lower;
+                faces.push_back(numbers[3*((static_cast<size_t>(w + ((a >> 1) & 1)))*depth + d + (a & 1)) + axis]);
+              }
+            }
+          }
+        }
+        std::swap(lower, upper);
+      }
+    }
+  }
+
+  // Concatenate the triangles of the slabs
+  std::vector<size_t> face_offsets(slabs + 1, 0);
+  for (int s = 0; s < slabs; s++) {
+    face_offsets[s + 1] = face_offsets[s] + slab_faces[s].size();
+  }
+  mesh.faces.resize(face_offsets[slabs]);
+  #pragma omp parallel for
+  for (int s = 0; s < slabs; s++) {
+    std::copy(slab_faces[s].begin(), slab_faces[s].end(), mesh.faces.begin() + face_offsets[s]);
+  }
+}
+
+#endif
@@ -0,0 +1,770 @@
+#ifndef MESH_H_
+#define MESH_H_
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <cfloat>
+
+// Eigen
+#include <Eigen/Dense>
+#include <unsupported/Eigen/CXX11/Tensor>
+
+// OpenMP
+#include <omp.h>
+
+// happly.h
+#include "happly.h"
+
+// Point-triangle distance and ray-triangle intersection.
+#include "triangle_point/poitri.h"
+#include "triangle_ray/raytri.h"
+#include "box_triangle/aabb_triangle_overlap.h"
+
+// Memory-mapped, parallel OFF parsing.
+#include "io/off_parser.h"
+
+// Binary cache of parsed meshes.
+#include "common/mesh_cache.h"
+
+// Chrome trace profiling and hardware counters.
+#include "common/trace.h"
+#include "common/perf_counters.h"
+
+// Always-on algorithmic counters.
+#include "common/voxel_stats.h"
+
+// Welding, degenerate and duplicate triangle removal.
+#include "common/mesh_cleaning.h"
+#include "common/mesh_simplification.h"
+
+/** \brief Number of voxels per brick span in detail traces. */
+const long TRACE_BRICK_SIZE = 4096;
+
+/** \brief Compute triangle point distance and corresponding closest point.
+ * \param[in] point point
+ * \param[in] v1 first vertex
+ * \param[in] v2 second vertex
+ * \param[in] v3 third vertex
+ * \param[out] ray corresponding closest point
+ * \return distance
+ */
+inline float triangle_point_distance(const Eigen::Vector3f &point, const Eigen::Vector3f &v1, const Eigen::Vector3f &v2, const Eigen::Vector3f &v3,
+    Eigen::Vector3f &closest_point) {
+
+  Vec3f x0(point.data());
+  Vec3f x1(v1.data());
+  Vec3f x2(v2.data());
+  Vec3f x3(v3.data());
+
+  Vec3f r(0);
+  float distance = point_triangle_distance(x0, x1, x2, x3, r);
+
+  for (int d = 0; d < 3; d++) {
+    closest_point(d) = r[d];
+  }
+
+  return distance;
+}
+
+/** \brief Test triangle ray intersection.
+ * \param[in] origin origin of ray
+ * \param[in] dest destination of ray
+ * \param[in] v1 first vertex
+ * \param[in] v2 second vertex
+ * \param[in] v3 third vertex
+ * \return intersects
+ */
+inline bool triangle_ray_intersection(const Eigen::Vector3f &origin, const Eigen::Vector3f &dest,
+    const Eigen::Vector3f &v1, const Eigen::Vector3f &v2, const Eigen::Vector3f &v3, float &t) {
+
+  double _origin[3] = {origin(0), origin(1), origin(2)};
+  double _dir[3] = {dest(0) - origin(0), dest(1) - origin(1), dest(2) - origin(2)};
+  double _v1[3] = {v1(0), v1(1), v1(2)};
+  double _v2[3] = {v2(0), v2(1), v2(2)};
+  double _v3[3] = {v3(0), v3(1), v3(2)};
+
+  // t is the distance, u and v are barycentric coordinates
+  // http://fileadmin.cs.lth.se/cs/personal/tomas_akenine-moller/code/raytri_tam.pdf
+  double _t, u, v;
+  int success = intersect_triangle(_origin, _dir, _v1, _v2, _v3, &_t, &u, &v);
+  t = _t;
+
+  if (success) {
+    return true;
+  }
+
+  return false;
+}
+
+/** \brief Compute triangle box intersection.
+ * \param[in] min defining voxel
+ * \param[in] max defining voxel
+ * \param[in] v1 first vertex
+ * \param[in] v2 second vertex
+ * \param[in] v3 third vertex
+ * \return intersects
+ */
+inline bool triangle_box_intersection(const Eigen::Vector3f &min, Eigen::Vector3f &max, const Eigen::Vector3f &v1, const Eigen::Vector3f &v2, const Eigen::Vector3f &v3) {
+  float half_size[3] = {
+    (max(0) - min(0))/2.,
+    (max(1) - min(1))/2.,
+    (max(2) - min(2))/2.
+  };
+
+  float center[3] = {
+    max(0) - half_size[0],
+    max(1) - half_size[1],
+    max(2) - half_size[2]
+  };
+
+  float vertices[3][3] = {{v1(0), v1(1), v1(2)}, {v2(0), v2(1), v2(2)}, {v3(0), v3(1), v3(2)}};
+  return triBoxOverlap(center, half_size, vertices);
+}
+
+/** \brief Specifies the voxelization mode, i.e. which point of a voxel to use for SDF computation. */
+enum VoxelizationMode {
+  CENTER = 0,
+  CORNER = 1
+};
+
+/** \brief Positions of the three vertices of a face, stored per face so that the voxelizers read them without indexing. */
+struct MeshTriangle {
+  Eigen::Vector3f v1;
+  Eigen::Vector3f v2;
+  Eigen::Vector3f v3;
+};
+
+/** \brief Just encapsulating vertices and faces.
+ *
+ * Positions, colors and labels of the vertices are separate arrays, so that every voxelizer only
+ * reads the channels it needs; colors and labels are empty for meshes without them. The
+ * voxelizers work on a packed array of the face positions, which is built on first use after
+ * the mesh changed. A mesh without colors loaded from the mesh cache keeps using the mapped
+ * vertices and faces until it is changed, see from_cache().
+ */
+class Mesh {
+public:
+  /** \brief Empty constructor. */
+  Mesh() {
+
+  }
+
+  /** \brief Reading an off file and returning the vertices x, y, z coordinates and the
+   * face indices.
+   * \param[in] filepath path to the OFF file
+   * \param[out] mesh read mesh with vertices and faces
+   * \return success
+   */
+  static bool from_off(const std::string filepath, Mesh& mesh) {
+    return parse_off(filepath, {"off", "OFF"}, 3,
+      [&mesh](int n_vertices, int n_faces) {
+        mesh.cached.reset();
+        mesh.vertices.resize(n_vertices);
+        mesh.colors.clear();
+        mesh.labels.clear();
+        mesh.faces.resize(n_faces);
+        mesh.triangles.clear();
+      },
+      [&mesh](int v, const float* values) {
+        mesh.vertices[v] = Eigen::Vector3f(values[0], values[1], values[2]);
+      },
+      [&mesh](int f, const int* indices) {
+        mesh.faces[f] = Eigen::Vector3i(indices[0], indices[1], indices[2]);
+      });
+  }
+
+
+  /** \brief Reading an off file and returning the vertices x, y, z coordinates and the
+   * face indices.
+   * \param[in] filepath path to the OFF file
+   * \param[out] mesh read mesh with vertices and faces
+   * \return success
+   */
+  static bool from_off_color(const std::string filepath, Mesh& mesh) {
+    return parse_off(filepath, {"coff", "COFF"}, 7,
+      [&mesh](int n_vertices, int n_faces) {
+        mesh.cached.reset();
+        mesh.vertices.resize(n_vertices);
+        mesh.colors.resize(n_vertices);
+        mesh.labels.resize(n_vertices);
+        mesh.faces.resize(n_faces);
+        mesh.triangles.clear();
+      },
+      [&mesh](int v, const float* values) {
+        mesh.vertices[v] = Eigen::Vector3f(values[0], values[1], values[2]);
+        mesh.colors[v] = Eigen::Vector3f(values[3], values[4], values[5]);
+        mesh.labels[v] = values[6];
+      },
+      [&mesh](int f, const int* indices) {
+        mesh.faces[f] = Eigen::Vector3i(indices[0], indices[1], indices[2]);
+      });
+  }
+
+  /** \brief Reading a mesh from a cache entry.
+   *
+   * Without colors the entry holds the vertices and faces in the layout of the mesh, so they are
+   * used straight from the mapping, which the mesh keeps alive; they are only copied once the mesh
+   * is changed. With colors the interleaved vertices are split into positions, colors and labels.
+   * \param[in] entry cache entry holding 3 (OFF) or 7 (COFF) floats per vertex
+   * \param[in] color whether the entry is expected to hold colors and labels
+   * \param[out] mesh read mesh with vertices and faces
+   * \return success
+   */
+  static bool from_cache(const std::shared_ptr<const MeshCacheEntry>& entry, bool color, Mesh& mesh) {
+    const int stride = color ? 7 : 3;
+    if (static_cast<int>(entry->header->vertex_stride) != stride) {
+      return false;
+    }
+
+    mesh.vertices.clear();
+    mesh.colors.clear();
+    mesh.labels.clear();
+    mesh.faces.clear();
+    mesh.triangles.clear();
+    mesh.cached = entry;
+    if (!color) {
+      return true;
+    }
+
+    const int n_vertices = mesh.num_vertices();
+    mesh.unpack();
+    mesh.colors.resize(n_vertices);
+    mesh.labels.resize(n_vertices);
+    for (int v = 0; v < n_vertices; v++) {
+      const float* values = entry->vertices + v*stride;
+      mesh.vertices[v] = Eigen::Vector3f(values[0], values[1], values[2]);
+      mesh.colors[v] = Eigen::Vector3f(values[3], values[4], values[5]);
+      mesh.labels[v] = values[6];
+    }
+    return true;
+  }
+
+  /** \brief Store the mesh in the cache, with colors and labels if present.
+   * \param[in] cache mesh cache
+   * \param[in] key key computed from the source file
+   * \return success
+   */
+  bool to_cache(MeshCache& cache, uint64_t key) {
+    this->unpack();
+    if (this->num_vertices_color() > 0) {
+      // The cache keeps the interleaved COFF layout.
+      std::vector<float> values(7*this->vertices.size());
+      for (size_t v = 0; v < this->vertices.size(); v++) {
+        float* vertex = &values[7*v];
+        Eigen::Map<Eigen::Vector3f>{vertex} = this->vertices[v];
+        Eigen::Map<Eigen::Vector3f>{vertex + 3} = this->colors[v];
+        vertex[6] = this->labels[v];
+      }
+      return cache.store(key, values.data(), this->num_vertices_color(), 7,
+        this->faces.data()->data(), this->num_faces());
+    }
+
+    return cache.store(key, this->vertices.data()->data(), this->num_vertices(), 3,
+      this->faces.data()->data(), this->num_faces());
+  }
+
+  /** \brief Reading an ply file and returning the vertices x, y, z coordinates and the
+   * face indices.
+   * \param[in] filepath path to the ply file
+   * \param[out] mesh read mesh with vertices and faces
+   * \return success
+   */
+  static bool from_ply(const std::string filepath, Mesh& mesh) {
+  // Construct the data object by reading from file
+    happly::PLYData plyIn(filepath);
+
+    // Get mesh-style data from the object
+    std::vector<std::array<double, 3>> vPos = plyIn.getVertexPositions();
+    std::vector<std::vector<size_t>> fInd = plyIn.getFaceIndices<size_t>();
+    std::vector<std::array<unsigned char, 3>> vcolor = plyIn.getVertexColors();
+
+     // Declaring iterator to a vector 
+
+    std::vector<std::array<double, 3>>::iterator vec = vPos.begin();
+    std::vector<std::array<unsigned char, 3>>::iterator vec_c= vcolor.begin();
+
+    while(vec != vPos.end() || vec_c != vcolor.end())
+    {
+      // TODO: Broken, find a way to get info for the label and append to vertex at the end
+        Eigen::Matrix<float, 7, 1> vertex;
+        vertex(0) = (float(vec[0][0]));
+        vertex(1) = (float(vec[0][1]));
+        vertex(2) = (float(vec[0][2]));
+        vertex(3) = (float(vec_c[0][0]));
+        vertex(4) = (float(vec_c[0][1]));
+        vertex(5) = (float(vec_c[0][2]));
+        // vertex(6) = (float(vec[0][3]));
+
+        ++vec;
+        ++vec_c;
+        mesh.add_vertex_color(vertex);
+    }
+
+
+    // for(auto& vec: vPos){
+    //     Eigen::Vector3f vertex;
+    //     vertex(0) = (float(vec[0]));
+    //     vertex(1) = (float(vec[1]));
+    //     vertex(2) = (float(vec[2]));
+    //     mesh.add_vertex(vertex);
+    // }
+
+    for(auto& f: fInd){
+      Eigen::Vector3i face;
+      face(0) = (int(f[0]));
+      face(1) = (int(f[1]));
+      face(2) = (int(f[2]));
+      mesh.add_face(face);
+    }
+
+    if (vPos.size() != mesh.num_vertices_color()) {
+      std::cout << "[Error] Number of vertices in header differs from actual number of vertices." << std::endl;
+      return false;
+    }
+
+    if (fInd.size() != mesh.num_faces()) {
+      std::cout << "[Error] Number of faces in header differs from actual number of faces." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+
+
+  /** \brief Write mesh to OFF file.
+   * \param[in] filepath path to OFF file to write
+   * \return success
+   */
+  bool to_off(const std::string filepath) {
+    this->unpack();
+    std::ofstream* out = new std::ofstream(filepath, std::ofstream::out);
+    if (!static_cast<bool>(out)) {
+      return false;
+    }
+
+    (*out) << "OFF" << std::endl;
+    (*out) << this->num_vertices() << " " << this->num_faces() << " 0" << std::endl;
+
+    for (unsigned int v = 0; v < this->num_vertices(); v++) {
+      (*out) << this->vertices[v](0) << " " << this->vertices[v](1) << " " << this->vertices[v](2) << std::endl;
+    }
+
+    for (unsigned int f = 0; f < this->num_faces(); f++) {
+      (*out) << "3 " << this->faces[f](0) << " " << this->faces[f](1) << " " << this->faces[f](2) << std::endl;
+    }
+
+    out->close();
+    delete out;
+
+    return true;
+  }
+
+  /** \brief Write mesh to OFF file.
+   * \param[in] filepath path to OFF file to write
+   * \return success
+   */
+  bool to_off_color(const std::string filepath) {
+    this->unpack();
+    std::ofstream* out = new std::ofstream(filepath, std::ofstream::out);
+    if (!static_cast<bool>(out)) {
+      return false;
+    }
+
+    (*out) << "COFF" << std::endl;
+    (*out) << this->num_vertices_color() << " " << this->num_faces() << " 0" << std::endl;
+
+    for (unsigned int v = 0; v < this->num_vertices_color(); v++) {
+      (*out) << this->vertices[v](0) << " " << this->vertices[v](1) << " " << this->vertices[v](2)<< " "; // We do a line wrap for readability here
+      (*out) << this->colors[v](0) << " " << this->colors[v](1) << " " << this->colors[v](2) << std::endl;
+    }
+
+    for (unsigned int f = 0; f < this->num_faces(); f++) {
+      (*out) << "3 " << this->faces[f](0) << " " << this->faces[f](1) << " " << this->faces[f](2) << std::endl;
+    }
+
+    out->close();
+    delete out;
+
+    return true;
+  }
+
+
+  /** \brief Add a vertex.
+   * \param[in] vertex vertex to add
+   */
+  void add_vertex(Eigen::Vector3f& vertex) {
+    this->unpack();
+    this->vertices.push_back(vertex);
+  }
+
+  /** \brief Add a vertex with color.
+   * \param[in] vertex vertex to add as (x, y, z, r, g, b, label)
+   */
+  void add_vertex_color(Eigen::Matrix<float, 7, 1>& vertex) {
+    this->unpack();
+    this->vertices.push_back(vertex.head<3>());
+    this->colors.push_back(vertex.segment<3>(3));
+    this->labels.push_back(vertex(6));
+  }
+
+  /** \brief Get the number of vertices.
+   * \return number of vertices
+   */
+  int num_vertices() {
+    return static_cast<int>(this->cached ? this->cached->header->n_vertices : this->vertices.size());
+  }
+
+  /** \brief Get the number of vertices.
+   * \return number of vertices
+   */
+  int num_vertices_color() {
+    return static_cast<int>(this->colors.size());
+  }
+
+  /** \brief Add a face.
+   * \param[in] face face to add
+   */
+  void add_face(Eigen::Vector3i& face) {
+    this->unpack();
+    this->faces.push_back(face);
+    this->triangles.clear();
+  }
+
+  /** \brief Get the number of faces.
+   * \return number of faces
+   */
+  int num_faces() {
+    return static_cast<int>(this->cached ? this->cached->header->n_faces : this->faces.size());
+  }
+
+  /** \brief Translate the mesh.
+   * \param[in] translation translation vector
+   */
+  void translate(const Eigen::Vector3f& translation) {
+    this->unpack();
+    for (int v = 0; v < this->num_vertices(); ++v) {
+      for (int i = 0; i < 3; ++i) {
+        this->vertices[v](i) += translation(i);
+      }
+    }
+    this->triangles.clear();
+  }
+
+  /** \brief Scale the mesh.
+   * \param[in] scale scale vector
+   */
+  void scale(const Eigen::Vector3f& scale) {
+    this->unpack();
+    for (int v = 0; v < this->num_vertices(); ++v) {
+      for (int i = 0; i < 3; ++i) {
+        this->vertices[v](i) *= scale(i);
+      }
+    }
+    this->triangles.clear();
+  }
+
+  /** \brief Weld vertices and remove degenerate and duplicate triangles, see clean_mesh().
+   * \param[in] tolerance weld distance in voxels, 0 to weld only identical positions
+   * \return what was removed
+   */
+  MeshCleaningReport clean(float tolerance) {
+    TraceScope scope("clean");
+    PerfScope perf("clean");
+    this->unpack();
+    MeshCleaningReport report = clean_mesh(this->vertices.empty() ? nullptr : this->vertices[0].data(), this->vertices.size(), this->faces, tolerance);
+    this->triangles.clear();
+    return report;
+  }
+
+  /** \brief Simplify the mesh by vertex clustering, see simplify_mesh().
+   * \param[in] cell cluster cell size in voxels, at most SIMPLIFICATION_MAX_CELL to keep the error below half a voxel
+   * \return what was changed
+   */
+  MeshSimplificationReport simplify(float cell) {
+    TraceScope scope("simplify");
+    PerfScope perf("simplify");
+    this->unpack();
+    const float origin[3] = { 0, 0, 0 };
+    MeshSimplificationReport report = simplify_mesh(this->vertices.empty() ? nullptr : this->vertices[0].data(), this->vertices.size(), this->faces, cell, origin);
+    this->triangles.clear();
+    return report;
+  }
+
+  /** \brief Get the positions of the vertices of every face, building them if the mesh changed.
+   * \return one triangle per face
+   */
+  const std::vector<MeshTriangle>& face_triangles() {
+    const int n_faces = this->num_faces();
+    if (static_cast<int>(this->triangles.size()) != n_faces) {
+      this->triangles.resize(n_faces);
+      // Mapped vertices and faces have the layout of Eigen::Vector3f and Eigen::Vector3i.
+      const Eigen::Vector3f* vertices = this->cached ? reinterpret_cast<const Eigen::Vector3f*>(this->cached->vertices) : this->vertices.data();
+      const Eigen::Vector3i* faces = this->cached ? reinterpret_cast<const Eigen::Vector3i*>(this->cached->faces) : this->faces.data();
+      #pragma omp parallel for if (n_faces > 65536)
+      for (int f = 0; f < n_faces; f++) {
+        this->triangles[f].v1 = vertices[faces[f](0)];
+        this->triangles[f].v2 = vertices[faces[f](1)];
+        this->triangles[f].v3 = vertices[faces[f](2)];
+      }
+    }
+    return this->triangles;
+  }
+
+  /** \brief Voxelize the given mesh into a SDF.
+   * \param[out] sdf volume to fill with sdf values
+   */
+  void voxelize_sdf(Eigen::Tensor<float, 3, Eigen::RowMajor>& sdf, const VoxelizationMode &mode) {
+    TraceScope scope("voxelize_sdf");
+
+    int height = sdf.dimension(0);
+    int width = sdf.dimension(1);
+    int depth = sdf.dimension(2);
+
+    this->voxel_stats.clear();
+    this->voxel_stats[STAT_TRIANGLES] = this->num_faces();
+    const std::vector<MeshTriangle>& triangles = this->face_triangles();
+
+    #pragma omp parallel
+    {
+      TraceBatch brick("voxelize_sdf brick", TRACE_BRICK_SIZE);
+      PerfScope perf("voxelize_sdf");
+      StatValues stats;
+
+      #pragma omp for
+      for (int i = 0; i < height*width*depth; i++) {
+        brick.step(i);
+        int d = i%depth;
+        int w = (i/depth)%width;
+        int h = (i/depth)/width;
+
+        sdf(h, w, d) = FLT_MAX;
+
+        // the box corresponding to this voxel
+        Eigen::Vector3f min(w, h, d);
+        Eigen::Vector3f max(w + 1, h + 1, d + 1);
+
+        Eigen::Vector3f center(w + 0.5f, h + 0.5f, d + 0.5f);
+        if (mode == VoxelizationMode::CORNER) {
+          center = Eigen::Vector3f(w, h, d);
+        }
+
+        // count number of intersections.
+        int num_intersect = 0;
+        for (const MeshTriangle& triangle : triangles) {
+          const Eigen::Vector3f& v1 = triangle.v1;
+          const Eigen::Vector3f& v2 = triangle.v2;
+          const Eigen::Vector3f& v3 = triangle.v3;
+
+          Eigen::Vector3f closest_point;
+          triangle_point_distance(center, v1, v2, v3, closest_point);
+          float distance = (center - closest_point).norm();
+
+          if (distance < sdf(h, w, d)) {
+            sdf(h, w, d) = distance;
+          }
+
+          bool intersect = triangle_ray_intersection(center, Eigen::Vector3f(0, 0, 0), v1, v2, v3, distance);
+
+          if (intersect && distance >= 0) {
+            num_intersect++;
+          }
+        }
+
+        if (num_intersect%2 == 1) {
+          sdf(h, w, d) *= -1;
+        }
+
+        stats[STAT_VOXELS]++;
+        stats[STAT_DISTANCE_TESTS] += this->num_faces();
+        stats[STAT_RAY_TESTS] += this->num_faces();
+        stats[STAT_RAY_HITS] += num_intersect;
+      }
+
+      #pragma omp critical
+      this->voxel_stats += stats;
+    }
+  }
+
+  /** \brief Voxelize the given mesh into an occupancy grid.
+   * \param[out] occ volume to fill
+   */
+  void voxelize_occ(Eigen::Tensor<int, 3, Eigen::RowMajor>& occ, const VoxelizationMode &mode) {
+    TraceScope scope("voxelize_occ");
+
+    int height = occ.dimension(0);
+    int width = occ.dimension(1);
+    int depth = occ.dimension(2);
+
+    this->voxel_stats.clear();
+    this->voxel_stats[STAT_TRIANGLES] = this->num_faces();
+    const std::vector<MeshTriangle>& triangles = this->face_triangles();
+
+    #pragma omp parallel
+    {
+      TraceBatch brick("voxelize_occ brick", TRACE_BRICK_SIZE);
+      PerfScope perf("voxelize_occ");
+      StatValues stats;
+
+      #pragma omp for
+      for (int i = 0; i < height*width*depth; i++) {
+        brick.step(i);
+        int d = i%depth;
+        int w = (i/depth)%width;
+        int h = (i/depth)/width;
+
+        Eigen::Vector3f min(w, h, d);
+        Eigen::Vector3f max(w + 1, h + 1, d + 1);
+        stats[STAT_VOXELS]++;
+
+        for (const MeshTriangle& triangle : triangles) {
+          stats[STAT_BOX_TESTS]++;
+          bool overlap = triangle_box_intersection(min, max, triangle.v1, triangle.v2, triangle.v3);
+          if (overlap) {
+            occ(h, w, d) = 1;
+            stats[STAT_MARKS]++;
+            break;
+          }
+        }
+      }
+
+      stats[STAT_OVERLAP_CULLS] = stats[STAT_BOX_TESTS] - stats[STAT_MARKS];
+      #pragma omp critical
+      this->voxel_stats += stats;
+    }
+  }
+
+  static float find_label(float & a, float& b, float &c){
+    //If any two match, return it
+    if (a == b || a == c) {
+        return a;
+    }
+    if (b == c){
+        return b;
+    }
+    // In worst case, just use the max value from the three
+    return std::max(std::max(a, b), c);
+  }
+
+  /** \brief Voxelize the given mesh into an occupancy grid.
+   * \param[out] occ volume to fill
+   */
+  void voxelize_occ_color(Eigen::Tensor<int, 4, Eigen::RowMajor>& occ, const VoxelizationMode &mode) {
+    TraceScope scope("voxelize_occ_color");
+    this->unpack();
+    
+    int height = occ.dimension(0);
+    int width = occ.dimension(1);
+    int depth = occ.dimension(2);
+
+    this->voxel_stats.clear();
+    this->voxel_stats[STAT_TRIANGLES] = this->num_faces();
+    const std::vector<MeshTriangle>& triangles = this->face_triangles();
+
+    // Color (averaged over the vertices) and label of every face, written to the voxels it overlaps.
+    std::vector<Eigen::Vector4i> attributes(this->faces.size(), Eigen::Vector4i::Zero());
+    if (this->num_vertices_color() > 0) {
+      #pragma omp parallel for
+      for (int f = 0; f < this->num_faces(); f++) {
+        const Eigen::Vector3i& face = this->faces[f];
+        for (int c = 0; c < 3; c++) {
+          attributes[f](c) = (int) (this->colors[face(0)](c) + this->colors[face(1)](c) + this->colors[face(2)](c)) / 3;
+        }
+        float l1 = this->labels[face(0)];
+        float l2 = this->labels[face(1)];
+        float l3 = this->labels[face(2)];
+        // Take the three labels and find the most appropriate label
+        attributes[f](3) = (int) find_label(l1, l2, l3);
+      }
+    }
+
+    #pragma omp parallel
+    {
+      TraceBatch brick("voxelize_occ_color brick", TRACE_BRICK_SIZE);
+      PerfScope perf("voxelize_occ_color");
+      StatValues stats;
+
+      #pragma omp for
+      for (int i = 0; i < height*width*depth; i++) {
+        brick.step(i);
+        int d = i%depth;
+        int w = (i/depth)%width;
+        int h = (i/depth)/width;
+
+        Eigen::Vector3f min(w, h, d);
+        Eigen::Vector3f max(w + 1, h + 1, d + 1);
+        stats[STAT_VOXELS]++;
+
+        for (size_t f = 0; f < triangles.size(); ++f) {
+          // For checking the intersection we only need the coordinates
+          stats[STAT_BOX_TESTS]++;
+          bool overlap = triangle_box_intersection(min, max, triangles[f].v1, triangles[f].v2, triangles[f].v3);
+          if (overlap) {
+            stats[STAT_MARKS]++;
+            for (int c = 0; c < 4; c++) {
+              occ(h, w, d, c) = attributes[f](c);
+            }
+            break;
+          }
+        }
+      }
+
+      stats[STAT_OVERLAP_CULLS] = stats[STAT_BOX_TESTS] - stats[STAT_MARKS];
+      #pragma omp critical
+      this->voxel_stats += stats;
+    }
+  }
+
+  /** \brief Counters of the last voxelization, summed over threads.
+   * \return counters
+   */
+  const StatValues& stats() const {
+    return this->voxel_stats;
+  }
+
+private:
+
+  /** \brief Copy the vertices and faces out of the cache entry, before they are changed or read directly. */
+  void unpack() {
+    if (!this->cached) {
+      return;
+    }
+
+    const int n_vertices = this->num_vertices();
+    const int n_faces = this->num_faces();
+    const int stride = static_cast<int>(this->cached->header->vertex_stride);
+    this->vertices.resize(n_vertices);
+    this->faces.resize(n_faces);
+    Eigen::Map<Eigen::Matrix3Xf>(this->vertices.data()->data(), 3, n_vertices)
+      = Eigen::Map<const Eigen::Matrix3Xf, 0, Eigen::OuterStride<> >(this->cached->vertices, 3, n_vertices, Eigen::OuterStride<>(stride));
+    Eigen::Map<Eigen::Matrix3Xi>(this->faces.data()->data(), 3, n_faces) = Eigen::Map<const Eigen::Matrix3Xi>(this->cached->faces, 3, n_faces);
+    this->cached.reset();
+  }
+
+  /** \brief Vertex positions as (x,y,z)-vectors. */
+  std::vector<Eigen::Vector3f> vertices;
+
+  /** \brief Vertex colors as (r,g,b)-vectors, empty if the mesh has no colors. */
+  std::vector<Eigen::Vector3f> colors;
+
+  /** \brief Vertex labels, empty if the mesh has no colors. */
+  std::vector<float> labels;
+
+  /** \brief Faces as list of vertex indices. */
+  std::vector<Eigen::Vector3i> faces;
+
+  /** \brief Cache entry whose mapped vertices and faces stand in for vertices and faces until unpack(), see from_cache(). */
+  std::shared_ptr<const MeshCacheEntry> cached;
+
+  /** \brief Vertex positions of every face, see face_triangles(). */
+  std::vector<MeshTriangle> triangles;
+
+  /** \brief Counters of the last voxelization. */
+  StatValues voxel_stats;
+};
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <functional>
+
+// Boost
+#include <boost/filesystem.hpp>
+
+// OpenMP
+#include <omp.h>
+
+#include "mesh.h"
+#include "common/bounded_queue.h"
+
+/** \brief Minimum number of voxels per thread when voxelizing one mesh; smaller grids are spread over several meshes instead. */
+const uint64_t PIPELINE_VOXELS_PER_THREAD = 4096;
+
+/** \brief One input of the directory pipeline. */
+struct PipelineItem {
+  /** \brief Position of the volume in the output. */
+  int index;
+  /** \brief Mesh file. */
+  std::string path;
+  /** \brief Size of the mesh file, used to schedule large meshes first. */
+  uint64_t size;
+  /** \brief Content hash of the mesh file and parameters, used by the journal; 0 if not computed. */
+  uint64_t hash;
+};
+
+/** \brief Threads of the directory pipeline: parsers feed voxelizer workers, which feed a single writer. */
+struct PipelineConfig {
+  /** \brief Parser threads. */
+  int parsers;
+  /** \brief Voxelizer workers, each voxelizing one mesh at a time. */
+  int workers;
+  /** \brief OpenMP threads per worker (and per parser). */
+  int threads_per_worker;
+  /** \brief Capacity of each of the two queues between the stages. */
+  int queue_capacity;
+
+  /** \brief Choose between parallelism within meshes and across meshes.
+   *
+   * A mesh gets as many threads as it has bricks of PIPELINE_VOXELS_PER_THREAD voxels, the
+   * remaining threads go to further workers voxelizing other meshes concurrently; e.g. at 32^3 and
+   * 64 threads, 8 meshes are voxelized at once with 8 threads each.
+   * \param[in] n_items number of meshes
+   * \param[in] voxels voxels per volume
+   * \param[in] threads total number of threads
+   * \param[in] parsers parser threads, 0 to choose automatically
+   * \param[in] workers voxelizer workers, 0 to choose automatically
+   * \return config
+   */
+  static PipelineConfig choose(size_t n_items, uint64_t voxels, int threads, int parsers, int workers) {
+    const int n = static_cast<int>(std::max<size_t>(1, std::min<size_t>(n_items, 1 << 20)));
+    threads = std::max(1, threads);
+
+    PipelineConfig config;
+    if (workers > 0) {
+      config.workers = std::min(workers, n);
+      config.threads_per_worker = std::max(1, threads/config.workers);
+    }
+    else {
+      config.threads_per_worker = static_cast<int>(std::max<uint64_t>(1, std::min<uint64_t>(threads, voxels/PIPELINE_VOXELS_PER_THREAD)));
+      config.workers = std::max(1, std::min(n, threads/config.threads_per_worker));
+    }
+
+    config.parsers = parsers > 0 ? std::min(parsers, n) : std::min(2, n);
+    config.queue_capacity = std::max(2, config.workers);
+    return config;
+  }
+};
+
+/** \brief Order the input files for the pipeline, largest first so the longest meshes do not end up last on an otherwise idle machine.
+ * \param[in] files input files by number, their order gives the position in the output
+ * \return items
+ */
+template<typename Files>
+std::vector<PipelineItem> pipeline_items(const Files& files) {
+  std::vector<PipelineItem> items;
+  int index = 0;
+  for (typename Files::const_iterator it = files.begin(); it != files.end(); ++it) {
+    boost::system::error_code error;
+    uintmax_t size = boost::filesystem::file_size(it->second, error);
+
+    PipelineItem item;
+    item.index = index++;
+    item.path = it->second.string();
+    item.size = error ? 0 : static_cast<uint64_t>(size);
+    item.hash = 0;
+    items.push_back(item);
+  }
+
+  std::stable_sort(items.begin(), items.end(), [](const PipelineItem& a, const PipelineItem& b) {
+    return a.size > b.size;
+  });
+  return items;
+}
+
+/** \brief Parse, voxelize and write meshes concurrently.
+ *
+ * Parser threads read meshes in the given order into a bounded queue, voxelizer workers turn
+ * them into volumes in a second bounded queue, and the calling thread writes the volumes one at
+ * a time as they complete; since every volume carries its position in the output, the writer
+ * needs no reorder buffer and memory stays bounded by the queue capacities. Meshes that cannot be
+ * parsed are reported and skipped; the first write failure stops the pipeline.
+ * \param[in] items meshes in scheduling order
+ * \param[in] config threads
+ * \param[in] dimensions dimensions of a volume
+ * \param[in] claim decides (from a parser thread) whether this process handles an item, e.g. by claiming it from other processes
+ * \param[in] parse reads an item into a mesh, returns success
+ * \param[in] parse_failed called (from a parser thread) for every item that could not be parsed
+ * \param[in] voxelize voxelizes a mesh into a volume of the given dimensions
+ * \param[in] write writes the volume of an item, returns success
+ * \param[out] failed path of the item that could not be written
+ * \return success
+ */
+template<typename Volume>
+bool run_pipeline(const std::vector<PipelineItem>& items, const PipelineConfig& config, const typename Volume::Dimensions& dimensions,
+    std::function<bool(const PipelineItem&)> claim,
+    std::function<bool(const PipelineItem&, Mesh&)> parse,
+    std::function<void(const PipelineItem&)> parse_failed,
+    std::function<void(const PipelineItem&, Mesh&, Volume&)> voxelize,
+    std::function<bool(const PipelineItem&, const Volume&)> write,
+    std::string& failed) {
+
+  struct Parsed {
+    size_t item;
+    std::unique_ptr<Mesh> mesh;
+  };
+
+  struct Voxelized {
+    size_t item;
+    std::unique_ptr<Volume> volume;
+  };
+
+  BoundedQueue<Parsed> parsed(config.queue_capacity);
+  BoundedQueue<Voxelized> voxelized(config.queue_capacity);
+
+  std::atomic<size_t> next(0);
+  std::atomic<int> parsers_left(config.parsers);
+  std::atomic<int> workers_left(config.workers);
+  std::atomic<bool> stop(false);
+  std::mutex failed_mutex;
+
+  auto fail = [&](size_t item) {
+    std::lock_guard<std::mutex> lock(failed_mutex);
+    if (!stop.exchange(true)) {
+      failed = items[item].path;
+    }
+    parsed.close();
+    voxelized.close();
+  };
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < config.parsers; t++) {
+    threads.emplace_back([&]() {
+      omp_set_num_threads(config.threads_per_worker);
+      for (size_t i = next++; i < items.size() && !stop; i = next++) {
+        if (!claim(items[i])) {
+          continue;
+        }
+
+        Parsed p;
+        p.item = i;
+        p.mesh.reset(new Mesh());
+        if (!parse(items[i], *p.mesh)) {
+          parse_failed(items[i]);
+          continue;
+        }
+        if (!parsed.push(std::move(p))) {
+          break;
+        }
+      }
+
+      if (--parsers_left == 0) {
+        parsed.close();
+      }
+    });
+  }
+
+  for (int t = 0; t < config.workers; t++) {
+    threads.emplace_back([&]() {
+      omp_set_num_threads(config.threads_per_worker);
+      Parsed p;
+      while (parsed.pop(p)) {
+        if (stop) {
+          continue;
+        }
+
+        Voxelized v;
+        v.item = p.item;
+        v.volume.reset(new Volume(dimensions));
+        voxelize(items[p.item], *p.mesh, *v.volume);
+        p.mesh.reset();
+
+        if (!voxelized.push(std::move(v))) {
+          break;
+        }
+      }
+
+      if (--workers_left == 0) {
+        voxelized.close();
+      }
+    });
+  }
+
+  Voxelized v;
+  while (voxelized.pop(v)) {
+    if (!stop && !write(items[v.item], *v.volume)) {
+      fail(v.item);
+    }
+    v.volume.reset();
+  }
+
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+  return !stop;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <iostream>
+#include <string>
+
+/** \brief Number of failed checks of the test. */
+inline int& check_failures() {
+  static int failures = 0;
+  return failures;
+}
+
+/** \brief Check a condition of a test and report it if it does not hold.
+ * \param[in] condition condition
+ * \param[in] message what was checked
+ * \return condition
+ */
+inline bool check(bool condition, const std::string& message) {
+  if (!condition) {
+    std::cout << "[Error] " << message << std::endl;
+    check_failures()++;
+  }
+  return condition;
+}
+
+/** \brief Report the result of a test.
+ * \param[in] name test
+ * \return exit code, 1 if a check failed
+ */
+inline int check_result(const std::string& name) {
+  if (check_failures() > 0) {
+    std::cout << name << ": " << check_failures() << " checks failed." << std::endl;
+    return 1;
+  }
+  std::cout << name << ": passed." << std::endl;
+  return 0;
+}
+
+#endif
@@ -0,0 +1,68 @@
+// Packed occupancy: pack/unpack round trips, including rows that do not fill their last word,
+// the gpu-vox voxel table split into rows, and the set bit offsets of the sparse output.
+#include <random>
+#include <vector>
+
+#include "common/bit_volume.h"
+#include "tests/check.h"
+
+int main() {
+  std::mt19937 random(7);
+
+  const size_t lengths[] = { 1, 31, 32, 33, 64, 100, 257 };
+  for (size_t length : lengths) {
+    const size_t rows = 13;
+    std::vector<int32_t> values(rows*length);
+    for (size_t i = 0; i < values.size(); i++) {
+      values[i] = random() % 3 == 0 ? static_cast<int32_t>(random() % 5 + 1) : 0;
+    }
+
+    std::vector<uint32_t> words(rows*bit_words(length), 0xffffffffu);
+    pack_bit_rows(values.data(), rows, length, words.data());
+
+    std::vector<int32_t> unpacked(rows*length, -1);
+    unpack_bit_rows(words.data(), rows, length, unpacked.data());
+    std::vector<float> unpacked_float(rows*length, -1);
+    unpack_bit_rows(words.data(), rows, length, unpacked_float.data());
+
+    bool same = true;
+    for (size_t i = 0; i < values.size(); i++) {
+      same = same && unpacked[i] == (values[i] != 0) && unpacked_float[i] == (values[i] != 0 ? 1.f : 0.f);
+    }
+    check(same, "unpacked rows of length " + std::to_string(length) + " differ from the packed values");
+
+    bool padding = true;
+    if (length % 32 != 0) {
+      for (size_t r = 0; r < rows; r++) {
+        padding = padding && (words[(r + 1)*bit_words(length) - 1] & ~(~0u << (32 - length % 32))) == 0;
+      }
+    }
+    check(padding, "trailing bits of rows of length " + std::to_string(length) + " are not zero");
+
+    // The voxel table of gpu-vox is one bit stream without padding between rows.
+    std::vector<uint32_t> stream(bit_words(rows*length), 0);
+    for (size_t i = 0; i < values.size(); i++) {
+      stream[i/32] |= (values[i] != 0 ? 1u : 0u) << (31 - i % 32);
+    }
+    std::vector<uint32_t> split(rows*bit_words(length), 0xffffffffu);
+    bits_to_rows(stream.data(), rows, length, split.data());
+    check(split == words, "bits_to_rows of length " + std::to_string(length) + " differs from pack_bit_rows");
+
+    // Set bits visited with their rank, as the sparse output compacts them.
+    std::vector<size_t> offsets;
+    const size_t n = bit_offsets(stream.data(), rows*length, offsets);
+    std::vector<size_t> indices(n, 0);
+    for_each_set_bit(stream.data(), rows*length, offsets, [&indices](size_t index, size_t rank) {
+      indices[rank] = index;
+    });
+    std::vector<size_t> expected;
+    for (size_t i = 0; i < values.size(); i++) {
+      if (values[i] != 0) {
+        expected.push_back(i);
+      }
+    }
+    check(indices == expected, "set bits of length " + std::to_string(length) + " are visited out of order");
+  }
+
+  return check_result("bit_volume");
+}
@@ -0,0 +1,129 @@
+// Connected components of gpu-vox: labels, sizes and the removal of small components match a
+// breadth-first flood fill on random voxel tables of odd sizes, for every connectivity.
+#include <cstdlib>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "components.h"
+#include "tests/check.h"
+
+/** \brief Check whether a voxel of a linear voxel table is set.
+ * \param[in] table voxel table
+ * \param[in] index voxel
+ * \return set
+ */
+bool voxel_set(const std::vector<unsigned int>& table, size_t index) {
+  return (table[index/32] >> (31 - index % 32)) & 1u;
+}
+
+/** \brief Label the components by flood fill, numbering them in voxel table order of their first voxel.
+ * \param[in] table voxel table
+ * \param[in] size grid size
+ * \param[in] connectivity 6, 18 or 26
+ * \param[out] labels component of every voxel, from 1, 0 for empty voxels
+ * \return size of every component
+ */
+std::vector<uint64_t> flood_fill(const std::vector<unsigned int>& table, const int size[3], int connectivity, std::vector<int32_t>& labels) {
+  const size_t n = static_cast<size_t>(size[0])*size[1]*size[2];
+  labels.assign(n, 0);
+  std::vector<uint64_t> sizes;
+
+  for (size_t i = 0; i < n; i++) {
+    if (!voxel_set(table, i) || labels[i] != 0) {
+      continue;
+    }
+    sizes.push_back(0);
+    labels[i] = static_cast<int32_t>(sizes.size());
+    std::queue<size_t> queue;
+    queue.push(i);
+    while (!queue.empty()) {
+      const size_t j = queue.front();
+      queue.pop();
+      sizes.back()++;
+      const int p[3] = { static_cast<int>(j % size[0]), static_cast<int>(j/size[0] % size[1]), static_cast<int>(j/size[0]/size[1]) };
+      for (int dz = -1; dz <= 1; dz++) {
+        for (int dy = -1; dy <= 1; dy++) {
+          for (int dx = -1; dx <= 1; dx++) {
+            const int steps = std::abs(dx) + std::abs(dy) + std::abs(dz);
+            if (steps == 0 || (connectivity == 6 && steps > 1) || (connectivity == 18 && steps > 2)) {
+              continue;
+            }
+            const int q[3] = { p[0] + dx, p[1] + dy, p[2] + dz };
+            if (q[0] < 0 || q[1] < 0 || q[2] < 0 || q[0] >= size[0] || q[1] >= size[1] || q[2] >= size[2]) {
+              continue;
+            }
+            const size_t l = q[0] + static_cast<size_t>(size[0])*(q[1] + static_cast<size_t>(size[1])*q[2]);
+            if (voxel_set(table, l) && labels[l] == 0) {
+              labels[l] = labels[i];
+              queue.push(l);
+            }
+          }
+        }
+      }
+    }
+  }
+  return sizes;
+}
+
+int main() {
+  std::mt19937 random(1);
+  const int connectivities[] = { 6, 18, 26 };
+
+  for (int trial = 0; trial < 120; trial++) {
+    const int connectivity = connectivities[trial % 3];
+    const int size[3] = { static_cast<int>(1 + random() % 70), static_cast<int>(1 + random() % 20), static_cast<int>(1 + random() % 40) };
+    const float density = (random() % 100)/100.f;
+    const std::string name = "trial " + std::to_string(trial) + " (" + std::to_string(size[0]) + " x " + std::to_string(size[1])
+      + " x " + std::to_string(size[2]) + ", connectivity " + std::to_string(connectivity) + ")";
+
+    voxinfo info(AABox<glm::vec3>(glm::vec3(0.f), glm::vec3(1.f)), glm::uvec3(size[0], size[1], size[2]), 0);
+    const size_t n = static_cast<size_t>(size[0])*size[1]*size[2];
+    std::vector<unsigned int> table((n + 31)/32, 0);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    for (size_t i = 0; i < n; i++) {
+      if (uniform(random) < density) {
+        table[i/32] |= 1u << (31 - i % 32);
+      }
+    }
+
+    components::Components result;
+    if (!check(components::label_components(info, table.data(), connectivity, result), name + ": labelling failed")) {
+      continue;
+    }
+    std::vector<int32_t> expected;
+    std::vector<uint64_t> sizes = flood_fill(table, size, connectivity, expected);
+
+    // component_ids is in the x x y x z layout of the combine_data tensor.
+    std::vector<int32_t> ids;
+    components::component_ids(info, result, false, ids);
+    bool same = result.components.size() == sizes.size();
+    for (size_t k = 0; k < sizes.size() && same; k++) {
+      same = result.components[k].size == sizes[k];
+    }
+    for (int z = 0; z < size[2] && same; z++) {
+      for (int y = 0; y < size[1] && same; y++) {
+        for (int x = 0; x < size[0] && same; x++) {
+          same = ids[(static_cast<size_t>(x)*size[1] + y)*size[2] + z] == expected[x + static_cast<size_t>(size[0])*(y + static_cast<size_t>(size[1])*z)];
+        }
+      }
+    }
+    check(same, name + ": components differ from the flood fill");
+
+    // Small components are cleared from the table, the others stay.
+    const uint64_t min_voxels = 1 + random() % 5;
+    std::vector<unsigned int> filtered = table;
+    const uint64_t removed = components::remove_small_components(info, filtered.data(), min_voxels, result);
+    uint64_t expected_removed = 0;
+    bool kept = true;
+    for (size_t i = 0; i < n; i++) {
+      const bool small = voxel_set(table, i) && sizes[expected[i] - 1] < min_voxels;
+      expected_removed += small;
+      kept = kept && voxel_set(filtered, i) == (voxel_set(table, i) && !small);
+    }
+    check(kept && removed == expected_removed, name + ": removing components below " + std::to_string(min_voxels) + " voxels differs");
+  }
+
+  return check_result("components");
+}
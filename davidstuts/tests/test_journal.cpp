@@ -0,0 +1,56 @@
+// Journal of directory runs: records survive reopening with resume, the last record of an item
+// wins, changed hashes count as new, failures are quarantined and a torn last line is ignored.
+#include <cstdio>
+#include <string>
+
+#include "common/journal.h"
+#include "tests/check.h"
+
+int main() {
+  const std::string path = "journal_test.journal";
+  std::remove(path.c_str());
+
+  {
+    Journal journal(path, false);
+    check(journal.is_open(), "could not open the journal");
+    journal.record("a.off", 1, JOURNAL_STARTED, "out.h5:0");
+    journal.record("a.off", 1, JOURNAL_DONE, "out.h5:0");
+    journal.record("b.off", 2, JOURNAL_FAILED, "out.h5:1", "no\tvertices\n", 2);
+    journal.record("c off\twith tab.off", 3, JOURNAL_DONE, "out.h5:2");
+    check(journal.record("d.off", 4, JOURNAL_FAILED, "out.h5:3", "parse error", 1) == JOURNAL_QUARANTINED,
+      "a failure at max_attempts is not quarantined");
+  }
+
+  // A crash while appending leaves a line without its line break.
+  FILE* file = fopen(path.c_str(), "a");
+  fprintf(file, "done\t0000000000000002\t0\tout.h5:1\tb.off");
+  fclose(file);
+
+  {
+    Journal journal(path, true);
+    JournalEntry a = journal.get("a.off", 1);
+    check(a.status == JOURNAL_DONE && a.output == "out.h5:0", "the last record of a.off is not loaded");
+    check(journal.get("a.off", 5).status == JOURNAL_NONE, "a record with another hash is returned");
+
+    JournalEntry b = journal.get("b.off", 2);
+    check(b.status == JOURNAL_FAILED && b.attempts == 1, "the torn line replaced the failure of b.off");
+    check(journal.record("b.off", 2, JOURNAL_FAILED, "out.h5:1", "again", 2) == JOURNAL_QUARANTINED,
+      "the second failure of b.off is not quarantined");
+
+    check(journal.get("c off with tab.off", 3).status == JOURNAL_DONE, "tabs in item names are not replaced");
+    check(journal.get("d.off", 4).status == JOURNAL_QUARANTINED, "the quarantine of d.off is not loaded");
+  }
+
+  {
+    Journal journal(path, true);
+    check(journal.get("b.off", 2).status == JOURNAL_QUARANTINED, "records appended after a torn line are lost");
+  }
+
+  {
+    Journal journal(path, false);
+    check(journal.get("a.off", 1).status == JOURNAL_NONE, "a journal opened without resume keeps records");
+  }
+  std::remove(path.c_str());
+
+  return check_result("journal");
+}
@@ -0,0 +1,80 @@
+// Mesh cleaning: the spatial hash welds the same vertices as comparing all pairs, and cleaning
+// removes exactly the degenerate and duplicate triangles.
+#include <array>
+#include <random>
+#include <vector>
+
+#include "common/mesh_cleaning.h"
+#include "tests/check.h"
+
+/** \brief Weld by comparing every vertex with all vertices of smaller index; the first close one gives the representative.
+ * \param[in] positions n x 3 floats
+ * \param[in] n number of vertices
+ * \param[in] tolerance weld distance
+ * \return representative of every vertex
+ */
+std::vector<uint32_t> weld_brute_force(const std::vector<float>& positions, size_t n, float tolerance) {
+  std::vector<uint32_t> representative(n);
+  for (size_t v = 0; v < n; v++) {
+    representative[v] = static_cast<uint32_t>(v);
+    for (size_t u = 0; u < v; u++) {
+      const float d[3] = { positions[3*v] - positions[3*u], positions[3*v + 1] - positions[3*u + 1], positions[3*v + 2] - positions[3*u + 2] };
+      const bool close = tolerance > 0 ? d[0]*d[0] + d[1]*d[1] + d[2]*d[2] <= tolerance*tolerance : d[0] == 0 && d[1] == 0 && d[2] == 0;
+      if (close) {
+        representative[v] = representative[u];
+        break;
+      }
+    }
+  }
+  return representative;
+}
+
+int main() {
+  std::mt19937 random(11);
+  std::uniform_real_distribution<float> distribution(-2.f, 2.f);
+
+  // Random vertices, some repeated exactly (with -0 for 0) and some moved slightly.
+  const size_t n = 3000;
+  std::vector<float> positions;
+  for (size_t v = 0; v < n; v++) {
+    if (v > 0 && random() % 4 == 0) {
+      const size_t u = random() % v;
+      for (int i = 0; i < 3; i++) {
+        const float p = positions[3*u + i];
+        positions.push_back(random() % 2 == 0 ? (p == 0 ? -0.f : p) : p + 0.002f*(distribution(random)));
+      }
+    }
+    else {
+      for (int i = 0; i < 3; i++) {
+        positions.push_back(random() % 10 == 0 ? 0.f : distribution(random));
+      }
+    }
+  }
+
+  const float tolerances[] = { 0.f, 0.001f, 0.003f, 0.05f };
+  for (float tolerance : tolerances) {
+    std::vector<uint32_t> representative;
+    const uint64_t welded = weld_vertices(positions.data(), n, tolerance, representative);
+    std::vector<uint32_t> expected = weld_brute_force(positions, n, tolerance);
+
+    uint64_t expected_welded = 0;
+    for (size_t v = 0; v < n; v++) {
+      expected_welded += expected[v] != v;
+    }
+    check(representative == expected, "welding with tolerance " + std::to_string(tolerance) + " differs from the brute force");
+    check(welded == expected_welded, "welding with tolerance " + std::to_string(tolerance) + " counts " + std::to_string(welded)
+      + " instead of " + std::to_string(expected_welded) + " vertices");
+  }
+
+  // Cleaning: one valid triangle, its copy in another order, a flipped copy, a collapsed and a zero-area one.
+  std::vector<float> square = { 0, 0, 0, 1, 0, 0, 0, 1, 0, 1, 1, 0, 2, 0, 0, 0, 0, 0 };
+  std::vector<std::array<int, 3>> faces = { {{ 0, 1, 2 }}, {{ 1, 2, 0 }}, {{ 2, 1, 0 }}, {{ 0, 5, 1 }}, {{ 0, 1, 4 }}, {{ 1, 3, 2 }} };
+  MeshCleaningReport report = clean_mesh(square.data(), 6, faces, 0.f);
+  check(report.welded_vertices == 1, "the copy of vertex 0 is not welded");
+  check(report.degenerate_triangles == 2, "degenerate triangles: " + std::to_string(report.degenerate_triangles));
+  check(report.duplicate_triangles == 2, "duplicate triangles: " + std::to_string(report.duplicate_triangles));
+  check(faces.size() == 2 && faces[0] == std::array<int, 3>{{ 0, 1, 2 }} && faces[1] == std::array<int, 3>{{ 1, 3, 2 }},
+    "cleaning does not keep the first of the duplicates and the other triangle in order");
+
+  return check_result("mesh_cleaning");
+}
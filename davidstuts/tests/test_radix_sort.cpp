@@ -0,0 +1,55 @@
+// Radix sort of the point cloud input: sorts (key, value) pairs like a stable std::sort, across
+// several blocks, with many equal keys and with passes that are skipped.
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "common/radix_sort.h"
+#include "tests/check.h"
+
+/** \brief Sort random pairs with both sorts and compare them.
+ * \param[in] n number of pairs
+ * \param[in] key_bits bits of the keys
+ * \param[in] distinct number of distinct keys, 0 for any
+ * \param[in] fixed bits set in every key, so that their passes are skipped
+ * \param[in] random random numbers
+ * \return whether the sorts agree
+ */
+bool compare_sorts(size_t n, int key_bits, uint64_t distinct, uint64_t fixed, std::mt19937_64& random) {
+  const uint64_t mask = key_bits >= 64 ? ~0ull : (1ull << key_bits) - 1;
+  std::vector<uint64_t> keys(n);
+  std::vector<uint32_t> values(n);
+  std::vector<std::pair<uint64_t, uint32_t> > expected(n);
+  for (size_t i = 0; i < n; i++) {
+    keys[i] = ((distinct > 0 ? random() % distinct : random()) | fixed) & mask;
+    values[i] = static_cast<uint32_t>(i);
+    expected[i] = std::make_pair(keys[i], values[i]);
+  }
+
+  radix_sort_pairs(keys, values, key_bits);
+  std::stable_sort(expected.begin(), expected.end(), [](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) {
+    return a.first < b.first;
+  });
+
+  bool same = keys.size() == n && values.size() == n;
+  for (size_t i = 0; i < n && same; i++) {
+    same = keys[i] == expected[i].first && values[i] == expected[i].second;
+  }
+  return same;
+}
+
+int main() {
+  std::mt19937_64 random(5);
+
+  check(compare_sorts(0, 32, 0, 0, random), "sorting no pairs fails");
+  check(compare_sorts(1, 32, 0, 0, random), "sorting one pair fails");
+  check(compare_sorts(1000, 16, 0, 0, random), "sorting 1000 pairs by 16 bits differs from std::sort");
+  // Several blocks of 65536 pairs, Morton codes of 3 x 10 bits as the point cloud input sorts them.
+  check(compare_sorts(300000, 30, 0, 0, random), "sorting 300000 pairs by 30 bits differs from std::sort");
+  check(compare_sorts(300000, 64, 0, 0, random), "sorting 300000 pairs by 64 bits differs from std::sort");
+  check(compare_sorts(200000, 24, 37, 0, random), "sorting pairs with few distinct keys is not stable");
+  check(compare_sorts(200000, 40, 0, 0xff0000ull, random), "sorting pairs with a skipped pass differs from std::sort");
+
+  return check_result("radix_sort");
+}
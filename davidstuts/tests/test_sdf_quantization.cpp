@@ -0,0 +1,79 @@
+// Quantized SDFs: values stored as float16, int16 or int8 and read back as floats through HDF5,
+// as readers do, stay within half a step of the truncated values.
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "io/sdf_quantization.h"
+#include "tests/check.h"
+
+/** \brief Store values with a quantization in an in-memory file and read them back as floats.
+ * \param[in] quantization quantization
+ * \param[in] values values
+ * \return dequantized values
+ */
+std::vector<float> round_trip(const SdfQuantization& quantization, const std::vector<float>& values) {
+  H5::FileAccPropList access;
+  access.setCore(1 << 20, false);
+  H5::H5File file("sdf_quantization.h5", H5F_ACC_TRUNC, H5::FileCreatPropList::DEFAULT, access);
+
+  std::vector<char> buffer(values.size()*quantization.bytes());
+  quantization.quantize(values.data(), values.size(), buffer.data());
+
+  hsize_t dims[1] = { values.size() };
+  H5::DataSpace space(1, dims);
+  H5::DataSet dataset = file.createDataSet("tensor", quantization.type(), space);
+  dataset.write(buffer.data(), quantization.type());
+  if (!quantization.is_identity()) {
+    quantization.write_attributes(dataset);
+  }
+
+  std::vector<float> read(values.size());
+  dataset.read(read.data(), H5::PredType::NATIVE_FLOAT);
+  const float scale = read_sdf_scale(dataset);
+  for (size_t i = 0; i < read.size(); i++) {
+    read[i] *= scale;
+  }
+  return read;
+}
+
+int main() {
+  std::mt19937 random(3);
+  std::uniform_real_distribution<float> distribution(-6.f, 6.f);
+
+  // More than a group of 8 so that the F16C path and its scalar tail both run, and the extremes.
+  std::vector<float> values(1003);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = distribution(random);
+  }
+  values[0] = 0;
+  values[1] = -0.f;
+  values[2] = 4.f;
+  values[3] = -4.f;
+  values[4] = 1e-6f;
+  values[5] = 1e30f;
+
+  const char* formats[] = { "float32", "float16", "int16", "int8" };
+  for (const char* format : formats) {
+    SdfQuantization quantization;
+    check(SdfQuantization::parse(format, 4.f, quantization), std::string("could not parse ") + format);
+
+    std::vector<float> read = round_trip(quantization, values);
+    for (size_t i = 0; i < values.size(); i++) {
+      const float truncated = std::min(std::max(values[i], -4.f), 4.f);
+      // Half a step of the integer formats, half an ulp of float16 (11 significant bits).
+      const float tolerance = quantization.is_integer() ? 0.5f*quantization.scale()*1.0001f
+        : (quantization.format == SdfFormat::FLOAT16 ? std::fabs(truncated)*std::ldexp(1.f, -11) + 6e-8f : 0.f);
+      if (!(std::fabs(read[i] - truncated) <= tolerance)) {
+        check(false, std::string(format) + " round trip of " + std::to_string(values[i]) + " gives " + std::to_string(read[i]));
+        break;
+      }
+    }
+  }
+
+  SdfQuantization quantization;
+  check(!SdfQuantization::parse("int8", 0.f, quantization), "int8 without truncation is accepted");
+  check(!SdfQuantization::parse("int4", 4.f, quantization), "an unknown format is accepted");
+
+  return check_result("sdf_quantization");
+}
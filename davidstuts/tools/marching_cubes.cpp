@@ -0,0 +1,122 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+
+// Boost
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+// HDF5
+#include <H5Cpp.h>
+
+#include "marching_cubes.h"
+#include "io/hdf5_reader.h"
+#include "io/ply_writer.h"
+
+/** \brief Read the rank of a dataset.
+ * \param[in] filepath h5 file
+ * \param[in] dataset_name dataset
+ * \return rank, -1 if the dataset can not be read
+ */
+int read_rank(const std::string& filepath, const std::string& dataset_name) {
+  try {
+    H5::Exception::dontPrint();
+    H5::H5File file(filepath, H5F_ACC_RDONLY);
+    return file.openDataSet(dataset_name).getSpace().getSimpleExtentNdims();
+  }
+  catch (H5::Exception& error) {
+    error.printError();
+    return -1;
+  }
+}
+
+/** \brief Extract the surfaces of the SDFs written by voxelize sdf as PLY meshes.
+ *
+ * Every volume of the N x height x width x depth tensor (or the height x width x depth tensor of a
+ * single voxelized file) is meshed with marching_cubes and written as <output>/<n>.ply, in the
+ * coordinates of the voxelized meshes. The volumes are meshed one after another, each in parallel.
+ */
+int main(int argc, char** argv) {
+  boost::program_options::options_description desc("Allowed options");
+  desc.add_options()
+      ("help", "produce help message")
+      ("input", boost::program_options::value<std::string>(), "h5 file written by voxelize sdf")
+      ("output", boost::program_options::value<std::string>(), "output directory, will contain one binary PLY file per volume")
+      ("dataset", boost::program_options::value<std::string>()->default_value("tensor"), "dataset to read")
+      ("iso", boost::program_options::value<float>()->default_value(0.f), "iso value of the surface, in voxels")
+      ("center", "the SDFs were computed with --center, i.e. at the voxel centers");
+
+  boost::program_options::positional_options_description positionals;
+  positionals.add("input", 1);
+  positionals.add("output", 1);
+
+  boost::program_options::variables_map parameters;
+  boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).positional(positionals).run(), parameters);
+  boost::program_options::notify(parameters);
+
+  if (parameters.find("help") != parameters.end() || parameters.find("input") == parameters.end() || parameters.find("output") == parameters.end()) {
+    std::cout << desc << std::endl;
+    return parameters.find("help") != parameters.end() ? 0 : 1;
+  }
+
+  const std::string input = parameters["input"].as<std::string>();
+  const std::string dataset = parameters["dataset"].as<std::string>();
+  const float iso = parameters["iso"].as<float>();
+  const VoxelizationMode mode = parameters.find("center") != parameters.end() ? VoxelizationMode::CENTER : VoxelizationMode::CORNER;
+
+  boost::filesystem::path output(parameters["output"].as<std::string>());
+  if (!boost::filesystem::is_directory(output)) {
+    boost::filesystem::create_directories(output);
+  }
+
+  // A single voxelized file gives one volume without the leading dimension
+  const int rank = read_rank(input, dataset);
+  if (rank != 3 && rank != 4) {
+    std::cout << "Expected a N x height x width x depth or height x width x depth dataset " << dataset << " in " << input << "." << std::endl;
+    return 1;
+  }
+
+  size_t n = 1;
+  std::unique_ptr<Hdf5Reader<float, 4> > reader;
+  if (rank == 4) {
+    reader.reset(new Hdf5Reader<float, 4>(input, dataset));
+    if (!reader->is_open()) {
+      std::cout << "Could not read " << input << "." << std::endl;
+      return 1;
+    }
+    n = reader->dimensions()[0];
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    Eigen::Tensor<float, 3, Eigen::RowMajor> sdf;
+    bool success;
+    if (rank == 4) {
+      success = reader->read_sample(i, sdf);
+    }
+    else {
+      Hdf5Reader<float, 3> volume_reader(input, dataset);
+      success = volume_reader.is_open() && volume_reader.read(sdf);
+    }
+    if (!success) {
+      std::cout << "Could not read volume " << i << " of " << input << "." << std::endl;
+      return 1;
+    }
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    MarchingCubesMesh mesh;
+    marching_cubes(sdf.data(), sdf.dimension(0), sdf.dimension(1), sdf.dimension(2), mode, iso, mesh);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    boost::filesystem::path filepath = output/(std::to_string(i) + ".ply");
+    if (!write_ply(filepath.string(), mesh.vertices, mesh.faces)) {
+      std::cout << "Could not write " << filepath << "." << std::endl;
+      return 1;
+    }
+    std::cout << "Wrote " << filepath << " with " << mesh.num_vertices() << " vertices and " << mesh.num_faces() << " triangles (" << seconds << "s)." << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,216 @@
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+// Boost
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+// HDF5
+#include <H5Cpp.h>
+
+#include "io/sdf_quantization.h"
+#include "io/bit_occupancy.h"
+
+/** \brief Output of one process of a sharded directory run. */
+struct Shard {
+  std::string path;
+  /** \brief Dimensions of the tensor, N x height x width x depth. */
+  hsize_t dims[4];
+  /** \brief Scalar type of the tensor. */
+  std::unique_ptr<H5::DataType> type;
+  /** \brief Quantization of SDFs, float32 if not quantized. */
+  SdfQuantization quantization;
+  /** \brief Scale of quantized SDFs as stored, 1 if not quantized. */
+  float scale;
+  /** \brief Unpacked dimensions of packed occupancy, empty if not packed. */
+  std::vector<hsize_t> bit_shape;
+  /** \brief Dense dimension of every packed dimension, see write_bit_attributes(). */
+  std::vector<hsize_t> bit_axes;
+  /** \brief Written flag of every volume. */
+  std::vector<uint8_t> written;
+};
+
+/** \brief Read the dimensions, type and written volumes of a shard.
+ * \param[in] filepath h5 file written by voxelize with --shard or --claim_dir
+ * \param[out] shard shard
+ * \return success
+ */
+bool read_shard(const std::string& filepath, Shard& shard) {
+  try {
+    H5::H5File file(filepath, H5F_ACC_RDONLY);
+    H5::DataSet tensor = file.openDataSet("tensor");
+    H5::DataSpace space = tensor.getSpace();
+    if (space.getSimpleExtentNdims() != 4) {
+      std::cout << "The tensor of " << filepath << " is not N x height x width x depth." << std::endl;
+      return false;
+    }
+    space.getSimpleExtentDims(shard.dims);
+    shard.type.reset(new H5::DataType(tensor.getDataType()));
+    shard.path = filepath;
+    shard.scale = read_sdf_scale(tensor);
+    if (read_bit_shape(tensor, shard.bit_shape)) {
+      read_bit_axes(tensor, shard.bit_shape.size(), shard.bit_axes);
+    }
+    else if (tensor.attrExists("format")) {
+      H5::Attribute format = tensor.openAttribute("format");
+      std::string name;
+      format.read(format.getStrType(), name);
+      float truncation = 0;
+      tensor.openAttribute("truncation").read(H5::PredType::NATIVE_FLOAT, &truncation);
+      if (!SdfQuantization::parse(name, truncation, shard.quantization)) {
+        std::cout << filepath << " has an unknown SDF format " << name << "." << std::endl;
+        return false;
+      }
+    }
+
+    H5::DataSet written = file.openDataSet("written");
+    H5::DataSpace written_space = written.getSpace();
+    hsize_t written_dims[1];
+    written_space.getSimpleExtentDims(written_dims);
+    shard.written.assign(written_dims[0], 0);
+    if (written_dims[0] > 0) {
+      written.read(shard.written.data(), H5::PredType::NATIVE_UINT8);
+    }
+    shard.written.resize(shard.dims[0], 0);
+  }
+  catch (H5::Exception& error) {
+    error.printError();
+    return false;
+  }
+
+  return true;
+}
+
+/** \brief Assemble the outputs of a sharded directory run into one file without copying.
+ *
+ * The merged "tensor" is a HDF5 virtual dataset: every range of consecutive volumes written by
+ * the same shard maps to that range of the shard's tensor, volumes written by no shard read as
+ * zero. The shards are referenced relative to the merged file, so they have to stay next to it.
+ */
+int main(int argc, char** argv) {
+  boost::program_options::options_description desc("Allowed options");
+  desc.add_options()
+      ("help", "produce help message")
+      ("output", boost::program_options::value<std::string>(), "merged h5 file, will contain a virtual N x height x width x depth tensor referencing the shards and the combined written flags")
+      ("shards", boost::program_options::value<std::vector<std::string> >()->multitoken(), "h5 files written by voxelize with --shard or --claim_dir");
+
+  boost::program_options::positional_options_description positionals;
+  positionals.add("output", 1);
+  positionals.add("shards", -1);
+
+  boost::program_options::variables_map parameters;
+  boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).positional(positionals).run(), parameters);
+  boost::program_options::notify(parameters);
+
+  if (parameters.find("help") != parameters.end() || parameters.find("output") == parameters.end() || parameters.find("shards") == parameters.end()) {
+    std::cout << desc << std::endl;
+    return parameters.find("help") != parameters.end() ? 0 : 1;
+  }
+
+  boost::filesystem::path output = boost::filesystem::absolute(parameters["output"].as<std::string>());
+  std::vector<std::string> paths = parameters["shards"].as<std::vector<std::string> >();
+
+  std::vector<Shard> shards(paths.size());
+  hsize_t n = 0;
+  for (size_t s = 0; s < paths.size(); s++) {
+    if (!read_shard(paths[s], shards[s])) {
+      std::cout << "Could not read " << paths[s] << "." << std::endl;
+      return 1;
+    }
+    if (shards[s].dims[1] != shards[0].dims[1] || shards[s].dims[2] != shards[0].dims[2] || shards[s].dims[3] != shards[0].dims[3]
+        || !(*shards[s].type == *shards[0].type) || shards[s].quantization.format != shards[0].quantization.format
+        || shards[s].quantization.truncation != shards[0].quantization.truncation || shards[s].scale != shards[0].scale
+        || shards[s].bit_shape != shards[0].bit_shape || shards[s].bit_axes != shards[0].bit_axes) {
+      std::cout << paths[s] << " has other volume dimensions, type or SDF quantization than " << paths[0] << "." << std::endl;
+      return 1;
+    }
+    n = std::max(n, shards[s].dims[0]);
+  }
+
+  // The first shard that wrote a volume provides it.
+  std::vector<int> owner(n, -1);
+  size_t merged = 0;
+  for (size_t s = 0; s < shards.size(); s++) {
+    for (hsize_t i = 0; i < shards[s].written.size(); i++) {
+      if (!shards[s].written[i]) {
+        continue;
+      }
+      if (owner[i] >= 0) {
+        std::cout << "Volume " << i << " was written by " << paths[owner[i]] << " and " << paths[s] << ", using the former." << std::endl;
+        continue;
+      }
+      owner[i] = static_cast<int>(s);
+      merged++;
+    }
+  }
+
+  size_t mappings = 0;
+  try {
+    H5::Exception::dontPrint();
+    H5::H5File file(output.string(), H5F_ACC_TRUNC);
+
+    hsize_t dims[4] = { n, shards[0].dims[1], shards[0].dims[2], shards[0].dims[3] };
+    H5::DataSpace space(4, dims);
+    H5::DSetCreatPropList properties;
+    std::vector<uint8_t> zero(shards[0].type->getSize(), 0);
+    properties.setFillValue(*shards[0].type, zero.data());
+
+    for (hsize_t i = 0; i < n;) {
+      hsize_t end = i + 1;
+      while (end < n && owner[end] == owner[i]) {
+        end++;
+      }
+
+      if (owner[i] >= 0) {
+        const Shard& shard = shards[owner[i]];
+        boost::filesystem::path source = boost::filesystem::relative(boost::filesystem::absolute(shard.path), output.parent_path());
+
+        hsize_t start[4] = { i, 0, 0, 0 };
+        hsize_t count[4] = { end - i, dims[1], dims[2], dims[3] };
+        H5::DataSpace virtual_space(4, dims);
+        virtual_space.selectHyperslab(H5S_SELECT_SET, count, start);
+        H5::DataSpace source_space(4, shard.dims);
+        source_space.selectHyperslab(H5S_SELECT_SET, count, start);
+        properties.setVirtual(virtual_space, source.string(), "tensor", source_space);
+        mappings++;
+      }
+      i = end;
+    }
+
+    H5::DataSet tensor = file.createDataSet("tensor", *shards[0].type, space, properties);
+    if (!shards[0].quantization.is_identity()) {
+      shards[0].quantization.write_attributes(tensor);
+    }
+    if (!shards[0].bit_shape.empty()) {
+      write_bit_attributes(tensor, shards[0].bit_shape, shards[0].bit_axes);
+    }
+
+    std::vector<uint8_t> written(n, 0);
+    for (hsize_t i = 0; i < n; i++) {
+      written[i] = owner[i] >= 0 ? 1 : 0;
+    }
+    hsize_t written_dims[1] = { n };
+    H5::DataSpace written_space(1, written_dims);
+    H5::DataSet written_dataset = file.createDataSet("written", H5::PredType::NATIVE_UINT8, written_space);
+    if (n > 0) {
+      written_dataset.write(written.data(), H5::PredType::NATIVE_UINT8);
+    }
+  }
+  catch (H5::Exception& error) {
+    error.printError();
+    std::cout << "Could not write " << output << "." << std::endl;
+    return 1;
+  }
+
+  std::cout << "Merged " << merged << " of " << n << " volumes from " << shards.size() << " shards into " << output
+    << " (" << mappings << " mappings)." << std::endl;
+  if (merged < n) {
+    std::cout << "The " << n - merged << " missing volumes read as zero." << std::endl;
+  }
+  return 0;
+}
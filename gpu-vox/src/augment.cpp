@@ -0,0 +1,189 @@
+#include "augment.h"
+#include "cpu_voxelizer.h"
+#include "util_io.h"
+#include "common/trace.h"
+#include "common/perf_counters.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+namespace augment {
+
+	Pose::Pose(glm::vec3 axis, float angle, float scale) : axis(axis), angle(angle), scale(scale) {
+		float length = std::sqrt(glm::dot(axis, axis));
+		this->axis = length > 0.0f ? axis / length : glm::vec3(0.0f, 0.0f, 1.0f);
+		// Rodrigues: R = cos(a) I + sin(a) [k]x + (1 - cos(a)) k k^T
+		const glm::vec3& k = this->axis;
+		float radians = angle * 3.14159265358979f / 180.0f;
+		float c = std::cos(radians), s = std::sin(radians), t = 1.0f - c;
+		float rotation[9] = {
+			c + t * k.x * k.x, t * k.x * k.y - s * k.z, t * k.x * k.z + s * k.y,
+			t * k.y * k.x + s * k.z, c + t * k.y * k.y, t * k.y * k.z - s * k.x,
+			t * k.z * k.x - s * k.y, t * k.z * k.y + s * k.x, c + t * k.z * k.z };
+		for (int i = 0; i < 9; i++) {
+			matrix[i] = scale * rotation[i];
+		}
+	}
+
+	std::string Pose::json(const glm::vec3& center) const {
+		char buffer[512];
+		snprintf(buffer, sizeof(buffer), "\"pose\": {\"axis\": [%.9g, %.9g, %.9g], \"angle\": %.9g, \"scale\": %.9g, \"center\": [%.9g, %.9g, %.9g], "
+			"\"matrix\": [%.9g, %.9g, %.9g, %.9g, %.9g, %.9g, %.9g, %.9g, %.9g]}", axis.x, axis.y, axis.z, angle, scale, center.x, center.y, center.z,
+			matrix[0], matrix[1], matrix[2], matrix[3], matrix[4], matrix[5], matrix[6], matrix[7], matrix[8]);
+		return std::string(buffer);
+	}
+
+	bool read_poses(const std::string& path, std::vector<Pose>& poses) {
+		std::ifstream input(path.c_str());
+		if (!input) {
+			fprintf(stdout, "[Err] Could not read poses from %s \n", path.c_str());
+			return false;
+		}
+		std::string line;
+		size_t number = 0;
+		while (std::getline(input, line)) {
+			number++;
+			size_t first = line.find_first_not_of(" \t\r");
+			if (first == std::string::npos || line[first] == '#') {
+				continue;
+			}
+			std::istringstream fields(line);
+			glm::vec3 axis;
+			float angle, scale;
+			if (!(fields >> axis.x >> axis.y >> axis.z >> angle >> scale) || scale <= 0.0f) {
+				fprintf(stdout, "[Err] Line %zu of %s is not a pose \"axis_x axis_y axis_z angle scale\" with a positive scale \n", number, path.c_str());
+				return false;
+			}
+			poses.push_back(Pose(axis, angle, scale));
+		}
+		return true;
+	}
+
+	std::vector<Pose> random_poses(size_t n, uint32_t seed) {
+		// Uniform random unit quaternions (Shoemake), turned into axis and angle
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+		std::uniform_real_distribution<float> scales(AUGMENT_SCALE_MIN, AUGMENT_SCALE_MAX);
+		const float two_pi = 2.0f * 3.14159265358979f;
+		std::vector<Pose> poses;
+		for (size_t i = 0; i < n; i++) {
+			float u1 = uniform(rng), u2 = uniform(rng), u3 = uniform(rng);
+			glm::vec3 q(std::sqrt(1.0f - u1) * std::sin(two_pi * u2), std::sqrt(1.0f - u1) * std::cos(two_pi * u2), std::sqrt(u1) * std::sin(two_pi * u3));
+			float w = std::sqrt(u1) * std::cos(two_pi * u3);
+			if (w < 0.0f) {
+				q = q * -1.0f;
+				w = -w;
+			}
+			float angle = 2.0f * std::acos(glm::min(w, 1.0f)) * 180.0f / 3.14159265358979f;
+			poses.push_back(Pose(q, angle, scales(rng)));
+		}
+		return poses;
+	}
+
+	// Center of the scene bbox, the point the poses rotate and scale about
+	static glm::vec3 sceneCenter(const voxinfo& scene) {
+		return (scene.bbox.min + scene.bbox.max) * 0.5f;
+	}
+
+	voxinfo pose_info(const voxinfo& scene, const trimesh::TriMesh* themesh, const Pose& pose) {
+		glm::vec3 center = sceneCenter(scene);
+		// The bbox of the posed vertices alone; a mesh without vertices gets an empty grid at the center
+		glm::vec3 lo(std::numeric_limits<float>::infinity()), hi(-std::numeric_limits<float>::infinity());
+		for (size_t v = 0; v < themesh->vertices.size(); v++) {
+			glm::vec3 p = pose.apply(trimesh_to_glm<trimesh::point>(themesh->vertices[v]), center);
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+		if (themesh->vertices.empty()) {
+			lo = hi = center;
+		}
+		glm::uvec3 gridsize;
+		for (int i = 0; i < 3; i++) {
+			gridsize[i] = scene.unit[i] > 0.0f ? glm::max(1u, static_cast<unsigned int>(std::ceil((hi[i] - lo[i]) / scene.unit[i]))) : 1u;
+		}
+		voxinfo info(AABox<glm::vec3>(lo, lo + scene.unit * glm::vec3(gridsize)), gridsize, themesh->faces.size());
+		info.unit = scene.unit; // exactly the scene voxel size, not recomputed from the bbox
+		return info;
+	}
+
+	glm::uvec3 max_gridsize(const voxinfo& scene, const std::vector<Pose>& poses) {
+		float scale = 0.0f;
+		for (size_t k = 0; k < poses.size(); k++) {
+			scale = glm::max(scale, poses[k].scale);
+		}
+		glm::vec3 extent = scene.bbox.max - scene.bbox.min;
+		float diameter = scale * std::sqrt(glm::dot(extent, extent));
+		glm::uvec3 gridsize;
+		for (int i = 0; i < 3; i++) {
+			gridsize[i] = scene.unit[i] > 0.0f ? glm::max(1u, static_cast<unsigned int>(std::ceil(diameter / scene.unit[i]))) : 1u;
+		}
+		return gridsize;
+	}
+
+	bool voxelize_poses(const voxinfo& scene, const trimesh::TriMesh* themesh, const std::vector<unsigned short>& labels,
+		const std::vector<Pose>& poses, const std::string& output, bool sparse, bool bits, StatValues& stats) {
+		std::vector<unsigned int> triangle_colors;
+		cpu_voxelizer::cpu_triangle_colors(themesh, labels, triangle_colors);
+
+		const glm::vec3 center = sceneCenter(scene);
+		const size_t n_triangles = themesh->faces.size();
+		std::mutex write_mutex;
+		bool success = true;
+		bool created = false;
+		size_t written = 0;
+		stats = StatValues();
+
+		// One pose per thread, running over all triangles, so the mesh is streamed once per pose
+#pragma omp parallel for schedule(dynamic)
+		for (long long k = 0; k < static_cast<long long>(poses.size()); k++) {
+			TraceScope scope("pose");
+			const Pose& pose = poses[k];
+			voxinfo info = pose_info(scene, themesh, pose);
+
+			// Triangle setup of the posed mesh, relative to the bbox minimum of the pose grid
+			TriangleSetup setup;
+			setup.origin = info.bbox.min;
+			setup.n_triangles = n_triangles;
+			setup.stride = TriangleSetup::stride_for(n_triangles);
+			std::vector<float> storage(TriangleSetup::COMPONENTS * setup.stride, 0.0f);
+			setup.data = storage.data();
+			for (size_t f = 0; f < n_triangles; f++) {
+				glm::vec3 v[3];
+				for (int j = 0; j < 3; j++) {
+					v[j] = pose.apply(trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[f][j]]), center) - setup.origin;
+				}
+				setup_triangle(setup, f, v[0], v[1], v[2]);
+			}
+
+			const size_t n_voxels = static_cast<size_t>(info.gridsize.x) * static_cast<size_t>(info.gridsize.y) * static_cast<size_t>(info.gridsize.z);
+			std::vector<unsigned int> vtable((n_voxels + 31) / 32, 0);
+			std::vector<unsigned int> colortable(4 * n_voxels, 0);
+			StatValues pose_stats;
+			cpu_voxelizer::cpu_voxelize_mesh(info, setup, triangle_colors.data(), vtable.data(), colortable.data(), false, pose_stats);
+
+			std::lock_guard<std::mutex> lock(write_mutex);
+			stats += pose_stats;
+			std::string name = "pose_" + std::to_string(k);
+			bool ok;
+			if (sparse) {
+				ok = write_sparse(vtable.data(), colortable.data(), info, output, "_" + name, created, false);
+			}
+			else {
+				ok = combine_data(vtable.data(), colortable.data(), info.gridsize.x, info, output, name, created, 0, false);
+			}
+			created = created || ok;
+			ok = ok && write_transformations(info, output + "." + name, pose.json(center));
+			if (bits) {
+				ok = ok && write_bits(vtable.data(), info, output, "occupancy_" + name);
+			}
+			success = success && ok;
+			written += ok ? 1 : 0;
+		}
+		fprintf(stdout, "[Augment] Wrote %zu of %zu poses \n", written, poses.size());
+		return success && !poses.empty();
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <TriMesh.h>
+#include "util.h"
+#include "common/voxel_stats.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Multi-pose augmentation: one mesh, read and prepared once, is voxelized at many rotations and scales about the
+// center of its bbox. The poses are voxelized in parallel, one pose per thread running over all triangles with its
+// own triangle setup, voxel table and color table, and every pose is written as a dataset of its own.
+namespace augment {
+	// Scales of random poses are drawn uniformly from [AUGMENT_SCALE_MIN, AUGMENT_SCALE_MAX]
+	const float AUGMENT_SCALE_MIN = 0.8f;
+	const float AUGMENT_SCALE_MAX = 1.2f;
+
+	struct Pose {
+		glm::vec3 axis; // rotation axis, unit length
+		float angle; // rotation angle in degrees, counter-clockwise about the axis
+		float scale; // uniform scale, applied after the rotation
+		float matrix[9]; // scale * rotation, row major
+
+		Pose(glm::vec3 axis, float angle, float scale);
+
+		// Position of p posed about center
+		glm::vec3 apply(const glm::vec3& p, const glm::vec3& center) const {
+			glm::vec3 d = p - center;
+			return center + glm::vec3(matrix[0] * d.x + matrix[1] * d.y + matrix[2] * d.z,
+				matrix[3] * d.x + matrix[4] * d.y + matrix[5] * d.z,
+				matrix[6] * d.x + matrix[7] * d.y + matrix[8] * d.z);
+		}
+
+		// The pose as the json member "pose" of the sidecar of write_transformations
+		std::string json(const glm::vec3& center) const;
+	};
+
+	// Read poses from a text file, one pose per line as "axis_x axis_y axis_z angle scale" (angle in degrees),
+	// skipping empty lines and lines starting with #; returns false if the file can not be read or a line is malformed
+	bool read_poses(const std::string& path, std::vector<Pose>& poses);
+
+	// n random poses for seed: rotations uniformly distributed over all rotations, scales uniform in
+	// [AUGMENT_SCALE_MIN, AUGMENT_SCALE_MAX]; the same seed gives the same poses
+	std::vector<Pose> random_poses(size_t n, uint32_t seed);
+
+	// Voxelization of the mesh in pose: the bbox of the posed mesh with the voxel size of scene, so scaled poses
+	// get larger or smaller grids rather than coarser or finer voxels
+	voxinfo pose_info(const voxinfo& scene, const trimesh::TriMesh* themesh, const Pose& pose);
+
+	// Bound of the grid size of pose_info for any of the poses, from the sphere around the scene bbox
+	glm::uvec3 max_gridsize(const voxinfo& scene, const std::vector<Pose>& poses);
+
+	// Voxelize the mesh in every pose in parallel and write pose k to the h5 file output (truncated) as dataset
+	// pose_<k> in the combine_data layout (coords_pose_<k>, colors_pose_<k> and labels_pose_<k> with sparse), plus
+	// occupancy_pose_<k> with bits. The sidecar <output>.pose_<k>.json holds the normalization of the pose grid and
+	// the pose. Returns whether all writes succeeded.
+	bool voxelize_poses(const voxinfo& scene, const trimesh::TriMesh* themesh, const std::vector<unsigned short>& labels,
+		const std::vector<Pose>& poses, const std::string& output, bool sparse, bool bits, StatValues& stats);
+}
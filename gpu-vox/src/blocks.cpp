@@ -0,0 +1,183 @@
+#include "blocks.h"
+#include "cpu_voxelizer.h"
+#include "util_io.h"
+#include "common/trace.h"
+#include "common/perf_counters.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+namespace blocks {
+
+	// Blocks along one axis of g voxels, for blocks of size voxels every stride voxels
+	static unsigned int blockCount(unsigned int g, unsigned int size, unsigned int stride) {
+		return g <= size ? 1 : 1 + (g - size + stride - 1) / stride;
+	}
+
+	BlockGrid::BlockGrid(const voxinfo& scene, unsigned int size, unsigned int overlap)
+		: scene(scene), size(size), overlap(overlap) {
+		unsigned int stride = size - overlap;
+		count = glm::uvec3(blockCount(scene.gridsize.x, size, stride), blockCount(scene.gridsize.y, size, stride), blockCount(scene.gridsize.z, size, stride));
+	}
+
+	glm::uvec3 BlockGrid::index(size_t b) const {
+		return glm::uvec3(b % count.x, (b / count.x) % count.y, b / (static_cast<size_t>(count.x) * count.y));
+	}
+
+	glm::uvec3 BlockGrid::origin(size_t b) const {
+		return index(b) * (size - overlap);
+	}
+
+	voxinfo BlockGrid::info(size_t b) const {
+		glm::vec3 min = scene.bbox.min + scene.unit * glm::vec3(origin(b));
+		voxinfo block(AABox<glm::vec3>(min, min + scene.unit * float(size)), glm::uvec3(size, size, size), 0);
+		block.unit = scene.unit; // exactly the scene voxel size, not recomputed from the bbox
+		return block;
+	}
+
+	// Blocks [lo, hi] along one axis that hold voxels lo_voxel .. hi_voxel
+	static bool blockRange(long long lo_voxel, long long hi_voxel, unsigned int size, unsigned int stride, unsigned int count,
+		unsigned int& lo, unsigned int& hi) {
+		long long first = lo_voxel - static_cast<long long>(size) + 1;
+		long long lo_block = first <= 0 ? 0 : (first + stride - 1) / stride;
+		long long hi_block = hi_voxel < 0 ? -1 : glm::min<long long>(count - 1, hi_voxel / stride);
+		lo = static_cast<unsigned int>(lo_block);
+		hi = static_cast<unsigned int>(glm::max<long long>(hi_block, 0));
+		return lo_block <= hi_block;
+	}
+
+	void bin_triangles(const BlockGrid& grid, const trimesh::TriMesh* themesh, std::vector<size_t>& starts, std::vector<uint32_t>& triangles) {
+		TraceScope scope("bin");
+		const long long n_triangles = static_cast<long long>(themesh->faces.size());
+		const unsigned int stride = grid.size - grid.overlap;
+
+		// Block ranges of triangle f, from its voxel bbox with a margin of one voxel for rounding
+		auto ranges = [&](long long f, glm::uvec3& lo, glm::uvec3& hi) {
+			glm::vec3 v0 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[f][0]]);
+			glm::vec3 v1 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[f][1]]);
+			glm::vec3 v2 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[f][2]]);
+			glm::vec3 t_min = (glm::min(v0, glm::min(v1, v2)) - grid.scene.bbox.min) / grid.scene.unit;
+			glm::vec3 t_max = (glm::max(v0, glm::max(v1, v2)) - grid.scene.bbox.min) / grid.scene.unit;
+			bool inside = true;
+			for (int i = 0; i < 3; i++) {
+				long long lo_voxel = static_cast<long long>(std::floor(t_min[i])) - 1;
+				long long hi_voxel = static_cast<long long>(std::floor(t_max[i])) + 1;
+				inside = blockRange(lo_voxel, hi_voxel, grid.size, stride, grid.count[i], lo[i], hi[i]) && inside;
+			}
+			return inside;
+		};
+
+		std::vector<size_t> counts(grid.n_blocks(), 0);
+#pragma omp parallel for
+		for (long long f = 0; f < n_triangles; f++) {
+			glm::uvec3 lo, hi;
+			if (!ranges(f, lo, hi)) {
+				continue;
+			}
+			for (unsigned int z = lo.z; z <= hi.z; z++) {
+				for (unsigned int y = lo.y; y <= hi.y; y++) {
+					for (unsigned int x = lo.x; x <= hi.x; x++) {
+						size_t b = x + grid.count.x * (y + static_cast<size_t>(grid.count.y) * z);
+#pragma omp atomic
+						counts[b]++;
+					}
+				}
+			}
+		}
+
+		starts.assign(grid.n_blocks() + 1, 0);
+		for (size_t b = 0; b < grid.n_blocks(); b++) {
+			starts[b + 1] = starts[b] + counts[b];
+			counts[b] = starts[b];
+		}
+		triangles.resize(starts.back());
+
+#pragma omp parallel for
+		for (long long f = 0; f < n_triangles; f++) {
+			glm::uvec3 lo, hi;
+			if (!ranges(f, lo, hi)) {
+				continue;
+			}
+			for (unsigned int z = lo.z; z <= hi.z; z++) {
+				for (unsigned int y = lo.y; y <= hi.y; y++) {
+					for (unsigned int x = lo.x; x <= hi.x; x++) {
+						size_t b = x + grid.count.x * (y + static_cast<size_t>(grid.count.y) * z);
+						size_t slot;
+#pragma omp atomic capture
+						slot = counts[b]++;
+						triangles[slot] = static_cast<uint32_t>(f);
+					}
+				}
+			}
+		}
+
+		// Back to mesh order, so the last triangle marking a voxel is the same as without blocks
+#pragma omp parallel for schedule(dynamic)
+		for (long long b = 0; b < static_cast<long long>(grid.n_blocks()); b++) {
+			std::sort(triangles.begin() + starts[b], triangles.begin() + starts[b + 1]);
+		}
+	}
+
+	bool voxelize_blocks(const BlockGrid& grid, const trimesh::TriMesh* themesh, const std::vector<unsigned short>& labels,
+		const std::vector<size_t>& starts, const std::vector<uint32_t>& triangles, const std::string& output, bool bits, StatValues& stats) {
+		std::vector<unsigned int> triangle_colors;
+		cpu_voxelizer::cpu_triangle_colors(themesh, labels, triangle_colors);
+		// The resolution independent terms are set up once for the scene, every block only rebases them on its origin
+		std::vector<float> storage;
+		TriangleSetup setup = cpu_voxelizer::cpu_setup_triangles(grid.scene, themesh, storage);
+
+		const size_t n_voxels = static_cast<size_t>(grid.size) * grid.size * grid.size;
+		std::mutex write_mutex;
+		bool success = true;
+		bool created = false;
+		std::vector<size_t> written;
+		stats = StatValues();
+
+		// One block per thread; the voxelization of a block runs serially within its thread
+#pragma omp parallel for schedule(dynamic)
+		for (long long b = 0; b < static_cast<long long>(grid.n_blocks()); b++) {
+			const size_t n = starts[b + 1] - starts[b];
+			if (n == 0) {
+				continue;
+			}
+			voxinfo info = grid.info(b);
+			info.n_triangles = n;
+
+			std::vector<unsigned int> vtable((n_voxels + 31) / 32, 0);
+			std::vector<unsigned int> colortable(4 * n_voxels, 0);
+			StatValues block_stats;
+			cpu_voxelizer::cpu_voxelize_mesh(info, setup, &triangles[starts[b]], grid.origin(b), triangle_colors.data(), vtable.data(),
+				colortable.data(), false, block_stats);
+
+			// Triangles binned by the margin of their bbox may mark nothing; such blocks are not written
+			std::lock_guard<std::mutex> lock(write_mutex);
+			stats += block_stats;
+			if (block_stats[STAT_MARKS] == 0) {
+				continue;
+			}
+			glm::uvec3 index = grid.index(b);
+			glm::uvec3 origin = grid.origin(b);
+			unsigned int origin_voxel[3] = { origin.x, origin.y, origin.z };
+			std::string name = "block_" + std::to_string(index.x) + "_" + std::to_string(index.y) + "_" + std::to_string(index.z);
+			bool ok = combine_data(vtable.data(), colortable.data(), grid.size, info, output, name, created, 0, false);
+			created = created || ok;
+			ok = ok && write_block_attributes(info, origin_voxel, output, name);
+			if (bits) {
+				ok = ok && write_bits(vtable.data(), info, output, "occupancy_" + name);
+			}
+			success = success && ok;
+			if (ok) {
+				written.push_back(static_cast<size_t>(b));
+			}
+		}
+
+		std::sort(written.begin(), written.end());
+		std::vector<unsigned int> origins;
+		for (size_t b : written) {
+			glm::uvec3 origin = grid.origin(b);
+			origins.push_back(origin.x); origins.push_back(origin.y); origins.push_back(origin.z);
+		}
+		fprintf(stdout, "[Blocks] Wrote %zu of %zu blocks \n", written.size(), grid.n_blocks());
+		return write_block_index(grid.scene, origins, grid.size, grid.overlap, output, created) && success;
+	}
+}
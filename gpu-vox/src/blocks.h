@@ -0,0 +1,45 @@
+#pragma once
+
+#include <TriMesh.h>
+#include "util.h"
+#include "common/voxel_stats.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Chunked voxelization of scenes too large for a single grid: the voxel grid over the scene bbox is divided into
+// cubic blocks of a fixed number of voxels, neighbouring blocks sharing overlap voxels. Triangles are binned into
+// the blocks they touch once, then the blocks are voxelized in parallel, one block per thread with its own small
+// voxel and color table, and written as datasets of their own.
+namespace blocks {
+	struct BlockGrid {
+		voxinfo scene; // voxelization of the whole scene, defines the voxel size and the origin of the blocks
+		unsigned int size; // voxels per block along every axis
+		unsigned int overlap; // voxels shared by neighbouring blocks
+		glm::uvec3 count; // blocks along every axis, enough to cover the scene grid
+
+		BlockGrid(const voxinfo& scene, unsigned int size, unsigned int overlap);
+
+		size_t n_blocks() const {
+			return static_cast<size_t>(count.x) * static_cast<size_t>(count.y) * static_cast<size_t>(count.z);
+		}
+		// Block indices (along x, y and z) of block b
+		glm::uvec3 index(size_t b) const;
+		// First voxel of block b in the scene grid
+		glm::uvec3 origin(size_t b) const;
+		// Voxelization of block b: size^3 voxels of the scene voxel size, starting at its origin
+		voxinfo info(size_t b) const;
+	};
+
+	// Bin the triangles into the blocks whose voxels they may touch (by their bbox, with a margin of one voxel):
+	// the triangles of block b are triangles[starts[b]] .. triangles[starts[b + 1] - 1], in mesh order
+	void bin_triangles(const BlockGrid& grid, const trimesh::TriMesh* themesh, std::vector<size_t>& starts, std::vector<uint32_t>& triangles);
+
+	// Voxelize the blocks in parallel and write every block with triangles to the h5 file output (truncated) as
+	// dataset block_<i>_<j>_<k> in the combine_data layout, with the attributes offset (world position of its
+	// first voxel), origin (its first voxel in the scene grid) and unit (voxel size), plus occupancy_block_<i>_<j>_<k>
+	// with bits. The dataset blocks lists the origins of the written blocks. Returns whether all writes succeeded.
+	bool voxelize_blocks(const BlockGrid& grid, const trimesh::TriMesh* themesh, const std::vector<unsigned short>& labels,
+		const std::vector<size_t>& starts, const std::vector<uint32_t>& triangles, const std::string& output, bool bits, StatValues& stats);
+}
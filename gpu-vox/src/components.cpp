@@ -0,0 +1,218 @@
+#include "components.h"
+#include "common/trace.h"
+#include "common/perf_counters.h"
+#include "common/bit_volume.h"
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+namespace components {
+
+	// Root of run r, halving the path on the way; the root of a component is its first run
+	static uint32_t findRoot(std::vector<uint32_t>& parent, uint32_t r) {
+		while (parent[r] != r) {
+			parent[r] = parent[parent[r]];
+			r = parent[r];
+		}
+		return r;
+	}
+
+	static void unite(std::vector<uint32_t>& parent, uint32_t a, uint32_t b) {
+		a = findRoot(parent, a);
+		b = findRoot(parent, b);
+		if (a < b) {
+			parent[b] = a;
+		}
+		else if (b < a) {
+			parent[a] = b;
+		}
+	}
+
+	// Join the runs of row r with those of the preceding row n that touch them, the runs of both rows sorted along
+	// x; with reach 1 runs touching diagonally along x are joined as well
+	static void connectRows(const Components& result, const std::vector<uint32_t>& row_starts, std::vector<uint32_t>& parent, size_t r, size_t n, uint32_t reach) {
+		uint32_t j = row_starts[n];
+		const uint32_t j_end = row_starts[n + 1];
+		for (uint32_t i = row_starts[r]; i < row_starts[r + 1] && j < j_end; i++) {
+			const Run& run = result.runs[i];
+			while (j < j_end && result.runs[j].end + reach <= run.begin) {
+				j++;
+			}
+			// The last run joined may reach the next run of row r as well, so j stays on it
+			for (uint32_t k = j; k < j_end && result.runs[k].begin < run.end + reach; k++) {
+				unite(parent, i, k);
+			}
+		}
+	}
+
+	// Join the runs of row y + z * gridsize.y with those of the rows before it, in y and in z if z > z_min
+	static void connectRow(const voxinfo& info, const Components& result, const std::vector<uint32_t>& row_starts, std::vector<uint32_t>& parent,
+		uint32_t y, uint32_t z, uint32_t z_min, bool in_plane) {
+		const size_t gy = info.gridsize.y;
+		const size_t r = y + z * gy;
+		// Reach along x of the neighbouring rows differing in one coordinate, and in both y and z
+		const uint32_t reach = result.connectivity == 6 ? 0 : 1;
+		const uint32_t diagonal_reach = result.connectivity == 26 ? 1 : 0;
+		if (in_plane && y > 0) {
+			connectRows(result, row_starts, parent, r, r - 1, reach);
+		}
+		if (z > z_min) {
+			connectRows(result, row_starts, parent, r, r - gy, reach);
+			if (result.connectivity != 6 && y > 0) {
+				connectRows(result, row_starts, parent, r, r - gy - 1, diagonal_reach);
+			}
+			if (result.connectivity != 6 && y + 1 < gy) {
+				connectRows(result, row_starts, parent, r, r - gy + 1, diagonal_reach);
+			}
+		}
+	}
+
+	bool label_components(const voxinfo& info, const unsigned int* vtable, int connectivity, Components& result) {
+		TraceScope scope("components");
+		PerfScope perf("components");
+		if (connectivity != 6 && connectivity != 18 && connectivity != 26) {
+			fprintf(stdout, "[Err] Connectivity %d is not 6, 18 or 26 \n", connectivity);
+			return false;
+		}
+		result.connectivity = connectivity;
+		const uint32_t* bits = reinterpret_cast<const uint32_t*>(vtable);
+		const size_t gx = info.gridsize.x;
+		const size_t rows = static_cast<size_t>(info.gridsize.y) * static_cast<size_t>(info.gridsize.z);
+
+		// Runs of every row: counted, then written at the prefix sum of the counts
+		std::vector<uint64_t> counts(rows + 1, 0);
+#pragma omp parallel for schedule(dynamic, 64)
+		for (int64_t r = 0; r < static_cast<int64_t>(rows); r++) {
+			uint64_t count = 0;
+			for_each_bit_run(bits, r * gx, (r + 1) * gx, [&](size_t, size_t) { count++; });
+			counts[r + 1] = count;
+		}
+		for (size_t r = 0; r < rows; r++) {
+			counts[r + 1] += counts[r];
+		}
+		if (counts[rows] >= std::numeric_limits<uint32_t>::max()) {
+			fprintf(stdout, "[Err] %llu runs of voxels are too many for connected components \n", static_cast<unsigned long long>(counts[rows]));
+			return false;
+		}
+		std::vector<uint32_t> row_starts(counts.begin(), counts.end());
+		result.runs.resize(row_starts[rows]);
+#pragma omp parallel for schedule(dynamic, 64)
+		for (int64_t r = 0; r < static_cast<int64_t>(rows); r++) {
+			Run* run = &result.runs[row_starts[r]];
+			for_each_bit_run(bits, r * gx, (r + 1) * gx, [&](size_t begin, size_t end) {
+				*run++ = Run{ static_cast<uint32_t>(r), static_cast<uint32_t>(begin), static_cast<uint32_t>(end) };
+			});
+		}
+
+		// Slabs of z planes hold consecutive runs, so the union-find trees of different slabs never share a run
+		std::vector<uint32_t> parent(result.runs.size());
+		for (size_t i = 0; i < parent.size(); i++) {
+			parent[i] = static_cast<uint32_t>(i);
+		}
+		const uint32_t gz = info.gridsize.z;
+		const uint32_t slabs = glm::max(1u, glm::min(gz, 4 * glm::max(1u, std::thread::hardware_concurrency())));
+		const uint32_t slab_planes = (gz + slabs - 1) / slabs;
+#pragma omp parallel for schedule(dynamic)
+		for (int64_t s = 0; s < static_cast<int64_t>(slabs); s++) {
+			const uint32_t z0 = static_cast<uint32_t>(s) * slab_planes;
+			for (uint32_t z = z0; z < glm::min(gz, z0 + slab_planes); z++) {
+				for (uint32_t y = 0; y < info.gridsize.y; y++) {
+					connectRow(info, result, row_starts, parent, y, z, z0, true);
+				}
+			}
+		}
+		// Round k merges groups of 2^k slabs across the first plane of every odd group, the pairs of groups are disjoint
+		for (uint32_t group = 1; group < slabs; group *= 2) {
+#pragma omp parallel for schedule(dynamic)
+			for (int64_t s = group; s < static_cast<int64_t>(slabs); s += 2 * group) {
+				const uint32_t z = static_cast<uint32_t>(s) * slab_planes;
+				for (uint32_t y = 0; y < info.gridsize.y && z < gz; y++) {
+					connectRow(info, result, row_starts, parent, y, z, z - 1, false);
+				}
+			}
+		}
+
+		// Number the components by their first run; the root of a run precedes it, so it is numbered already
+		result.labels.resize(result.runs.size());
+		result.components.clear();
+		for (size_t i = 0; i < result.runs.size(); i++) {
+			const uint32_t root = findRoot(parent, static_cast<uint32_t>(i));
+			if (root == i) {
+				result.components.push_back(Component{ 0, glm::uvec3(std::numeric_limits<unsigned int>::max()), glm::uvec3(0) });
+				result.labels[i] = static_cast<uint32_t>(result.components.size());
+			}
+			else {
+				result.labels[i] = result.labels[root];
+			}
+			const Run& run = result.runs[i];
+			Component& component = result.components[result.labels[i] - 1];
+			glm::uvec3 first(run.begin, run.row % info.gridsize.y, run.row / info.gridsize.y);
+			component.size += run.end - run.begin;
+			component.min = glm::min(component.min, first);
+			component.max = glm::max(component.max, glm::uvec3(run.end - 1, first.y, first.z));
+		}
+		return true;
+	}
+
+	uint64_t remove_small_components(const voxinfo& info, unsigned int* vtable, uint64_t min_voxels, Components& result) {
+		std::vector<uint32_t> renumber(result.components.size() + 1, 0);
+		std::vector<Component> kept;
+		for (size_t k = 0; k < result.components.size(); k++) {
+			if (result.components[k].size >= min_voxels) {
+				kept.push_back(result.components[k]);
+				renumber[k + 1] = static_cast<uint32_t>(kept.size());
+			}
+		}
+
+		// Runs of different rows may share a word, so the voxels are cleared by one thread; only specks are cleared
+		uint64_t removed = 0;
+		size_t n_runs = 0;
+		for (size_t i = 0; i < result.runs.size(); i++) {
+			const Run& run = result.runs[i];
+			if (renumber[result.labels[i]] != 0) {
+				result.labels[n_runs] = renumber[result.labels[i]];
+				result.runs[n_runs++] = run;
+				continue;
+			}
+			const size_t first = static_cast<size_t>(run.row) * info.gridsize.x;
+			for (size_t v = first + run.begin; v < first + run.end; v++) {
+				vtable[v / 32] &= ~(1u << (31 - v % 32));
+			}
+			removed += run.end - run.begin;
+		}
+		result.runs.resize(n_runs);
+		result.labels.resize(n_runs);
+		result.components.swap(kept);
+		return removed;
+	}
+
+	void component_ids(const voxinfo& info, const Components& result, bool sparse, std::vector<int32_t>& ids) {
+		const size_t gy = info.gridsize.y;
+		const size_t gz = info.gridsize.z;
+		std::vector<uint64_t> offsets;
+		if (sparse) {
+			// Runs are in voxel table order, so their voxels follow each other
+			offsets.resize(result.runs.size() + 1, 0);
+			for (size_t i = 0; i < result.runs.size(); i++) {
+				offsets[i + 1] = offsets[i] + result.runs[i].end - result.runs[i].begin;
+			}
+			ids.assign(offsets.back(), 0);
+		}
+		else {
+			ids.assign(static_cast<size_t>(info.gridsize.x) * gy * gz, 0);
+		}
+#pragma omp parallel for schedule(dynamic, 1024)
+		for (int64_t i = 0; i < static_cast<int64_t>(result.runs.size()); i++) {
+			const Run& run = result.runs[i];
+			const int32_t id = static_cast<int32_t>(result.labels[i]);
+			if (sparse) {
+				std::fill(ids.begin() + offsets[i], ids.begin() + offsets[i + 1], id);
+				continue;
+			}
+			const size_t y = run.row % gy, z = run.row / gy;
+			for (size_t x = run.begin; x < run.end; x++) {
+				ids[(x * gy + y) * gz + z] = id;
+			}
+		}
+	}
+}
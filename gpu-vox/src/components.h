@@ -0,0 +1,45 @@
+#pragma once
+
+#include "util.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Connected components of the set voxels of a linear (not morton ordered) voxel table, e.g. to split a scene into
+// instances or to drop floating specks. The voxels are never unpacked: every row along x is read a word at a time as
+// runs of set voxels, and union-find joins runs of neighbouring rows. The z range is split into slabs labelled in
+// parallel, then neighbouring slabs are merged pairwise, in parallel as well, in log2(slabs) rounds.
+namespace components {
+	// A run of set voxels [begin, end) along x in row y + z * gridsize.y
+	struct Run {
+		uint32_t row;
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	struct Component {
+		uint64_t size; // voxels
+		glm::uvec3 min; // bbox, inclusive
+		glm::uvec3 max;
+	};
+
+	struct Components {
+		int connectivity; // 6 (faces), 18 (faces and edges) or 26 (faces, edges and corners)
+		std::vector<Run> runs; // in voxel table order
+		std::vector<uint32_t> labels; // component of every run, from 1
+		std::vector<Component> components; // component k is components[k - 1], numbered in voxel table order of their first voxel
+	};
+
+	// Label the components of the voxel table; returns false if the connectivity is not 6, 18 or 26 or the table has
+	// too many runs for 32-bit run indices
+	bool label_components(const voxinfo& info, const unsigned int* vtable, int connectivity, Components& result);
+
+	// Clear the voxels of components with less than min_voxels voxels in the voxel table and renumber the remaining
+	// ones; returns the number of cleared voxels
+	uint64_t remove_small_components(const voxinfo& info, unsigned int* vtable, uint64_t min_voxels, Components& result);
+
+	// Component of every voxel, 0 for empty voxels: for all voxels in the x x y x z layout of the combine_data tensor,
+	// or with sparse for the set voxels in voxel table order, matching the coords of write_sparse
+	void component_ids(const voxinfo& info, const Components& result, bool sparse, std::vector<int32_t>& ids);
+}
@@ -2,12 +2,14 @@
 
 namespace cpu_voxelizer {
 
-	// Set specific bit in voxel table
-	void setBit(unsigned int* voxel_table, size_t index) {
+	// Set specific bit in voxel table, returns whether it was set already
+	bool setBit(unsigned int* voxel_table, size_t index) {
 		size_t int_location = index / size_t(32);
 		uint32_t bit_pos = size_t(31) - (index % size_t(32)); // we count bit positions RtL, but array indices LtR
 		uint32_t mask = 1 << bit_pos | 0;
+		bool was_set = (voxel_table[int_location] & mask) != 0;
 		voxel_table[int_location] = (voxel_table[int_location] | mask);
+		return was_set;
 	}
 
 	// Encode morton code using LUT table
@@ -27,156 +29,145 @@ namespace cpu_voxelizer {
 		return answer;
 	}
 
+	// Triangle setup, in parallel as the triangles are independent
+	TriangleSetup cpu_setup_triangles(const voxinfo& info, const trimesh::TriMesh* themesh, std::vector<float>& storage) {
+		TraceScope scope("triangle setup");
+		PerfScope perf("triangle setup");
+		TriangleSetup setup;
+		setup.origin = info.bbox.min;
+		setup.n_triangles = themesh->faces.size();
+		setup.stride = TriangleSetup::stride_for(setup.n_triangles);
+		storage.assign(TriangleSetup::COMPONENTS * setup.stride, 0.0f);
+		setup.data = storage.data();
+
+		// Move all vertices to origin using bbox
+#pragma omp parallel for
+		for (int64_t i = 0; i < static_cast<int64_t>(setup.n_triangles); i++) {
+			glm::vec3 v0 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][0]]) - setup.origin;
+			glm::vec3 v1 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][1]]) - setup.origin;
+			glm::vec3 v2 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][2]]) - setup.origin;
+			setup_triangle(setup, static_cast<size_t>(i), v0, v1, v2);
+		}
+		return setup;
+	}
+
 	// Mesh voxelization method
-	void cpu_voxelize_mesh(voxinfo info, trimesh::TriMesh* themesh, unsigned int* voxel_table, bool morton_order) {
-		//// Common variables used in the voxelization process
-		//glm::vec3 delta_p(info.unit.x, info.unit.y, info.unit.z);
-		//glm::vec3 c(0.0f, 0.0f, 0.0f); // critical point
-		//glm::vec3 grid_max(info.gridsize.x - 1, info.gridsize.y - 1, info.gridsize.z - 1); // grid max (grid runs from 0 to gridsize-1)
-
-
-		// PREPASS
-		// Move all vertices to origin (can be done in parallel)
-		trimesh::vec3 move_min = glm_to_trimesh<trimesh::vec3>(info.bbox.min);
-#pragma omp for
-		for (uint64_t i = 0; i < themesh->vertices.size(); i++) {
-			themesh->vertices[i] = themesh->vertices[i] - move_min;
+	void cpu_voxelize_mesh(voxinfo info, const TriangleSetup& setup, unsigned int* voxel_table, bool morton_order, StatValues& stats) {
+		cpu_voxelize_mesh(info, setup, nullptr, voxel_table, nullptr, morton_order, stats);
+	}
+
+	void cpu_voxelize_mesh(voxinfo info, const TriangleSetup& setup, const unsigned int* triangle_colors, unsigned int* voxel_table,
+		unsigned int* color_table, bool morton_order, StatValues& stats) {
+		cpu_voxelize_mesh(info, setup, nullptr, glm::uvec3(0, 0, 0), triangle_colors, voxel_table, color_table, morton_order, stats);
+	}
+
+	void cpu_voxelize_mesh(voxinfo info, const TriangleSetup& setup, const uint32_t* triangles, glm::uvec3 offset, const unsigned int* triangle_colors,
+		unsigned int* voxel_table, unsigned int* color_table, bool morton_order, StatValues& stats) {
+		TraceScope scope("voxelize");
+		// The grid has to start a whole number of voxels from the setup origin, up to rounding
+		glm::vec3 grid_min = setup.origin + info.unit * glm::vec3(offset);
+		bool matches = triangles != nullptr || setup.n_triangles == info.n_triangles;
+		for (int i = 0; i < 3; i++) {
+			matches = matches && std::fabs(grid_min[i] - info.bbox.min[i]) <= 1e-3f * info.unit[i];
+		}
+		if (!matches) {
+			fprintf(stdout, "[Err] The triangle setup does not match the voxelization, skipping it \n");
+			return;
 		}
 
-#ifdef _DEBUG
-		size_t debug_n_triangles = 0;
-		size_t debug_n_voxels_tested = 0;
-		size_t debug_n_voxels_marked = 0;
-#endif
+		// Counters are always on, they only touch this stack copy
+		StatValues local_stats;
 
+		PerfScope perf("voxelize");
+		TraceBatch batch("triangle batch", 4096);
 		for (size_t i = 0; i < info.n_triangles; i++) {
-			// Common variables used in the voxelization process
-			glm::vec3 delta_p(info.unit.x, info.unit.y, info.unit.z);
-			glm::vec3 c(0.0f, 0.0f, 0.0f); // critical point
-			glm::vec3 grid_max(info.gridsize.x - 1, info.gridsize.y - 1, info.gridsize.z - 1); // grid max (grid runs from 0 to gridsize-1)
-#ifdef _DEBUG
-			debug_n_triangles++;
-#endif
-			// COMPUTE COMMON TRIANGLE PROPERTIES
-			// Move vertices to origin using bbox
-			glm::vec3 v0 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][0]]);
-			glm::vec3 v1 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][1]]);
-			glm::vec3 v2 = trimesh_to_glm<trimesh::point>(themesh->vertices[themesh->faces[i][2]]);
-
-			// Edge vectors
-			glm::vec3 e0 = v1 - v0;
-			glm::vec3 e1 = v2 - v1;
-			glm::vec3 e2 = v0 - v2;
-			// Normal vector pointing up from the triangle
-			glm::vec3 n = glm::normalize(glm::cross(e0, e1));
-
-			// COMPUTE TRIANGLE BBOX IN GRID
-			// Triangle bounding box in world coordinates is min(v0,v1,v2) and max(v0,v1,v2)
-			AABox<glm::vec3> t_bbox_world(glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)));
-			// Triangle bounding box in voxel grid coordinates is the world bounding box divided by the grid unit vector
-			AABox<glm::ivec3> t_bbox_grid;
-			t_bbox_grid.min = glm::clamp(t_bbox_world.min / info.unit, glm::vec3(0.0f, 0.0f, 0.0f), grid_max);
-			t_bbox_grid.max = glm::clamp(t_bbox_world.max / info.unit, glm::vec3(0.0f, 0.0f, 0.0f), grid_max);
-
-			// PREPARE PLANE TEST PROPERTIES
-			if (n.x > 0.0f) { c.x = info.unit.x; }
-			if (n.y > 0.0f) { c.y = info.unit.y; }
-			if (n.z > 0.0f) { c.z = info.unit.z; }
-			float d1 = glm::dot(n, (c - v0));
-			float d2 = glm::dot(n, ((delta_p - c) - v0));
-
-			// PREPARE PROJECTION TEST PROPERTIES
-			// XY plane
-			glm::vec2 n_xy_e0(-1.0f * e0.y, e0.x);
-			glm::vec2 n_xy_e1(-1.0f * e1.y, e1.x);
-			glm::vec2 n_xy_e2(-1.0f * e2.y, e2.x);
-			if (n.z < 0.0f) {
-				n_xy_e0 = -n_xy_e0;
-				n_xy_e1 = -n_xy_e1;
-				n_xy_e2 = -n_xy_e2;
-			}
-			float d_xy_e0 = (-1.0f * glm::dot(n_xy_e0, glm::vec2(v0.x, v0.y))) + glm::max(0.0f, info.unit.x * n_xy_e0[0]) + glm::max(0.0f, info.unit.y * n_xy_e0[1]);
-			float d_xy_e1 = (-1.0f * glm::dot(n_xy_e1, glm::vec2(v1.x, v1.y))) + glm::max(0.0f, info.unit.x * n_xy_e1[0]) + glm::max(0.0f, info.unit.y * n_xy_e1[1]);
-			float d_xy_e2 = (-1.0f * glm::dot(n_xy_e2, glm::vec2(v2.x, v2.y))) + glm::max(0.0f, info.unit.x * n_xy_e2[0]) + glm::max(0.0f, info.unit.y * n_xy_e2[1]);
-			// YZ plane
-			glm::vec2 n_yz_e0(-1.0f * e0.z, e0.y);
-			glm::vec2 n_yz_e1(-1.0f * e1.z, e1.y);
-			glm::vec2 n_yz_e2(-1.0f * e2.z, e2.y);
-			if (n.x < 0.0f) {
-				n_yz_e0 = -n_yz_e0;
-				n_yz_e1 = -n_yz_e1;
-				n_yz_e2 = -n_yz_e2;
-			}
-			float d_yz_e0 = (-1.0f * glm::dot(n_yz_e0, glm::vec2(v0.y, v0.z))) + glm::max(0.0f, info.unit.y * n_yz_e0[0]) + glm::max(0.0f, info.unit.z * n_yz_e0[1]);
-			float d_yz_e1 = (-1.0f * glm::dot(n_yz_e1, glm::vec2(v1.y, v1.z))) + glm::max(0.0f, info.unit.y * n_yz_e1[0]) + glm::max(0.0f, info.unit.z * n_yz_e1[1]);
-			float d_yz_e2 = (-1.0f * glm::dot(n_yz_e2, glm::vec2(v2.y, v2.z))) + glm::max(0.0f, info.unit.y * n_yz_e2[0]) + glm::max(0.0f, info.unit.z * n_yz_e2[1]);
-			// ZX plane
-			glm::vec2 n_zx_e0(-1.0f * e0.x, e0.z);
-			glm::vec2 n_zx_e1(-1.0f * e1.x, e1.z);
-			glm::vec2 n_zx_e2(-1.0f * e2.x, e2.z);
-			if (n.y < 0.0f) {
-				n_zx_e0 = -n_zx_e0;
-				n_zx_e1 = -n_zx_e1;
-				n_zx_e2 = -n_zx_e2;
-			}
-			float d_xz_e0 = (-1.0f * glm::dot(n_zx_e0, glm::vec2(v0.z, v0.x))) + glm::max(0.0f, info.unit.x * n_zx_e0[0]) + glm::max(0.0f, info.unit.z * n_zx_e0[1]);
-			float d_xz_e1 = (-1.0f * glm::dot(n_zx_e1, glm::vec2(v1.z, v1.x))) + glm::max(0.0f, info.unit.x * n_zx_e1[0]) + glm::max(0.0f, info.unit.z * n_zx_e1[1]);
-			float d_xz_e2 = (-1.0f * glm::dot(n_zx_e2, glm::vec2(v2.z, v2.x))) + glm::max(0.0f, info.unit.x * n_zx_e2[0]) + glm::max(0.0f, info.unit.z * n_zx_e2[1]);
+			batch.step(static_cast<long>(i));
+			local_stats[STAT_TRIANGLES]++;
+			const size_t t = triangles != nullptr ? triangles[i] : i;
+			// Only the voxel size dependent terms are computed here
+			TriangleTest tri = triangle_test(setup, t, info, offset);
 
 			// test possible grid boxes for overlap
-			for (int z = t_bbox_grid.min.z; z <= t_bbox_grid.max.z; z++) {
-				for (int y = t_bbox_grid.min.y; y <= t_bbox_grid.max.y; y++) {
-					for (int x = t_bbox_grid.min.x; x <= t_bbox_grid.max.x; x++) {
+			for (int z = tri.bbox_grid.min.z; z <= tri.bbox_grid.max.z; z++) {
+				for (int y = tri.bbox_grid.min.y; y <= tri.bbox_grid.max.y; y++) {
+					for (int x = tri.bbox_grid.min.x; x <= tri.bbox_grid.max.x; x++) {
 						// size_t location = x + (y*info.gridsize) + (z*info.gridsize*info.gridsize);
 						// if (checkBit(voxel_table, location)){ continue; }
-#ifdef _DEBUG
-						debug_n_voxels_tested++;
-#endif
+						local_stats[STAT_BOX_TESTS]++;
 
 						// TRIANGLE PLANE THROUGH BOX TEST
-						glm::vec3 p(x * info.unit.x, y * info.unit.y, z * info.unit.z);
-						float nDOTp = glm::dot(n, p);
-						if (((nDOTp + d1) * (nDOTp + d2)) > 0.0f) { continue; }
+						glm::vec3 p((x + offset.x) * info.unit.x, (y + offset.y) * info.unit.y, (z + offset.z) * info.unit.z);
+						float nDOTp = glm::dot(tri.n, p);
+						if (((nDOTp + tri.d1) * (nDOTp + tri.d2)) > 0.0f) { local_stats[STAT_PLANE_CULLS]++; continue; }
 
 						// PROJECTION TESTS
 						// XY
 						glm::vec2 p_xy(p.x, p.y);
-						if ((glm::dot(n_xy_e0, p_xy) + d_xy_e0) < 0.0f) { continue; }
-						if ((glm::dot(n_xy_e1, p_xy) + d_xy_e1) < 0.0f) { continue; }
-						if ((glm::dot(n_xy_e2, p_xy) + d_xy_e2) < 0.0f) { continue; }
+						if ((glm::dot(tri.n_xy[0], p_xy) + tri.d_xy[0]) < 0.0f) { local_stats[STAT_XY_CULLS]++; continue; }
+						if ((glm::dot(tri.n_xy[1], p_xy) + tri.d_xy[1]) < 0.0f) { local_stats[STAT_XY_CULLS]++; continue; }
+						if ((glm::dot(tri.n_xy[2], p_xy) + tri.d_xy[2]) < 0.0f) { local_stats[STAT_XY_CULLS]++; continue; }
 
 						// YZ
 						glm::vec2 p_yz(p.y, p.z);
-						if ((glm::dot(n_yz_e0, p_yz) + d_yz_e0) < 0.0f) { continue; }
-						if ((glm::dot(n_yz_e1, p_yz) + d_yz_e1) < 0.0f) { continue; }
-						if ((glm::dot(n_yz_e2, p_yz) + d_yz_e2) < 0.0f) { continue; }
+						if ((glm::dot(tri.n_yz[0], p_yz) + tri.d_yz[0]) < 0.0f) { local_stats[STAT_YZ_CULLS]++; continue; }
+						if ((glm::dot(tri.n_yz[1], p_yz) + tri.d_yz[1]) < 0.0f) { local_stats[STAT_YZ_CULLS]++; continue; }
+						if ((glm::dot(tri.n_yz[2], p_yz) + tri.d_yz[2]) < 0.0f) { local_stats[STAT_YZ_CULLS]++; continue; }
 
 						// XZ	
 						glm::vec2 p_zx(p.z, p.x);
-						if ((glm::dot(n_zx_e0, p_zx) + d_xz_e0) < 0.0f) { continue; }
-						if ((glm::dot(n_zx_e1, p_zx) + d_xz_e1) < 0.0f) { continue; }
-						if ((glm::dot(n_zx_e2, p_zx) + d_xz_e2) < 0.0f) { continue; }
-#ifdef _DEBUG
-						debug_n_voxels_marked += 1;
-#endif
+						if ((glm::dot(tri.n_zx[0], p_zx) + tri.d_zx[0]) < 0.0f) { local_stats[STAT_ZX_CULLS]++; continue; }
+						if ((glm::dot(tri.n_zx[1], p_zx) + tri.d_zx[1]) < 0.0f) { local_stats[STAT_ZX_CULLS]++; continue; }
+						if ((glm::dot(tri.n_zx[2], p_zx) + tri.d_zx[2]) < 0.0f) { local_stats[STAT_ZX_CULLS]++; continue; }
+						local_stats[STAT_MARKS]++;
+						size_t location;
 						if (morton_order) {
-							size_t location = mortonEncode_LUT(x, y, z);
-							setBit(voxel_table, location);
+							location = mortonEncode_LUT(x, y, z);
+							local_stats[STAT_DUPLICATE_MARKS] += setBit(voxel_table, location);
 						}
 						else {
-							size_t location = static_cast<size_t>(x) + (static_cast<size_t>(y)* static_cast<size_t>(info.gridsize.y)) + (static_cast<size_t>(z)* static_cast<size_t>(info.gridsize.y)* static_cast<size_t>(info.gridsize.z));
+							location = static_cast<size_t>(x) + (static_cast<size_t>(y)* static_cast<size_t>(info.gridsize.x)) + (static_cast<size_t>(z)* static_cast<size_t>(info.gridsize.y)* static_cast<size_t>(info.gridsize.x));
 							//std:: cout << "Voxel found at " << x << " " << y << " " << z << std::endl;
-							setBit(voxel_table, location);
+							local_stats[STAT_DUPLICATE_MARKS] += setBit(voxel_table, location);
+						}
+						// Like the GPU path, the last triangle marking a voxel gives it its color and label
+						if (color_table != nullptr) {
+							for (int c = 0; c < 4; c++) {
+								color_table[4 * location + c] = triangle_colors[4 * t + c];
+							}
 						}
 						continue;
 					}
 				}
 			}
 		}
-#ifdef _DEBUG
-		printf("[Debug] Processed %llu triangles on the CPU \n", debug_n_triangles);
-		printf("[Debug] Tested %llu voxels for overlap on CPU \n", debug_n_voxels_tested);
-		printf("[Debug] Marked %llu voxels as filled (includes duplicates!) on CPU \n", debug_n_voxels_marked);
-#endif
+		stats = local_stats;
+	}
+
+	void cpu_triangle_colors(const trimesh::TriMesh* themesh, const std::vector<unsigned short>& labels, std::vector<unsigned int>& triangle_colors) {
+		const bool colors = themesh->colors.size() == themesh->vertices.size();
+		const bool labeled = labels.size() == themesh->vertices.size();
+		triangle_colors.resize(4 * themesh->faces.size());
+#pragma omp parallel for
+		for (int64_t i = 0; i < static_cast<int64_t>(themesh->faces.size()); i++) {
+			unsigned int* color = &triangle_colors[4 * i];
+			for (int c = 0; c < 3; c++) {
+				float sum = 0.0f;
+				for (int v = 0; v < 3 && colors; v++) {
+					sum += themesh->colors[themesh->faces[i][v]][c];
+				}
+				color[c] = static_cast<unsigned int>(255 * sum / 3.0f);
+			}
+			color[3] = 100;
+			if (labeled) {
+				color[3] = glm::max(labels[themesh->faces[i][0]], glm::max(labels[themesh->faces[i][1]], labels[themesh->faces[i][2]]));
+			}
+		}
+	}
+
+	// Mesh voxelization method for a single pass
+	void cpu_voxelize_mesh(voxinfo info, trimesh::TriMesh* themesh, unsigned int* voxel_table, bool morton_order, StatValues& stats) {
+		std::vector<float> storage;
+		TriangleSetup setup = cpu_setup_triangles(info, themesh, storage);
+		cpu_voxelize_mesh(info, setup, voxel_table, morton_order, stats);
 	}
 }
\ No newline at end of file
@@ -4,9 +4,33 @@
 #include <TriMesh.h>
 #include <glm/glm.hpp>
 #include "util.h"
+#include "triangle_setup.h"
 #include "morton_LUTs.h"
+#include "common/trace.h"
+#include "common/perf_counters.h"
+#include "common/voxel_stats.h"
+#include <cmath>
 #include <cstdio>
+#include <vector>
 
 namespace cpu_voxelizer {
-	void cpu_voxelize_mesh(voxinfo info, trimesh::TriMesh* themesh, unsigned int* voxel_table, bool morton_order);
+	// Set up the triangles of the mesh relative to info.bbox.min, storing the components in storage.
+	// The setup serves every voxelization over a bounding box with this minimum, whatever the grid size.
+	TriangleSetup cpu_setup_triangles(const voxinfo& info, const trimesh::TriMesh* themesh, std::vector<float>& storage);
+	// Voxelize set up triangles; fills stats with the triangles, triangle-voxel pairs tested, culls per test and (duplicate) marks
+	void cpu_voxelize_mesh(voxinfo info, const TriangleSetup& setup, unsigned int* voxel_table, bool morton_order, StatValues& stats);
+	// Voxelize set up triangles and also fill the color table (4 uints per voxel: r, g, b, label, as the GPU path) of the
+	// voxels they mark from triangle_colors, 4 uints per set up triangle
+	void cpu_voxelize_mesh(voxinfo info, const TriangleSetup& setup, const unsigned int* triangle_colors, unsigned int* voxel_table,
+		unsigned int* color_table, bool morton_order, StatValues& stats);
+	// Voxelize the info.n_triangles set up triangles listed in triangles (all of the setup if nullptr) into the grid of info,
+	// whose first voxel is offset voxels from setup.origin, e.g. a block of the scene the setup was made for; the color
+	// table is filled from triangle_colors (4 uints per triangle of the setup) unless it is nullptr
+	void cpu_voxelize_mesh(voxinfo info, const TriangleSetup& setup, const uint32_t* triangles, glm::uvec3 offset, const unsigned int* triangle_colors,
+		unsigned int* voxel_table, unsigned int* color_table, bool morton_order, StatValues& stats);
+	// Color and label of every triangle as the GPU path assigns them to voxels: the mean vertex color scaled to
+	// [0, 255] and the largest vertex label, 4 uints per triangle; missing colors are black, missing labels 100
+	void cpu_triangle_colors(const trimesh::TriMesh* themesh, const std::vector<unsigned short>& labels, std::vector<unsigned int>& triangle_colors);
+	// Set up and voxelize the triangles of the mesh in one pass
+	void cpu_voxelize_mesh(voxinfo info, trimesh::TriMesh* themesh, unsigned int* voxel_table, bool morton_order, StatValues& stats);
 }
\ No newline at end of file
@@ -20,6 +20,31 @@
 #include "timer.h"
 // CPU voxelizer fallback
 #include "cpu_voxelizer.h"
+// Coarser resolutions from a single voxelization
+#include "pyramid.h"
+// Point clouds instead of meshes
+#include "point_cloud.h"
+// Chunked voxelization of large scenes
+#include "blocks.h"
+// Voxelization of one mesh in many poses
+#include "augment.h"
+// Connected components of the voxels
+#include "components.h"
+// Binary cache of parsed meshes
+#include "common/mesh_cache.h"
+// Chrome trace profiling and hardware counters
+#include "common/trace.h"
+#include "common/perf_counters.h"
+// Memory prediction and budget
+#include "common/memory_budget.h"
+// Journal of batch runs
+#include "common/journal.h"
+// Splitting batches over processes
+#include "common/work_claims.h"
+// Vertex welding, degenerate and duplicate triangle removal
+#include "common/mesh_cleaning.h"
+// Vertex clustering below the voxel size
+#include "common/mesh_simplification.h"
 
 #define TINYPLY_IMPLEMENTATION
 #include "tinyply.h"
@@ -35,7 +60,9 @@ string version_number = "v0.4.4";
 // Forward declaration of CUDA functions
 float *meshToGPU_thrust(const trimesh::TriMesh *mesh, vector<ushort> voxinfo); // METHOD 3 to transfer triangles can be found in thrust_operations.cu(h)
 void cleanup_thrust();
-void voxelize(const voxinfo & v, float* triangle_data, unsigned int* vtable, unsigned int* colortable, bool useThrustPath, bool morton_code);
+TriangleSetup setup_triangles(const voxinfo& v, float* triangle_data); // triangle setup in DEVICE memory, reusable by voxelize for every grid size over the same bbox min
+void free_triangle_setup(TriangleSetup& setup);
+void voxelize(const voxinfo& v, const TriangleSetup& setup, float* triangle_data, unsigned int* vtable, unsigned int* colortable, bool useThrustPath, bool morton_code);
 
 // Output formats
 enum class OutputFormat { output_binvox = 0, output_morton = 1, output_off = 2};
@@ -52,6 +79,30 @@ unsigned int gridsize_z = 0;
 bool useThrustPath = false;
 bool forceCPU = false;
 float voxel_size = 0.0;
+string cache_dir = "";
+unsigned int cache_size_mb = 4096;
+unsigned int levels = 1;
+string trace_file = "";
+bool trace_detail = false;
+string perf_counters_file = "";
+string stats_file = "";
+unsigned int max_memory_mb = 0;
+string journal_file = "";
+int max_attempts = 3;
+string shard = "";
+string claim_dir = "";
+bool bits = false;
+bool sparse = false;
+bool clean = false;
+float weld = 0.0f;
+float simplify = 0.0f;
+bool points = false;
+unsigned int block_size = 0;
+unsigned int block_overlap = 0;
+string augment_poses = ""; // number of random poses or a file of poses
+unsigned int augment_seed = 0;
+int components_connectivity = 0; // 6, 18 or 26, 0 disables
+unsigned int min_component = 0;
 
 class PlyFile;
 
@@ -72,11 +123,36 @@ void printHelp(){
 	cout << " -s <voxelization grid size, power of 2: 8 -> 512, 1024, ... (default: 256)>" << endl;
 	cout << " -o <output format: binvox, obj or morton (default: binvox)>" << endl;
 	cout << " -t : Force using CUDA Thrust Library (possible speedup / throughput improvement)" << endl;
+	cout << " -cache <directory of the binary mesh cache, parsed meshes are reused across runs (default: disabled)>" << endl;
+	cout << " -cache_size <size limit of the mesh cache in MB, least recently used meshes are evicted (default: 4096)>" << endl;
+	cout << " -levels <number of pyramid levels, each level halves the grid size and doubles the voxel size (default: 1)>" << endl;
+	cout << " -max_memory <memory budget in MB: the run writes the HDF5 tensor in slabs, or refuses to start, if the predicted memory exceeds it (default: 0, unlimited)>" << endl;
+	cout << " -trace <Chrome trace JSON of the parse, voxelize, attribute and write stages, open in chrome://tracing or ui.perfetto.dev (default: disabled)>" << endl;
+	cout << " -trace_detail : Also trace every batch of triangles in the CPU voxelizer" << endl;
+	cout << " -stats <JSON of the CPU voxelizer counters: triangles, triangle-voxel pairs tested, cull rate of every test, (duplicate) marks (default: disabled)>" << endl;
+	cout << " -perf_counters <JSON of cycles, instructions, LLC misses and branch misses per CPU stage and thread, Linux only (default: disabled)>" << endl;
+	cout << " -journal <journal shared by the runs of a batch: models already done with the same parameters are skipped, failed ones retried (default: disabled)>" << endl;
+	cout << " -max_attempts <failed or crashed runs of a model before the journal quarantines it, i.e. skips it with exit code 2 (default: 3)>" << endl;
+	cout << " -shard <i/n: only voxelize the models of shard i of n, chosen by a hash of the model path; other models are skipped (default: disabled)>" << endl;
+	cout << " -claim <directory shared by the processes of a batch: a model is skipped if another process is voxelizing or has voxelized it (default: disabled)>" << endl;
+	cout << " -clean : Weld vertices and remove degenerate (zero area) and duplicate triangles before voxelizing, and report what was removed" << endl;
+	cout << " -weld <with -clean: weld vertices closer than this distance in voxels, 0 welds only vertices at identical positions (default: 0)>" << endl;
+	cout << " -simplify <cluster vertices in cells of this size in voxels before voxelizing, at most 0.288 so the surface moves by less than half a voxel, 0 disables (default: 0)>" << endl;
+	cout << " -points : Voxelize the vertices of the model as a point cloud (e.g. a .labels.ply): voxels with points are set, with the mean point color and the majority label" << endl;
+	cout << " -block <voxels per block along every axis: voxelize the scene in overlapping blocks, in parallel on the CPU, each written to dataset block_<i>_<j>_<k> with its world offset; 0 disables (default: 0)>" << endl;
+	cout << " -overlap <with -block: voxels shared by neighbouring blocks, less than the block size (default: 0)>" << endl;
+	cout << " -augment <number of random poses, or a file with one pose \"axis_x axis_y axis_z angle scale\" per line: voxelize the mesh in every pose, in parallel on the CPU, each written to dataset pose_<k>>" << endl;
+	cout << " -seed <with -augment: seed of the random poses (default: 0)>" << endl;
+	cout << " -components <connectivity 6, 18 or 26: label the connected components of the voxels and write their ids, sizes and bboxes to the h5 file (default: 0, disabled)>" << endl;
+	cout << " -min_component <with -components: remove components of less than this many voxels before writing any output (default: 0)>" << endl;
+	cout << " -bits : Also write the voxel table as packed occupancy, 1 bit per voxel, to the dataset occupancy of the h5 file (occupancy_level_<k> for pyramid levels)" << endl;
+	cout << " -sparse : Write the h5 file as sparse coordinates and features of the set voxels (datasets coords, colors and labels, with the suffix _level_<k> for pyramid levels) instead of the dense tensor" << endl;
 	printExample();
 }
 
 // METHOD 1: Helper function to transfer triangles to automatically managed CUDA memory ( > CUDA 7.x)
 float* meshToGPU_managed(const trimesh::TriMesh *mesh) {
+	TraceScope scope("upload");
 	Timer t; t.start();
 	size_t n_floats = sizeof(float) * 9 * (mesh->faces.size());
 	float* device_triangles;
@@ -97,6 +173,112 @@ float* meshToGPU_managed(const trimesh::TriMesh *mesh) {
 	return device_triangles;
 }
 
+// Read the per-vertex labels from the .labels.ply accompanying the mesh and remap them to our label ids
+vector<ushort> readLabels(const string& filepath) {
+    std::unique_ptr<std::istream> file_stream;
+    file_stream.reset(new std::ifstream(filepath, std::ios::binary));
+    tinyply::PlyFile  file;
+
+    file_stream->seekg(0, std::ios::end);
+    const float size_mb = file_stream->tellg() * float(1e-6);
+    file_stream->seekg(0, std::ios::beg);
+
+    file.parse_header(*file_stream);
+
+    std::shared_ptr<tinyply::PlyData> labels;
+    try {
+        labels = file.request_properties_from_element("vertex", { "label"});
+    }
+    catch (const std::exception & e) {
+        std::cerr << "tinyply exception: " << e.what() << std::endl;
+        return vector<ushort>();
+    }
+//    Now read the file contents
+    file.read(*file_stream);
+//    Copy the label information next
+    const size_t numLabelsBytes = labels->buffer.size_bytes();
+    std::vector<ushort> labels_vector(labels->count);
+    std::memcpy(labels_vector.data(), labels->buffer.get(), numLabelsBytes);
+
+//    Again, we need to take care of the remapping operation as well. So,
+    std::map<ushort, ushort> remapper;
+    remapper[1] = 0;
+    remapper[2] = 1;
+    remapper[3] = 2;
+    remapper[4] = 3;
+    remapper[5] = 4;
+    remapper[6] = 5;
+    remapper[7] = 6;
+    remapper[8] = 7;
+    remapper[9] = 8;
+    remapper[10] = 9;
+    remapper[11] = 10;
+    remapper[12] = 11;
+    remapper[14] = 12;
+    remapper[16] = 13;
+    remapper[24] = 14;
+    remapper[28] = 15;
+    remapper[33] = 16;
+    remapper[34] = 17;
+    remapper[36] = 18;
+    remapper[39] = 19;
+
+    for(std::size_t i=0; i<labels_vector.size(); ++i){
+//        If the value is not within the keys, it is simply -100
+        if (remapper.find(labels_vector.at(i)) != remapper.end())
+            labels_vector.at(i) = remapper[labels_vector.at(i)];
+        else
+            labels_vector.at(i) = 100; //Since only positive values are allowed, we treat 100 now and change it later
+    }
+    return labels_vector;
+}
+
+// Rebuild the TriMesh (vertices, colors, faces and bbox) and the vertex labels from a mesh cache entry
+trimesh::TriMesh* meshFromCache(const MeshCacheEntry& entry, vector<ushort>& labels) {
+	trimesh::TriMesh* mesh = new trimesh::TriMesh();
+	size_t n_vertices = entry.header->n_vertices;
+	size_t n_faces = entry.header->n_faces;
+	mesh->vertices.resize(n_vertices);
+	mesh->colors.resize(n_vertices);
+	mesh->faces.resize(n_faces);
+	labels.resize(n_vertices);
+	for (size_t i = 0; i < n_vertices; i++) {
+		const float* v = entry.vertices + 7 * i;
+		mesh->vertices[i] = trimesh::point(v[0], v[1], v[2]);
+		mesh->colors[i] = trimesh::Color(v[3], v[4], v[5]);
+		labels[i] = static_cast<ushort>(v[6]);
+	}
+	for (size_t i = 0; i < n_faces; i++) {
+		const int32_t* f = entry.faces + 3 * i;
+		mesh->faces[i] = trimesh::TriMesh::Face(f[0], f[1], f[2]);
+	}
+	mesh->bbox.min = trimesh::point(entry.header->bbox_min[0], entry.header->bbox_min[1], entry.header->bbox_min[2]);
+	mesh->bbox.max = trimesh::point(entry.header->bbox_max[0], entry.header->bbox_max[1], entry.header->bbox_max[2]);
+	mesh->bbox.valid = true;
+	return mesh;
+}
+
+// Store the mesh as 7 floats per vertex (x, y, z, r, g, b, label) in the mesh cache
+bool meshToCache(MeshCache& cache, uint64_t key, const trimesh::TriMesh* mesh, const vector<ushort>& labels) {
+	size_t n_vertices = mesh->vertices.size();
+	vector<float> vertices(7 * n_vertices, 0.0f);
+	for (size_t i = 0; i < n_vertices; i++) {
+		float* v = &vertices[7 * i];
+		v[0] = mesh->vertices[i][0]; v[1] = mesh->vertices[i][1]; v[2] = mesh->vertices[i][2];
+		if (i < mesh->colors.size()) {
+			v[3] = mesh->colors[i][0]; v[4] = mesh->colors[i][1]; v[5] = mesh->colors[i][2];
+		}
+		if (i < labels.size()) {
+			v[6] = labels[i];
+		}
+	}
+	vector<int32_t> faces(3 * mesh->faces.size());
+	for (size_t i = 0; i < mesh->faces.size(); i++) {
+		faces[3 * i] = mesh->faces[i][0]; faces[3 * i + 1] = mesh->faces[i][1]; faces[3 * i + 2] = mesh->faces[i][2];
+	}
+	return cache.store(key, vertices.data(), n_vertices, 7, faces.data(), mesh->faces.size());
+}
+
 // Parse the program parameters and set them as global variables
 void parseProgramParameters(int argc, char* argv[]){
 	if(argc<2){ // not enough arguments
@@ -160,16 +342,145 @@ void parseProgramParameters(int argc, char* argv[]){
 		else if (string(argv[i]) == "-cpu") {
 			forceCPU = true;
 		}
+		else if (string(argv[i]) == "-cache") {
+			cache_dir = argv[i + 1];
+			i++;
+		}
+		else if (string(argv[i]) == "-cache_size") {
+			cache_size_mb = atoi(argv[i + 1]);
+			i++;
+		}
+		else if (string(argv[i]) == "-levels" || string(argv[i]) == "--levels") {
+			levels = glm::max(1, atoi(argv[i + 1]));
+			i++;
+		}
+		else if (string(argv[i]) == "-max_memory" || string(argv[i]) == "--max-memory") {
+			max_memory_mb = glm::max(0, atoi(argv[i + 1]));
+			i++;
+		}
+		else if (string(argv[i]) == "-trace") {
+			trace_file = argv[i + 1];
+			i++;
+		}
+		else if (string(argv[i]) == "-trace_detail") {
+			trace_detail = true;
+		}
+		else if (string(argv[i]) == "-bits") {
+			bits = true;
+		}
+		else if (string(argv[i]) == "-sparse") {
+			sparse = true;
+		}
+		else if (string(argv[i]) == "-points") {
+			points = true;
+		}
+		else if (string(argv[i]) == "-block") {
+			block_size = static_cast<unsigned int>(glm::max(0, atoi(argv[i + 1])));
+			i++;
+		}
+		else if (string(argv[i]) == "-overlap") {
+			block_overlap = static_cast<unsigned int>(glm::max(0, atoi(argv[i + 1])));
+			i++;
+		}
+		else if (string(argv[i]) == "-augment") {
+			augment_poses = argv[i + 1];
+			i++;
+		}
+		else if (string(argv[i]) == "-seed") {
+			augment_seed = static_cast<unsigned int>(strtoul(argv[i + 1], nullptr, 10));
+			i++;
+		}
+		else if (string(argv[i]) == "-components") {
+			components_connectivity = atoi(argv[i + 1]);
+			i++;
+		}
+		else if (string(argv[i]) == "-min_component") {
+			min_component = static_cast<unsigned int>(glm::max(0, atoi(argv[i + 1])));
+			i++;
+		}
+		else if (string(argv[i]) == "-clean") {
+			clean = true;
+		}
+		else if (string(argv[i]) == "-weld") {
+			weld = max(0.0f, static_cast<float>(atof(argv[i + 1])));
+			i++;
+		}
+		else if (string(argv[i]) == "-simplify") {
+			simplify = static_cast<float>(atof(argv[i + 1]));
+			if (!(simplify >= 0.0f && simplify <= SIMPLIFICATION_MAX_CELL)) {
+				cout << "Simplification cell size must be from 0 to " << SIMPLIFICATION_MAX_CELL << " voxels." << endl;
+				exit(1);
+			}
+			i++;
+		}
+		else if (string(argv[i]) == "-stats") {
+			stats_file = argv[i + 1];
+			i++;
+		}
+		else if (string(argv[i]) == "-perf_counters") {
+			perf_counters_file = argv[i + 1];
+			i++;
+		}
+		else if (string(argv[i]) == "-journal") {
+			journal_file = argv[i + 1];
+			i++;
+		}
+		else if (string(argv[i]) == "-max_attempts") {
+			max_attempts = glm::max(1, atoi(argv[i + 1]));
+			i++;
+		}
+		else if (string(argv[i]) == "-shard") {
+			shard = argv[i + 1];
+			i++;
+		}
+		else if (string(argv[i]) == "-claim") {
+			claim_dir = argv[i + 1];
+			i++;
+		}
 	}
 	if (!filegiven) {
 		fprintf(stdout, "[Err] You didn't specify a file using -f (path). This is required. Exiting. \n");
 		printExample();
 		exit(1);
 	}
+	if (block_size > 0 && block_overlap >= block_size) {
+		fprintf(stdout, "[Err] The block overlap (%u) must be less than the block size (%u). Exiting. \n", block_overlap, block_size);
+		exit(1);
+	}
+	if (!augment_poses.empty() && (points || block_size > 0)) {
+		fprintf(stdout, "[Err] -augment voxelizes whole meshes, it can not be combined with -points or -block. Exiting. \n");
+		exit(1);
+	}
+	if (components_connectivity != 0 && components_connectivity != 6 && components_connectivity != 18 && components_connectivity != 26) {
+		fprintf(stdout, "[Err] The connectivity of -components must be 6, 18 or 26, not %d. Exiting. \n", components_connectivity);
+		exit(1);
+	}
+	if (min_component > 0 && components_connectivity == 0) {
+		fprintf(stdout, "[Err] -min_component needs -components. Exiting. \n");
+		exit(1);
+	}
+	if (components_connectivity > 0 && (!augment_poses.empty() || (block_size > 0 && !points))) {
+		fprintf(stdout, "[Err] -components labels the whole grid, it can not be combined with -augment or -block. Exiting. \n");
+		exit(1);
+	}
 	fprintf(stdout, "[Info] Filename: %s \n", filename.c_str());
 	fprintf(stdout, "[Info] Grid size: %i %i %i\n", gridsize_x, gridsize_y, gridsize_z);
 	fprintf(stdout, "[Info] Output format: %s \n", OutputFormats[int(outputformat)]);
 	fprintf(stdout, "[Info] Using CUDA Thrust: %s (default: No)\n", useThrustPath ? "Yes" : "No");
+	fprintf(stdout, "[Info] Pyramid levels: %u \n", levels);
+	fprintf(stdout, "[Info] Sparse output: %s (default: No)\n", sparse ? "Yes" : "No");
+	if (points) {
+		fprintf(stdout, "[Info] Point cloud: Yes%s \n", (clean || simplify > 0.0f || block_size > 0) ? ", ignoring -clean, -simplify and -block" : "");
+	}
+	else if (block_size > 0) {
+		fprintf(stdout, "[Info] Blocks: %u voxels, overlap %u \n", block_size, block_overlap);
+	}
+	if (!augment_poses.empty()) {
+		fprintf(stdout, "[Info] Augment: %s, seed %u \n", augment_poses.c_str(), augment_seed);
+	}
+	if (components_connectivity > 0) {
+		fprintf(stdout, "[Info] Components: %d-connected, removing less than %u voxels \n", components_connectivity, min_component);
+	}
 }
 
 
@@ -179,6 +490,15 @@ int main(int argc, char *argv[]) {
 	fprintf(stdout, "\n## PROGRAM PARAMETERS \n");
 	parseProgramParameters(argc, argv);
 	fflush(stdout);
+	if (!trace_file.empty()) {
+		Tracer::instance().enable(trace_detail);
+	}
+	if (!stats_file.empty()) {
+		VoxelStats::instance().enable();
+	}
+	if (!perf_counters_file.empty()) {
+		PerfCounters::instance().enable();
+	}
 	trimesh::TriMesh::set_verbose(false);
 
 	// SECTION: Read the mesh from disk using the TriMesh library
@@ -186,14 +506,143 @@ int main(int argc, char *argv[]) {
 #ifdef _DEBUG
 	trimesh::TriMesh::set_verbose(true);
 #endif
-	fprintf(stdout, "[I/O] Reading mesh from %s \n", filename.c_str());
-	trimesh::TriMesh *themesh = trimesh::TriMesh::read(filename.c_str());
-	themesh->need_faces(); // Trimesh: Unpack (possible) triangle strips so we have faces for sure
+	// The labels live next to the mesh, in <scene>.labels.ply; a point cloud carries its own
+	string base_path = filename.substr (0, filename.find("_aligned"));
+	string labels_filepath = base_path + ".labels.ply";
+	if (points) {
+		base_path = filename.substr(0, filename.find(".labels.ply"));
+		base_path = base_path == filename ? filename_base : base_path;
+		labels_filepath = filename;
+	}
+
+	string outfile = base_path + "_"+ std::to_string(voxel_size * 1000)[0]+ ".data.h5"; // Take the first element from voxel size
+
+	// SECTION: Split a batch over processes: statically by shard, or dynamically by claiming models in a shared directory
+	if (!shard.empty()) {
+		int shard_index = 0, shard_count = 1;
+		if (!parse_shard(shard, shard_index, shard_count)) {
+			fprintf(stdout, "[Err] Invalid shard %s, expected i/n with 0 <= i < n \n", shard.c_str());
+			exit(1);
+		}
+		if (shard_of(mesh_cache_hash(filename.c_str(), filename.size()), shard_count) != shard_index) {
+			fprintf(stdout, "[Shard] Model belongs to another shard than %i/%i, skipping \n", shard_index, shard_count);
+			exit(0);
+		}
+	}
+
+	// The content of the model and all parameters influencing the output identify a run
+	uint64_t run_key = 0;
+	if (!journal_file.empty() || !claim_dir.empty()) {
+		char params[1024];
+		char clean_params[64] = "";
+		if (clean) {
+			snprintf(clean_params, sizeof(clean_params), ";clean;%g", weld);
+		}
+		if (simplify > 0.0f) {
+			size_t length = strlen(clean_params);
+			snprintf(clean_params + length, sizeof(clean_params) - length, ";simplify;%g", simplify);
+		}
+		if (block_size > 0 && !points) {
+			size_t length = strlen(clean_params);
+			snprintf(clean_params + length, sizeof(clean_params) - length, ";block;%u;%u", block_size, block_overlap);
+		}
+		snprintf(params, sizeof(params), "cuda_voxelizer:%s;%u,%u,%u;%g;%d;%u;labels:%llu%s%s%s", version_number.c_str(), gridsize_x, gridsize_y, gridsize_z,
+			voxel_size, int(outputformat), levels, static_cast<unsigned long long>(MeshCache::key(labels_filepath, "remap-v1")), bits ? ";bits" : "", clean_params, points ? ";points" : "");
+		if (sparse) {
+			size_t length = strlen(params);
+			snprintf(params + length, sizeof(params) - length, ";sparse");
+		}
+		if (!augment_poses.empty()) {
+			// A file of poses is keyed by its path only, like the mesh itself
+			size_t length = strlen(params);
+			snprintf(params + length, sizeof(params) - length, ";augment;%s;%u", augment_poses.c_str(), augment_seed);
+		}
+		if (components_connectivity > 0) {
+			size_t length = strlen(params);
+			snprintf(params + length, sizeof(params) - length, ";components;%d;%u", components_connectivity, min_component);
+		}
+		run_key = MeshCache::key(filename, params);
+	}
+
+	// The claim is held until the process exits, or released early if it crashes
+	unique_ptr<WorkClaims> claims;
+	char claim_name[32];
+	snprintf(claim_name, sizeof(claim_name), "%016llx", static_cast<unsigned long long>(run_key));
+	if (!claim_dir.empty()) {
+		claims.reset(new WorkClaims(claim_dir));
+		if (!claims->is_open()) {
+			exit(1);
+		}
+		if (!claims->claim(claim_name)) {
+			fprintf(stdout, "[Claims] Model is voxelized by another process or done, skipping \n");
+			exit(0);
+		}
+	}
+
+	// SECTION: Skip models a previous run of the batch finished (or gave up on); a run that never finished counts as failed attempt
+	unique_ptr<Journal> journal;
+	if (!journal_file.empty()) {
+		journal.reset(new Journal(journal_file, true));
+		if (!journal->is_open()) {
+			exit(1);
+		}
+		JournalEntry entry = journal->get(filename, run_key);
+		if (entry.status == JOURNAL_DONE && file_exists(entry.output)) {
+			fprintf(stdout, "[Journal] Already done: %s, skipping \n", entry.output.c_str());
+			exit(0);
+		}
+		if (entry.status == JOURNAL_STARTED) {
+			entry.status = journal->record(filename, run_key, JOURNAL_FAILED, outfile, "did not finish", max_attempts);
+		}
+		if (entry.status == JOURNAL_QUARANTINED) {
+			fprintf(stdout, "[Journal] Quarantined after %i failed attempts, skipping \n", max_attempts);
+			exit(2);
+		}
+		journal->record(filename, run_key, JOURNAL_STARTED, outfile);
+	}
+
+	// Repeat runs on the same mesh (other grid sizes, output formats) skip parsing through the mesh cache
+	MeshCache cache(cache_dir, static_cast<uint64_t>(cache_size_mb) << 20);
+	uint64_t cache_key = 0;
+	MeshCacheEntry cache_entry;
+	if (cache.enabled()) {
+		cache_key = MeshCache::key(filename, string(points ? "points" : "trimesh") + ":xyz,rgb,label;labels:" + to_string(MeshCache::key(labels_filepath, "remap-v1")));
+	}
+
+	trimesh::TriMesh *themesh;
+	vector<ushort> labels_vector;
+	{
+		TraceScope parse("parse");
+		PerfScope parse_counters("parse");
+		if (cache.load(cache_key, cache_entry)) {
+			fprintf(stdout, "[I/O] Reading mesh from cache %s \n", cache_dir.c_str());
+			themesh = meshFromCache(cache_entry, labels_vector);
+		}
+		else {
+			fprintf(stdout, "[I/O] Reading mesh from %s \n", filename.c_str());
+			themesh = trimesh::TriMesh::read(filename.c_str());
+			if (themesh == nullptr) {
+				fprintf(stdout, "[Err] Could not read mesh %s \n", filename.c_str());
+				if (journal) {
+					journal->record(filename, run_key, JOURNAL_FAILED, outfile, "could not read", max_attempts);
+				}
+				exit(1);
+			}
+			themesh->need_faces(); // Trimesh: Unpack (possible) triangle strips so we have faces for sure
+			if (points) {
+				themesh->faces.clear(); // Only the vertices of a point cloud count
+			}
+			labels_vector = readLabels(labels_filepath);
+			fprintf(stdout, "[Mesh] Computing bbox \n");
+			themesh->need_bbox(); // Trimesh: Compute the bounding box (in model coordinates)
+			if (cache.enabled() && meshToCache(cache, cache_key, themesh, labels_vector)) {
+				fprintf(stdout, "[I/O] Stored mesh in cache %s \n", cache_dir.c_str());
+			}
+		}
+	}
 	fprintf(stdout, "[Mesh] Number of triangles: %zu \n", themesh->faces.size());
 	fprintf(stdout, "[Mesh] Number of vertices: %zu \n", themesh->vertices.size());
 	fprintf(stdout, "[Mesh] Number of colors: %zu \n", themesh->colors.size());
-	fprintf(stdout, "[Mesh] Computing bbox \n");
-	themesh->need_bbox(); // Trimesh: Compute the bounding box (in model coordinates)
 
 	// SECTION: Compute some information needed for voxelization (bounding box, unit vector, ...)
 	fprintf(stdout, "\n## VOXELISATION SETUP \n");
@@ -210,72 +659,45 @@ int main(int argc, char *argv[]) {
     }
 //	voxinfo voxelization_info(createMeshBBCube<glm::vec3>(bbox_mesh), glm::uvec3(gridsize_x, gridsize_y, gridsize_z), themesh->faces.size());
 	voxinfo voxelization_info(bbox_mesh, glm::uvec3(gridsize_x, gridsize_y, gridsize_z), themesh->faces.size());
+
+	// Clean the mesh before any per-triangle work; the vertices and thus the bbox stay the same
+	if (clean && !points) {
+		TraceScope clean_scope("clean");
+		PerfScope clean_counters("clean");
+		Timer t_clean; t_clean.start();
+		float tolerance = weld * glm::min(voxelization_info.unit.x, glm::min(voxelization_info.unit.y, voxelization_info.unit.z));
+		MeshCleaningReport report = clean_mesh(themesh->vertices.empty() ? nullptr : &themesh->vertices[0][0], themesh->vertices.size(), themesh->faces, tolerance);
+		voxelization_info.n_triangles = themesh->faces.size();
+		t_clean.stop();
+		fprintf(stdout, "[Mesh] Cleaning welded %llu vertices, removed %llu degenerate and %llu duplicate triangles, %zu triangles left \n",
+			static_cast<unsigned long long>(report.welded_vertices), static_cast<unsigned long long>(report.degenerate_triangles),
+			static_cast<unsigned long long>(report.duplicate_triangles), themesh->faces.size());
+		fprintf(stdout, "[Perf] Mesh cleaning time: %.1f ms \n", t_clean.elapsed_time_milliseconds);
+		VoxelStats::instance().add(filename, "clean", report.stats());
+	}
+	// Simplify below the voxel size, with the clustering grid anchored at the voxel grid origin
+	MeshSimplificationReport simplification;
+	Timer t_simplify;
+	if (simplify > 0.0f && !points) {
+		TraceScope simplify_scope("simplify");
+		PerfScope simplify_counters("simplify");
+		t_simplify.start();
+		float cell = simplify * glm::min(voxelization_info.unit.x, glm::min(voxelization_info.unit.y, voxelization_info.unit.z));
+		float origin[3] = { voxelization_info.bbox.min.x, voxelization_info.bbox.min.y, voxelization_info.bbox.min.z };
+		simplification = simplify_mesh(themesh->vertices.empty() ? nullptr : &themesh->vertices[0][0], themesh->vertices.size(), themesh->faces, cell, origin);
+		voxelization_info.n_triangles = themesh->faces.size();
+		t_simplify.stop();
+		fprintf(stdout, "[Mesh] Simplification kept %llu of %llu triangles (%.1f%%), vertices moved by at most %.3f voxels, %llu collapsed triangles kept \n",
+			static_cast<unsigned long long>(simplification.triangles_after), static_cast<unsigned long long>(simplification.triangles_before),
+			100.0 * simplification.ratio(), simplification.max_displacement / cell * simplify, static_cast<unsigned long long>(simplification.kept_triangles));
+		fprintf(stdout, "[Perf] Mesh simplification time: %.1f ms \n", t_simplify.elapsed_time_milliseconds);
+	}
 	voxelization_info.print();
-	// Compute space needed to hold voxel table (1 voxel / bit)
-	size_t vtable_size = static_cast<size_t>(ceil(static_cast<size_t>(voxelization_info.gridsize.x)* static_cast<size_t>(voxelization_info.gridsize.y)* static_cast<size_t>(voxelization_info.gridsize.z)) / 8.0f);
+	// Compute space needed to hold voxel table (1 voxel / bit, rounded up to whole 32-bit words)
+	size_t vtable_size = ((static_cast<size_t>(voxelization_info.gridsize.x)* static_cast<size_t>(voxelization_info.gridsize.y)* static_cast<size_t>(voxelization_info.gridsize.z) + 31) / 32) * sizeof(unsigned int);
 	size_t colortable_size = static_cast<size_t>(ceil(static_cast<size_t>(voxelization_info.gridsize.x)* static_cast<size_t>(voxelization_info.gridsize.y)* static_cast<size_t>(voxelization_info.gridsize.z) * size_t(4) *  size_t(32)/ 8.0f));
 	unsigned int* vtable; // Both voxelization paths (GPU and CPU) need this
-	unsigned int* colortable; // Both voxelization paths (GPU and CPU) need this
-
-//	TODO: My sections to see if things work fine
-    std::unique_ptr<std::istream> file_stream;
-    string base_path = filename.substr (0, filename.find("_aligned"));
-    string filepath = base_path + ".labels.ply";
-
-    file_stream.reset(new std::ifstream(filepath, std::ios::binary));
-    tinyply::PlyFile  file;
-
-    file_stream->seekg(0, std::ios::end);
-    const float size_mb = file_stream->tellg() * float(1e-6);
-    file_stream->seekg(0, std::ios::beg);
-
-    file.parse_header(*file_stream);
-
-    std::shared_ptr<tinyply::PlyData> labels;
-    try {
-        labels = file.request_properties_from_element("vertex", { "label"});
-    }
-    catch (const std::exception & e) {
-        std::cerr << "tinyply exception: " << e.what() << std::endl;
-    }
-//    Now read the file contents
-    file.read(*file_stream);
-//    Copy the label information next
-    const size_t numLabelsBytes = labels->buffer.size_bytes();
-    std::vector<ushort> labels_vector(labels->count);
-    std::memcpy(labels_vector.data(), labels->buffer.get(), numLabelsBytes);
-
-//    Again, we need to take care of the remapping operation as well. So,
-    std::map<ushort, ushort> remapper;
-    remapper[1] = 0;
-    remapper[2] = 1;
-    remapper[3] = 2;
-    remapper[4] = 3;
-    remapper[5] = 4;
-    remapper[6] = 5;
-    remapper[7] = 6;
-    remapper[8] = 7;
-    remapper[9] = 8;
-    remapper[10] = 9;
-    remapper[11] = 10;
-    remapper[12] = 11;
-    remapper[14] = 12;
-    remapper[16] = 13;
-    remapper[24] = 14;
-    remapper[28] = 15;
-    remapper[33] = 16;
-    remapper[34] = 17;
-    remapper[36] = 18;
-    remapper[39] = 19;
-
-    for(std::size_t i=0; i<labels_vector.size(); ++i){
-//        If the value is not within the keys, it is simply -100
-        if (remapper.find(labels_vector.at(i)) != remapper.end())
-            labels_vector.at(i) = remapper[labels_vector.at(i)];
-        else
-            labels_vector.at(i) = 100; //Since only positive values are allowed, we treat 100 now and change it later
-    }
-    //TODO: End my section
+	unsigned int* colortable = nullptr; // Filled by every path except the GPU unified memory path, which has no colors
 
     // SECTION: Try to figure out if we have a CUDA-enabled GPU
 	fprintf(stdout, "\n## CUDA INIT \n");
@@ -287,8 +709,188 @@ int main(int argc, char *argv[]) {
 		fprintf(stdout, "[Info] CUDA GPU not found\n");
 	}
 
+	// SECTION: Predict the memory of the run and check it against the budget
+	fprintf(stdout, "\n## MEMORY \n");
+	MemoryBudget budget(static_cast<uint64_t>(max_memory_mb) << 20);
+	size_t n_voxels = static_cast<size_t>(voxelization_info.gridsize.x) * static_cast<size_t>(voxelization_info.gridsize.y) * static_cast<size_t>(voxelization_info.gridsize.z);
+
+	// Record the outcome of the run and print the stats, whichever way the scene was voxelized
+	auto finish = [&](bool success) {
+		printf("\nThe status of print attempt is %d \n", success);
+		if (journal) {
+			journal->record(filename, run_key, success ? JOURNAL_DONE : JOURNAL_FAILED, outfile, success ? "" : "could not write", max_attempts);
+		}
+		if (claims && success) {
+			claims->complete(claim_name);
+		}
+		if (useThrustPath) {
+			cleanup_thrust();
+		}
+
+		fprintf(stdout, "\n## STATS \n");
+		t.stop(); fprintf(stdout, "[Perf] Total runtime: %.1f ms \n", t.elapsed_time_milliseconds);
+		budget.report();
+		if (!stats_file.empty()) {
+			VoxelStats::instance().print();
+			if (VoxelStats::instance().write(stats_file)) {
+				fprintf(stdout, "[I/O] Wrote stats to %s \n", stats_file.c_str());
+			}
+		}
+		if (!perf_counters_file.empty()) {
+			PerfCounters::instance().print();
+			if (PerfCounters::instance().write(perf_counters_file)) {
+				fprintf(stdout, "[I/O] Wrote counters to %s \n", perf_counters_file.c_str());
+			}
+		}
+		if (!trace_file.empty() && Tracer::instance().write(trace_file)) {
+			fprintf(stdout, "[I/O] Wrote trace to %s \n", trace_file.c_str());
+		}
+	};
+
+	// SECTION: Augmentation: the prepared mesh voxelized in every pose, in parallel on the CPU
+	if (!augment_poses.empty()) {
+		vector<augment::Pose> poses;
+		if (augment_poses.find_first_not_of("0123456789") == string::npos) {
+			poses = augment::random_poses(strtoul(augment_poses.c_str(), nullptr, 10), augment_seed);
+		}
+		else if (!augment::read_poses(augment_poses, poses)) {
+			exit(1);
+		}
+		if (poses.empty()) {
+			fprintf(stdout, "[Err] -augment %s gives no poses. Exiting. \n", augment_poses.c_str());
+			exit(1);
+		}
+		fprintf(stdout, "[Augment] %zu poses about the bbox center \n", poses.size());
+
+		// Every thread holds the triangle setup, the voxel and color table and the h5 tensor of one pose
+		glm::uvec3 pose_grid = augment::max_gridsize(voxelization_info, poses);
+		size_t pose_voxels = static_cast<size_t>(pose_grid.x) * static_cast<size_t>(pose_grid.y) * static_cast<size_t>(pose_grid.z);
+		size_t threads = glm::min<size_t>(poses.size(), glm::max(1u, std::thread::hardware_concurrency()));
+		budget.add("pose setups", threads * TriangleSetup::COMPONENTS * TriangleSetup::stride_for(themesh->faces.size()) * sizeof(float));
+		budget.add("pose tables", threads * ((pose_voxels + 31) / 32 * sizeof(unsigned int) + pose_voxels * size_t(4) * (sizeof(unsigned int) + (sparse ? 0 : sizeof(int)))));
+		budget.print();
+		if (!budget.fits()) {
+			fprintf(stdout, "[Err] The predicted memory exceeds the budget of %u MB, choose a coarser grid. Exiting. \n", max_memory_mb);
+			exit(1);
+		}
+		fprintf(stdout, "[Augment] Poses are only written to the h5 file, without the %s output or pyramid levels \n", OutputFormats[int(outputformat)]);
+
+		fprintf(stdout, "\n## POSE VOXELISATION \n");
+		Timer t_poses; t_poses.start();
+		StatValues stats;
+		bool success = augment::voxelize_poses(voxelization_info, themesh, labels_vector, poses, outfile, sparse, bits, stats);
+		t_poses.stop();
+		fprintf(stdout, "[Perf] Pose voxelization time: %.1f ms (%.1f ms per pose) \n", t_poses.elapsed_time_milliseconds, t_poses.elapsed_time_milliseconds / poses.size());
+		VoxelStats::instance().add(filename, "voxelize_poses", stats);
+		finish(success);
+		return 0;
+	}
+
+	// SECTION: Chunked voxelization: triangles binned into blocks once, blocks voxelized in parallel on the CPU
+	if (block_size > 0 && !points) {
+		blocks::BlockGrid grid(voxelization_info, block_size, block_overlap);
+		Timer t_bin; t_bin.start();
+		vector<size_t> block_starts;
+		vector<uint32_t> block_triangles;
+		blocks::bin_triangles(grid, themesh, block_starts, block_triangles);
+		t_bin.stop();
+		fprintf(stdout, "[Blocks] %u x %u x %u blocks of %u voxels, overlap %u, %zu triangle references (%.2f per triangle) \n", grid.count.x, grid.count.y, grid.count.z,
+			block_size, block_overlap, block_triangles.size(), themesh->faces.empty() ? 0.0 : double(block_triangles.size()) / themesh->faces.size());
+		fprintf(stdout, "[Perf] Triangle binning time: %.1f ms \n", t_bin.elapsed_time_milliseconds);
+
+		// Every thread holds the voxel and color table and the h5 tensor of one block
+		size_t block_voxels = static_cast<size_t>(block_size) * block_size * block_size;
+		size_t threads = glm::max(1u, std::thread::hardware_concurrency());
+		budget.add("block triangles", block_triangles.size() * sizeof(uint32_t) + block_starts.size() * sizeof(size_t));
+		budget.add("triangle setup", TriangleSetup::COMPONENTS * TriangleSetup::stride_for(themesh->faces.size()) * sizeof(float));
+		budget.add("block tables", threads * ((block_voxels + 31) / 32 * sizeof(unsigned int) + block_voxels * size_t(4) * (sizeof(unsigned int) + sizeof(int))));
+		budget.print();
+		if (!budget.fits()) {
+			fprintf(stdout, "[Err] The predicted memory exceeds the budget of %u MB, choose smaller blocks. Exiting. \n", max_memory_mb);
+			exit(1);
+		}
+		fprintf(stdout, "[Blocks] Blocks are only written to the h5 file%s, without the %s output or pyramid levels \n", sparse ? " in the dense layout" : "", OutputFormats[int(outputformat)]);
+
+		fprintf(stdout, "\n## BLOCK VOXELISATION \n");
+		Timer t_blocks; t_blocks.start();
+		StatValues stats;
+		bool success = blocks::voxelize_blocks(grid, themesh, labels_vector, block_starts, block_triangles, outfile, bits, stats);
+		t_blocks.stop();
+		fprintf(stdout, "[Perf] Block voxelization time: %.1f ms \n", t_blocks.elapsed_time_milliseconds);
+		VoxelStats::instance().add(filename, "voxelize_blocks", stats);
+		finish(success);
+		return 0;
+	}
+	// The GPU unified memory path only uploads the vertex positions, its set voxels are written without colors
+	bool gpu = cuda_ok && !forceCPU;
+	bool colors = !gpu || useThrustPath || points;
+	if (!colors) {
+		fprintf(stdout, "[Info] Colors and labels need -t on the GPU, set voxels are written white with label -100 \n");
+	}
+	budget.add("voxel table", vtable_size);
+	if (colors) {
+		budget.add("color table", colortable_size);
+	}
+	if (!points && !gpu) {
+		budget.add("triangle setup", TriangleSetup::COMPONENTS * TriangleSetup::stride_for(themesh->faces.size()) * sizeof(float));
+		budget.add("triangle colors", themesh->faces.size() * size_t(4) * sizeof(unsigned int));
+	}
+	if (points) {
+		// Morton keys and point indices, twice for the radix sort
+		budget.add("point keys", themesh->vertices.size() * size_t(2) * (sizeof(uint64_t) + sizeof(uint32_t)));
+	}
+	// combine_data expands the grid into a tensor of 4 ints per voxel; the sparse output only holds the set voxels
+	bool sparse_output = sparse && outputformat != OutputFormat::output_morton;
+	if (!sparse_output) {
+		budget.add("h5 tensor", n_voxels * size_t(4) * sizeof(int));
+	}
+	if (components_connectivity > 0 && !sparse_output) {
+		// The component ids are expanded to the layout of the h5 tensor after it is written
+		budget.add("component ids", n_voxels * sizeof(int32_t));
+	}
+	if (levels > 1 && outputformat != OutputFormat::output_morton) {
+		// All coarser levels together take less than 1/7 of the finest one
+		budget.add("pyramid", (vtable_size + (colors ? colortable_size : 0)) / 7);
+	}
+	size_t write_slab = 0; // x-slices of the h5 tensor held in memory at once, 0 for all
+	if (!budget.fits() && sparse_output) {
+		budget.print();
+		fprintf(stdout, "[Err] The predicted memory exceeds the budget of %u MB. Exiting. \n", max_memory_mb);
+		exit(1);
+	}
+	if (!budget.fits()) {
+		size_t slice_size = static_cast<size_t>(voxelization_info.gridsize.y) * static_cast<size_t>(voxelization_info.gridsize.z) * size_t(4) * sizeof(int);
+		budget.set("h5 tensor", 0);
+		if (budget.fits()) {
+			write_slab = glm::min<size_t>(voxelization_info.gridsize.x, (budget.limit - budget.total()) / slice_size);
+		}
+		if (write_slab == 0) {
+			budget.set("h5 tensor", slice_size);
+			budget.print();
+			fprintf(stdout, "[Err] The predicted memory exceeds the budget of %u MB even when writing one slice at a time. Exiting. \n", max_memory_mb);
+			exit(1);
+		}
+		budget.set("h5 tensor", write_slab * slice_size);
+		fprintf(stdout, "[Memory] Over budget, writing the h5 tensor %zu x-slices at a time \n", write_slab);
+	}
+	budget.print();
+
 	// SECTION: The actual voxelization
-	if (cuda_ok && !forceCPU) {
+	Timer t_voxelize; t_voxelize.start();
+	if (points) {
+		// Point clouds are sorted and reduced on the CPU, whatever the device
+		fprintf(stdout, "\n## POINT CLOUD VOXELISATION \n");
+		vtable = (unsigned int*) calloc(1, vtable_size);
+		colortable = (unsigned int*) calloc(n_voxels * size_t(4), sizeof(unsigned int));
+		StatValues stats;
+		point_cloud::voxelize_points(voxelization_info, themesh->vertices.empty() ? nullptr : &themesh->vertices[0][0],
+			themesh->colors.size() == themesh->vertices.size() && !themesh->colors.empty() ? &themesh->colors[0][0] : nullptr,
+			labels_vector.size() == themesh->vertices.size() && !labels_vector.empty() ? labels_vector.data() : nullptr,
+			themesh->vertices.size(), vtable, colortable, (outputformat == OutputFormat::output_morton), stats);
+		fprintf(stdout, "[Points] %zu points set %llu voxels \n", themesh->vertices.size(), static_cast<unsigned long long>(stats[STAT_VOXELS]));
+		VoxelStats::instance().add(filename, "voxelize_points", stats);
+	}
+	else if (cuda_ok && !forceCPU) {
 		// GPU voxelization
 		fprintf(stdout, "\n## TRIANGLES TO GPU TRANSFER \n");
 
@@ -310,14 +912,61 @@ int main(int argc, char *argv[]) {
             checkCudaErrors(cudaHostAlloc((void**)&colortable, colortable_size, cudaHostAllocDefault));
 		}
 		fprintf(stdout, "\n## GPU VOXELISATION \n");
-		voxelize(voxelization_info, device_triangles, vtable, colortable, useThrustPath, (outputformat == OutputFormat::output_morton));
+		TraceScope voxelize_scope("voxelize");
+		TriangleSetup setup = setup_triangles(voxelization_info, device_triangles);
+		voxelize(voxelization_info, setup, device_triangles, vtable, colortable, useThrustPath, (outputformat == OutputFormat::output_morton));
+		free_triangle_setup(setup);
 	} else {
 		// CPU VOXELIZATION FALLBACK
 		fprintf(stdout, "\n## CPU VOXELISATION \n");
 		if (!forceCPU) { fprintf(stdout, "[Info] No suitable CUDA GPU was found: Falling back to CPU voxelization\n"); }
 		else { fprintf(stdout, "[Info] Doing CPU voxelization (forced using command-line switch -cpu)\n"); }
 		vtable = (unsigned int*) calloc(1, vtable_size);
-		cpu_voxelizer::cpu_voxelize_mesh(voxelization_info, themesh, vtable, (outputformat == OutputFormat::output_morton));
+		colortable = (unsigned int*) calloc(n_voxels * size_t(4), sizeof(unsigned int));
+		StatValues stats;
+		std::vector<float> setup_storage;
+		TriangleSetup setup = cpu_voxelizer::cpu_setup_triangles(voxelization_info, themesh, setup_storage);
+		std::vector<unsigned int> triangle_colors;
+		cpu_voxelizer::cpu_triangle_colors(themesh, labels_vector, triangle_colors);
+		cpu_voxelizer::cpu_voxelize_mesh(voxelization_info, setup, triangle_colors.data(), vtable, colortable, (outputformat == OutputFormat::output_morton), stats);
+		VoxelStats::instance().add(filename, "voxelize", stats);
+	}
+	t_voxelize.stop();
+	if (simplify > 0.0f && simplification.triangles_after > 0) {
+		// Extrapolated assuming time proportional to triangles, an upper estimate
+		double removed = static_cast<double>(simplification.triangles_before - simplification.triangles_after);
+		double saved = t_voxelize.elapsed_time_milliseconds * removed / simplification.triangles_after;
+		fprintf(stdout, "[Perf] Simplification saved up to about %.1f ms of voxelization (%.1f ms), %.1f ms net \n",
+			saved, t_voxelize.elapsed_time_milliseconds, saved - t_simplify.elapsed_time_milliseconds);
+	}
+
+	// SECTION: Connected components, labelled and filtered before any output is written
+	components::Components voxel_components;
+	bool labelled = false;
+	if (components_connectivity > 0 && outputformat == OutputFormat::output_morton) {
+		fprintf(stdout, "[Components] Connected components need a linear voxel table, skipping them for morton output \n");
+	}
+	else if (components_connectivity > 0) {
+		fprintf(stdout, "\n## CONNECTED COMPONENTS \n");
+		Timer t_components; t_components.start();
+		labelled = components::label_components(voxelization_info, vtable, components_connectivity, voxel_components);
+		size_t found = voxel_components.components.size();
+		uint64_t removed = 0;
+		if (labelled && min_component > 0) {
+			removed = components::remove_small_components(voxelization_info, vtable, min_component, voxel_components);
+		}
+		t_components.stop();
+		uint64_t largest = 0;
+		for (size_t k = 0; k < voxel_components.components.size(); k++) {
+			largest = glm::max(largest, voxel_components.components[k].size);
+		}
+		fprintf(stdout, "[Components] %zu %d-connected components in %zu runs of voxels, the largest has %llu voxels \n", found, components_connectivity,
+			voxel_components.runs.size(), static_cast<unsigned long long>(largest));
+		if (min_component > 0) {
+			fprintf(stdout, "[Components] Removed %zu components of less than %u voxels, %llu voxels in total \n", found - voxel_components.components.size(), min_component,
+				static_cast<unsigned long long>(removed));
+		}
+		fprintf(stdout, "[Perf] Connected components time: %.1f ms \n", t_components.elapsed_time_milliseconds);
 	}
 
 	//// DEBUG: print vtable
@@ -337,13 +986,81 @@ int main(int argc, char *argv[]) {
 	}
 
 //	TODO: Put a condition to save this file in H5 and not generate Off File
-    string outfile = base_path + "_"+ std::to_string(voxel_size * 1000)[0]+ ".data.h5"; // Take the first element from voxel size
-    bool success = combine_data(vtable, colortable, gridsize, voxelization_info, outfile);
-    printf("\nThe status of print attempt is %d \n", success);
-	if (useThrustPath) {
-		cleanup_thrust();
+	bool success;
+	if (sparse && !sparse_output) {
+		fprintf(stdout, "[Sparse] Sparse output needs a linear voxel table, writing the dense tensor for morton output \n");
+	}
+	if (sparse_output) {
+		Timer t_sparse; t_sparse.start();
+		success = write_sparse(vtable, colortable, voxelization_info, outfile);
+		t_sparse.stop(); fprintf(stdout, "[Perf] Sparse output time: %.1f ms \n", t_sparse.elapsed_time_milliseconds);
+	}
+	else {
+		success = combine_data(vtable, colortable, gridsize, voxelization_info, outfile, "tensor", false, write_slab);
+	}
+	if (bits && outputformat == OutputFormat::output_morton) {
+		fprintf(stdout, "[Bits] Packed occupancy needs a linear voxel table, skipping it for morton output \n");
+	}
+	else if (bits) {
+		success = write_bits(vtable, voxelization_info, outfile, "occupancy") && success;
+	}
+	if (components_connectivity > 0 && outputformat != OutputFormat::output_morton) {
+		vector<int32_t> component_ids;
+		vector<uint64_t> component_sizes;
+		vector<int32_t> component_bboxes;
+		components::component_ids(voxelization_info, voxel_components, sparse_output, component_ids);
+		for (size_t k = 0; k < voxel_components.components.size(); k++) {
+			const components::Component& component = voxel_components.components[k];
+			component_sizes.push_back(component.size);
+			for (int i = 0; i < 3; i++) {
+				component_bboxes.push_back(static_cast<int32_t>(component.min[i]));
+			}
+			for (int i = 0; i < 3; i++) {
+				component_bboxes.push_back(static_cast<int32_t>(component.max[i]));
+			}
+		}
+		success = labelled && write_components(voxelization_info, component_ids, sparse_output, component_sizes, component_bboxes, components_connectivity, outfile) && success;
 	}
 
-	fprintf(stdout, "\n## STATS \n");
-	t.stop(); fprintf(stdout, "[Perf] Total runtime: %.1f ms \n", t.elapsed_time_milliseconds);
+	// SECTION: Coarser levels, each built from the previous one by 2x2x2 OR-reduction and written to dataset level_<k>
+	if (levels > 1 && outputformat == OutputFormat::output_morton) {
+		fprintf(stdout, "[Pyramid] Pyramid levels need a linear voxel table, skipping them for morton output \n");
+	}
+	else if (levels > 1) {
+		fprintf(stdout, "\n## PYRAMID \n");
+		voxinfo level_info = voxelization_info;
+		unsigned int* level_vtable = vtable;
+		unsigned int* level_colortable = colortable;
+		for (unsigned int level = 1; level < levels; level++) {
+			Timer t_level; t_level.start();
+			voxinfo coarse_info = pyramid::coarsen(level_info);
+			size_t coarse_voxels = static_cast<size_t>(coarse_info.gridsize.x) * static_cast<size_t>(coarse_info.gridsize.y) * static_cast<size_t>(coarse_info.gridsize.z);
+			unsigned int* coarse_vtable = (unsigned int*) calloc((coarse_voxels + 31) / 32, sizeof(unsigned int));
+			unsigned int* coarse_colortable = (colortable != nullptr) ? (unsigned int*) calloc(coarse_voxels * size_t(4), sizeof(unsigned int)) : nullptr;
+			pyramid::downsample(level_info, level_vtable, level_colortable, coarse_info, coarse_vtable, coarse_colortable);
+			t_level.stop();
+			fprintf(stdout, "[Pyramid] Level %u grid size: %i %i %i \n", level, coarse_info.gridsize.x, coarse_info.gridsize.y, coarse_info.gridsize.z);
+			fprintf(stdout, "[Perf] Pyramid level %u time: %.1f ms \n", level, t_level.elapsed_time_milliseconds);
+			if (sparse_output) {
+				success = write_sparse(coarse_vtable, coarse_colortable, coarse_info, outfile, "_level_" + to_string(level), true) && success;
+			}
+			else {
+				success = combine_data(coarse_vtable, coarse_colortable, gridsize, coarse_info, outfile, "level_" + to_string(level), true, write_slab) && success;
+			}
+			if (bits) {
+				success = write_bits(coarse_vtable, coarse_info, outfile, "occupancy_level_" + to_string(level)) && success;
+			}
+
+			if (level > 1) {
+				free(level_vtable);
+				free(level_colortable);
+			}
+			level_info = coarse_info;
+			level_vtable = coarse_vtable;
+			level_colortable = coarse_colortable;
+		}
+		free(level_vtable);
+		free(level_colortable);
+	}
+	finish(success);
 }
@@ -0,0 +1,128 @@
+#include "point_cloud.h"
+#include "common/radix_sort.h"
+#include "common/trace.h"
+#include "common/perf_counters.h"
+#include <vector>
+#include <utility>
+
+namespace point_cloud {
+
+	// Voxel coordinate of a grid coordinate, clamped to [0, size - 1]; NaN goes to 0
+	static inline unsigned int quantize(float c, unsigned int size) {
+		if (!(c > 0.0f)) {
+			return 0;
+		}
+		if (c >= static_cast<float>(size - 1)) {
+			return size - 1;
+		}
+		return static_cast<unsigned int>(c);
+	}
+
+	// Set a bit of the voxel table; runs of different threads can share a word
+	static inline void setBit(unsigned int* voxel_table, size_t index) {
+		unsigned int mask = 1u << (31 - index % size_t(32));
+#pragma omp atomic
+		voxel_table[index / size_t(32)] |= mask;
+	}
+
+	// Reduce the sorted points first..last-1 of one voxel to its color and label; counts is scratch space for the
+	// (label, points) pairs, usually a handful
+	static void reduceVoxel(const std::vector<uint32_t>& order, size_t first, size_t last, const float* colors,
+		const unsigned short* labels, std::vector<std::pair<unsigned int, unsigned int>>& counts, unsigned int* color) {
+		double sum[3] = { 0.0, 0.0, 0.0 };
+		counts.clear();
+		for (size_t i = first; i < last; i++) {
+			size_t p = order[i];
+			if (colors != nullptr) {
+				sum[0] += colors[3 * p]; sum[1] += colors[3 * p + 1]; sum[2] += colors[3 * p + 2];
+			}
+			unsigned int label = labels != nullptr ? labels[p] : 100u;
+			size_t k = 0;
+			while (k < counts.size() && counts[k].first != label) { k++; }
+			if (k == counts.size()) { counts.push_back(std::make_pair(label, 0u)); }
+			counts[k].second++;
+		}
+		size_t best = 0;
+		for (size_t k = 1; k < counts.size(); k++) {
+			if (counts[k].second > counts[best].second || (counts[k].second == counts[best].second && counts[k].first < counts[best].first)) {
+				best = k;
+			}
+		}
+		float n = static_cast<float>(last - first);
+		for (int c = 0; c < 3; c++) {
+			color[c] = static_cast<unsigned int>(255.0f * glm::clamp(static_cast<float>(sum[c] / n), 0.0f, 1.0f) + 0.5f);
+		}
+		color[3] = counts[best].first;
+	}
+
+	void voxelize_points(const voxinfo& info, const float* positions, const float* colors, const unsigned short* labels,
+		size_t n, unsigned int* vtable, unsigned int* colortable, bool morton_order, StatValues& stats) {
+		TraceScope scope("voxelize");
+		const long long n_points = static_cast<long long>(n);
+		const size_t n_voxels = static_cast<size_t>(info.gridsize.x) * static_cast<size_t>(info.gridsize.y) * static_cast<size_t>(info.gridsize.z);
+
+		// Quantize and encode; the keys only need 3 bits per bit of the largest grid dimension
+		std::vector<uint64_t> keys(n);
+		std::vector<uint32_t> order(n);
+#pragma omp parallel
+		{
+			PerfScope perf("voxelize");
+#pragma omp for
+			for (long long i = 0; i < n_points; i++) {
+				const float* p = positions + 3 * i;
+				unsigned int x = quantize((p[0] - info.bbox.min.x) / info.unit.x, info.gridsize.x);
+				unsigned int y = quantize((p[1] - info.bbox.min.y) / info.unit.y, info.gridsize.y);
+				unsigned int z = quantize((p[2] - info.bbox.min.z) / info.unit.z, info.gridsize.z);
+				keys[i] = mortonEncode(x, y, z);
+				order[i] = static_cast<uint32_t>(i);
+			}
+		}
+		unsigned int largest = glm::max(info.gridsize.x, glm::max(info.gridsize.y, info.gridsize.z));
+		int key_bits = 0;
+		while (key_bits < 63 && (uint64_t(1) << (key_bits / 3)) < largest) { key_bits += 3; }
+		radix_sort_pairs(keys, order, key_bits);
+
+		// Every chunk starts at the first run beginning in it and reduces the runs starting in it, so every voxel is
+		// written by exactly one thread
+		const long long chunk = 1 << 14;
+		const long long n_chunks = (n_points + chunk - 1) / chunk;
+		uint64_t set = 0;
+#pragma omp parallel
+		{
+			PerfScope perf("attribute");
+			std::vector<std::pair<unsigned int, unsigned int>> counts;
+#pragma omp for schedule(dynamic) reduction(+:set)
+			for (long long c = 0; c < n_chunks; c++) {
+				size_t first = static_cast<size_t>(c * chunk);
+				size_t end = static_cast<size_t>(glm::min(n_points, (c + 1) * chunk));
+				while (first < end && first > 0 && keys[first] == keys[first - 1]) { first++; }
+				while (first < end) {
+					size_t last = first + 1;
+					while (last < n && keys[last] == keys[first]) { last++; }
+
+					size_t location;
+					if (morton_order) {
+						location = static_cast<size_t>(keys[first]);
+					}
+					else {
+						size_t x = mortonCompact(keys[first]), y = mortonCompact(keys[first] >> 1), z = mortonCompact(keys[first] >> 2);
+						location = x + (y * info.gridsize.x) + (z * info.gridsize.y * info.gridsize.x);
+					}
+					if (location < n_voxels) {
+						setBit(vtable, location);
+						if (colortable != nullptr) {
+							reduceVoxel(order, first, last, colors, labels, counts, colortable + location * size_t(4));
+						}
+						set++;
+					}
+					first = last;
+				}
+			}
+		}
+
+		stats = StatValues();
+		stats[STAT_VOXELS] = set;
+		stats[STAT_MARKS] = n;
+		stats[STAT_DUPLICATE_MARKS] = n - set;
+	}
+}
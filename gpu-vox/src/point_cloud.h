@@ -0,0 +1,46 @@
+#pragma once
+
+#include "util.h"
+#include "common/voxel_stats.h"
+#include <cstdio>
+#include <stdint.h>
+
+// Point cloud voxelization: points are quantized to voxel coordinates, sorted by their Morton code and every
+// run of points in the same voxel is reduced to one voxel, without any per-voxel locks or atomics.
+namespace point_cloud {
+	// Morton code of voxel (x, y, z), coordinates up to 21 bits, x in the lowest bit (the order of mortonEncode_LUT)
+	inline uint64_t mortonEncode(unsigned int x, unsigned int y, unsigned int z) {
+		uint64_t code = 0;
+		const unsigned int c[3] = { x, y, z };
+		for (int i = 0; i < 3; i++) {
+			uint64_t v = c[i] & 0x1fffff;
+			v = (v | (v << 32)) & 0x1f00000000ffffULL;
+			v = (v | (v << 16)) & 0x1f0000ff0000ffULL;
+			v = (v | (v << 8)) & 0x100f00f00f00f00fULL;
+			v = (v | (v << 4)) & 0x10c30c30c30c30c3ULL;
+			v = (v | (v << 2)) & 0x1249249249249249ULL;
+			code |= v << i;
+		}
+		return code;
+	}
+
+	// Inverse of mortonEncode for one coordinate: shift the code right by 0, 1 or 2 for x, y or z first
+	inline unsigned int mortonCompact(uint64_t code) {
+		uint64_t v = code & 0x1249249249249249ULL;
+		v = (v | (v >> 2)) & 0x10c30c30c30c30c3ULL;
+		v = (v | (v >> 4)) & 0x100f00f00f00f00fULL;
+		v = (v | (v >> 8)) & 0x1f0000ff0000ffULL;
+		v = (v | (v >> 16)) & 0x1f00000000ffffULL;
+		v = (v | (v >> 32)) & 0x1fffffULL;
+		return static_cast<unsigned int>(v);
+	}
+
+	// Voxelize n points (x, y, z floats each) into a zeroed voxel table and color table of 4 uints per voxel, the
+	// layout combine_data writes. A voxel with points is set, its color is the mean point color (r, g, b floats in
+	// [0, 1], scaled to [0, 255]) and its label the most frequent point label (ties go to the lower label).
+	// colors and labels may be null, for black points and the unknown label 100. Points outside the grid are clamped
+	// to its border voxels. Morton order needs a cubic power-of-two grid, as for the mesh voxelizers.
+	// Fills stats with the voxels set, the points as marks and the points that fell into an already set voxel.
+	void voxelize_points(const voxinfo& info, const float* positions, const float* colors, const unsigned short* labels,
+		size_t n, unsigned int* vtable, unsigned int* colortable, bool morton_order, StatValues& stats);
+}
@@ -0,0 +1,144 @@
+#include "pyramid.h"
+#include "common/trace.h"
+#include "common/perf_counters.h"
+
+namespace pyramid {
+
+	// Read count (<= 64) bits of a voxel table starting at bit index start, first voxel in the most significant bit.
+	// Only the words holding these bits are touched, bits past count are zero.
+	static inline uint64_t readBits(const unsigned int* table, size_t start, size_t count) {
+		size_t word = start / size_t(32);
+		size_t last = (start + count - 1) / size_t(32);
+		unsigned int offset = start % size_t(32);
+		uint64_t bits = (uint64_t(table[word]) << 32) | (word + 1 <= last ? table[word + 1] : 0u);
+		if (offset > 0) {
+			uint64_t next = (word + 2 <= last) ? table[word + 2] : 0u;
+			bits = (bits << offset) | (next >> (32 - offset));
+		}
+		if (count < 64) {
+			bits &= ~uint64_t(0) << (64 - count);
+		}
+		return bits;
+	}
+
+	// OR every pair of adjacent voxels in 64 bits and pack the 32 results, first pair in the most significant bit
+	static inline uint32_t pairReduce(uint64_t bits) {
+		uint64_t x = ((bits | (bits << 1)) >> 1) & 0x5555555555555555ULL; // pair i ends up in bit 2 * (31 - i)
+		x = (x | (x >> 1)) & 0x3333333333333333ULL;
+		x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+		x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+		x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+		x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+		return static_cast<uint32_t>(x);
+	}
+
+	// OR count (<= 32) bits into a voxel table at bit index start. Rows of the table need not be
+	// word aligned, so words on row boundaries are shared between threads and updated atomically.
+	static inline void writeBits(unsigned int* table, size_t start, uint32_t bits, size_t count) {
+		size_t word = start / size_t(32);
+		unsigned int offset = start % size_t(32);
+		unsigned int first = bits >> offset;
+#pragma omp atomic
+		table[word] |= first;
+		if (offset > 0 && offset + count > 32) {
+			unsigned int second = bits << (32 - offset);
+#pragma omp atomic
+			table[word + 1] |= second;
+		}
+	}
+
+	// Average the colors and pool the labels of the set children of coarse voxel (x, y, z)
+	static void poolColor(const voxinfo& fine, const unsigned int* vtable, const unsigned int* colortable,
+		size_t x, size_t y, size_t z, unsigned int* pooled) {
+		unsigned int sum[3] = { 0, 0, 0 };
+		unsigned int labels[8];
+		unsigned int counts[8];
+		unsigned int n_labels = 0;
+		unsigned int n = 0;
+		for (size_t fz = 2 * z; fz < glm::min<size_t>(2 * z + 2, fine.gridsize.z); fz++) {
+			for (size_t fy = 2 * y; fy < glm::min<size_t>(2 * y + 2, fine.gridsize.y); fy++) {
+				for (size_t fx = 2 * x; fx < glm::min<size_t>(2 * x + 2, fine.gridsize.x); fx++) {
+					size_t location = fx + (fy * fine.gridsize.x) + (fz * fine.gridsize.y * fine.gridsize.x);
+					if (!(vtable[location / size_t(32)] & (1u << (31 - location % size_t(32))))) {
+						continue;
+					}
+					const unsigned int* color = colortable + location * size_t(4);
+					sum[0] += color[0]; sum[1] += color[1]; sum[2] += color[2];
+					n++;
+					unsigned int k = 0;
+					while (k < n_labels && labels[k] != color[3]) { k++; }
+					if (k == n_labels) { labels[k] = color[3]; counts[k] = 0; n_labels++; }
+					counts[k]++;
+				}
+			}
+		}
+		if (n == 0) {
+			return;
+		}
+		unsigned int best = 0;
+		for (unsigned int k = 1; k < n_labels; k++) {
+			if (counts[k] > counts[best] || (counts[k] == counts[best] && labels[k] < labels[best])) {
+				best = k;
+			}
+		}
+		pooled[0] = (sum[0] + n / 2) / n;
+		pooled[1] = (sum[1] + n / 2) / n;
+		pooled[2] = (sum[2] + n / 2) / n;
+		pooled[3] = labels[best];
+	}
+
+	voxinfo coarsen(const voxinfo& fine) {
+		glm::uvec3 gridsize((fine.gridsize.x + 1) / 2, (fine.gridsize.y + 1) / 2, (fine.gridsize.z + 1) / 2);
+		AABox<glm::vec3> bbox(fine.bbox.min, fine.bbox.min + fine.unit * 2.0f * glm::vec3(gridsize));
+		return voxinfo(bbox, gridsize, fine.n_triangles);
+	}
+
+	void downsample(const voxinfo& fine, const unsigned int* vtable, const unsigned int* colortable,
+		const voxinfo& coarse, unsigned int* coarse_vtable, unsigned int* coarse_colortable) {
+		TraceScope scope("attribute");
+		const size_t fine_x = fine.gridsize.x, fine_y = fine.gridsize.y, fine_z = fine.gridsize.z;
+		const size_t coarse_x = coarse.gridsize.x, coarse_y = coarse.gridsize.y;
+		const long long rows = static_cast<long long>(coarse_y) * static_cast<long long>(coarse.gridsize.z);
+
+		// Every coarse row (y, z) is the pairwise OR along x of the OR of up to 4 fine rows,
+		// handled 32 coarse voxels (one word) at a time
+#pragma omp parallel
+		{
+			PerfScope perf("attribute");
+#pragma omp for schedule(dynamic, 16)
+			for (long long row = 0; row < rows; row++) {
+				size_t y = static_cast<size_t>(row) % coarse_y;
+				size_t z = static_cast<size_t>(row) / coarse_y;
+				size_t fine_rows[4];
+				int n_rows = 0;
+				for (size_t fz = 2 * z; fz < glm::min<size_t>(2 * z + 2, fine_z); fz++) {
+					for (size_t fy = 2 * y; fy < glm::min<size_t>(2 * y + 2, fine_y); fy++) {
+						fine_rows[n_rows++] = (fy * fine_x) + (fz * fine_y * fine_x);
+					}
+				}
+				size_t coarse_row = (y * coarse_x) + (z * coarse_y * coarse_x);
+
+				for (size_t x = 0; x < coarse_x; x += 32) {
+					size_t count = glm::min<size_t>(64, fine_x - 2 * x);
+					uint64_t bits = 0;
+					for (int r = 0; r < n_rows; r++) {
+						bits |= readBits(vtable, fine_rows[r] + 2 * x, count);
+					}
+					if (bits == 0) {
+						continue;
+					}
+					uint32_t reduced = pairReduce(bits);
+					writeBits(coarse_vtable, coarse_row + x, reduced, glm::min<size_t>(32, coarse_x - x));
+
+					if (colortable != nullptr) {
+						for (size_t i = 0; i < 32; i++) {
+							if (reduced & (0x80000000u >> i)) {
+								poolColor(fine, vtable, colortable, x + i, y, z, coarse_colortable + (coarse_row + x + i) * size_t(4));
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "util.h"
+#include <cstdio>
+
+// Multi-resolution pyramid: coarser levels are built from the finest voxel table
+// by 2x2x2 OR-reduction, instead of voxelizing the mesh again at every resolution.
+namespace pyramid {
+	// Voxelization info of the next coarser level: half the grid size (rounded up), twice the unit length.
+	// The bbox grows to cover the extra voxel of odd grid sizes, so the transformations stay exact.
+	voxinfo coarsen(const voxinfo& fine);
+
+	// Build the coarser voxel table (and color table, if given) from the finer one.
+	// Tables are in linear (non-morton) order; coarse_vtable and coarse_colortable must be zeroed.
+	// A coarse voxel is set if any of its 8 children is set; its color is the average color of the
+	// set children and its label the most frequent label among them (ties go to the lower label).
+	void downsample(const voxinfo& fine, const unsigned int* vtable, const unsigned int* colortable,
+		const voxinfo& coarse, unsigned int* coarse_vtable, unsigned int* coarse_colortable);
+}
@@ -41,7 +41,7 @@ struct Timer { // High performance Win64 timer using QPC events
 
 #define MILLION 1000000.0f
 
-struct Timer { // High performance timer using standard c++11 chrono
+struct Timer { // High performance timer using the POSIX monotonic clock
 	double elapsed_time_milliseconds = 0;
 	timespec t1;
 	timespec t2;
@@ -50,11 +50,11 @@ struct Timer { // High performance timer using standard c++11 chrono
 	}
 
 	inline void start() {
-		clock_gettime(CLOCK_REALTIME, &t1);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
 	}
 
 	inline void stop() {
-		clock_gettime(CLOCK_REALTIME, &t2);
+		clock_gettime(CLOCK_MONOTONIC, &t2);
 		elapsed_time_milliseconds += (t2.tv_sec - t1.tv_sec) * 1000.0f;
 		elapsed_time_milliseconds += ((float)(t2.tv_nsec - t1.tv_nsec)) / MILLION;
 	}
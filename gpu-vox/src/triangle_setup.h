@@ -0,0 +1,145 @@
+#pragma once
+
+#include "util.h"
+
+// Per-triangle setup of the triangle/box overlap test (plane test plus the three projection tests), computed once
+// per mesh and shared by all voxelization passes.
+//
+// Everything except the terms that depend on the voxel size is stored: the first vertex relative to the origin,
+// the normal, the triangle bounding box, the 2D edge normals of the XY, YZ and ZX projections and the edge
+// offsets without their voxel size terms. A pass only adds those terms (see triangle_test), so the setup stays
+// valid for every grid size over a bounding box with the same minimum, and for grids starting a whole number of
+// voxels further, such as the blocks of a scene. The components are stored as structure
+// of arrays, each padded to a multiple of 32 floats: CPU loops stream through them and neighbouring CUDA threads
+// read them coalesced.
+struct TriangleSetup {
+	enum Component {
+		V0_X, V0_Y, V0_Z,
+		N_X, N_Y, N_Z,
+		MIN_X, MIN_Y, MIN_Z,
+		MAX_X, MAX_Y, MAX_Z,
+		N_XY, // 3 edges x 2 floats
+		N_YZ = N_XY + 6,
+		N_ZX = N_YZ + 6,
+		D_XY = N_ZX + 6, // 3 edges
+		D_YZ = D_XY + 3,
+		D_ZX = D_YZ + 3,
+		COMPONENTS = D_ZX + 3
+	};
+
+	glm::vec3 origin; // the vertices are relative to this point, the bounding box minimum of the voxelization
+	size_t n_triangles;
+	size_t stride; // floats per component
+	float* data; // COMPONENTS * stride floats, owned by whoever allocated them
+
+	__device__ __host__ float& at(int component, size_t t) const {
+		return data[component * stride + t];
+	}
+
+	// Floats per component for n triangles
+	__device__ __host__ static size_t stride_for(size_t n) {
+		return (n + 31) / 32 * 32;
+	}
+};
+
+// Set up triangle t from its vertices, given relative to setup.origin
+__device__ __host__ inline void setup_triangle(const TriangleSetup& setup, size_t t, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2) {
+	// Edge vectors
+	glm::vec3 e0 = v1 - v0;
+	glm::vec3 e1 = v2 - v1;
+	glm::vec3 e2 = v0 - v2;
+	// Normal vector pointing up from the triangle
+	glm::vec3 n = glm::normalize(glm::cross(e0, e1));
+	// Triangle bounding box in world coordinates is min(v0,v1,v2) and max(v0,v1,v2)
+	glm::vec3 t_min = glm::min(v0, glm::min(v1, v2));
+	glm::vec3 t_max = glm::max(v0, glm::max(v1, v2));
+
+	// XY plane
+	glm::vec2 n_xy[3] = { glm::vec2(-1.0f * e0.y, e0.x), glm::vec2(-1.0f * e1.y, e1.x), glm::vec2(-1.0f * e2.y, e2.x) };
+	// YZ plane
+	glm::vec2 n_yz[3] = { glm::vec2(-1.0f * e0.z, e0.y), glm::vec2(-1.0f * e1.z, e1.y), glm::vec2(-1.0f * e2.z, e2.y) };
+	// ZX plane
+	glm::vec2 n_zx[3] = { glm::vec2(-1.0f * e0.x, e0.z), glm::vec2(-1.0f * e1.x, e1.z), glm::vec2(-1.0f * e2.x, e2.z) };
+	glm::vec3 v[3] = { v0, v1, v2 };
+	for (int e = 0; e < 3; e++) {
+		if (n.z < 0.0f) { n_xy[e] = -n_xy[e]; }
+		if (n.x < 0.0f) { n_yz[e] = -n_yz[e]; }
+		if (n.y < 0.0f) { n_zx[e] = -n_zx[e]; }
+		setup.at(TriangleSetup::N_XY + 2 * e, t) = n_xy[e].x;
+		setup.at(TriangleSetup::N_XY + 2 * e + 1, t) = n_xy[e].y;
+		setup.at(TriangleSetup::N_YZ + 2 * e, t) = n_yz[e].x;
+		setup.at(TriangleSetup::N_YZ + 2 * e + 1, t) = n_yz[e].y;
+		setup.at(TriangleSetup::N_ZX + 2 * e, t) = n_zx[e].x;
+		setup.at(TriangleSetup::N_ZX + 2 * e + 1, t) = n_zx[e].y;
+		setup.at(TriangleSetup::D_XY + e, t) = -1.0f * glm::dot(n_xy[e], glm::vec2(v[e].x, v[e].y));
+		setup.at(TriangleSetup::D_YZ + e, t) = -1.0f * glm::dot(n_yz[e], glm::vec2(v[e].y, v[e].z));
+		setup.at(TriangleSetup::D_ZX + e, t) = -1.0f * glm::dot(n_zx[e], glm::vec2(v[e].z, v[e].x));
+	}
+
+	for (int i = 0; i < 3; i++) {
+		setup.at(TriangleSetup::V0_X + i, t) = v0[i];
+		setup.at(TriangleSetup::N_X + i, t) = n[i];
+		setup.at(TriangleSetup::MIN_X + i, t) = t_min[i];
+		setup.at(TriangleSetup::MAX_X + i, t) = t_max[i];
+	}
+}
+
+// Overlap test of one triangle for one voxel size
+struct TriangleTest {
+	glm::vec3 n;
+	float d1;
+	float d2;
+	glm::vec2 n_xy[3];
+	glm::vec2 n_yz[3];
+	glm::vec2 n_zx[3];
+	float d_xy[3];
+	float d_yz[3];
+	float d_zx[3];
+	AABox<glm::ivec3> bbox_grid;
+};
+
+// Complete the setup of triangle t with the terms that depend on the voxel size of info. The first voxel of the grid
+// of info is offset voxels from setup.origin: the voxel range is relative to the grid, but the tests take voxel
+// positions relative to setup.origin, i.e. (voxel + offset) * unit, so a block marks exactly the voxels of the scene
+__device__ __host__ inline TriangleTest triangle_test(const TriangleSetup& setup, size_t t, const voxinfo& info, glm::uvec3 offset = glm::uvec3(0, 0, 0)) {
+	TriangleTest test;
+	glm::vec3 v0(setup.at(TriangleSetup::V0_X, t), setup.at(TriangleSetup::V0_Y, t), setup.at(TriangleSetup::V0_Z, t));
+	test.n = glm::vec3(setup.at(TriangleSetup::N_X, t), setup.at(TriangleSetup::N_Y, t), setup.at(TriangleSetup::N_Z, t));
+
+	// Triangle bounding box in voxel grid coordinates is the world bounding box divided by the grid unit vector
+	glm::vec3 grid_max(info.gridsize.x - 1, info.gridsize.y - 1, info.gridsize.z - 1); // grid max (grid runs from 0 to gridsize-1)
+	glm::vec3 t_min(setup.at(TriangleSetup::MIN_X, t), setup.at(TriangleSetup::MIN_Y, t), setup.at(TriangleSetup::MIN_Z, t));
+	glm::vec3 t_max(setup.at(TriangleSetup::MAX_X, t), setup.at(TriangleSetup::MAX_Y, t), setup.at(TriangleSetup::MAX_Z, t));
+	glm::vec3 grid_offset(offset);
+	test.bbox_grid.min = glm::clamp(t_min / info.unit - grid_offset, glm::vec3(0.0f, 0.0f, 0.0f), grid_max);
+	test.bbox_grid.max = glm::clamp(t_max / info.unit - grid_offset, glm::vec3(0.0f, 0.0f, 0.0f), grid_max);
+	// A triangle entirely beyond the grid (e.g. outside a block of a larger scene) gets an empty range, clamping would
+	// move it onto the border voxels where the plane and projection tests alone do not reject it. A triangle touching
+	// the far side of the grid, such as a face on the bbox max plane or on a block seam, touches the last layer of
+	// voxels and keeps it
+	for (int i = 0; i < 3; i++) {
+		if (t_min[i] / info.unit[i] - grid_offset[i] > grid_max[i] + 1.0f || t_max[i] / info.unit[i] - grid_offset[i] < 0.0f) {
+			test.bbox_grid.max[i] = test.bbox_grid.min[i] - 1;
+		}
+	}
+
+	// Plane test: critical point
+	glm::vec3 delta_p(info.unit.x, info.unit.y, info.unit.z);
+	glm::vec3 c(0.0f, 0.0f, 0.0f);
+	if (test.n.x > 0.0f) { c.x = info.unit.x; }
+	if (test.n.y > 0.0f) { c.y = info.unit.y; }
+	if (test.n.z > 0.0f) { c.z = info.unit.z; }
+	test.d1 = glm::dot(test.n, (c - v0));
+	test.d2 = glm::dot(test.n, ((delta_p - c) - v0));
+
+	// Projection tests: add the critical corner of the projected voxel to the edge offsets
+	for (int e = 0; e < 3; e++) {
+		test.n_xy[e] = glm::vec2(setup.at(TriangleSetup::N_XY + 2 * e, t), setup.at(TriangleSetup::N_XY + 2 * e + 1, t));
+		test.n_yz[e] = glm::vec2(setup.at(TriangleSetup::N_YZ + 2 * e, t), setup.at(TriangleSetup::N_YZ + 2 * e + 1, t));
+		test.n_zx[e] = glm::vec2(setup.at(TriangleSetup::N_ZX + 2 * e, t), setup.at(TriangleSetup::N_ZX + 2 * e + 1, t));
+		test.d_xy[e] = setup.at(TriangleSetup::D_XY + e, t) + glm::max(0.0f, info.unit.x * test.n_xy[e][0]) + glm::max(0.0f, info.unit.y * test.n_xy[e][1]);
+		test.d_yz[e] = setup.at(TriangleSetup::D_YZ + e, t) + glm::max(0.0f, info.unit.y * test.n_yz[e][0]) + glm::max(0.0f, info.unit.z * test.n_yz[e][1]);
+		test.d_zx[e] = setup.at(TriangleSetup::D_ZX + e, t) + glm::max(0.0f, info.unit.x * test.n_zx[e][0]) + glm::max(0.0f, info.unit.z * test.n_zx[e][1]);
+	}
+	return test;
+}
@@ -1,10 +1,11 @@
 #include "util.h"
 #include "util_io.h"
 #include <H5Cpp.h>
+#include "common/trace.h"
+#include "common/perf_counters.h"
+#include "common/bit_volume.h"
 
 
-bool write_transformations(const voxinfo &voxinfo, const std::string &output);
-
 using namespace std;
 
 size_t get_file_length(const std::string base_filename) {
@@ -31,8 +32,14 @@ void read_binary(void *data, const size_t length, const std::string base_filenam
     return;
 }
 
+//Colour and label of set voxels without a color table: white with the unknown label, so that they differ from the
+//black empty voxels
+static const unsigned int UNCOLORED_VOXEL[4] = {255, 255, 255, 100};
+
 void write_off(const unsigned int *vtable, const unsigned int *colortable, const size_t gridsize,
                const std::string base_filename, voxinfo voxinfo) {
+    TraceScope scope("write");
+    PerfScope perf("write");
     string filename_output = base_filename + string("_") + string(".off");
 #ifndef SILENT
     fprintf(stdout, "[I/O] Writing data in obj format to %s \n", filename_output.c_str());
@@ -68,12 +75,12 @@ void write_off(const unsigned int *vtable, const unsigned int *colortable, const
 //                    verts.push_back(  std::to_string(x + 1)+" "+ std::to_string(y + 1)+" "+ std::to_string(z) );
 //                    verts.push_back(  std::to_string(x + 1)+" "+ std::to_string(y + 1)+" "+ std::to_string(z + 1));
                     size_t location = x + (y * voxinfo.gridsize.x) + (z*voxinfo.gridsize.y * voxinfo.gridsize.x);
-                    size_t int_location = location * size_t(4);
+                    const unsigned int *features = colortable != nullptr ? colortable + location * size_t(4) : UNCOLORED_VOXEL;
 //                    handle labels here since they are 100 but should be -100
-                    int label = colortable[int_location + 3] == 100 ? -100 : colortable[int_location + 3];
-                    string color = std::to_string(colortable[int_location]) + " " +
-                                   std::to_string(colortable[int_location + 1]) + " " +
-                                   std::to_string(colortable[int_location + 2]) + " " +
+                    int label = features[3] == 100 ? -100 : features[3];
+                    string color = std::to_string(features[0]) + " " +
+                                   std::to_string(features[1]) + " " +
+                                   std::to_string(features[2]) + " " +
                                    std::to_string(label);
 
                     verts.push_back(std::to_string((x / scale_x - 0.5) * secondScaler_x - t_x) + " " +
@@ -161,6 +168,8 @@ void write_off(const unsigned int *vtable, const unsigned int *colortable, const
 }
 
 void write_binary(void *data, size_t bytes, const std::string base_filename) {
+    TraceScope scope("write");
+    PerfScope perf("write");
     string filename_output = base_filename + string(".bin");
 #ifndef SILENT
     fprintf(stdout, "[I/O] Writing data in binary format to %s (%s) \n", filename_output.c_str(),
@@ -217,8 +226,11 @@ void write_binvox(const unsigned int *vtable, const size_t gridsize, const std::
     output.close();
 }
 
+//Writes the tensor as rows [offset, offset + tensor.dimension(0)) of a dataset with rows rows in total;
+//the dataset is created when offset is 0 and must already exist otherwise
 template<int RANK>
-bool write_int_hdf5(const std::string filepath, Eigen::Tensor<int, RANK, Eigen::RowMajor> &tensor) {
+bool write_int_hdf5(const std::string filepath, Eigen::Tensor<int, RANK, Eigen::RowMajor> &tensor,
+                    const std::string &dataset_name, bool append, hsize_t rows, hsize_t offset) {
 
     try {
 
@@ -229,11 +241,12 @@ bool write_int_hdf5(const std::string filepath, Eigen::Tensor<int, RANK, Eigen::
         H5::Exception::dontPrint();
 
         /*
-         * Create a new file using H5F_ACC_TRUNC access,
+         * Create a new file using H5F_ACC_TRUNC access, or open the existing
+         * one with H5F_ACC_RDWR access when appending another dataset,
          * default file creation properties, and default file
          * access properties.
          */
-        H5::H5File file(filepath, H5F_ACC_TRUNC);
+        H5::H5File file(filepath, append || offset > 0 ? H5F_ACC_RDWR : H5F_ACC_TRUNC);
 
         /*
          * Define the size of the array and create the data space for fixed
@@ -241,10 +254,15 @@ bool write_int_hdf5(const std::string filepath, Eigen::Tensor<int, RANK, Eigen::
          */
         hsize_t rank = RANK;
         hsize_t dimsf[rank];
+        hsize_t count[rank];
+        hsize_t start[rank];
         for (int i = 0; i < rank; i++) {
             dimsf[i] = tensor.dimension(i);
-
+            count[i] = tensor.dimension(i);
+            start[i] = 0;
         }
+        dimsf[0] = rows;
+        start[0] = offset;
 
         H5::DataSpace dataspace(rank, dimsf);
 
@@ -257,16 +275,20 @@ bool write_int_hdf5(const std::string filepath, Eigen::Tensor<int, RANK, Eigen::
 
         /*
          * Create a new dataset within the file using defined dataspace and
-         * datatype and default dataset creation properties.
+         * datatype and default dataset creation properties, or open it to
+         * write a later block of rows.
          */
-        H5::DataSet dataset = file.createDataSet("tensor", datatype, dataspace);
+        H5::DataSet dataset = offset == 0 ? file.createDataSet(dataset_name, datatype, dataspace) : file.openDataSet(dataset_name);
 
         /*
-         * Write the data to the dataset using default memory space, file
-         * space, and transfer properties.
+         * Write the data to the selected rows of the dataset using default
+         * transfer properties.
          */
+        H5::DataSpace filespace = dataset.getSpace();
+        filespace.selectHyperslab(H5S_SELECT_SET, count, start);
+        H5::DataSpace memspace(rank, count);
         int *data = static_cast<int *>(tensor.data());
-        dataset.write(data, H5::PredType::NATIVE_INT);
+        dataset.write(data, H5::PredType::NATIVE_INT, memspace, filespace);
     }  // end of try block
 
         // catch failure caused by the H5File operations
@@ -298,41 +320,230 @@ bool write_int_hdf5(const std::string filepath, Eigen::Tensor<int, RANK, Eigen::
 
 
 bool combine_data(const unsigned int *vtable, const unsigned int *colortable, const size_t gridsize,
-                  voxinfo voxinfo, const string output) {
-    Eigen::Tensor<int, 4, Eigen::RowMajor> occ(voxinfo.gridsize.x, voxinfo.gridsize.y, voxinfo.gridsize.z, 4);
-    occ.setZero();
+                  voxinfo voxinfo, const string output, const string &dataset, bool append, size_t slab, bool transformations) {
+    TraceScope scope("write");
+    PerfScope perf("write");
+    if (slab == 0 || slab > voxinfo.gridsize.x) {
+        slab = voxinfo.gridsize.x;
+    }
+    bool success = true;
+//    The tensor is built and written slab slices along x at a time, the first slab creates the dataset
+    for (size_t x0 = 0; x0 < voxinfo.gridsize.x && success; x0 += slab) {
+        size_t rows = std::min(slab, voxinfo.gridsize.x - x0);
+        Eigen::Tensor<int, 4, Eigen::RowMajor> occ(rows, voxinfo.gridsize.y, voxinfo.gridsize.z, 4);
+        occ.setZero();
 //    Last column is set to -100 since that is how we have generated the labels for ourselves
 //    occ(Eigen::all, Eigen::last)= -100;
 //    occ:all
-    for (size_t x = 0; x < voxinfo.gridsize.x; x++) {
-        for (size_t y = 0; y < voxinfo.gridsize.y; y++) {
-            for (size_t z = 0; z < voxinfo.gridsize.z; z++) {
+        for (size_t x = x0; x < x0 + rows; x++) {
+            for (size_t y = 0; y < voxinfo.gridsize.y; y++) {
+                for (size_t z = 0; z < voxinfo.gridsize.z; z++) {
 //                This is the data that we have. We simply need to write this into an Eigen Tensor.
 //                In case we have no intersection at this location, that means it
 //                is empty space.
-                if (checkVoxel(x, y, z, voxinfo, vtable)) {
-                    size_t location = x + (y * voxinfo.gridsize.x) + (z* voxinfo.gridsize.y * voxinfo.gridsize.x);
-                    size_t int_location = location * size_t(4);
-                    occ(x, y, z, 0) = colortable[int_location];
-                    occ(x, y, z, 1) = colortable[int_location + 1];
-                    occ(x, y, z, 2) = colortable[int_location + 2];
+                    if (checkVoxel(x, y, z, voxinfo, vtable)) {
+                        size_t location = x + (y * voxinfo.gridsize.x) + (z* voxinfo.gridsize.y * voxinfo.gridsize.x);
+                        const unsigned int *features = colortable != nullptr ? colortable + location * size_t(4) : UNCOLORED_VOXEL;
+                        occ(x - x0, y, z, 0) = features[0];
+                        occ(x - x0, y, z, 1) = features[1];
+                        occ(x - x0, y, z, 2) = features[2];
 //                Again labels need to be specifically checked since we stored them as 100 as they are unsigned here
-                    int label = colortable[int_location + 3] == 100 ? -100 : colortable[int_location + 3];
-                    occ(x, y, z, 3) = label;
-                } else {
+                        int label = features[3] == 100 ? -100 : features[3];
+                        occ(x - x0, y, z, 3) = label;
+                    } else {
 //                    Once it is empty space, that also means that we should put a label of -100 there since this is a don't care
 //                location for us
-                    occ(x, y, z, 3) = -100;
-                }
+                        occ(x - x0, y, z, 3) = -100;
+                    }
 
+                }
             }
         }
+        success = write_int_hdf5<4>(output, occ, dataset, append, voxinfo.gridsize.x, x0);
+    }
+//    The default dataset keeps its <output>.json, every other dataset gets <output>.<dataset>.json
+    return success && (!transformations || write_transformations(voxinfo, dataset == "tensor" ? output : output + "." + dataset));
+}
+
+bool write_block_attributes(const voxinfo &block, const unsigned int origin[3], const std::string &output, const std::string &dataset) {
+    try {
+        H5::Exception::dontPrint();
+        H5::H5File file(output, H5F_ACC_RDWR);
+        H5::DataSet tensor = file.openDataSet(dataset);
+        hsize_t rank[1] = {3};
+        H5::DataSpace space(1, rank);
+        float offset[3] = {block.bbox.min.x, block.bbox.min.y, block.bbox.min.z};
+        float unit[3] = {block.unit.x, block.unit.y, block.unit.z};
+        tensor.createAttribute("offset", H5::PredType::NATIVE_FLOAT, space).write(H5::PredType::NATIVE_FLOAT, offset);
+        tensor.createAttribute("origin", H5::PredType::NATIVE_UINT, space).write(H5::PredType::NATIVE_UINT, origin);
+        tensor.createAttribute("unit", H5::PredType::NATIVE_FLOAT, space).write(H5::PredType::NATIVE_FLOAT, unit);
+    }
+    catch (H5::Exception error) {
+        error.printError();
+        return false;
+    }
+    return true;
+}
+
+bool write_block_index(const voxinfo &scene, const std::vector<unsigned int> &origins, unsigned int size, unsigned int overlap,
+                       const std::string &output, bool append) {
+    try {
+        H5::Exception::dontPrint();
+        H5::H5File file(output, append ? H5F_ACC_RDWR : H5F_ACC_TRUNC);
+        hsize_t dims[2] = {origins.size() / 3, 3};
+        H5::DataSpace dataspace(2, dims);
+        H5::DataSet index = file.createDataSet("blocks", H5::PredType::STD_U32LE, dataspace);
+        if (!origins.empty()) {
+            index.write(origins.data(), H5::PredType::NATIVE_UINT);
+        }
+
+        H5::DataSpace scalar(H5S_SCALAR);
+        index.createAttribute("block_size", H5::PredType::NATIVE_UINT, scalar).write(H5::PredType::NATIVE_UINT, &size);
+        index.createAttribute("overlap", H5::PredType::NATIVE_UINT, scalar).write(H5::PredType::NATIVE_UINT, &overlap);
+        hsize_t rank[1] = {3};
+        H5::DataSpace space(1, rank);
+        unsigned int grid_size[3] = {scene.gridsize.x, scene.gridsize.y, scene.gridsize.z};
+        float scene_min[3] = {scene.bbox.min.x, scene.bbox.min.y, scene.bbox.min.z};
+        index.createAttribute("grid_size", H5::PredType::NATIVE_UINT, space).write(H5::PredType::NATIVE_UINT, grid_size);
+        index.createAttribute("scene_min", H5::PredType::NATIVE_FLOAT, space).write(H5::PredType::NATIVE_FLOAT, scene_min);
     }
-    bool success = write_int_hdf5<4>(output, occ);
-    return success && write_transformations(voxinfo, output);
+    catch (H5::Exception error) {
+        error.printError();
+        return false;
+    }
+    return true;
 }
 
-bool write_transformations(const voxinfo &voxinfo, const std::string &output) {
+bool write_bits(const unsigned int *vtable, voxinfo voxinfo, const std::string &output, const std::string &dataset) {
+    TraceScope scope("write");
+    PerfScope perf("write");
+    const size_t rows = static_cast<size_t>(voxinfo.gridsize.y) * static_cast<size_t>(voxinfo.gridsize.z);
+    const size_t length = voxinfo.gridsize.x;
+    const size_t row_words = bit_words(length);
+//    Rows of the voxel table only start at word boundaries if x is a multiple of 32, otherwise they are split up
+    std::vector<uint32_t> words;
+    const uint32_t *data = reinterpret_cast<const uint32_t *>(vtable);
+    if (length % 32 != 0) {
+        words.resize(rows * row_words);
+        bits_to_rows(data, rows, length, words.data());
+        data = words.data();
+    }
+
+    try {
+        H5::Exception::dontPrint();
+        H5::H5File file(output, H5F_ACC_RDWR);
+        hsize_t dims[3] = {voxinfo.gridsize.z, voxinfo.gridsize.y, row_words};
+        H5::DataSpace dataspace(3, dims);
+        H5::DataSet tensor = file.createDataSet(dataset, H5::PredType::STD_U32LE, dataspace);
+        tensor.write(data, H5::PredType::NATIVE_UINT32);
+
+        H5::DataSpace scalar(H5S_SCALAR);
+        H5::StrType string_type(H5::PredType::C_S1, 4);
+        tensor.createAttribute("format", string_type, scalar).write(string_type, "bits");
+        hsize_t shape[3] = {voxinfo.gridsize.z, voxinfo.gridsize.y, voxinfo.gridsize.x};
+        hsize_t rank[1] = {3};
+        H5::DataSpace shape_space(1, rank);
+        tensor.createAttribute("shape", H5::PredType::NATIVE_HSIZE, shape_space).write(H5::PredType::NATIVE_HSIZE, shape);
+//        The dimensions of the dense tensor (x, y, z) the packed ones run along
+        hsize_t axes[3] = {2, 1, 0};
+        tensor.createAttribute("axes", H5::PredType::NATIVE_HSIZE, shape_space).write(H5::PredType::NATIVE_HSIZE, axes);
+    }
+    catch (H5::Exception error) {
+        error.printError();
+        return false;
+    }
+    return true;
+}
+
+bool write_sparse(const unsigned int *vtable, const unsigned int *colortable, voxinfo voxinfo, const std::string &output,
+                  const std::string &suffix, bool append, bool transformations) {
+    TraceScope scope("write");
+    PerfScope perf("write");
+    const size_t n_voxels = static_cast<size_t>(voxinfo.gridsize.x) * static_cast<size_t>(voxinfo.gridsize.y) * static_cast<size_t>(voxinfo.gridsize.z);
+    const uint32_t *bits = reinterpret_cast<const uint32_t *>(vtable);
+//    Prefix sum of the set bits per chunk of words, then every chunk fills its rows in parallel
+    std::vector<size_t> offsets;
+    const size_t n = bit_offsets(bits, n_voxels, offsets);
+    std::vector<int32_t> coords(n * 3);
+    std::vector<uint8_t> colors(n * 3);
+    std::vector<int16_t> labels(n);
+    const size_t plane = static_cast<size_t>(voxinfo.gridsize.x) * static_cast<size_t>(voxinfo.gridsize.y);
+    for_each_set_bit(bits, n_voxels, offsets, [&](size_t location, size_t row) {
+        coords[3 * row] = static_cast<int32_t>(location % voxinfo.gridsize.x);
+        coords[3 * row + 1] = static_cast<int32_t>((location / voxinfo.gridsize.x) % voxinfo.gridsize.y);
+        coords[3 * row + 2] = static_cast<int32_t>(location / plane);
+        const unsigned int *color = colortable != nullptr ? colortable + location * size_t(4) : UNCOLORED_VOXEL;
+        for (int c = 0; c < 3; c++) {
+            colors[3 * row + c] = static_cast<uint8_t>(std::min(color[c], 255u));
+        }
+        labels[row] = color[3] == 100 ? -100 : static_cast<int16_t>(color[3]);
+    });
+#ifndef SILENT
+    fprintf(stdout, "[I/O] Writing %zu of %zu voxels as sparse coordinates to %s \n", n, n_voxels, output.c_str());
+#endif
+
+    try {
+        H5::Exception::dontPrint();
+        H5::H5File file(output, append ? H5F_ACC_RDWR : H5F_ACC_TRUNC);
+        hsize_t dims[2] = {n, 3};
+        H5::DataSpace rows(2, dims);
+        H5::DataSpace column(1, dims);
+        H5::DataSet coords_set = file.createDataSet("coords" + suffix, H5::PredType::STD_I32LE, rows);
+        H5::DataSet colors_set = file.createDataSet("colors" + suffix, H5::PredType::STD_U8LE, rows);
+        H5::DataSet labels_set = file.createDataSet("labels" + suffix, H5::PredType::STD_I16LE, column);
+        if (n > 0) {
+            coords_set.write(coords.data(), H5::PredType::NATIVE_INT32);
+            colors_set.write(colors.data(), H5::PredType::NATIVE_UINT8);
+            labels_set.write(labels.data(), H5::PredType::NATIVE_INT16);
+        }
+        hsize_t rank[1] = {3};
+        H5::DataSpace space(1, rank);
+        unsigned int grid_size[3] = {voxinfo.gridsize.x, voxinfo.gridsize.y, voxinfo.gridsize.z};
+        coords_set.createAttribute("grid_size", H5::PredType::NATIVE_UINT, space).write(H5::PredType::NATIVE_UINT, grid_size);
+    }
+    catch (H5::Exception error) {
+        error.printError();
+        return false;
+    }
+//    Named like the json of combine_data: <output>.json for the finest level, <output>.coords<suffix>.json otherwise
+    return !transformations || write_transformations(voxinfo, suffix.empty() ? output : output + ".coords" + suffix);
+}
+
+bool write_components(const voxinfo &voxinfo, const std::vector<int32_t> &ids, bool sparse, const std::vector<uint64_t> &sizes,
+                      const std::vector<int32_t> &bboxes, int connectivity, const std::string &output) {
+    TraceScope scope("write");
+    PerfScope perf("write");
+    try {
+        H5::Exception::dontPrint();
+        H5::H5File file(output, H5F_ACC_RDWR);
+        hsize_t dims[3] = {voxinfo.gridsize.x, voxinfo.gridsize.y, voxinfo.gridsize.z};
+        if (sparse) {
+            dims[0] = ids.size();
+        }
+        H5::DataSpace dataspace(sparse ? 1 : 3, dims);
+        H5::DataSet components = file.createDataSet("components", H5::PredType::STD_I32LE, dataspace);
+        if (!ids.empty()) {
+            components.write(ids.data(), H5::PredType::NATIVE_INT32);
+        }
+        H5::DataSpace scalar(H5S_SCALAR);
+        components.createAttribute("connectivity", H5::PredType::NATIVE_INT, scalar).write(H5::PredType::NATIVE_INT, &connectivity);
+
+        hsize_t table_dims[2] = {sizes.size(), 6};
+        H5::DataSet sizes_set = file.createDataSet("component_sizes", H5::PredType::STD_U64LE, H5::DataSpace(1, table_dims));
+        H5::DataSet bboxes_set = file.createDataSet("component_bboxes", H5::PredType::STD_I32LE, H5::DataSpace(2, table_dims));
+        if (!sizes.empty()) {
+            sizes_set.write(sizes.data(), H5::PredType::NATIVE_UINT64);
+            bboxes_set.write(bboxes.data(), H5::PredType::NATIVE_INT32);
+        }
+    }
+    catch (H5::Exception error) {
+        error.printError();
+        return false;
+    }
+    return true;
+}
+
+bool write_transformations(const voxinfo &voxinfo, const std::string &output, const std::string &extra) {
 //    Writing json data format using a simple text writer as I wanted to avoid extra file dependencies
     ofstream myfile;
     string vox_info_file = output + ".json";
@@ -348,7 +559,11 @@ bool write_transformations(const voxinfo &voxinfo, const std::string &output) {
     myfile << ", ";
     myfile << "\"grid_size\": [" + to_string(voxinfo.gridsize.x) + ", " + to_string(voxinfo.gridsize.y) + ", " +
               to_string(voxinfo.gridsize.z) + "]";
+    if (!extra.empty()) {
+        myfile << ", " << extra;
+    }
     myfile << "}";
     myfile.close();
+    return !myfile.fail();
 }
 
@@ -3,6 +3,7 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <vector>
 
 // Eigen
 #include <Eigen/Dense>
@@ -15,6 +16,45 @@ void write_binvox(const unsigned int* vtable, const size_t gridsize, const std::
 void write_off(const unsigned int *vtable, const unsigned int *colortable, const size_t gridsize,
                const std::string base_filename, voxinfo voxinfo);
 
-//h5 file
+//h5 file, written to the given dataset; append adds the dataset to an existing file instead of truncating it;
+//slab limits how many x-slices of the (16 bytes per voxel) tensor are held in memory at once, 0 for all;
+//transformations writes the json of the normalization next to it. Set voxels take their colour and label from the
+//color table; without one (nullptr) they are white with the unknown label -100, empty voxels are black with it
 bool combine_data(const unsigned int *vtable, const unsigned int *colortable, const size_t gridsize,
-               voxinfo voxinfo, std::string output);
+               voxinfo voxinfo, std::string output, const std::string &dataset = "tensor", bool append = false, size_t slab = 0,
+               bool transformations = true);
+
+//Adds the attributes offset (world position of the first voxel), origin (first voxel in the scene grid) and unit
+//(voxel size) to a dataset of a block of a scene
+bool write_block_attributes(const voxinfo &block, const unsigned int origin[3], const std::string &output, const std::string &dataset);
+
+//Adds the dataset blocks to the h5 file (or creates the file with it unless append): the n x 3 origins of the blocks in
+//the scene grid, with the attributes block_size, overlap, grid_size (of the scene) and scene_min (world position of its
+//first voxel)
+bool write_block_index(const voxinfo &scene, const std::vector<unsigned int> &origins, unsigned int size, unsigned int overlap,
+               const std::string &output, bool append);
+
+//Adds the linear (not morton ordered) voxel table to the h5 file as packed occupancy (see common/bit_volume.h): a
+//z x y x ceil(x/32) dataset of 32-bit words with the attributes format = "bits", shape = [z, y, x] and
+//axes = [2, 1, 0], the dimensions of the x x y x z tensor the packed ones run along; the table is written as
+//it is if the x size is a multiple of 32
+bool write_bits(const unsigned int *vtable, voxinfo voxinfo, const std::string &output, const std::string &dataset);
+
+//Adds the set voxels of the linear (not morton ordered) voxel table to the h5 file (or creates the file unless append)
+//as sparse coordinates and features, compacted straight from the tables without the dense tensor: coords<suffix>
+//(n x 3 int32 x, y, z in voxel table order, i.e. sorted by z, then y, then x), colors<suffix> (n x 3 uint8) and
+//labels<suffix> (n int16, -100 for unknown as in combine_data); coords has the attribute grid_size. With
+//transformations the json of the normalization is written next to it as for combine_data
+bool write_sparse(const unsigned int *vtable, const unsigned int *colortable, voxinfo voxinfo, const std::string &output,
+               const std::string &suffix = "", bool append = false, bool transformations = true);
+
+//Adds the connected components of the voxels to the h5 file: components holds the component of every voxel (0 for
+//empty voxels), x x y x z int32 like the tensor of combine_data or, with sparse, n int32 matching coords of write_sparse,
+//with the attribute connectivity; component_sizes (k uint64 voxel counts) and component_bboxes (k x 6 int32 minimum and
+//maximum x, y, z, inclusive) describe components 1 to k
+bool write_components(const voxinfo &voxinfo, const std::vector<int32_t> &ids, bool sparse, const std::vector<uint64_t> &sizes,
+               const std::vector<int32_t> &bboxes, int connectivity, const std::string &output);
+
+//Writes the normalization of the voxelization (scales, translation and grid size) to <output>.json; extra holds
+//further json members, e.g. "pose": {...}, without the enclosing braces
+bool write_transformations(const voxinfo &voxinfo, const std::string &output, const std::string &extra = "");
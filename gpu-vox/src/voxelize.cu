@@ -106,100 +106,48 @@ setData(unsigned int *color_table, size_t index, glm::vec3 vec, glm::vec3 vec1,
 
 
 
-// Main triangle voxelization method
-__global__ void voxelize_triangle(voxinfo info, float* triangle_data, unsigned int* voxel_table,unsigned int* color_table, bool morton_order){
+// Triangle setup: every thread sets up the triangles in its stride
+__global__ void setup_triangles_kernel(TriangleSetup setup, const float* triangle_data){
 	size_t thread_id = threadIdx.x + blockIdx.x * blockDim.x;
 	size_t stride = blockDim.x * gridDim.x;
 
-	// Common variables used in the voxelization process
-	glm::vec3 delta_p(info.unit.x, info.unit.y, info.unit.z);
-	glm::vec3 grid_max(info.gridsize.x - 1, info.gridsize.y - 1, info.gridsize.z - 1); // grid max (grid runs from 0 to gridsize-1)
+	while (thread_id < setup.n_triangles){
+		size_t t = thread_id * 21; // same layout as in voxelize_triangle
+		// Move vertices to origin using bbox
+		glm::vec3 v0 = glm::vec3(triangle_data[t], triangle_data[t + 1], triangle_data[t + 2]) - setup.origin;
+		glm::vec3 v1 = glm::vec3(triangle_data[t + 3], triangle_data[t + 4], triangle_data[t + 5]) - setup.origin;
+		glm::vec3 v2 = glm::vec3(triangle_data[t + 6], triangle_data[t + 7], triangle_data[t + 8]) - setup.origin;
+		setup_triangle(setup, thread_id, v0, v1, v2);
+		thread_id = thread_id + stride;
+	}
+}
+
+// Main triangle voxelization method
+__global__ void voxelize_triangle(voxinfo info, TriangleSetup setup, float* triangle_data, unsigned int* voxel_table,unsigned int* color_table, bool morton_order){
+	size_t thread_id = threadIdx.x + blockIdx.x * blockDim.x;
+	size_t stride = blockDim.x * gridDim.x;
 
 	while (thread_id < info.n_triangles){ // every thread works on specific triangles in its stride
         //		Since 9 more vertices added for the color info so we should skip 18
         // Another 3 added for making sure that we include label info
 		size_t t = thread_id * 21; // triangle contains 9 vertices
 
+//		Color information, only uploaded along with a color table (the unified memory path holds the 9 vertex floats only)
+        glm::vec3 c0, c1, c2, ll;
+        if (color_table != nullptr) {
+            c0 = glm::vec3(triangle_data[t+9], triangle_data[t + 10], triangle_data[t + 11]);
+            c1 = glm::vec3(triangle_data[t+12], triangle_data[t + 13], triangle_data[t + 14]);
+            c2 = glm::vec3(triangle_data[t+15], triangle_data[t + 16], triangle_data[t + 17]);
+            ll = glm::vec3(triangle_data[t+18], triangle_data[t + 19], triangle_data[t + 20]);
+        }
 
-		// COMPUTE COMMON TRIANGLE PROPERTIES
-		// Move vertices to origin using bbox
-		glm::vec3 v0 = glm::vec3(triangle_data[t], triangle_data[t + 1], triangle_data[t + 2]) - info.bbox.min;
-		glm::vec3 v1 = glm::vec3(triangle_data[t + 3], triangle_data[t + 4], triangle_data[t + 5]) - info.bbox.min; 
-		glm::vec3 v2 = glm::vec3(triangle_data[t + 6], triangle_data[t + 7], triangle_data[t + 8]) - info.bbox.min;
-
-//		Color information
-        glm::vec3 c0 = glm::vec3(triangle_data[t+9], triangle_data[t + 10], triangle_data[t + 11]);
-        glm::vec3 c1 = glm::vec3(triangle_data[t+12], triangle_data[t + 13], triangle_data[t + 14]);
-        glm::vec3 c2 = glm::vec3(triangle_data[t+15], triangle_data[t + 16], triangle_data[t + 17]);
-        glm::vec3 ll = glm::vec3(triangle_data[t+18], triangle_data[t + 19], triangle_data[t + 20]);
-
-		// Edge vectors
-		glm::vec3 e0 = v1 - v0;
-		glm::vec3 e1 = v2 - v1;
-		glm::vec3 e2 = v0 - v2;
-		// Normal vector pointing up from the triangle
-		glm::vec3 n = glm::normalize(glm::cross(e0, e1));
-
-		// COMPUTE TRIANGLE BBOX IN GRID
-		// Triangle bounding box in world coordinates is min(v0,v1,v2) and max(v0,v1,v2)
-		AABox<glm::vec3> t_bbox_world(glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)));
-		// Triangle bounding box in voxel grid coordinates is the world bounding box divided by the grid unit vector
-		AABox<glm::ivec3> t_bbox_grid;
-		t_bbox_grid.min = glm::clamp(t_bbox_world.min / info.unit, glm::vec3(0.0f, 0.0f, 0.0f), grid_max);
-		t_bbox_grid.max = glm::clamp(t_bbox_world.max / info.unit, glm::vec3(0.0f, 0.0f, 0.0f), grid_max);
-
-		// PREPARE PLANE TEST PROPERTIES
-		glm::vec3 c(0.0f, 0.0f, 0.0f);
-		if (n.x > 0.0f) { c.x = info.unit.x; }
-		if (n.y > 0.0f) { c.y = info.unit.y; }
-		if (n.z > 0.0f) { c.z = info.unit.z; }
-		float d1 = glm::dot(n, (c - v0));
-		float d2 = glm::dot(n, ((delta_p - c) - v0));
-
-		// PREPARE PROJECTION TEST PROPERTIES
-		// XY plane
-		glm::vec2 n_xy_e0(-1.0f*e0.y, e0.x);
-		glm::vec2 n_xy_e1(-1.0f*e1.y, e1.x);
-		glm::vec2 n_xy_e2(-1.0f*e2.y, e2.x);
-		if (n.z < 0.0f) {
-			n_xy_e0 = -n_xy_e0;
-			n_xy_e1 = -n_xy_e1;
-			n_xy_e2 = -n_xy_e2;
-		}
-		float d_xy_e0 = (-1.0f * glm::dot(n_xy_e0, glm::vec2(v0.x, v0.y))) + glm::max(0.0f, info.unit.x*n_xy_e0[0]) + glm::max(0.0f, info.unit.y*n_xy_e0[1]);
-		float d_xy_e1 = (-1.0f * glm::dot(n_xy_e1, glm::vec2(v1.x, v1.y))) + glm::max(0.0f, info.unit.x*n_xy_e1[0]) + glm::max(0.0f, info.unit.y*n_xy_e1[1]);
-		float d_xy_e2 = (-1.0f * glm::dot(n_xy_e2, glm::vec2(v2.x, v2.y))) + glm::max(0.0f, info.unit.x*n_xy_e2[0]) + glm::max(0.0f, info.unit.y*n_xy_e2[1]);
-		// YZ plane
-		glm::vec2 n_yz_e0(-1.0f*e0.z, e0.y);
-		glm::vec2 n_yz_e1(-1.0f*e1.z, e1.y);
-		glm::vec2 n_yz_e2(-1.0f*e2.z, e2.y);
-		if (n.x < 0.0f) {
-			n_yz_e0 = -n_yz_e0;
-			n_yz_e1 = -n_yz_e1;
-			n_yz_e2 = -n_yz_e2;
-		}
-		float d_yz_e0 = (-1.0f * glm::dot(n_yz_e0, glm::vec2(v0.y, v0.z))) + glm::max(0.0f, info.unit.y*n_yz_e0[0]) + glm::max(0.0f, info.unit.z*n_yz_e0[1]);
-		float d_yz_e1 = (-1.0f * glm::dot(n_yz_e1, glm::vec2(v1.y, v1.z))) + glm::max(0.0f, info.unit.y*n_yz_e1[0]) + glm::max(0.0f, info.unit.z*n_yz_e1[1]);
-		float d_yz_e2 = (-1.0f * glm::dot(n_yz_e2, glm::vec2(v2.y, v2.z))) + glm::max(0.0f, info.unit.y*n_yz_e2[0]) + glm::max(0.0f, info.unit.z*n_yz_e2[1]);
-		// ZX plane
-		glm::vec2 n_zx_e0(-1.0f*e0.x, e0.z);
-		glm::vec2 n_zx_e1(-1.0f*e1.x, e1.z);
-		glm::vec2 n_zx_e2(-1.0f*e2.x, e2.z);
-		if (n.y < 0.0f) {
-			n_zx_e0 = -n_zx_e0;
-			n_zx_e1 = -n_zx_e1;
-			n_zx_e2 = -n_zx_e2;
-		}
-		float d_xz_e0 = (-1.0f * glm::dot(n_zx_e0, glm::vec2(v0.z, v0.x))) + glm::max(0.0f, info.unit.x*n_zx_e0[0]) + glm::max(0.0f, info.unit.z*n_zx_e0[1]);
-		float d_xz_e1 = (-1.0f * glm::dot(n_zx_e1, glm::vec2(v1.z, v1.x))) + glm::max(0.0f, info.unit.x*n_zx_e1[0]) + glm::max(0.0f, info.unit.z*n_zx_e1[1]);
-		float d_xz_e2 = (-1.0f * glm::dot(n_zx_e2, glm::vec2(v2.z, v2.x))) + glm::max(0.0f, info.unit.x*n_zx_e2[0]) + glm::max(0.0f, info.unit.z*n_zx_e2[1]);
-
-
+		// The geometry comes set up, only the voxel size dependent terms are computed here
+		TriangleTest tri = triangle_test(setup, thread_id, info);
 
 		// test possible grid boxes for overlap
-		for (int z = t_bbox_grid.min.z; z <= t_bbox_grid.max.z; z++){
-			for (int y = t_bbox_grid.min.y; y <= t_bbox_grid.max.y; y++){
-				for (int x = t_bbox_grid.min.x; x <= t_bbox_grid.max.x; x++){
+		for (int z = tri.bbox_grid.min.z; z <= tri.bbox_grid.max.z; z++){
+			for (int y = tri.bbox_grid.min.y; y <= tri.bbox_grid.max.y; y++){
+				for (int x = tri.bbox_grid.min.x; x <= tri.bbox_grid.max.x; x++){
 					// size_t location = x + (y*info.gridsize) + (z*info.gridsize*info.gridsize);
 					// if (checkBit(voxel_table, location)){ continue; }
 #ifdef _DEBUG
@@ -207,27 +155,27 @@ __global__ void voxelize_triangle(voxinfo info, float* triangle_data, unsigned i
 #endif
 					// TRIANGLE PLANE THROUGH BOX TEST
 					glm::vec3 p(x*info.unit.x, y*info.unit.y, z*info.unit.z);
-					float nDOTp = glm::dot(n, p);
-					if ((nDOTp + d1) * (nDOTp + d2) > 0.0f) { continue; }
+					float nDOTp = glm::dot(tri.n, p);
+					if ((nDOTp + tri.d1) * (nDOTp + tri.d2) > 0.0f) { continue; }
 
 					// PROJECTION TESTS
 					// XY
 					glm::vec2 p_xy(p.x, p.y);
-					if ((glm::dot(n_xy_e0, p_xy) + d_xy_e0) < 0.0f){ continue; }
-					if ((glm::dot(n_xy_e1, p_xy) + d_xy_e1) < 0.0f){ continue; }
-					if ((glm::dot(n_xy_e2, p_xy) + d_xy_e2) < 0.0f){ continue; }
+					if ((glm::dot(tri.n_xy[0], p_xy) + tri.d_xy[0]) < 0.0f){ continue; }
+					if ((glm::dot(tri.n_xy[1], p_xy) + tri.d_xy[1]) < 0.0f){ continue; }
+					if ((glm::dot(tri.n_xy[2], p_xy) + tri.d_xy[2]) < 0.0f){ continue; }
 
 					// YZ
 					glm::vec2 p_yz(p.y, p.z);
-					if ((glm::dot(n_yz_e0, p_yz) + d_yz_e0) < 0.0f){ continue; }
-					if ((glm::dot(n_yz_e1, p_yz) + d_yz_e1) < 0.0f){ continue; }
-					if ((glm::dot(n_yz_e2, p_yz) + d_yz_e2) < 0.0f){ continue; }
+					if ((glm::dot(tri.n_yz[0], p_yz) + tri.d_yz[0]) < 0.0f){ continue; }
+					if ((glm::dot(tri.n_yz[1], p_yz) + tri.d_yz[1]) < 0.0f){ continue; }
+					if ((glm::dot(tri.n_yz[2], p_yz) + tri.d_yz[2]) < 0.0f){ continue; }
 
 					// XZ	
 					glm::vec2 p_zx(p.z, p.x);
-					if ((glm::dot(n_zx_e0, p_zx) + d_xz_e0) < 0.0f){ continue; }
-					if ((glm::dot(n_zx_e1, p_zx) + d_xz_e1) < 0.0f){ continue; }
-					if ((glm::dot(n_zx_e2, p_zx) + d_xz_e2) < 0.0f){ continue; }
+					if ((glm::dot(tri.n_zx[0], p_zx) + tri.d_zx[0]) < 0.0f){ continue; }
+					if ((glm::dot(tri.n_zx[1], p_zx) + tri.d_zx[1]) < 0.0f){ continue; }
+					if ((glm::dot(tri.n_zx[2], p_zx) + tri.d_zx[2]) < 0.0f){ continue; }
 
 #ifdef _DEBUG
 					atomicAdd(&debug_d_n_voxels_marked, 1);
@@ -236,11 +184,11 @@ __global__ void voxelize_triangle(voxinfo info, float* triangle_data, unsigned i
 					if (morton_order){
 						size_t location = mortonEncode_LUT(x, y, z);
 						setBit(voxel_table, location);
-                        setData(color_table, location, c0, c1, c2, ll);
+                        if (color_table != nullptr) { setData(color_table, location, c0, c1, c2, ll); }
 					} else {
 						size_t location = static_cast<size_t>(x) + (static_cast<size_t>(y)* static_cast<size_t>(info.gridsize.x)) + (static_cast<size_t>(z)* static_cast<size_t>(info.gridsize.y)* static_cast<size_t>(info.gridsize.x));
 						setBit(voxel_table, location);
-                        setData(color_table, location, c0, c1, c2, ll);
+                        if (color_table != nullptr) { setData(color_table, location, c0, c1, c2, ll); }
 					}
 					continue;
 				}
@@ -254,13 +202,41 @@ __global__ void voxelize_triangle(voxinfo info, float* triangle_data, unsigned i
 	}
 }
 
-void voxelize(const voxinfo& v, float* triangle_data, unsigned int* vtable, unsigned int* colortable, bool useThrustPath, bool morton_code) {
+TriangleSetup setup_triangles(const voxinfo& v, float* triangle_data) {
+	TriangleSetup setup;
+	setup.origin = v.bbox.min;
+	setup.n_triangles = v.n_triangles;
+	setup.stride = TriangleSetup::stride_for(v.n_triangles);
+	size_t setup_size = TriangleSetup::COMPONENTS * setup.stride * sizeof(float);
+	fprintf(stdout, "[Triangle Setup] Allocating %llu kB of DEVICE memory for the triangle setup\n", size_t(setup_size / 1024.0f));
+	checkCudaErrors(cudaMalloc(&setup.data, setup_size));
+
+	int blockSize;
+	int minGridSize;
+	cudaOccupancyMaxPotentialBlockSize(&minGridSize, &blockSize, setup_triangles_kernel, 0, 0);
+	int gridSize = (v.n_triangles + blockSize - 1) / blockSize;
+	setup_triangles_kernel <<<gridSize, blockSize >>> (setup, triangle_data);
+	checkCudaErrors(cudaDeviceSynchronize());
+	return setup;
+}
+
+void free_triangle_setup(TriangleSetup& setup) {
+	checkCudaErrors(cudaFree(setup.data));
+	setup.data = nullptr;
+}
+
+void voxelize(const voxinfo& v, const TriangleSetup& setup, float* triangle_data, unsigned int* vtable, unsigned int* colortable, bool useThrustPath, bool morton_code) {
 	float   elapsedTime;
+	if (setup.origin != v.bbox.min || setup.n_triangles != v.n_triangles) {
+		fprintf(stdout, "[Err] The triangle setup does not match the voxelization, skipping it \n");
+		return;
+	}
 
 	// These are only used when we're not using UNIFIED memory
 	unsigned int* dev_vtable; // DEVICE pointer to voxel_data
 	unsigned int* dev_colortable; // DEVICE pointer to voxel_data
 	size_t vtable_size; // vtable size
+	size_t colortable_size; // colortable size, 4 values per voxel
 
 
 	// Create timers, set start time
@@ -284,21 +260,22 @@ void voxelize(const voxinfo& v, float* triangle_data, unsigned int* vtable, unsi
 	gridSize = (v.n_triangles + blockSize - 1) / blockSize;
 
 	if (useThrustPath) { // We're not using UNIFIED memory
-		vtable_size = ((size_t)v.gridsize.x * v.gridsize.y * v.gridsize.z) / (size_t) 8.0;
+		vtable_size = (((size_t)v.gridsize.x * v.gridsize.y * v.gridsize.z + 31) / 32) * sizeof(unsigned int); // whole 32-bit words
+		colortable_size = ((size_t)v.gridsize.x * v.gridsize.y * v.gridsize.z) * size_t(4) * sizeof(unsigned int);
 		fprintf(stdout, "[Voxel Grid] Allocating %llu kB of DEVICE memory for Voxel Grid\n", size_t(vtable_size / 1024.0f));
 		checkCudaErrors(cudaMalloc(&dev_vtable, vtable_size));
 		checkCudaErrors(cudaMemset(dev_vtable, 0, vtable_size));
 //		Do the same for colors
-        fprintf(stdout, "[Color Grid] Allocating %llu kB of DEVICE memory for Color Grid\n", size_t((vtable_size) * size_t(4)* (size_t) 32/ 1024.0f));
-        checkCudaErrors(cudaMalloc(&dev_colortable, vtable_size * size_t(4) * (size_t) 32));
-        checkCudaErrors(cudaMemset(dev_colortable, 0, vtable_size * size_t(4) * (size_t) 32 ));
+        fprintf(stdout, "[Color Grid] Allocating %llu kB of DEVICE memory for Color Grid\n", size_t(colortable_size / 1024.0f));
+        checkCudaErrors(cudaMalloc(&dev_colortable, colortable_size));
+        checkCudaErrors(cudaMemset(dev_colortable, 0, colortable_size));
 		// Start voxelization
 		checkCudaErrors(cudaEventRecord(start_vox, 0));
-		voxelize_triangle <<<gridSize, blockSize >>> (v, triangle_data, dev_vtable, dev_colortable, morton_code);
+		voxelize_triangle <<<gridSize, blockSize >>> (v, setup, triangle_data, dev_vtable, dev_colortable, morton_code);
 	}
 	else { // UNIFIED MEMORY 
 		checkCudaErrors(cudaEventRecord(start_vox, 0));
-		voxelize_triangle << <gridSize, blockSize >> > (v, triangle_data, vtable, colortable, morton_code);
+		voxelize_triangle << <gridSize, blockSize >> > (v, setup, triangle_data, vtable, colortable, morton_code);
 	}
 
 	cudaDeviceSynchronize();
@@ -313,9 +290,9 @@ void voxelize(const voxinfo& v, float* triangle_data, unsigned int* vtable, unsi
 		checkCudaErrors(cudaMemcpy((void*)vtable, dev_vtable, vtable_size, cudaMemcpyDefault));
 		fprintf(stdout, "[Voxel Grid] Freeing %llu kB of DEVICE memory\n", size_t(vtable_size / 1024.0f));
 //		Same for the colors
-        fprintf(stdout, "[Color Grid] Copying %llu kB to page-locked HOST memory\n", size_t(vtable_size * size_t(4) * (size_t) 32 / 1024.0f));
-        checkCudaErrors(cudaMemcpy((void*)colortable, dev_colortable, vtable_size * size_t(4) * size_t (32), cudaMemcpyDefault));
-        fprintf(stdout, "[Color Grid] Freeing %llu kB of DEVICE memory\n", size_t(vtable_size * size_t(4) * (size_t) 32 / 1024.0f));
+        fprintf(stdout, "[Color Grid] Copying %llu kB to page-locked HOST memory\n", size_t(colortable_size / 1024.0f));
+        checkCudaErrors(cudaMemcpy((void*)colortable, dev_colortable, colortable_size, cudaMemcpyDefault));
+        fprintf(stdout, "[Color Grid] Freeing %llu kB of DEVICE memory\n", size_t(colortable_size / 1024.0f));
 		checkCudaErrors(cudaFree(dev_vtable));
 		checkCudaErrors(cudaFree(dev_colortable));
 	}
@@ -11,5 +11,6 @@
 #include <iostream>
 #include "util.h"
 #include "util_cuda.h"
+#include "triangle_setup.h"
 
 #include "morton_LUTs.h"